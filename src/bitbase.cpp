@@ -18,7 +18,6 @@
 
 #include <cassert>
 #include <vector>
-#include <bitset>
 
 #include "bitboard.h"
 #include "types.h"
@@ -31,7 +30,779 @@ namespace {
   // Positions with the pawn on files E to H will be mirrored before probing.
   constexpr unsigned MAX_INDEX = 2*24*64*64; // stm * psq * wksq * bksq = 196608
 
-  std::bitset<MAX_INDEX> KPKBitbase;
+  // The KPK bitbase, one bit per index set for a win, as computed by the
+  // retrograde analysis of Bitbases::init(). Storing it spares the analysis at
+  // startup, debug builds still run it to check the table.
+  constexpr uint64_t KPKBitbase[MAX_INDEX / 64] = {
+    0xfffefffffffffcfcULL, 0xfffefffffffff8f8ULL, 0xfffefffffffff1f1ULL, 0xfffeffffffffe3e3ULL,
+    0xfffeffffffffc7c7ULL, 0xfffeffffffff8f8fULL, 0xfffeffffffff1f1fULL, 0xfffeffffffff3f3fULL,
+    0xfffefffffffcfcfcULL, 0xfffefffffff8f8f8ULL, 0xfffefffffff1f1f1ULL, 0xfffeffffffe3e3e3ULL,
+    0xfffeffffffc7c7c7ULL, 0xfffeffffff8f8f8fULL, 0xfffeffffff1f1f1fULL, 0xfffeffffff3f3f3fULL,
+    0xfffefffffcfcfcffULL, 0xfffefffff8f8f8ffULL, 0xfffefffff1f1f1ffULL, 0xfffeffffe3e3e3ffULL,
+    0xfffeffffc7c7c7ffULL, 0xfffeffff8f8f8fffULL, 0xfffeffff1f1f1fffULL, 0xfffeffff3f3f3fffULL,
+    0xfffefffcfcfcffffULL, 0xfffefff8f8f8ffffULL, 0xfffefff1f1f1ffffULL, 0xfffeffe3e3e3ffffULL,
+    0xfffeffc7c7c7ffffULL, 0xfffeff8f8f8fffffULL, 0xfffeff1f1f1fffffULL, 0xfffeff3f3f3fffffULL,
+    0xfffefcfcfcffffffULL, 0xfffef8f8f8ffffffULL, 0xfffef1f1f1ffffffULL, 0xfffee3e3e3ffffffULL,
+    0xfffec7c7c7ffffffULL, 0xfffe8f8f8fffffffULL, 0xfffe1f1f1fffffffULL, 0xfffe3f3f3fffffffULL,
+    0xfffcfcfcffffffffULL, 0xfff8f8f8ffffffffULL, 0xfff0f1f1ffffffffULL, 0xffe2e3e3ffffffffULL,
+    0xffc6c7c7ffffffffULL, 0xff8e8f8fffffffffULL, 0xff1e1f1fffffffffULL, 0xff3e3f3fffffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0xf0f0f1ffffffffffULL, 0xe3e2e3ffffffffffULL,
+    0xc7c6c7ffffffffffULL, 0x8f8e8fffffffffffULL, 0x1f1e1fffffffffffULL, 0x3f3e3fffffffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0xf0f0ffffffffffffULL, 0xe3e2ffffffffffffULL,
+    0xc7c6ffffffffffffULL, 0x8f8effffffffffffULL, 0x1f1effffffffffffULL, 0x3f3effffffffffffULL,
+    0xfffefffffffffcfcULL, 0xfffefffffffff8f8ULL, 0xfffefffffffff1f1ULL, 0xfffeffffffffe3e3ULL,
+    0xfffeffffffffc7c7ULL, 0xfffeffffffff8f8fULL, 0xfffeffffffff1f1fULL, 0xfffeffffffff3f3fULL,
+    0xfffefffffffcfcfcULL, 0xfffefffffff8f8f8ULL, 0xfffefffffff1f1f1ULL, 0xfffeffffffe3e3e3ULL,
+    0xfffeffffffc7c7c7ULL, 0xfffeffffff8f8f8fULL, 0xfffeffffff1f1f1fULL, 0xfffeffffff3f3f3fULL,
+    0xfffefffffcfcfcffULL, 0xfffefffff8f8f8ffULL, 0xfffefffff1f1f1ffULL, 0xfffeffffe3e3e3ffULL,
+    0xfffeffffc7c7c7ffULL, 0xfffeffff8f8f8fffULL, 0xfffeffff1f1f1fffULL, 0xfffeffff3f3f3fffULL,
+    0xfffefffcfcfcffffULL, 0xfffefff8f8f8ffffULL, 0xfffefff1f1f1ffffULL, 0xfffeffe3e3e3ffffULL,
+    0xfffeffc7c7c7ffffULL, 0xfffeff8f8f8fffffULL, 0xfffeff1f1f1fffffULL, 0xfffeff3f3f3fffffULL,
+    0xfffefcfcfcffffffULL, 0xfffef8f8f8ffffffULL, 0xfffef1f1f1ffffffULL, 0xfffee3e3e3ffffffULL,
+    0xfffec7c7c7ffffffULL, 0xfffe8f8f8fffffffULL, 0xfffe1f1f1fffffffULL, 0xfffe3f3f3fffffffULL,
+    0x0300000000000000ULL, 0x0200000000000000ULL, 0x0600010000000000ULL, 0xfee2e3e3ffffffffULL,
+    0xffc6c7c7ffffffffULL, 0xff8e8f8fffffffffULL, 0xff1e1f1fffffffffULL, 0xff3e3f3fffffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000010000000000ULL, 0xe2e2e3ffffffffffULL,
+    0xc7c6c7ffffffffffULL, 0x8f8e8fffffffffffULL, 0x1f1e1fffffffffffULL, 0x3f3e3fffffffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000070000000000ULL, 0xe2e2ffffffffffffULL,
+    0xc7c6ffffffffffffULL, 0x8f8effffffffffffULL, 0x1f1effffffffffffULL, 0x3f3effffffffffffULL,
+    0xfffdfffffffffcfcULL, 0xfffdfffffffff8f8ULL, 0xfffdfffffffff1f1ULL, 0xfffdffffffffe3e3ULL,
+    0xfffdffffffffc7c7ULL, 0xfffdffffffff8f8fULL, 0xfffdffffffff1f1fULL, 0xfffdffffffff3f3fULL,
+    0xfffdfffffffcfcfcULL, 0xfffdfffffff8f8f8ULL, 0xfffdfffffff1f1f1ULL, 0xfffdffffffe3e3e3ULL,
+    0xfffdffffffc7c7c7ULL, 0xfffdffffff8f8f8fULL, 0xfffdffffff1f1f1fULL, 0xfffdffffff3f3f3fULL,
+    0xfffdfffffcfcfcffULL, 0xfffdfffff8f8f8ffULL, 0xfffdfffff1f1f1ffULL, 0xfffdffffe3e3e3ffULL,
+    0xfffdffffc7c7c7ffULL, 0xfffdffff8f8f8fffULL, 0xfffdffff1f1f1fffULL, 0xfffdffff3f3f3fffULL,
+    0xfffdfffcfcfcffffULL, 0xfffdfff8f8f8ffffULL, 0xfffdfff1f1f1ffffULL, 0xfffdffe3e3e3ffffULL,
+    0xfffdffc7c7c7ffffULL, 0xfffdff8f8f8fffffULL, 0xfffdff1f1f1fffffULL, 0xfffdff3f3f3fffffULL,
+    0xfffdfcfcfcffffffULL, 0xfffdf8f8f8ffffffULL, 0xfffdf1f1f1ffffffULL, 0xfffde3e3e3ffffffULL,
+    0xfffdc7c7c7ffffffULL, 0xfffd8f8f8fffffffULL, 0xfffd1f1f1fffffffULL, 0xfffd3f3f3fffffffULL,
+    0xfffcfcfcffffffffULL, 0xfff8f8f8ffffffffULL, 0xfff1f1f1ffffffffULL, 0xffe1e3e3ffffffffULL,
+    0xffc5c7c7ffffffffULL, 0xff8d8f8fffffffffULL, 0xff1d1f1fffffffffULL, 0xff3d3f3fffffffffULL,
+    0x0c0c0c0000000000ULL, 0x0000000000000000ULL, 0x0101010000000000ULL, 0xe3e1e3ffffffffffULL,
+    0xc7c5c7ffffffffffULL, 0x8f8d8fffffffffffULL, 0x1f1d1fffffffffffULL, 0x3f3d3fffffffffffULL,
+    0x0000000000000000ULL, 0x00080a0f00000000ULL, 0x0000000000000000ULL, 0xe3e1ffffffffffffULL,
+    0xc7c5ffffffffffffULL, 0x8f8dffffffffffffULL, 0x1f1dffffffffffffULL, 0x3f3dffffffffffffULL,
+    0xfffdfffffffffcfcULL, 0xfffdfffffffff8f8ULL, 0xfffdfffffffff1f1ULL, 0xfffdffffffffe3e3ULL,
+    0xfffdffffffffc7c7ULL, 0xfffdffffffff8f8fULL, 0xfffdffffffff1f1fULL, 0xfffdffffffff3f3fULL,
+    0xfffdfffffffcfcfcULL, 0xfffdfffffff8f8f8ULL, 0xfffdfffffff1f1f1ULL, 0xfffdffffffe3e3e3ULL,
+    0xfffdffffffc7c7c7ULL, 0xfffdffffff8f8f8fULL, 0xfffdffffff1f1f1fULL, 0xfffdffffff3f3f3fULL,
+    0xfffdfffffcfcfcffULL, 0xfffdfffff8f8f8ffULL, 0xfffdfffff1f1f1ffULL, 0xfffdffffe3e3e3ffULL,
+    0xfffdffffc7c7c7ffULL, 0xfffdffff8f8f8fffULL, 0xfffdffff1f1f1fffULL, 0xfffdffff3f3f3fffULL,
+    0xfffdfffcfcfcffffULL, 0xfffdfff8f8f8ffffULL, 0xfffdfff1f1f1ffffULL, 0xfffdffe3e3e3ffffULL,
+    0xfffdffc7c7c7ffffULL, 0xfffdff8f8f8fffffULL, 0xfffdff1f1f1fffffULL, 0xfffdff3f3f3fffffULL,
+    0xfffdfcfcfcffffffULL, 0xfffdf8f8f8ffffffULL, 0xfffdf1f1f1ffffffULL, 0xfffde3e3e3ffffffULL,
+    0xfffdc7c7c7ffffffULL, 0xfffd8f8f8fffffffULL, 0xfffd1f1f1fffffffULL, 0xfffd3f3f3fffffffULL,
+    0x0704040000000000ULL, 0x0700000000000000ULL, 0x0701010000000000ULL, 0x0f01030000000000ULL,
+    0xffc5c7c7ffffffffULL, 0xff8d8f8fffffffffULL, 0xff1d1f1fffffffffULL, 0xff3d3f3fffffffffULL,
+    0x0404000000000000ULL, 0x0000000000000000ULL, 0x0101000000000000ULL, 0x0301030000000000ULL,
+    0xc7c5c7ffffffffffULL, 0x8f8d8fffffffffffULL, 0x1f1d1fffffffffffULL, 0x3f3d3fffffffffffULL,
+    0x0404020000000000ULL, 0x0000050000000000ULL, 0x0101020000000000ULL, 0x03010f0000000000ULL,
+    0xc7c5ffffffffffffULL, 0x8f8dffffffffffffULL, 0x1f1dffffffffffffULL, 0x3f3dffffffffffffULL,
+    0xfffbfffffffffcfcULL, 0xfffbfffffffff8f8ULL, 0xfffbfffffffff1f1ULL, 0xfffbffffffffe3e3ULL,
+    0xfffbffffffffc7c7ULL, 0xfffbffffffff8f8fULL, 0xfffbffffffff1f1fULL, 0xfffbffffffff3f3fULL,
+    0xfffbfffffffcfcfcULL, 0xfffbfffffff8f8f8ULL, 0xfffbfffffff1f1f1ULL, 0xfffbffffffe3e3e3ULL,
+    0xfffbffffffc7c7c7ULL, 0xfffbffffff8f8f8fULL, 0xfffbffffff1f1f1fULL, 0xfffbffffff3f3f3fULL,
+    0xfffbfffffcfcfcffULL, 0xfffbfffff8f8f8ffULL, 0xfffbfffff1f1f1ffULL, 0xfffbffffe3e3e3ffULL,
+    0xfffbffffc7c7c7ffULL, 0xfffbffff8f8f8fffULL, 0xfffbffff1f1f1fffULL, 0xfffbffff3f3f3fffULL,
+    0xfffbfffcfcfcffffULL, 0xfffbfff8f8f8ffffULL, 0xfffbfff1f1f1ffffULL, 0xfffbffe3e3e3ffffULL,
+    0xfffbffc7c7c7ffffULL, 0xfffbff8f8f8fffffULL, 0xfffbff1f1f1fffffULL, 0xfffbff3f3f3fffffULL,
+    0xfffbfcfcfcffffffULL, 0xfffbf8f8f8ffffffULL, 0xfffbf1f1f1ffffffULL, 0xfffbe3e3e3ffffffULL,
+    0xfffbc7c7c7ffffffULL, 0xfffb8f8f8fffffffULL, 0xfffb1f1f1fffffffULL, 0xfffb3f3f3fffffffULL,
+    0xfff8fcfcffffffffULL, 0xfff8f8f8ffffffffULL, 0xfff1f1f1ffffffffULL, 0xffe3e3e3ffffffffULL,
+    0xffc3c7c7ffffffffULL, 0xff8b8f8fffffffffULL, 0xff1b1f1fffffffffULL, 0xff3b3f3fffffffffULL,
+    0xfcf8fcffffffffffULL, 0x1818180000000000ULL, 0x0000000000000000ULL, 0x0303030000000000ULL,
+    0xc7c3c7ffffffffffULL, 0x8f8b8fffffffffffULL, 0x1f1b1fffffffffffULL, 0x3f3b3fffffffffffULL,
+    0xfcf8ffffffffffffULL, 0x0000000000000000ULL, 0x0011151f00000000ULL, 0x0000000000000000ULL,
+    0xc7c3ffffffffffffULL, 0x8f8bffffffffffffULL, 0x1f1bffffffffffffULL, 0x3f3bffffffffffffULL,
+    0xfffbfffffffffcfcULL, 0xfffbfffffffff8f8ULL, 0xfffbfffffffff1f1ULL, 0xfffbffffffffe3e3ULL,
+    0xfffbffffffffc7c7ULL, 0xfffbffffffff8f8fULL, 0xfffbffffffff1f1fULL, 0xfffbffffffff3f3fULL,
+    0xfffbfffffffcfcfcULL, 0xfffbfffffff8f8f8ULL, 0xfffbfffffff1f1f1ULL, 0xfffbffffffe3e3e3ULL,
+    0xfffbffffffc7c7c7ULL, 0xfffbffffff8f8f8fULL, 0xfffbffffff1f1f1fULL, 0xfffbffffff3f3f3fULL,
+    0xfffbfffffcfcfcffULL, 0xfffbfffff8f8f8ffULL, 0xfffbfffff1f1f1ffULL, 0xfffbffffe3e3e3ffULL,
+    0xfffbffffc7c7c7ffULL, 0xfffbffff8f8f8fffULL, 0xfffbffff1f1f1fffULL, 0xfffbffff3f3f3fffULL,
+    0xfffbfffcfcfcffffULL, 0xfffbfff8f8f8ffffULL, 0xfffbfff1f1f1ffffULL, 0xfffbffe3e3e3ffffULL,
+    0xfffbffc7c7c7ffffULL, 0xfffbff8f8f8fffffULL, 0xfffbff1f1f1fffffULL, 0xfffbff3f3f3fffffULL,
+    0xfffbfcfcfcffffffULL, 0xfffbf8f8f8ffffffULL, 0xfffbf1f1f1ffffffULL, 0xfffbe3e3e3ffffffULL,
+    0xfffbc7c7c7ffffffULL, 0xfffb8f8f8fffffffULL, 0xfffb1f1f1fffffffULL, 0xfffb3f3f3fffffffULL,
+    0x1f181c0000000000ULL, 0x0e08080000000000ULL, 0x0e00000000000000ULL, 0x0e02020000000000ULL,
+    0x1f03070000000000ULL, 0xff8b8f8fffffffffULL, 0xff1b1f1fffffffffULL, 0xff3b3f3fffffffffULL,
+    0x1c181c0000000000ULL, 0x0808000000000000ULL, 0x0000000000000000ULL, 0x0202000000000000ULL,
+    0x0703070000000000ULL, 0x8f8b8fffffffffffULL, 0x1f1b1fffffffffffULL, 0x3f3b3fffffffffffULL,
+    0x1c181c0000000000ULL, 0x0808040000000000ULL, 0x00000a0000000000ULL, 0x0202040000000000ULL,
+    0x07031f0000000000ULL, 0x8f8bffffffffffffULL, 0x1f1bffffffffffffULL, 0x3f3bffffffffffffULL,
+    0xfff7fffffffffcfcULL, 0xfff7fffffffff8f8ULL, 0xfff7fffffffff1f1ULL, 0xfff7ffffffffe3e3ULL,
+    0xfff7ffffffffc7c7ULL, 0xfff7ffffffff8f8fULL, 0xfff7ffffffff1f1fULL, 0xfff7ffffffff3f3fULL,
+    0xfff7fffffffcfcfcULL, 0xfff7fffffff8f8f8ULL, 0xfff7fffffff1f1f1ULL, 0xfff7ffffffe3e3e3ULL,
+    0xfff7ffffffc7c7c7ULL, 0xfff7ffffff8f8f8fULL, 0xfff7ffffff1f1f1fULL, 0xfff7ffffff3f3f3fULL,
+    0xfff7fffffcfcfcffULL, 0xfff7fffff8f8f8ffULL, 0xfff7fffff1f1f1ffULL, 0xfff7ffffe3e3e3ffULL,
+    0xfff7ffffc7c7c7ffULL, 0xfff7ffff8f8f8fffULL, 0xfff7ffff1f1f1fffULL, 0xfff7ffff3f3f3fffULL,
+    0xfff7fffcfcfcffffULL, 0xfff7fff8f8f8ffffULL, 0xfff7fff1f1f1ffffULL, 0xfff7ffe3e3e3ffffULL,
+    0xfff7ffc7c7c7ffffULL, 0xfff7ff8f8f8fffffULL, 0xfff7ff1f1f1fffffULL, 0xfff7ff3f3f3fffffULL,
+    0xfff7fcfcfcffffffULL, 0xfff7f8f8f8ffffffULL, 0xfff7f1f1f1ffffffULL, 0xfff7e3e3e3ffffffULL,
+    0xfff7c7c7c7ffffffULL, 0xfff78f8f8fffffffULL, 0xfff71f1f1fffffffULL, 0xfff73f3f3fffffffULL,
+    0xfff4fcfcffffffffULL, 0xfff0f8f8ffffffffULL, 0xfff1f1f1ffffffffULL, 0xffe3e3e3ffffffffULL,
+    0xffc7c7c7ffffffffULL, 0xff878f8fffffffffULL, 0xff171f1fffffffffULL, 0xff373f3fffffffffULL,
+    0xfcf4fcffffffffffULL, 0xf8f0f8ffffffffffULL, 0x3030300000000000ULL, 0x0000000000000000ULL,
+    0x0606060000000000ULL, 0x8f878fffffffffffULL, 0x1f171fffffffffffULL, 0x3f373fffffffffffULL,
+    0xfcf4ffffffffffffULL, 0xf8f0ffffffffffffULL, 0x0000000000000000ULL, 0x00222a3e00000000ULL,
+    0x0000000000000000ULL, 0x8f87ffffffffffffULL, 0x1f17ffffffffffffULL, 0x3f37ffffffffffffULL,
+    0xfff7fffffffffcfcULL, 0xfff7fffffffff8f8ULL, 0xfff7fffffffff1f1ULL, 0xfff7ffffffffe3e3ULL,
+    0xfff7ffffffffc7c7ULL, 0xfff7ffffffff8f8fULL, 0xfff7ffffffff1f1fULL, 0xfff7ffffffff3f3fULL,
+    0xfff7fffffffcfcfcULL, 0xfff7fffffff8f8f8ULL, 0xfff7fffffff1f1f1ULL, 0xfff7ffffffe3e3e3ULL,
+    0xfff7ffffffc7c7c7ULL, 0xfff7ffffff8f8f8fULL, 0xfff7ffffff1f1f1fULL, 0xfff7ffffff3f3f3fULL,
+    0xfff7fffffcfcfcffULL, 0xfff7fffff8f8f8ffULL, 0xfff7fffff1f1f1ffULL, 0xfff7ffffe3e3e3ffULL,
+    0xfff7ffffc7c7c7ffULL, 0xfff7ffff8f8f8fffULL, 0xfff7ffff1f1f1fffULL, 0xfff7ffff3f3f3fffULL,
+    0xfff7fffcfcfcffffULL, 0xfff7fff8f8f8ffffULL, 0xfff7fff1f1f1ffffULL, 0xfff7ffe3e3e3ffffULL,
+    0xfff7ffc7c7c7ffffULL, 0xfff7ff8f8f8fffffULL, 0xfff7ff1f1f1fffffULL, 0xfff7ff3f3f3fffffULL,
+    0xfff7fcfcfcffffffULL, 0xfff7f8f8f8ffffffULL, 0xfff7f1f1f1ffffffULL, 0xfff7e3e3e3ffffffULL,
+    0xfff7c7c7c7ffffffULL, 0xfff78f8f8fffffffULL, 0xfff71f1f1fffffffULL, 0xfff73f3f3fffffffULL,
+    0xfff4fcfcffffffffULL, 0x3e30380000000000ULL, 0x1c10100000000000ULL, 0x1c00000000000000ULL,
+    0x1c04040000000000ULL, 0x3e060e0000000000ULL, 0xff171f1fffffffffULL, 0xff373f3fffffffffULL,
+    0xfcf4fcffffffffffULL, 0x3830380000000000ULL, 0x1010000000000000ULL, 0x0000000000000000ULL,
+    0x0404000000000000ULL, 0x0e060e0000000000ULL, 0x1f171fffffffffffULL, 0x3f373fffffffffffULL,
+    0xfcf4ffffffffffffULL, 0x38303e0000000000ULL, 0x1010080000000000ULL, 0x0000140000000000ULL,
+    0x0404080000000000ULL, 0x0e063e0000000000ULL, 0x1f17ffffffffffffULL, 0x3f37ffffffffffffULL,
+    0xfffffefffffffcfcULL, 0xfffffefffffff8f8ULL, 0xfffffefffffff1f1ULL, 0xfffffeffffffe3e3ULL,
+    0xfffffeffffffc7c7ULL, 0xfffffeffffff8f8fULL, 0xfffffeffffff1f1fULL, 0xfffffeffffff3f3fULL,
+    0xfffffefffffcfcfcULL, 0xfffffefffff8f8f8ULL, 0xfffffefffff1f1f1ULL, 0xfffffeffffe3e3e3ULL,
+    0xfffffeffffc7c7c7ULL, 0xfffffeffff8f8f8fULL, 0xfffffeffff1f1f1fULL, 0xfffffeffff3f3f3fULL,
+    0xfffffefffcfcfcffULL, 0xfffffefff8f8f8ffULL, 0xfffffefff1f1f1ffULL, 0xfffffeffe3e3e3ffULL,
+    0xfffffeffc7c7c7ffULL, 0xfffffeff8f8f8fffULL, 0xfffffeff1f1f1fffULL, 0xfffffeff3f3f3fffULL,
+    0xfffffefcfcfcffffULL, 0xfffffef8f8f8ffffULL, 0xfffffef1f1f1ffffULL, 0xfffffee3e3e3ffffULL,
+    0xfffffec7c7c7ffffULL, 0xfffffe8f8f8fffffULL, 0xfffffe1f1f1fffffULL, 0xfffffe3f3f3fffffULL,
+    0xfffffcfcfcffffffULL, 0xfffff8f8f8ffffffULL, 0xfffff0f1f1ffffffULL, 0xffffe2e3e3ffffffULL,
+    0xffffc6c7c7ffffffULL, 0xffff8e8f8fffffffULL, 0xffff1e1f1fffffffULL, 0xffff3e3f3fffffffULL,
+    0x0000000000000000ULL, 0x0200000000000000ULL, 0x0701000000000000ULL, 0xffe3e2e3ffffffffULL,
+    0xffc7c6c7ffffffffULL, 0xff8f8e8fffffffffULL, 0xff1f1e1fffffffffULL, 0xff3f3e3fffffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0xe3e3e2ffffffffffULL,
+    0xc7c7c6ffffffffffULL, 0x8f8f8effffffffffULL, 0x1f1f1effffffffffULL, 0x3f3f3effffffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000060000000000ULL, 0xe3e3feffffffffffULL,
+    0xc7c7feffffffffffULL, 0x8f8ffeffffffffffULL, 0x1f1ffeffffffffffULL, 0x3f3ffeffffffffffULL,
+    0xfffffefffffffcfcULL, 0xfffffefffffff8f8ULL, 0xfffffefffffff1f1ULL, 0xfffffeffffffe3e3ULL,
+    0xfffffeffffffc7c7ULL, 0xfffffeffffff8f8fULL, 0xfffffeffffff1f1fULL, 0xfffffeffffff3f3fULL,
+    0xfffffefffffcfcfcULL, 0xfffffefffff8f8f8ULL, 0xfffffefffff1f1f1ULL, 0xfffffeffffe3e3e3ULL,
+    0xfffffeffffc7c7c7ULL, 0xfffffeffff8f8f8fULL, 0xfffffeffff1f1f1fULL, 0xfffffeffff3f3f3fULL,
+    0xfffffefffcfcfcffULL, 0xfffffefff8f8f8ffULL, 0xfffffefff1f1f1ffULL, 0xfffffeffe3e3e3ffULL,
+    0xfffffeffc7c7c7ffULL, 0xfffffeff8f8f8fffULL, 0xfffffeff1f1f1fffULL, 0xfffffeff3f3f3fffULL,
+    0xfffffefcfcfcffffULL, 0xfffffef8f8f8ffffULL, 0xfffffef1f1f1ffffULL, 0xfffffee3e3e3ffffULL,
+    0xfffffec7c7c7ffffULL, 0xfffffe8f8f8fffffULL, 0xfffffe1f1f1fffffULL, 0xfffffe3f3f3fffffULL,
+    0x0003000000000000ULL, 0x0003000000000000ULL, 0x0207000000000000ULL, 0x070f020200000000ULL,
+    0xffffc6c7c7ffffffULL, 0xffff8e8f8fffffffULL, 0xffff1e1f1fffffffULL, 0xffff3e3f3fffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0200000000000000ULL, 0x0602020000000000ULL,
+    0xffc7c6c7ffffffffULL, 0xff8f8e8fffffffffULL, 0xff1f1e1fffffffffULL, 0xff3f3e3fffffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0202020000000000ULL,
+    0xc7c7c6ffffffffffULL, 0x8f8f8effffffffffULL, 0x1f1f1effffffffffULL, 0x3f3f3effffffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0202060000000000ULL,
+    0xc7c7feffffffffffULL, 0x8f8ffeffffffffffULL, 0x1f1ffeffffffffffULL, 0x3f3ffeffffffffffULL,
+    0xfffffdfffffffcfcULL, 0xfffffdfffffff8f8ULL, 0xfffffdfffffff1f1ULL, 0xfffffdffffffe3e3ULL,
+    0xfffffdffffffc7c7ULL, 0xfffffdffffff8f8fULL, 0xfffffdffffff1f1fULL, 0xfffffdffffff3f3fULL,
+    0xfffffdfffffcfcfcULL, 0xfffffdfffff8f8f8ULL, 0xfffffdfffff1f1f1ULL, 0xfffffdffffe3e3e3ULL,
+    0xfffffdffffc7c7c7ULL, 0xfffffdffff8f8f8fULL, 0xfffffdffff1f1f1fULL, 0xfffffdffff3f3f3fULL,
+    0xfffffdfffcfcfcffULL, 0xfffffdfff8f8f8ffULL, 0xfffffdfff1f1f1ffULL, 0xfffffdffe3e3e3ffULL,
+    0xfffffdffc7c7c7ffULL, 0xfffffdff8f8f8fffULL, 0xfffffdff1f1f1fffULL, 0xfffffdff3f3f3fffULL,
+    0xfffffdfcfcfcffffULL, 0xfffffdf8f8f8ffffULL, 0xfffffdf1f1f1ffffULL, 0xfffffde3e3e3ffffULL,
+    0xfffffdc7c7c7ffffULL, 0xfffffd8f8f8fffffULL, 0xfffffd1f1f1fffffULL, 0xfffffd3f3f3fffffULL,
+    0xfffffcfcfcffffffULL, 0xfffff8f8f8ffffffULL, 0xfffff1f1f1ffffffULL, 0xffffe1e3e3ffffffULL,
+    0xffffc5c7c7ffffffULL, 0xffff8d8f8fffffffULL, 0xffff1d1f1fffffffULL, 0xffff3d3f3fffffffULL,
+    0x0f0c0c0c00000000ULL, 0x0000000000000000ULL, 0x0701010100000000ULL, 0x0f03010307000000ULL,
+    0xffc7c5c7ffffffffULL, 0xff8f8d8fffffffffULL, 0xff1f1d1fffffffffULL, 0xff3f3d3fffffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0303011f1f000000ULL,
+    0xc7c7c5ffffffffffULL, 0x8f8f8dffffffffffULL, 0x1f1f1dffffffffffULL, 0x3f3f3dffffffffffULL,
+    0x040c080f00000000ULL, 0x0000050000000000ULL, 0x0101090f00000000ULL, 0x03031d1f1f000000ULL,
+    0xc7c7fdffffffffffULL, 0x8f8ffdffffffffffULL, 0x1f1ffdffffffffffULL, 0x3f3ffdffffffffffULL,
+    0xfffffdfffffffcfcULL, 0xfffffdfffffff8f8ULL, 0xfffffdfffffff1f1ULL, 0xfffffdffffffe3e3ULL,
+    0xfffffdffffffc7c7ULL, 0xfffffdffffff8f8fULL, 0xfffffdffffff1f1fULL, 0xfffffdffffff3f3fULL,
+    0xfffffdfffffcfcfcULL, 0xfffffdfffff8f8f8ULL, 0xfffffdfffff1f1f1ULL, 0xfffffdffffe3e3e3ULL,
+    0xfffffdffffc7c7c7ULL, 0xfffffdffff8f8f8fULL, 0xfffffdffff1f1f1fULL, 0xfffffdffff3f3f3fULL,
+    0xfffffdfffcfcfcffULL, 0xfffffdfff8f8f8ffULL, 0xfffffdfff1f1f1ffULL, 0xfffffdffe3e3e3ffULL,
+    0xfffffdffc7c7c7ffULL, 0xfffffdff8f8f8fffULL, 0xfffffdff1f1f1fffULL, 0xfffffdff3f3f3fffULL,
+    0xfffffdfcfcfcffffULL, 0xfffffdf8f8f8ffffULL, 0xfffffdf1f1f1ffffULL, 0xfffffde3e3e3ffffULL,
+    0xfffffdc7c7c7ffffULL, 0xfffffd8f8f8fffffULL, 0xfffffd1f1f1fffffULL, 0xfffffd3f3f3fffffULL,
+    0x0007040400000000ULL, 0x0007000000000000ULL, 0x0007010100000000ULL, 0x070f010300000000ULL,
+    0x0f1f050707000000ULL, 0xffff8d8f8fffffffULL, 0xffff1d1f1fffffffULL, 0xffff3d3f3fffffffULL,
+    0x0004040000000000ULL, 0x0000000000000000ULL, 0x0001010000000000ULL, 0x0703010300000000ULL,
+    0x0f07050707000000ULL, 0xff8f8d8fffffffffULL, 0xff1f1d1fffffffffULL, 0xff3f3d3fffffffffULL,
+    0x0004000000000000ULL, 0x0000000000000000ULL, 0x0001010000000000ULL, 0x0303010f00000000ULL,
+    0x0707051f07000000ULL, 0x8f8f8dffffffffffULL, 0x1f1f1dffffffffffULL, 0x3f3f3dffffffffffULL,
+    0x0000050000000000ULL, 0x0000000000000000ULL, 0x0101050000000000ULL, 0x0303090f00000000ULL,
+    0x07071d1f1f000000ULL, 0x8f8ffdffffffffffULL, 0x1f1ffdffffffffffULL, 0x3f3ffdffffffffffULL,
+    0xfffffbfffffffcfcULL, 0xfffffbfffffff8f8ULL, 0xfffffbfffffff1f1ULL, 0xfffffbffffffe3e3ULL,
+    0xfffffbffffffc7c7ULL, 0xfffffbffffff8f8fULL, 0xfffffbffffff1f1fULL, 0xfffffbffffff3f3fULL,
+    0xfffffbfffffcfcfcULL, 0xfffffbfffff8f8f8ULL, 0xfffffbfffff1f1f1ULL, 0xfffffbffffe3e3e3ULL,
+    0xfffffbffffc7c7c7ULL, 0xfffffbffff8f8f8fULL, 0xfffffbffff1f1f1fULL, 0xfffffbffff3f3f3fULL,
+    0xfffffbfffcfcfcffULL, 0xfffffbfff8f8f8ffULL, 0xfffffbfff1f1f1ffULL, 0xfffffbffe3e3e3ffULL,
+    0xfffffbffc7c7c7ffULL, 0xfffffbff8f8f8fffULL, 0xfffffbff1f1f1fffULL, 0xfffffbff3f3f3fffULL,
+    0xfffffbfcfcfcffffULL, 0xfffffbf8f8f8ffffULL, 0xfffffbf1f1f1ffffULL, 0xfffffbe3e3e3ffffULL,
+    0xfffffbc7c7c7ffffULL, 0xfffffb8f8f8fffffULL, 0xfffffb1f1f1fffffULL, 0xfffffb3f3f3fffffULL,
+    0xfffff8fcfcffffffULL, 0xfffff8f8f8ffffffULL, 0xfffff1f1f1ffffffULL, 0xffffe3e3e3ffffffULL,
+    0xffffc3c7c7ffffffULL, 0xffff8b8f8fffffffULL, 0xffff1b1f1fffffffULL, 0xffff3b3f3fffffffULL,
+    0x3f3c383c3e000000ULL, 0x1e18181800000000ULL, 0x0000000000000000ULL, 0x0f03030300000000ULL,
+    0x1f0703070f000000ULL, 0xff8f8b8fffffffffULL, 0xff1f1b1fffffffffULL, 0xff3f3b3fffffffffULL,
+    0x3c3c383f3f000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL,
+    0x0707033f3f000000ULL, 0x8f8f8bffffffffffULL, 0x1f1f1bffffffffffULL, 0x3f3f3bffffffffffULL,
+    0x3c3c3b3f3f000000ULL, 0x1818191f00000000ULL, 0x00000a0000000000ULL, 0x0303131f00000000ULL,
+    0x07073b3f3f000000ULL, 0x8f8ffbffffffffffULL, 0x1f1ffbffffffffffULL, 0x3f3ffbffffffffffULL,
+    0xfffffbfffffffcfcULL, 0xfffffbfffffff8f8ULL, 0xfffffbfffffff1f1ULL, 0xfffffbffffffe3e3ULL,
+    0xfffffbffffffc7c7ULL, 0xfffffbffffff8f8fULL, 0xfffffbffffff1f1fULL, 0xfffffbffffff3f3fULL,
+    0xfffffbfffffcfcfcULL, 0xfffffbfffff8f8f8ULL, 0xfffffbfffff1f1f1ULL, 0xfffffbffffe3e3e3ULL,
+    0xfffffbffffc7c7c7ULL, 0xfffffbffff8f8f8fULL, 0xfffffbffff1f1f1fULL, 0xfffffbffff3f3f3fULL,
+    0xfffffbfffcfcfcffULL, 0xfffffbfff8f8f8ffULL, 0xfffffbfff1f1f1ffULL, 0xfffffbffe3e3e3ffULL,
+    0xfffffbffc7c7c7ffULL, 0xfffffbff8f8f8fffULL, 0xfffffbff1f1f1fffULL, 0xfffffbff3f3f3fffULL,
+    0xfffffbfcfcfcffffULL, 0xfffffbf8f8f8ffffULL, 0xfffffbf1f1f1ffffULL, 0xfffffbe3e3e3ffffULL,
+    0xfffffbc7c7c7ffffULL, 0xfffffb8f8f8fffffULL, 0xfffffb1f1f1fffffULL, 0xfffffb3f3f3fffffULL,
+    0x1e1f181c00000000ULL, 0x000e080800000000ULL, 0x000e000000000000ULL, 0x000e020200000000ULL,
+    0x0f1f030700000000ULL, 0x1f3f0b0f0f000000ULL, 0xffff1b1f1fffffffULL, 0xffff3b3f3fffffffULL,
+    0x1e1c181c00000000ULL, 0x0008080000000000ULL, 0x0000000000000000ULL, 0x0002020000000000ULL,
+    0x0f07030700000000ULL, 0x1f0f0b0f0f000000ULL, 0xff1f1b1fffffffffULL, 0xff3f3b3fffffffffULL,
+    0x1c1c181f00000000ULL, 0x0008080000000000ULL, 0x0000000000000000ULL, 0x0002020000000000ULL,
+    0x0707031f00000000ULL, 0x0f0f0b3f0f000000ULL, 0x1f1f1bffffffffffULL, 0x3f3f3bffffffffffULL,
+    0x1c1c191f00000000ULL, 0x08080a0000000000ULL, 0x0000000000000000ULL, 0x02020a0000000000ULL,
+    0x0707131f00000000ULL, 0x0f0f3b3f3f000000ULL, 0x1f1ffbffffffffffULL, 0x3f3ffbffffffffffULL,
+    0xfffff7fffffffcfcULL, 0xfffff7fffffff8f8ULL, 0xfffff7fffffff1f1ULL, 0xfffff7ffffffe3e3ULL,
+    0xfffff7ffffffc7c7ULL, 0xfffff7ffffff8f8fULL, 0xfffff7ffffff1f1fULL, 0xfffff7ffffff3f3fULL,
+    0xfffff7fffffcfcfcULL, 0xfffff7fffff8f8f8ULL, 0xfffff7fffff1f1f1ULL, 0xfffff7ffffe3e3e3ULL,
+    0xfffff7ffffc7c7c7ULL, 0xfffff7ffff8f8f8fULL, 0xfffff7ffff1f1f1fULL, 0xfffff7ffff3f3f3fULL,
+    0xfffff7fffcfcfcffULL, 0xfffff7fff8f8f8ffULL, 0xfffff7fff1f1f1ffULL, 0xfffff7ffe3e3e3ffULL,
+    0xfffff7ffc7c7c7ffULL, 0xfffff7ff8f8f8fffULL, 0xfffff7ff1f1f1fffULL, 0xfffff7ff3f3f3fffULL,
+    0xfffff7fcfcfcffffULL, 0xfffff7f8f8f8ffffULL, 0xfffff7f1f1f1ffffULL, 0xfffff7e3e3e3ffffULL,
+    0xfffff7c7c7c7ffffULL, 0xfffff78f8f8fffffULL, 0xfffff71f1f1fffffULL, 0xfffff73f3f3fffffULL,
+    0xfffff4fcfcffffffULL, 0xfffff0f8f8ffffffULL, 0xfffff1f1f1ffffffULL, 0xffffe3e3e3ffffffULL,
+    0xffffc7c7c7ffffffULL, 0xffff878f8fffffffULL, 0xffff171f1fffffffULL, 0xffff373f3fffffffULL,
+    0xfffcf4fcffffffffULL, 0x7e7870787c000000ULL, 0x3c30303000000000ULL, 0x0000000000000000ULL,
+    0x1e06060600000000ULL, 0x3f0f070f1f000000ULL, 0xff1f171fffffffffULL, 0xff3f373fffffffffULL,
+    0xfcfcf4ffffffffffULL, 0x7878707f7f000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL,
+    0x0000000000000000ULL, 0x0f0f077f7f000000ULL, 0x1f1f17ffffffffffULL, 0x3f3f37ffffffffffULL,
+    0xfcfcf7ffffffffffULL, 0x7878777f7f000000ULL, 0x3030323e00000000ULL, 0x0000140000000000ULL,
+    0x0606263e00000000ULL, 0x0f0f777f7f000000ULL, 0x1f1ff7ffffffffffULL, 0x3f3ff7ffffffffffULL,
+    0xfffff7fffffffcfcULL, 0xfffff7fffffff8f8ULL, 0xfffff7fffffff1f1ULL, 0xfffff7ffffffe3e3ULL,
+    0xfffff7ffffffc7c7ULL, 0xfffff7ffffff8f8fULL, 0xfffff7ffffff1f1fULL, 0xfffff7ffffff3f3fULL,
+    0xfffff7fffffcfcfcULL, 0xfffff7fffff8f8f8ULL, 0xfffff7fffff1f1f1ULL, 0xfffff7ffffe3e3e3ULL,
+    0xfffff7ffffc7c7c7ULL, 0xfffff7ffff8f8f8fULL, 0xfffff7ffff1f1f1fULL, 0xfffff7ffff3f3f3fULL,
+    0xfffff7fffcfcfcffULL, 0xfffff7fff8f8f8ffULL, 0xfffff7fff1f1f1ffULL, 0xfffff7ffe3e3e3ffULL,
+    0xfffff7ffc7c7c7ffULL, 0xfffff7ff8f8f8fffULL, 0xfffff7ff1f1f1fffULL, 0xfffff7ff3f3f3fffULL,
+    0xfffff7fcfcfcffffULL, 0xfffff7f8f8f8ffffULL, 0xfffff7f1f1f1ffffULL, 0xfffff7e3e3e3ffffULL,
+    0xfffff7c7c7c7ffffULL, 0xfffff78f8f8fffffULL, 0xfffff71f1f1fffffULL, 0xfffff73f3f3fffffULL,
+    0x7e7f747c7c000000ULL, 0x3c3e303800000000ULL, 0x001c101000000000ULL, 0x001c000000000000ULL,
+    0x001c040400000000ULL, 0x1e3e060e00000000ULL, 0x3f7f171f1f000000ULL, 0xffff373f3fffffffULL,
+    0x7e7c747c7c000000ULL, 0x3c38303800000000ULL, 0x0010100000000000ULL, 0x0000000000000000ULL,
+    0x0004040000000000ULL, 0x1e0e060e00000000ULL, 0x3f1f171f1f000000ULL, 0xff3f373fffffffffULL,
+    0x7c7c747f7c000000ULL, 0x3838303e00000000ULL, 0x0010100000000000ULL, 0x0000000000000000ULL,
+    0x0004040000000000ULL, 0x0e0e063e00000000ULL, 0x1f1f177f1f000000ULL, 0x3f3f37ffffffffffULL,
+    0x7c7c777f7f000000ULL, 0x3838323e00000000ULL, 0x1010140000000000ULL, 0x0000000000000000ULL,
+    0x0404140000000000ULL, 0x0e0e263e00000000ULL, 0x1f1f777f7f000000ULL, 0x3f3ff7ffffffffffULL,
+    0xfffffffefffffcfcULL, 0xfffffffefffff8f8ULL, 0xfffffffefffff1f1ULL, 0xfffffffeffffe3e3ULL,
+    0xfffffffeffffc7c7ULL, 0xfffffffeffff8f8fULL, 0xfffffffeffff1f1fULL, 0xfffffffeffff3f3fULL,
+    0xfffffffefffcfcfcULL, 0xfffffffefff8f8f8ULL, 0xfffffffefff1f1f1ULL, 0xfffffffeffe3e3e3ULL,
+    0xfffffffeffc7c7c7ULL, 0xfffffffeff8f8f8fULL, 0xfffffffeff1f1f1fULL, 0xfffffffeff3f3f3fULL,
+    0xfffffffefcfcfcffULL, 0xfffffffef8f8f8ffULL, 0xfffffffef1f1f1ffULL, 0xfffffffee3e3e3ffULL,
+    0xfffffffec7c7c7ffULL, 0xfffffffe8f8f8fffULL, 0xfffffffe1f1f1fffULL, 0xfffffffe3f3f3fffULL,
+    0xfffffffcfcfcffffULL, 0xfffffff8f8f8ffffULL, 0xfffffff0f1f1ffffULL, 0xffffffe2e3e3ffffULL,
+    0xffffffc6c7c7ffffULL, 0xffffff8e8f8fffffULL, 0xffffff1e1f1fffffULL, 0xffffff3e3f3fffffULL,
+    0x0000000000000000ULL, 0x0003000000000000ULL, 0x0707010000000000ULL, 0x0f0f030203000000ULL,
+    0xffffc7c6c7ffffffULL, 0xffff8f8e8fffffffULL, 0xffff1f1e1fffffffULL, 0xffff3f3e3fffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0200000000000000ULL, 0x0703030200000000ULL,
+    0xffc7c7c6ffffffffULL, 0xff8f8f8effffffffULL, 0xff1f1f1effffffffULL, 0xff3f3f3effffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0303030000000000ULL,
+    0xc7c7c7feffffffffULL, 0x8f8f8ffeffffffffULL, 0x1f1f1ffeffffffffULL, 0x3f3f3ffeffffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0303070000000000ULL,
+    0xc7c7fffeffffffffULL, 0x8f8ffffeffffffffULL, 0x1f1ffffeffffffffULL, 0x3f3ffffeffffffffULL,
+    0xfffffffefffffcfcULL, 0xfffffffefffff8f8ULL, 0xfffffffefffff1f1ULL, 0xfffffffeffffe3e3ULL,
+    0xfffffffeffffc7c7ULL, 0xfffffffeffff8f8fULL, 0xfffffffeffff1f1fULL, 0xfffffffeffff3f3fULL,
+    0xfffffffefffcfcfcULL, 0xfffffffefff8f8f8ULL, 0xfffffffefff1f1f1ULL, 0xfffffffeffe3e3e3ULL,
+    0xfffffffeffc7c7c7ULL, 0xfffffffeff8f8f8fULL, 0xfffffffeff1f1f1fULL, 0xfffffffeff3f3f3fULL,
+    0xfffffffefcfcfcffULL, 0xfffffffef8f8f8ffULL, 0xfffffffef1f1f1ffULL, 0xfffffffee3e3e3ffULL,
+    0xfffffffec7c7c7ffULL, 0xfffffffe8f8f8fffULL, 0xfffffffe1f1f1fffULL, 0xfffffffe3f3f3fffULL,
+    0x0000030000000000ULL, 0x0000030000000000ULL, 0x0003070000000000ULL, 0x07070f0202000000ULL,
+    0x0f0f1f0607000000ULL, 0xffffff8e8f8fffffULL, 0xffffff1e1f1fffffULL, 0xffffff3e3f3fffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0002000000000000ULL, 0x0206020200000000ULL,
+    0x070f070600000000ULL, 0xffff8f8e8fffffffULL, 0xffff1f1e1fffffffULL, 0xffff3f3e3fffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0202020000000000ULL,
+    0x0707070000000000ULL, 0xff8f8f8effffffffULL, 0xff1f1f1effffffffULL, 0xff3f3f3effffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0202000000000000ULL,
+    0x0707070000000000ULL, 0x8f8f8ffeffffffffULL, 0x1f1f1ffeffffffffULL, 0x3f3f3ffeffffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0202000000000000ULL,
+    0x0707070000000000ULL, 0x8f8ffffeffffffffULL, 0x1f1ffffeffffffffULL, 0x3f3ffffeffffffffULL,
+    0xfffffffdfffffcfcULL, 0xfffffffdfffff8f8ULL, 0xfffffffdfffff1f1ULL, 0xfffffffdffffe3e3ULL,
+    0xfffffffdffffc7c7ULL, 0xfffffffdffff8f8fULL, 0xfffffffdffff1f1fULL, 0xfffffffdffff3f3fULL,
+    0xfffffffdfffcfcfcULL, 0xfffffffdfff8f8f8ULL, 0xfffffffdfff1f1f1ULL, 0xfffffffdffe3e3e3ULL,
+    0xfffffffdffc7c7c7ULL, 0xfffffffdff8f8f8fULL, 0xfffffffdff1f1f1fULL, 0xfffffffdff3f3f3fULL,
+    0xfffffffdfcfcfcffULL, 0xfffffffdf8f8f8ffULL, 0xfffffffdf1f1f1ffULL, 0xfffffffde3e3e3ffULL,
+    0xfffffffdc7c7c7ffULL, 0xfffffffd8f8f8fffULL, 0xfffffffd1f1f1fffULL, 0xfffffffd3f3f3fffULL,
+    0xfffffffcfcfcffffULL, 0xfffffff8f8f8ffffULL, 0xfffffff1f1f1ffffULL, 0xffffffe1e3e3ffffULL,
+    0xffffffc5c7c7ffffULL, 0xffffff8d8f8fffffULL, 0xffffff1d1f1fffffULL, 0xffffff3d3f3fffffULL,
+    0x000f0c0c0c000000ULL, 0x0000000000000000ULL, 0x0007010101000000ULL, 0x0f0f030103070000ULL,
+    0x1f1f070507070000ULL, 0xffff8f8d8fffffffULL, 0xffff1f1d1fffffffULL, 0xffff3f3d3fffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0703030103000000ULL,
+    0x0f0707050f070000ULL, 0xff8f8f8dffffffffULL, 0xff1f1f1dffffffffULL, 0xff3f3f3dffffffffULL,
+    0x0c0c0c0c00000000ULL, 0x0000000000000000ULL, 0x0101010100000000ULL, 0x0303030d03000000ULL,
+    0x0707071d1f070000ULL, 0x8f8f8ffdffffffffULL, 0x1f1f1ffdffffffffULL, 0x3f3f3ffdffffffffULL,
+    0x0c0c0f0d00000000ULL, 0x00080f0d00000000ULL, 0x01010f0d00000000ULL, 0x03031f1d03000000ULL,
+    0x07073f3d1f070000ULL, 0x8f8ffffdffffffffULL, 0x1f1ffffdffffffffULL, 0x3f3ffffdffffffffULL,
+    0xfffffffdfffffcfcULL, 0xfffffffdfffff8f8ULL, 0xfffffffdfffff1f1ULL, 0xfffffffdffffe3e3ULL,
+    0xfffffffdffffc7c7ULL, 0xfffffffdffff8f8fULL, 0xfffffffdffff1f1fULL, 0xfffffffdffff3f3fULL,
+    0xfffffffdfffcfcfcULL, 0xfffffffdfff8f8f8ULL, 0xfffffffdfff1f1f1ULL, 0xfffffffdffe3e3e3ULL,
+    0xfffffffdffc7c7c7ULL, 0xfffffffdff8f8f8fULL, 0xfffffffdff1f1f1fULL, 0xfffffffdff3f3f3fULL,
+    0xfffffffdfcfcfcffULL, 0xfffffffdf8f8f8ffULL, 0xfffffffdf1f1f1ffULL, 0xfffffffde3e3e3ffULL,
+    0xfffffffdc7c7c7ffULL, 0xfffffffd8f8f8fffULL, 0xfffffffd1f1f1fffULL, 0xfffffffd3f3f3fffULL,
+    0x0000070404000000ULL, 0x0000070000000000ULL, 0x0000070101000000ULL, 0x00070f0103000000ULL,
+    0x0f0f1f0507070000ULL, 0x1f1f3f0d0f070000ULL, 0xffffff1d1f1fffffULL, 0xffffff3d3f3fffffULL,
+    0x0000040400000000ULL, 0x0000000000000000ULL, 0x0000010100000000ULL, 0x0007030103000000ULL,
+    0x070f070503000000ULL, 0x0f1f0f0d0f070000ULL, 0xffff1f1d1fffffffULL, 0xffff3f3d3fffffffULL,
+    0x0000040000000000ULL, 0x0000000000000000ULL, 0x0000010000000000ULL, 0x0003030100000000ULL,
+    0x0707070503000000ULL, 0x0f0f0f0d0f070000ULL, 0xff1f1f1dffffffffULL, 0xff3f3f3dffffffffULL,
+    0x0004040000000000ULL, 0x0000000000000000ULL, 0x0001010000000000ULL, 0x0303030100000000ULL,
+    0x0707070d03000000ULL, 0x0f0f0f1d0f070000ULL, 0x1f1f1ffdffffffffULL, 0x3f3f3ffdffffffffULL,
+    0x0404070000000000ULL, 0x0000070000000000ULL, 0x0101070000000000ULL, 0x03030f0100000000ULL,
+    0x07071f0d03000000ULL, 0x0f0f3f1d1f070000ULL, 0x1f1ffffdffffffffULL, 0x3f3ffffdffffffffULL,
+    0xfffffffbfffffcfcULL, 0xfffffffbfffff8f8ULL, 0xfffffffbfffff1f1ULL, 0xfffffffbffffe3e3ULL,
+    0xfffffffbffffc7c7ULL, 0xfffffffbffff8f8fULL, 0xfffffffbffff1f1fULL, 0xfffffffbffff3f3fULL,
+    0xfffffffbfffcfcfcULL, 0xfffffffbfff8f8f8ULL, 0xfffffffbfff1f1f1ULL, 0xfffffffbffe3e3e3ULL,
+    0xfffffffbffc7c7c7ULL, 0xfffffffbff8f8f8fULL, 0xfffffffbff1f1f1fULL, 0xfffffffbff3f3f3fULL,
+    0xfffffffbfcfcfcffULL, 0xfffffffbf8f8f8ffULL, 0xfffffffbf1f1f1ffULL, 0xfffffffbe3e3e3ffULL,
+    0xfffffffbc7c7c7ffULL, 0xfffffffb8f8f8fffULL, 0xfffffffb1f1f1fffULL, 0xfffffffb3f3f3fffULL,
+    0xfffffff8fcfcffffULL, 0xfffffff8f8f8ffffULL, 0xfffffff1f1f1ffffULL, 0xffffffe3e3e3ffffULL,
+    0xffffffc3c7c7ffffULL, 0xffffff8b8f8fffffULL, 0xffffff1b1f1fffffULL, 0xffffff3b3f3fffffULL,
+    0x3f3f3c383c3e0000ULL, 0x001e181818000000ULL, 0x0000000000000000ULL, 0x000f030303000000ULL,
+    0x1f1f0703070f0000ULL, 0x3f3f0f0b0f0f0000ULL, 0xffff1f1b1fffffffULL, 0xffff3f3b3fffffffULL,
+    0x3e3c3c383c000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL,
+    0x0f07070307000000ULL, 0x1f0f0f0b1f0f0000ULL, 0xff1f1f1bffffffffULL, 0xff3f3f3bffffffffULL,
+    0x3c3c3c3b3c000000ULL, 0x1818181800000000ULL, 0x0000000000000000ULL, 0x0303030300000000ULL,
+    0x0707071b07000000ULL, 0x0f0f0f3b3f0f0000ULL, 0x1f1f1ffbffffffffULL, 0x3f3f3ffbffffffffULL,
+    0x3c3c3f3b3c000000ULL, 0x18181f1b00000000ULL, 0x00111f1b00000000ULL, 0x03031f1b00000000ULL,
+    0x07073f3b07000000ULL, 0x0f0f7f7b3f0f0000ULL, 0x1f1ffffbffffffffULL, 0x3f3ffffbffffffffULL,
+    0xfffffffbfffffcfcULL, 0xfffffffbfffff8f8ULL, 0xfffffffbfffff1f1ULL, 0xfffffffbffffe3e3ULL,
+    0xfffffffbffffc7c7ULL, 0xfffffffbffff8f8fULL, 0xfffffffbffff1f1fULL, 0xfffffffbffff3f3fULL,
+    0xfffffffbfffcfcfcULL, 0xfffffffbfff8f8f8ULL, 0xfffffffbfff1f1f1ULL, 0xfffffffbffe3e3e3ULL,
+    0xfffffffbffc7c7c7ULL, 0xfffffffbff8f8f8fULL, 0xfffffffbff1f1f1fULL, 0xfffffffbff3f3f3fULL,
+    0xfffffffbfcfcfcffULL, 0xfffffffbf8f8f8ffULL, 0xfffffffbf1f1f1ffULL, 0xfffffffbe3e3e3ffULL,
+    0xfffffffbc7c7c7ffULL, 0xfffffffb8f8f8fffULL, 0xfffffffb1f1f1fffULL, 0xfffffffb3f3f3fffULL,
+    0x001e1f181c000000ULL, 0x00000e0808000000ULL, 0x00000e0000000000ULL, 0x00000e0202000000ULL,
+    0x000f1f0307000000ULL, 0x1f1f3f0b0f0f0000ULL, 0x3f3f7f1b1f0f0000ULL, 0xffffff3b3f3fffffULL,
+    0x001e1c181c000000ULL, 0x0000080800000000ULL, 0x0000000000000000ULL, 0x0000020200000000ULL,
+    0x000f070307000000ULL, 0x0f1f0f0b07000000ULL, 0x1f3f1f1b1f0f0000ULL, 0xffff3f3b3fffffffULL,
+    0x001c1c1800000000ULL, 0x0000080000000000ULL, 0x0000000000000000ULL, 0x0000020000000000ULL,
+    0x0007070300000000ULL, 0x0f0f0f0b07000000ULL, 0x1f1f1f1b1f0f0000ULL, 0xff3f3f3bffffffffULL,
+    0x1c1c1c1800000000ULL, 0x0008080000000000ULL, 0x0000000000000000ULL, 0x0002020000000000ULL,
+    0x0707070300000000ULL, 0x0f0f0f1b07000000ULL, 0x1f1f1f3b1f0f0000ULL, 0x3f3f3ffbffffffffULL,
+    0x1c1c1f1800000000ULL, 0x08080e0000000000ULL, 0x00000e0000000000ULL, 0x02020e0000000000ULL,
+    0x07071f0300000000ULL, 0x0f0f3f1b07000000ULL, 0x1f1f7f3b3f0f0000ULL, 0x3f3ffffbffffffffULL,
+    0xfffffff7fffffcfcULL, 0xfffffff7fffff8f8ULL, 0xfffffff7fffff1f1ULL, 0xfffffff7ffffe3e3ULL,
+    0xfffffff7ffffc7c7ULL, 0xfffffff7ffff8f8fULL, 0xfffffff7ffff1f1fULL, 0xfffffff7ffff3f3fULL,
+    0xfffffff7fffcfcfcULL, 0xfffffff7fff8f8f8ULL, 0xfffffff7fff1f1f1ULL, 0xfffffff7ffe3e3e3ULL,
+    0xfffffff7ffc7c7c7ULL, 0xfffffff7ff8f8f8fULL, 0xfffffff7ff1f1f1fULL, 0xfffffff7ff3f3f3fULL,
+    0xfffffff7fcfcfcffULL, 0xfffffff7f8f8f8ffULL, 0xfffffff7f1f1f1ffULL, 0xfffffff7e3e3e3ffULL,
+    0xfffffff7c7c7c7ffULL, 0xfffffff78f8f8fffULL, 0xfffffff71f1f1fffULL, 0xfffffff73f3f3fffULL,
+    0xfffffff4fcfcffffULL, 0xfffffff0f8f8ffffULL, 0xfffffff1f1f1ffffULL, 0xffffffe3e3e3ffffULL,
+    0xffffffc7c7c7ffffULL, 0xffffff878f8fffffULL, 0xffffff171f1fffffULL, 0xffffff373f3fffffULL,
+    0xfffffcf4fcfc0000ULL, 0x7e7e7870787c0000ULL, 0x003c303030000000ULL, 0x0000000000000000ULL,
+    0x001e060606000000ULL, 0x3f3f0f070f1f0000ULL, 0x7f7f1f171f1f0000ULL, 0xffff3f373fffffffULL,
+    0xfefcfcf4fefc0000ULL, 0x7c78787078000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL,
+    0x0000000000000000ULL, 0x1f0f0f070f000000ULL, 0x3f1f1f173f1f0000ULL, 0xff3f3f37ffffffffULL,
+    0xfcfcfcf7fffc0000ULL, 0x7878787678000000ULL, 0x3030303000000000ULL, 0x0000000000000000ULL,
+    0x0606060600000000ULL, 0x0f0f0f370f000000ULL, 0x1f1f1f777f1f0000ULL, 0x3f3f3ff7ffffffffULL,
+    0xfcfcfff7fffc0000ULL, 0x78787f7778000000ULL, 0x30303e3600000000ULL, 0x00223e3600000000ULL,
+    0x06063e3600000000ULL, 0x0f0f7f770f000000ULL, 0x1f1ffff77f1f0000ULL, 0x3f3ffff7ffffffffULL,
+    0xfffffff7fffffcfcULL, 0xfffffff7fffff8f8ULL, 0xfffffff7fffff1f1ULL, 0xfffffff7ffffe3e3ULL,
+    0xfffffff7ffffc7c7ULL, 0xfffffff7ffff8f8fULL, 0xfffffff7ffff1f1fULL, 0xfffffff7ffff3f3fULL,
+    0xfffffff7fffcfcfcULL, 0xfffffff7fff8f8f8ULL, 0xfffffff7fff1f1f1ULL, 0xfffffff7ffe3e3e3ULL,
+    0xfffffff7ffc7c7c7ULL, 0xfffffff7ff8f8f8fULL, 0xfffffff7ff1f1f1fULL, 0xfffffff7ff3f3f3fULL,
+    0xfffffff7fcfcfcffULL, 0xfffffff7f8f8f8ffULL, 0xfffffff7f1f1f1ffULL, 0xfffffff7e3e3e3ffULL,
+    0xfffffff7c7c7c7ffULL, 0xfffffff78f8f8fffULL, 0xfffffff71f1f1fffULL, 0xfffffff73f3f3fffULL,
+    0x7e7e7f747c7c0000ULL, 0x003c3e3038000000ULL, 0x00001c1010000000ULL, 0x00001c0000000000ULL,
+    0x00001c0404000000ULL, 0x001e3e060e000000ULL, 0x3f3f7f171f1f0000ULL, 0x7f7fff373f1f0000ULL,
+    0x7c7e7c7478000000ULL, 0x003c383038000000ULL, 0x0000101000000000ULL, 0x0000000000000000ULL,
+    0x0000040400000000ULL, 0x001e0e060e000000ULL, 0x1f3f1f170f000000ULL, 0x3f7f3f373f1f0000ULL,
+    0x7c7c7c7478000000ULL, 0x0038383000000000ULL, 0x0000100000000000ULL, 0x0000000000000000ULL,
+    0x0000040000000000ULL, 0x000e0e0600000000ULL, 0x1f1f1f170f000000ULL, 0x3f3f3f373f1f0000ULL,
+    0x7c7c7c7678000000ULL, 0x3838383000000000ULL, 0x0010100000000000ULL, 0x0000000000000000ULL,
+    0x0004040000000000ULL, 0x0e0e0e0600000000ULL, 0x1f1f1f370f000000ULL, 0x3f3f3f773f1f0000ULL,
+    0x7c7c7f7678000000ULL, 0x38383e3000000000ULL, 0x10101c0000000000ULL, 0x00001c0000000000ULL,
+    0x04041c0000000000ULL, 0x0e0e3e0600000000ULL, 0x1f1f7f370f000000ULL, 0x3f3fff777f1f0000ULL,
+    0xfffffffffefffcfcULL, 0xfffffffffefff8f8ULL, 0xfffffffffefff1f1ULL, 0xfffffffffeffe3e3ULL,
+    0xfffffffffeffc7c7ULL, 0xfffffffffeff8f8fULL, 0xfffffffffeff1f1fULL, 0xfffffffffeff3f3fULL,
+    0xfffffffffefcfcfcULL, 0xfffffffffef8f8f8ULL, 0xfffffffffef1f1f1ULL, 0xfffffffffee3e3e3ULL,
+    0xfffffffffec7c7c7ULL, 0xfffffffffe8f8f8fULL, 0xfffffffffe1f1f1fULL, 0xfffffffffe3f3f3fULL,
+    0xfffffffffcfcfcffULL, 0xfffffffff8f8f8ffULL, 0xfffffffff0f1f1ffULL, 0xffffffffe2e3e3ffULL,
+    0xffffffffc6c7c7ffULL, 0xffffffff8e8f8fffULL, 0xffffffff1e1f1fffULL, 0xffffffff3e3f3fffULL,
+    0x0000000000000000ULL, 0x0000030000000000ULL, 0x0007070100000000ULL, 0x070f0f0302030000ULL,
+    0x0f1f1f0706070000ULL, 0xffffff8f8e8fffffULL, 0xffffff1f1e1fffffULL, 0xffffff3f3e3fffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0002000000000000ULL, 0x0707030302000000ULL,
+    0x0f0f070706000000ULL, 0xffff8f8f8effffffULL, 0xffff1f1f1effffffULL, 0xffff3f3f3effffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0703030300000000ULL,
+    0x0f07070700000000ULL, 0xff8f8f8ffeffffffULL, 0xff1f1f1ffeffffffULL, 0xff3f3f3ffeffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0303030000000000ULL,
+    0x0707070f00000000ULL, 0x8f8f8ffffeffffffULL, 0x1f1f1ffffeffffffULL, 0x3f3f3ffffeffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0303070000000000ULL,
+    0x07070f0f00000000ULL, 0x8f8ffffffeffffffULL, 0x1f1ffffffeffffffULL, 0x3f3ffffffeffffffULL,
+    0xfffffffffefffcfcULL, 0xfffffffffefff8f8ULL, 0xfffffffffefff1f1ULL, 0xfffffffffeffe3e3ULL,
+    0xfffffffffeffc7c7ULL, 0xfffffffffeff8f8fULL, 0xfffffffffeff1f1fULL, 0xfffffffffeff3f3fULL,
+    0xfffffffffefcfcfcULL, 0xfffffffffef8f8f8ULL, 0xfffffffffef1f1f1ULL, 0xfffffffffee3e3e3ULL,
+    0xfffffffffec7c7c7ULL, 0xfffffffffe8f8f8fULL, 0xfffffffffe1f1f1fULL, 0xfffffffffe3f3f3fULL,
+    0x0000000300000000ULL, 0x0000000300000000ULL, 0x0000030700000000ULL, 0x0007070f02020000ULL,
+    0x070f0f1f06070000ULL, 0x0f1f1f3f0e0f0000ULL, 0xffffffff1e1f1fffULL, 0xffffffff3e3f3fffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000020000000000ULL, 0x0002060202000000ULL,
+    0x07070f0706000000ULL, 0x0f0f1f0f0e000000ULL, 0xffffff1f1e1fffffULL, 0xffffff3f3e3fffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0002020200000000ULL,
+    0x0707070700000000ULL, 0x0f0f0f0f00000000ULL, 0xffff1f1f1effffffULL, 0xffff3f3f3effffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0002020000000000ULL,
+    0x0707070000000000ULL, 0x0f0f0f0f00000000ULL, 0xff1f1f1ffeffffffULL, 0xff3f3f3ffeffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0002000000000000ULL,
+    0x0707070000000000ULL, 0x0f0f0f0f00000000ULL, 0x1f1f1ffffeffffffULL, 0x3f3f3ffffeffffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0202000000000000ULL,
+    0x0707070000000000ULL, 0x0f0f0f0f00000000ULL, 0x1f1ffffffeffffffULL, 0x3f3ffffffeffffffULL,
+    0xfffffffffdfffcfcULL, 0xfffffffffdfff8f8ULL, 0xfffffffffdfff1f1ULL, 0xfffffffffdffe3e3ULL,
+    0xfffffffffdffc7c7ULL, 0xfffffffffdff8f8fULL, 0xfffffffffdff1f1fULL, 0xfffffffffdff3f3fULL,
+    0xfffffffffdfcfcfcULL, 0xfffffffffdf8f8f8ULL, 0xfffffffffdf1f1f1ULL, 0xfffffffffde3e3e3ULL,
+    0xfffffffffdc7c7c7ULL, 0xfffffffffd8f8f8fULL, 0xfffffffffd1f1f1fULL, 0xfffffffffd3f3f3fULL,
+    0xfffffffffcfcfcffULL, 0xfffffffff8f8f8ffULL, 0xfffffffff1f1f1ffULL, 0xffffffffe1e3e3ffULL,
+    0xffffffffc5c7c7ffULL, 0xffffffff8d8f8fffULL, 0xffffffff1d1f1fffULL, 0xffffffff3d3f3fffULL,
+    0x00000f0c0c0c0000ULL, 0x0000000000000000ULL, 0x0000070101010000ULL, 0x000f0f0301030700ULL,
+    0x0f1f1f0705070700ULL, 0x1f3f3f0f0d0f1f0fULL, 0xffffff1f1d1fffffULL, 0xffffff3f3d3fffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0007030301030000ULL,
+    0x0f0f0707050f0700ULL, 0x1f1f0f0f0d1f1f0fULL, 0xffff1f1f1dffffffULL, 0xffff3f3f3dffffffULL,
+    0x000c0c0c0c000000ULL, 0x0000000000000000ULL, 0x0001010101000000ULL, 0x0703030305030000ULL,
+    0x0f0707070d0f0700ULL, 0x1f0f0f0f1d1f1f0fULL, 0xff1f1f1ffdffffffULL, 0xff3f3f3ffdffffffULL,
+    0x0c0c0c0e0d000000ULL, 0x0000000505000000ULL, 0x0101010b0d000000ULL, 0x030303171d030000ULL,
+    0x0707072f3d0f0700ULL, 0x0f0f0f5f7d1f1f0fULL, 0x1f1f1ffffdffffffULL, 0x3f3f3ffffdffffffULL,
+    0x0c0c0f0f0c000000ULL, 0x00080f0f00000000ULL, 0x01010f0f01000000ULL, 0x03031f1f05030000ULL,
+    0x07073f3f0d0f0700ULL, 0x0f0f7f7f1d1f1f0fULL, 0x1f1ffffffdffffffULL, 0x3f3ffffffdffffffULL,
+    0xfffffffffdfffcfcULL, 0xfffffffffdfff8f8ULL, 0xfffffffffdfff1f1ULL, 0xfffffffffdffe3e3ULL,
+    0xfffffffffdffc7c7ULL, 0xfffffffffdff8f8fULL, 0xfffffffffdff1f1fULL, 0xfffffffffdff3f3fULL,
+    0xfffffffffdfcfcfcULL, 0xfffffffffdf8f8f8ULL, 0xfffffffffdf1f1f1ULL, 0xfffffffffde3e3e3ULL,
+    0xfffffffffdc7c7c7ULL, 0xfffffffffd8f8f8fULL, 0xfffffffffd1f1f1fULL, 0xfffffffffd3f3f3fULL,
+    0x0000000704040000ULL, 0x0000000700000000ULL, 0x0000000701010000ULL, 0x0000070f01030000ULL,
+    0x000f0f1f05070700ULL, 0x0f1f1f3f0d0f0700ULL, 0x1f3f3f7f1d1f1f0fULL, 0xffffffff3d3f3fffULL,
+    0x0000000404000000ULL, 0x0000000000000000ULL, 0x0000000101000000ULL, 0x0000070301030000ULL,
+    0x00070f0705030000ULL, 0x0f0f1f0f0d0f0700ULL, 0x1f1f3f1f1d1f1f0fULL, 0xffffff3f3d3fffffULL,
+    0x0000000400000000ULL, 0x0000000000000000ULL, 0x0000000100000000ULL, 0x0000030301000000ULL,
+    0x0007070705030000ULL, 0x0f0f0f0f0d0f0700ULL, 0x1f1f1f1f1d1f1f0fULL, 0xffff3f3f3dffffffULL,
+    0x0000040400000000ULL, 0x0000000000000000ULL, 0x0000010100000000ULL, 0x0003030301000000ULL,
+    0x0007070705030000ULL, 0x0f0f0f0f0d0f0700ULL, 0x1f1f1f1f1d1f1f0fULL, 0xff3f3f3ffdffffffULL,
+    0x0004040500000000ULL, 0x0000000200000000ULL, 0x0001010500000000ULL, 0x0003030b01000000ULL,
+    0x0707071705030000ULL, 0x0f0f0f2f0d0f0700ULL, 0x1f1f1f5f1d1f1f0fULL, 0x3f3f3ffffdffffffULL,
+    0x0404070400000000ULL, 0x0000070000000000ULL, 0x0101070100000000ULL, 0x03030f0301000000ULL,
+    0x07071f0705030000ULL, 0x0f0f3f0f0d0f0700ULL, 0x1f1f7f5f1d1f1f0fULL, 0x3f3ffffffdffffffULL,
+    0xfffffffffbfffcfcULL, 0xfffffffffbfff8f8ULL, 0xfffffffffbfff1f1ULL, 0xfffffffffbffe3e3ULL,
+    0xfffffffffbffc7c7ULL, 0xfffffffffbff8f8fULL, 0xfffffffffbff1f1fULL, 0xfffffffffbff3f3fULL,
+    0xfffffffffbfcfcfcULL, 0xfffffffffbf8f8f8ULL, 0xfffffffffbf1f1f1ULL, 0xfffffffffbe3e3e3ULL,
+    0xfffffffffbc7c7c7ULL, 0xfffffffffb8f8f8fULL, 0xfffffffffb1f1f1fULL, 0xfffffffffb3f3f3fULL,
+    0xfffffffff8fcfcffULL, 0xfffffffff8f8f8ffULL, 0xfffffffff1f1f1ffULL, 0xffffffffe3e3e3ffULL,
+    0xffffffffc3c7c7ffULL, 0xffffffff8b8f8fffULL, 0xffffffff1b1f1fffULL, 0xffffffff3b3f3fffULL,
+    0x003f3f3c383c3e00ULL, 0x00001e1818180000ULL, 0x0000000000000000ULL, 0x00000f0303030000ULL,
+    0x001f1f0703070f00ULL, 0x1f3f3f0f0b0f0f00ULL, 0x3f7f7f1f1b1f3f1fULL, 0xffffff3f3b3fffffULL,
+    0x003e3c3c383c0000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL,
+    0x000f070703070000ULL, 0x1f1f0f0f0b1f0f00ULL, 0x3f3f1f1f1b3f3f1fULL, 0xffff3f3f3bffffffULL,
+    0x3e3c3c3c3a3c0000ULL, 0x0018181818000000ULL, 0x0000000000000000ULL, 0x0003030303000000ULL,
+    0x0f0707070b070000ULL, 0x1f0f0f0f1b1f0f00ULL, 0x3f1f1f1f3b3f3f1fULL, 0xff3f3f3ffbffffffULL,
+    0x3c3c3c3e3b3c0000ULL, 0x1818181d1b000000ULL, 0x0000000a0a000000ULL, 0x030303171b000000ULL,
+    0x0707072f3b070000ULL, 0x0f0f0f5f7b1f0f00ULL, 0x1f1f1fbffb3f3f1fULL, 0x3f3f3ffffbffffffULL,
+    0x3c3c3f3f3a3c0000ULL, 0x18181f1f18000000ULL, 0x00111f1f00000000ULL, 0x03031f1f03000000ULL,
+    0x07073f3f0b070000ULL, 0x0f0f7f7f1b1f0f00ULL, 0x1f1fffff3b3f3f1fULL, 0x3f3ffffffbffffffULL,
+    0xfffffffffbfffcfcULL, 0xfffffffffbfff8f8ULL, 0xfffffffffbfff1f1ULL, 0xfffffffffbffe3e3ULL,
+    0xfffffffffbffc7c7ULL, 0xfffffffffbff8f8fULL, 0xfffffffffbff1f1fULL, 0xfffffffffbff3f3fULL,
+    0xfffffffffbfcfcfcULL, 0xfffffffffbf8f8f8ULL, 0xfffffffffbf1f1f1ULL, 0xfffffffffbe3e3e3ULL,
+    0xfffffffffbc7c7c7ULL, 0xfffffffffb8f8f8fULL, 0xfffffffffb1f1f1fULL, 0xfffffffffb3f3f3fULL,
+    0x00001e1f181c0000ULL, 0x0000000e08080000ULL, 0x0000000e00000000ULL, 0x0000000e02020000ULL,
+    0x00000f1f03070000ULL, 0x001f1f3f0b0f0f00ULL, 0x1f3f3f7f1b1f0f00ULL, 0x3f7f7fff3b3f3f1fULL,
+    0x00001e1c181c0000ULL, 0x0000000808000000ULL, 0x0000000000000000ULL, 0x0000000202000000ULL,
+    0x00000f0703070000ULL, 0x000f1f0f0b070000ULL, 0x1f1f3f1f1b1f0f00ULL, 0x3f3f7f3f3b3f3f1fULL,
+    0x00001c1c18000000ULL, 0x0000000800000000ULL, 0x0000000000000000ULL, 0x0000000200000000ULL,
+    0x0000070703000000ULL, 0x000f0f0f0b070000ULL, 0x1f1f1f1f1b1f0f00ULL, 0x3f3f3f3f3b3f3f1fULL,
+    0x001c1c1c18000000ULL, 0x0000080800000000ULL, 0x0000000000000000ULL, 0x0000020200000000ULL,
+    0x0007070703000000ULL, 0x000f0f0f0b070000ULL, 0x1f1f1f1f1b1f0f00ULL, 0x3f3f3f3f3b3f3f1fULL,
+    0x001c1c1d18000000ULL, 0x0008080a00000000ULL, 0x0000000400000000ULL, 0x0002020a00000000ULL,
+    0x0007071703000000ULL, 0x0f0f0f2f0b070000ULL, 0x1f1f1f5f1b1f0f00ULL, 0x3f3f3fbf3b3f3f1fULL,
+    0x1c1c1f1c18000000ULL, 0x08080e0800000000ULL, 0x00000e0000000000ULL, 0x02020e0200000000ULL,
+    0x07071f0703000000ULL, 0x0f0f3f0f0b070000ULL, 0x1f1f7f1f1b1f0f00ULL, 0x3f3fffbf3b3f3f1fULL,
+    0xfffffffff7fffcfcULL, 0xfffffffff7fff8f8ULL, 0xfffffffff7fff1f1ULL, 0xfffffffff7ffe3e3ULL,
+    0xfffffffff7ffc7c7ULL, 0xfffffffff7ff8f8fULL, 0xfffffffff7ff1f1fULL, 0xfffffffff7ff3f3fULL,
+    0xfffffffff7fcfcfcULL, 0xfffffffff7f8f8f8ULL, 0xfffffffff7f1f1f1ULL, 0xfffffffff7e3e3e3ULL,
+    0xfffffffff7c7c7c7ULL, 0xfffffffff78f8f8fULL, 0xfffffffff71f1f1fULL, 0xfffffffff73f3f3fULL,
+    0xfffffffff4fcfcffULL, 0xfffffffff0f8f8ffULL, 0xfffffffff1f1f1ffULL, 0xffffffffe3e3e3ffULL,
+    0xffffffffc7c7c7ffULL, 0xffffffff878f8fffULL, 0xffffffff171f1fffULL, 0xffffffff373f3fffULL,
+    0xfefffffcf4fcfc00ULL, 0x007e7e7870787c00ULL, 0x00003c3030300000ULL, 0x0000000000000000ULL,
+    0x00001e0606060000ULL, 0x003f3f0f070f1f00ULL, 0x3f7f7f1f171f1f00ULL, 0x7fffff3f373f7f3fULL,
+    0xfefefcfcf4fefc00ULL, 0x007c787870780000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL,
+    0x0000000000000000ULL, 0x001f0f0f070f0000ULL, 0x3f3f1f1f173f1f00ULL, 0x7f7f3f3f377f7f3fULL,
+    0xfefcfcfcf6fefc00ULL, 0x7c78787874780000ULL, 0x0030303030000000ULL, 0x0000000000000000ULL,
+    0x0006060606000000ULL, 0x1f0f0f0f170f0000ULL, 0x3f1f1f1f373f1f00ULL, 0x7f3f3f3f777f7f3fULL,
+    0xfcfcfcfef7fefc00ULL, 0x7878787d77780000ULL, 0x3030303a36000000ULL, 0x0000001414000000ULL,
+    0x0606062e36000000ULL, 0x0f0f0f5f770f0000ULL, 0x1f1f1fbff73f1f00ULL, 0x3f3f3f7ff77f7f3fULL,
+    0xfcfcfffff6fefc00ULL, 0x78787f7f74780000ULL, 0x30303e3e30000000ULL, 0x00223e3e00000000ULL,
+    0x06063e3e06000000ULL, 0x0f0f7f7f170f0000ULL, 0x1f1fffff373f1f00ULL, 0x3f3fffff777f7f3fULL,
+    0xfffffffff7fffcfcULL, 0xfffffffff7fff8f8ULL, 0xfffffffff7fff1f1ULL, 0xfffffffff7ffe3e3ULL,
+    0xfffffffff7ffc7c7ULL, 0xfffffffff7ff8f8fULL, 0xfffffffff7ff1f1fULL, 0xfffffffff7ff3f3fULL,
+    0xfffffffff7fcfcfcULL, 0xfffffffff7f8f8f8ULL, 0xfffffffff7f1f1f1ULL, 0xfffffffff7e3e3e3ULL,
+    0xfffffffff7c7c7c7ULL, 0xfffffffff78f8f8fULL, 0xfffffffff71f1f1fULL, 0xfffffffff73f3f3fULL,
+    0x007e7e7f747c7c00ULL, 0x00003c3e30380000ULL, 0x0000001c10100000ULL, 0x0000001c00000000ULL,
+    0x0000001c04040000ULL, 0x00001e3e060e0000ULL, 0x003f3f7f171f1f00ULL, 0x3f7f7fff373f1f00ULL,
+    0x007c7e7c74780000ULL, 0x00003c3830380000ULL, 0x0000001010000000ULL, 0x0000000000000000ULL,
+    0x0000000404000000ULL, 0x00001e0e060e0000ULL, 0x001f3f1f170f0000ULL, 0x3f3f7f3f373f1f00ULL,
+    0x007c7c7c74780000ULL, 0x0000383830000000ULL, 0x0000001000000000ULL, 0x0000000000000000ULL,
+    0x0000000400000000ULL, 0x00000e0e06000000ULL, 0x001f1f1f170f0000ULL, 0x3f3f3f3f373f1f00ULL,
+    0x007c7c7c74780000ULL, 0x0038383830000000ULL, 0x0000101000000000ULL, 0x0000000000000000ULL,
+    0x0000040400000000ULL, 0x000e0e0e06000000ULL, 0x001f1f1f170f0000ULL, 0x3f3f3f3f373f1f00ULL,
+    0x7c7c7c7d74780000ULL, 0x0038383a30000000ULL, 0x0010101400000000ULL, 0x0000000800000000ULL,
+    0x0004041400000000ULL, 0x000e0e2e06000000ULL, 0x1f1f1f5f170f0000ULL, 0x3f3f3fbf373f1f00ULL,
+    0x7c7c7f7c74780000ULL, 0x38383e3830000000ULL, 0x10101c1000000000ULL, 0x00001c0000000000ULL,
+    0x04041c0400000000ULL, 0x0e0e3e0e06000000ULL, 0x1f1f7f1f170f0000ULL, 0x3f3fff3f373f1f00ULL,
+    0xfffffffffffefcfcULL, 0xfffffffffffef8f8ULL, 0xfffffffffffef1f1ULL, 0xfffffffffffee3e3ULL,
+    0xfffffffffffec7c7ULL, 0xfffffffffffe8f8fULL, 0xfffffffffffe1f1fULL, 0xfffffffffffe3f3fULL,
+    0xfffffffffffcfcfcULL, 0xfffffffffff8f8f8ULL, 0xfffffffffff0f1f1ULL, 0xffffffffffe2e3e3ULL,
+    0xffffffffffc6c7c7ULL, 0xffffffffff8e8f8fULL, 0xffffffffff1e1f1fULL, 0xffffffffff3e3f3fULL,
+    0x0000000000000000ULL, 0x0000000300000000ULL, 0x0000070701000000ULL, 0x00070f0f03020300ULL,
+    0x0f0f1f1f07060700ULL, 0x1f1f3f3f0f0e0f00ULL, 0xffffffff1f1e1fffULL, 0xffffffff3f3e3fffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000020000000000ULL, 0x0007070303020000ULL,
+    0x0f0f0f0707060000ULL, 0x1f1f1f0f0f0e0000ULL, 0xffffff1f1f1effffULL, 0xffffff3f3f3effffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0007030303000000ULL,
+    0x0f0f070707000000ULL, 0x1f1f0f0f0f000000ULL, 0xffff1f1f1ffeffffULL, 0xffff3f3f3ffeffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0003030300000000ULL,
+    0x0f07070700000000ULL, 0x1f0f0f0f1f000000ULL, 0xff1f1f1ffffeffffULL, 0xff3f3f3ffffeffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0303030000000000ULL,
+    0x0707070f00000000ULL, 0x0f0f0f1f1f000000ULL, 0x1f1f1ffffffeffffULL, 0x3f3f3ffffffeffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0303070000000000ULL,
+    0x07070f0f00000000ULL, 0x0f0f1f1f1f000000ULL, 0x1f1ffffffffeffffULL, 0x3f3ffffffffeffffULL,
+    0xfffffffffffefcfcULL, 0xfffffffffffef8f8ULL, 0xfffffffffffef1f1ULL, 0xfffffffffffee3e3ULL,
+    0xfffffffffffec7c7ULL, 0xfffffffffffe8f8fULL, 0xfffffffffffe1f1fULL, 0xfffffffffffe3f3fULL,
+    0x0000000003000000ULL, 0x0000000003000000ULL, 0x0000000307000000ULL, 0x000007070f020200ULL,
+    0x00070f0f1f060700ULL, 0x0f0f1f1f3f0e0f00ULL, 0x1f1f3f3f7f1e1f00ULL, 0xffffffffff3e3f3fULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000200000000ULL, 0x0000020602020000ULL,
+    0x0007070f07060000ULL, 0x0f0f0f1f0f0e0000ULL, 0x1f1f1f3f1f1e0000ULL, 0xffffffff3f3e3fffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000020202000000ULL,
+    0x0007070707000000ULL, 0x0f0f0f0f0f000000ULL, 0x1f1f1f1f1f000000ULL, 0xffffff3f3f3effffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000020200000000ULL,
+    0x0007070700000000ULL, 0x0f0f0f0f00000000ULL, 0x1f1f1f1f1f000000ULL, 0xffff3f3f3ffeffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000020000000000ULL,
+    0x0007070000000000ULL, 0x0f0f0f0f00000000ULL, 0x1f1f1f1f1f000000ULL, 0xff3f3f3ffffeffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0002000000000000ULL,
+    0x0007070000000000ULL, 0x0f0f0f0f00000000ULL, 0x1f1f1f1f1f000000ULL, 0x3f3f3ffffffeffffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0202000000000000ULL,
+    0x0707070000000000ULL, 0x0f0f0f0f00000000ULL, 0x1f1f1f1f1f000000ULL, 0x3f3ffffffffeffffULL,
+    0xfffffffffffdfcfcULL, 0xfffffffffffdf8f8ULL, 0xfffffffffffdf1f1ULL, 0xfffffffffffde3e3ULL,
+    0xfffffffffffdc7c7ULL, 0xfffffffffffd8f8fULL, 0xfffffffffffd1f1fULL, 0xfffffffffffd3f3fULL,
+    0xfffffffffffcfcfcULL, 0xfffffffffff8f8f8ULL, 0xfffffffffff1f1f1ULL, 0xffffffffffe1e3e3ULL,
+    0xffffffffffc5c7c7ULL, 0xffffffffff8d8f8fULL, 0xffffffffff1d1f1fULL, 0xffffffffff3d3f3fULL,
+    0x0000000f0c0c0c00ULL, 0x0000000000000000ULL, 0x0000000701010100ULL, 0x00000f0f03010307ULL,
+    0x000f1f1f07050707ULL, 0x1f1f3f3f0f0d0f1fULL, 0x3f3f7f7f1f1d1f3fULL, 0xffffffff3f3d3fffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000070303010300ULL,
+    0x000f0f0707050f07ULL, 0x1f1f1f0f0f0d1f1fULL, 0x3f3f3f1f1f1d3f3fULL, 0xffffff3f3f3dffffULL,
+    0x00000c0c0c0c0000ULL, 0x0000000000000000ULL, 0x0000010101010000ULL, 0x0007030303050300ULL,
+    0x000f0707070d0f07ULL, 0x1f1f0f0f0f1d1f1fULL, 0x3f3f1f1f1f3d3f3fULL, 0xffff3f3f3ffdffffULL,
+    0x000c0c0c0e0d0000ULL, 0x0000000005050000ULL, 0x000101010b0d0000ULL, 0x00030303171d0300ULL,
+    0x0f0707072f3d0f07ULL, 0x1f0f0f0f5f7d1f1fULL, 0x3f1f1f1fbffd3f3fULL, 0xff3f3f3ffffdffffULL,
+    0x0c0c0c0f0f0c0000ULL, 0x0000080f0f000000ULL, 0x0101010f0f010000ULL, 0x0303031f1f050300ULL,
+    0x0707073f3f0d0f07ULL, 0x0f0f0f7f7f1d1f1fULL, 0x1f1f1fffff3d3f3fULL, 0x3f3f3ffffffdffffULL,
+    0x0c1c1f1f1f1d0000ULL, 0x00181f1f1f1d0000ULL, 0x01111f1f1f1d0000ULL, 0x03031f1f1f1d0300ULL,
+    0x07073f3f3f3d0f07ULL, 0x0f0f7f7f7f7d1f1fULL, 0x1f1ffffffffd3f3fULL, 0x3f3ffffffffdffffULL,
+    0xfffffffffffdfcfcULL, 0xfffffffffffdf8f8ULL, 0xfffffffffffdf1f1ULL, 0xfffffffffffde3e3ULL,
+    0xfffffffffffdc7c7ULL, 0xfffffffffffd8f8fULL, 0xfffffffffffd1f1fULL, 0xfffffffffffd3f3fULL,
+    0x0000000007040400ULL, 0x0000000007000000ULL, 0x0000000007010100ULL, 0x000000070f010300ULL,
+    0x00000f0f1f050707ULL, 0x000f1f1f3f0d0f07ULL, 0x1f1f3f3f7f1d1f1fULL, 0x3f3f7f7fff3d3f3fULL,
+    0x0000000004040000ULL, 0x0000000000000000ULL, 0x0000000001010000ULL, 0x0000000703010300ULL,
+    0x0000070f07050300ULL, 0x000f0f1f0f0d0f07ULL, 0x1f1f1f3f1f1d1f1fULL, 0x3f3f3f7f3f3d3f3fULL,
+    0x0000000004000000ULL, 0x0000000000000000ULL, 0x0000000001000000ULL, 0x0000000303010000ULL,
+    0x0000070707050300ULL, 0x000f0f0f0f0d0f07ULL, 0x1f1f1f1f1f1d1f1fULL, 0x3f3f3f3f3f3d3f3fULL,
+    0x0000000404000000ULL, 0x0000000000000000ULL, 0x0000000101000000ULL, 0x0000030303010000ULL,
+    0x0000070707050300ULL, 0x000f0f0f0f0d0f07ULL, 0x1f1f1f1f1f1d1f1fULL, 0x3f3f3f3f3f3d3f3fULL,
+    0x0000040405000000ULL, 0x0000000002000000ULL, 0x0000010105000000ULL, 0x000003030b010000ULL,
+    0x0007070717050300ULL, 0x000f0f0f2f0d0f07ULL, 0x1f1f1f1f5f1d1f1fULL, 0x3f3f3f3fbf3d3f3fULL,
+    0x0004040704000000ULL, 0x0000000700000000ULL, 0x0001010701000000ULL, 0x0003030f03010000ULL,
+    0x0007071f07050300ULL, 0x0f0f0f3f0f0d0f07ULL, 0x1f1f1f7f1f1d1f1fULL, 0x3f3f3fffbf3d3f3fULL,
+    0x04040f0f0f000000ULL, 0x00000f0f0f000000ULL, 0x01010f0f0f000000ULL, 0x03030f0f0f010000ULL,
+    0x07071f1f1f050300ULL, 0x0f0f3f3f3f0d0f07ULL, 0x1f1f7f7f7f1d1f1fULL, 0x3f3fffffff3d3f3fULL,
+    0xfffffffffffbfcfcULL, 0xfffffffffffbf8f8ULL, 0xfffffffffffbf1f1ULL, 0xfffffffffffbe3e3ULL,
+    0xfffffffffffbc7c7ULL, 0xfffffffffffb8f8fULL, 0xfffffffffffb1f1fULL, 0xfffffffffffb3f3fULL,
+    0xfffffffffff8fcfcULL, 0xfffffffffff8f8f8ULL, 0xfffffffffff1f1f1ULL, 0xffffffffffe3e3e3ULL,
+    0xffffffffffc3c7c7ULL, 0xffffffffff8b8f8fULL, 0xffffffffff1b1f1fULL, 0xffffffffff3b3f3fULL,
+    0x00003f3f3c383c3eULL, 0x0000001e18181800ULL, 0x0000000000000000ULL, 0x0000000f03030300ULL,
+    0x00001f1f0703070fULL, 0x001f3f3f0f0b0f0fULL, 0x3f3f7f7f1f1b1f3fULL, 0x7f7fffff3f3b3f7fULL,
+    0x00003e3c3c383c00ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL,
+    0x00000f0707030700ULL, 0x001f1f0f0f0b1f0fULL, 0x3f3f3f1f1f1b3f3fULL, 0x7f7f7f3f3f3b7f7fULL,
+    0x003e3c3c3c3a3c00ULL, 0x0000181818180000ULL, 0x0000000000000000ULL, 0x0000030303030000ULL,
+    0x000f0707070b0700ULL, 0x001f0f0f0f1b1f0fULL, 0x3f3f1f1f1f3b3f3fULL, 0x7f7f3f3f3f7b7f7fULL,
+    0x003c3c3c3e3b3c00ULL, 0x001818181d1b0000ULL, 0x000000000a0a0000ULL, 0x00030303171b0000ULL,
+    0x000707072f3b0700ULL, 0x1f0f0f0f5f7b1f0fULL, 0x3f1f1f1fbffb3f3fULL, 0x7f3f3f3f7ffb7f7fULL,
+    0x3c3c3c3f3f3a3c00ULL, 0x1818181f1f180000ULL, 0x0000111f1f000000ULL, 0x0303031f1f030000ULL,
+    0x0707073f3f0b0700ULL, 0x0f0f0f7f7f1b1f0fULL, 0x1f1f1fffff3b3f3fULL, 0x3f3f3fffff7b7f7fULL,
+    0x3c3c3f3f3f3b3c00ULL, 0x18383f3f3f3b0000ULL, 0x00313f3f3f3b0000ULL, 0x03233f3f3f3b0000ULL,
+    0x07073f3f3f3b0700ULL, 0x0f0f7f7f7f7b1f0fULL, 0x1f1ffffffffb3f3fULL, 0x3f3ffffffffb7f7fULL,
+    0xfffffffffffbfcfcULL, 0xfffffffffffbf8f8ULL, 0xfffffffffffbf1f1ULL, 0xfffffffffffbe3e3ULL,
+    0xfffffffffffbc7c7ULL, 0xfffffffffffb8f8fULL, 0xfffffffffffb1f1fULL, 0xfffffffffffb3f3fULL,
+    0x0000001e1f181c00ULL, 0x000000000e080800ULL, 0x000000000e000000ULL, 0x000000000e020200ULL,
+    0x0000000f1f030700ULL, 0x00001f1f3f0b0f0fULL, 0x001f3f3f7f1b1f0fULL, 0x3f3f7f7fff3b3f3fULL,
+    0x0000001e1c181c00ULL, 0x0000000008080000ULL, 0x0000000000000000ULL, 0x0000000002020000ULL,
+    0x0000000f07030700ULL, 0x00000f1f0f0b0700ULL, 0x001f1f3f1f1b1f0fULL, 0x3f3f3f7f3f3b3f3fULL,
+    0x0000001c1c180000ULL, 0x0000000008000000ULL, 0x0000000000000000ULL, 0x0000000002000000ULL,
+    0x0000000707030000ULL, 0x00000f0f0f0b0700ULL, 0x001f1f1f1f1b1f0fULL, 0x3f3f3f3f3f3b3f3fULL,
+    0x00001c1c1c180000ULL, 0x0000000808000000ULL, 0x0000000000000000ULL, 0x0000000202000000ULL,
+    0x0000070707030000ULL, 0x00000f0f0f0b0700ULL, 0x001f1f1f1f1b1f0fULL, 0x3f3f3f3f3f3b3f3fULL,
+    0x00001c1c1d180000ULL, 0x000008080a000000ULL, 0x0000000004000000ULL, 0x000002020a000000ULL,
+    0x0000070717030000ULL, 0x000f0f0f2f0b0700ULL, 0x001f1f1f5f1b1f0fULL, 0x3f3f3f3fbf3b3f3fULL,
+    0x001c1c1f1c180000ULL, 0x0008080e08000000ULL, 0x0000000e00000000ULL, 0x0002020e02000000ULL,
+    0x0007071f07030000ULL, 0x000f0f3f0f0b0700ULL, 0x1f1f1f7f1f1b1f0fULL, 0x3f3f3fff3f3b3f3fULL,
+    0x1c1c1f1f1f180000ULL, 0x08081f1f1f000000ULL, 0x00001f1f1f000000ULL, 0x02021f1f1f000000ULL,
+    0x07071f1f1f030000ULL, 0x0f0f3f3f3f0b0700ULL, 0x1f1f7f7f7f1b1f0fULL, 0x3f3fffffff3b3f3fULL,
+    0xfffffffffff7fcfcULL, 0xfffffffffff7f8f8ULL, 0xfffffffffff7f1f1ULL, 0xfffffffffff7e3e3ULL,
+    0xfffffffffff7c7c7ULL, 0xfffffffffff78f8fULL, 0xfffffffffff71f1fULL, 0xfffffffffff73f3fULL,
+    0xfffffffffff4fcfcULL, 0xfffffffffff0f8f8ULL, 0xfffffffffff1f1f1ULL, 0xffffffffffe3e3e3ULL,
+    0xffffffffffc7c7c7ULL, 0xffffffffff878f8fULL, 0xffffffffff171f1fULL, 0xffffffffff373f3fULL,
+    0x00fefffffcf4fcfcULL, 0x00007e7e7870787cULL, 0x0000003c30303000ULL, 0x0000000000000000ULL,
+    0x0000001e06060600ULL, 0x00003f3f0f070f1fULL, 0x003f7f7f1f171f1fULL, 0x7f7fffff3f373f7fULL,
+    0x00fefefcfcf4fefcULL, 0x00007c7878707800ULL, 0x0000000000000000ULL, 0x0000000000000000ULL,
+    0x0000000000000000ULL, 0x00001f0f0f070f00ULL, 0x003f3f1f1f173f1fULL, 0x7f7f7f3f3f377f7fULL,
+    0x00fefcfcfcf6fefcULL, 0x007c787878747800ULL, 0x0000303030300000ULL, 0x0000000000000000ULL,
+    0x0000060606060000ULL, 0x001f0f0f0f170f00ULL, 0x003f1f1f1f373f1fULL, 0x7f7f3f3f3f777f7fULL,
+    0xfefcfcfcfef7fefcULL, 0x007878787d777800ULL, 0x003030303a360000ULL, 0x0000000014140000ULL,
+    0x000606062e360000ULL, 0x000f0f0f5f770f00ULL, 0x3f1f1f1fbff73f1fULL, 0x7f3f3f3f7ff77f7fULL,
+    0xfcfcfcfffff6fefcULL, 0x7878787f7f747800ULL, 0x3030303e3e300000ULL, 0x0000223e3e000000ULL,
+    0x0606063e3e060000ULL, 0x0f0f0f7f7f170f00ULL, 0x1f1f1fffff373f1fULL, 0x3f3f3fffff777f7fULL,
+    0xfcfcfffffff7fefcULL, 0x78787f7f7f777800ULL, 0x30717f7f7f770000ULL, 0x00637f7f7f770000ULL,
+    0x06477f7f7f770000ULL, 0x0f0f7f7f7f770f00ULL, 0x1f1ffffffff73f1fULL, 0x3f3ffffffff77f7fULL,
+    0xfffffffffff7fcfcULL, 0xfffffffffff7f8f8ULL, 0xfffffffffff7f1f1ULL, 0xfffffffffff7e3e3ULL,
+    0xfffffffffff7c7c7ULL, 0xfffffffffff78f8fULL, 0xfffffffffff71f1fULL, 0xfffffffffff73f3fULL,
+    0x00007e7e7f747c7cULL, 0x0000003c3e303800ULL, 0x000000001c101000ULL, 0x000000001c000000ULL,
+    0x000000001c040400ULL, 0x0000001e3e060e00ULL, 0x00003f3f7f171f1fULL, 0x003f7f7fff373f1fULL,
+    0x00007c7e7c747800ULL, 0x0000003c38303800ULL, 0x0000000010100000ULL, 0x0000000000000000ULL,
+    0x0000000004040000ULL, 0x0000001e0e060e00ULL, 0x00001f3f1f170f00ULL, 0x003f3f7f3f373f1fULL,
+    0x00007c7c7c747800ULL, 0x0000003838300000ULL, 0x0000000010000000ULL, 0x0000000000000000ULL,
+    0x0000000004000000ULL, 0x0000000e0e060000ULL, 0x00001f1f1f170f00ULL, 0x003f3f3f3f373f1fULL,
+    0x00007c7c7c747800ULL, 0x0000383838300000ULL, 0x0000001010000000ULL, 0x0000000000000000ULL,
+    0x0000000404000000ULL, 0x00000e0e0e060000ULL, 0x00001f1f1f170f00ULL, 0x003f3f3f3f373f1fULL,
+    0x007c7c7c7d747800ULL, 0x000038383a300000ULL, 0x0000101014000000ULL, 0x0000000008000000ULL,
+    0x0000040414000000ULL, 0x00000e0e2e060000ULL, 0x001f1f1f5f170f00ULL, 0x003f3f3fbf373f1fULL,
+    0x007c7c7f7c747800ULL, 0x0038383e38300000ULL, 0x0010101c10000000ULL, 0x0000001c00000000ULL,
+    0x0004041c04000000ULL, 0x000e0e3e0e060000ULL, 0x001f1f7f1f170f00ULL, 0x3f3f3fff3f373f1fULL,
+    0x7c7c7f7f7f747800ULL, 0x38383e3e3e300000ULL, 0x10103e3e3e000000ULL, 0x00003e3e3e000000ULL,
+    0x04043e3e3e000000ULL, 0x0e0e3e3e3e060000ULL, 0x1f1f7f7f7f170f00ULL, 0x3f3fffffff373f1fULL,
+    0xfffffffffffffcfcULL, 0xfffffffffffff8f8ULL, 0xfffffffffffff0f1ULL, 0xffffffffffffe2e3ULL,
+    0xffffffffffffc6c7ULL, 0xffffffffffff8e8fULL, 0xffffffffffff1e1fULL, 0xffffffffffff3e3fULL,
+    0x0000000000000000ULL, 0xfffffffffff8f8f8ULL, 0xfffffffffff1f0f1ULL, 0xffffffffffe3e2e3ULL,
+    0xffffffffffc7c6c7ULL, 0xffffffffff8f8e8fULL, 0xffffffffff1f1e1fULL, 0xffffffffff3f3e3fULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x00000f0f01000000ULL, 0x00071f1f03030200ULL,
+    0x0f0f3f3f07070600ULL, 0x1f1f7f7f0f0f0e00ULL, 0xffffffff1f1f1effULL, 0xffffffff3f3f3effULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000020000000000ULL, 0x0007070303030000ULL,
+    0x0f0f0f0707070000ULL, 0x1f1f1f0f0f0f0000ULL, 0xffffff1f1f1ffeffULL, 0xffffff3f3f3ffeffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0007030303000000ULL,
+    0x0f0f070707000000ULL, 0x1f1f0f0f0f000000ULL, 0xffff1f1f1ffffeffULL, 0xffff3f3f3ffffeffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0003030300000000ULL,
+    0x0f07070700000000ULL, 0x1f0f0f0f1f000000ULL, 0xff1f1f1ffffffeffULL, 0xff3f3f3ffffffeffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0303030000000000ULL,
+    0x0707070f00000000ULL, 0x0f0f0f1f1f000000ULL, 0x1f1f1ffffffffeffULL, 0x3f3f3ffffffffeffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0303070000000000ULL,
+    0x07070f0f00000000ULL, 0x0f0f1f1f1f000000ULL, 0x1f1ffffffffffeffULL, 0x3f3ffffffffffeffULL,
+    0x0000000000030000ULL, 0x0000000000030000ULL, 0xfffffffffffff0f1ULL, 0xffffffffffffe2e3ULL,
+    0xffffffffffffc6c7ULL, 0xffffffffffff8e8fULL, 0xffffffffffff1e1fULL, 0xffffffffffff3e3fULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x00000f0f0f000000ULL, 0x00000f0f0f020200ULL,
+    0x00071f1f1f070600ULL, 0x0f0f3f3f3f0f0e00ULL, 0x1f1f7f7f7f1f1e00ULL, 0xffffffffff3f3e3fULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000600000000ULL, 0x0000020e02020000ULL,
+    0x0007071f07070000ULL, 0x0f0f0f3f0f0f0000ULL, 0x1f1f1f7f1f1f0000ULL, 0xffffffff3f3f3effULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000020202000000ULL,
+    0x0007070707000000ULL, 0x0f0f0f0f0f000000ULL, 0x1f1f1f1f1f000000ULL, 0xffffff3f3f3ffeffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000020200000000ULL,
+    0x0007070700000000ULL, 0x0f0f0f0f00000000ULL, 0x1f1f1f1f1f000000ULL, 0xffff3f3f3ffffeffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000020000000000ULL,
+    0x0007070000000000ULL, 0x0f0f0f0f00000000ULL, 0x1f1f1f1f1f000000ULL, 0xff3f3f3ffffffeffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0002000000000000ULL,
+    0x0007070000000000ULL, 0x0f0f0f0f00000000ULL, 0x1f1f1f1f1f000000ULL, 0x3f3f3ffffffffeffULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0202000000000000ULL,
+    0x0707070000000000ULL, 0x0f0f0f0f00000000ULL, 0x1f1f1f1f1f000000ULL, 0x3f3ffffffffffeffULL,
+    0xfffffffffffffcfcULL, 0xfffffffffffff8f8ULL, 0xfffffffffffff1f1ULL, 0xffffffffffffe1e3ULL,
+    0xffffffffffffc5c7ULL, 0xffffffffffff8d8fULL, 0xffffffffffff1d1fULL, 0xffffffffffff3d3fULL,
+    0xfffffffffffcfcfcULL, 0x0000000000000000ULL, 0xfffffffffff1f1f1ULL, 0xffffffffffe3e1e3ULL,
+    0xffffffffffc7c5c7ULL, 0xffffffffff8f8d8fULL, 0xffffffffff1f1d1fULL, 0xffffffffff3f3d3fULL,
+    0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x00001f1f03030103ULL,
+    0x000f3f3f0707050fULL, 0x1f1f7f7f0f0f0d1fULL, 0x3f3fffff1f1f1d3fULL, 0xffffffff3f3f3dffULL,
+    0x0000000c0c0c0c00ULL, 0x0000000000000000ULL, 0x0000000101010100ULL, 0x0000070303030503ULL,
+    0x000f0f0707070d0fULL, 0x1f1f1f0f0f0f1d1fULL, 0x3f3f3f1f1f1f3d3fULL, 0xffffff3f3f3ffdffULL,
+    0x00000c0c0c0e0d00ULL, 0x0000000000050500ULL, 0x00000101010b0d00ULL, 0x0000030303171d03ULL,
+    0x000f0707072f3d0fULL, 0x1f1f0f0f0f5f7d1fULL, 0x3f3f1f1f1fbffd3fULL, 0xffff3f3f3ffffdffULL,
+    0x000c0c0c0f0f0c00ULL, 0x000000080f0f0000ULL, 0x000101010f0f0100ULL, 0x000303031f1f0503ULL,
+    0x000707073f3f0d0fULL, 0x1f0f0f0f7f7f1d1fULL, 0x3f1f1f1fffff3d3fULL, 0xff3f3f3ffffffdffULL,
+    0x0c0c1c1f1f1f1d00ULL, 0x0000181f1f1f1d00ULL, 0x0101111f1f1f1d00ULL, 0x0303031f1f1f1d03ULL,
+    0x0707073f3f3f3d0fULL, 0x0f0f0f7f7f7f7d1fULL, 0x1f1f1ffffffffd3fULL, 0x3f3f3ffffffffdffULL,
+    0x0c3c3f3f3f3f3d3fULL, 0x00383f3f3f3f3d3fULL, 0x01313f3f3f3f3d3fULL, 0x03233f3f3f3f3d3fULL,
+    0x07073f3f3f3f3d3fULL, 0x0f0f7f7f7f7f7d7fULL, 0x1f1ffffffffffdffULL, 0x3f3ffffffffffdffULL,
+    0x0000000000070404ULL, 0x0000000000070000ULL, 0x0000000000070101ULL, 0xffffffffffffe1e3ULL,
+    0xffffffffffffc5c7ULL, 0xffffffffffff8d8fULL, 0xffffffffffff1d1fULL, 0xffffffffffff3d3fULL,
+    0x0000000000040400ULL, 0x0000000000000000ULL, 0x0000000000010100ULL, 0x00001f1f1f030103ULL,
+    0x00001f1f1f070503ULL, 0x000f3f3f3f0f0d0fULL, 0x1f1f7f7f7f1f1d1fULL, 0x3f3fffffff3f3d3fULL,
+    0x0000000000040000ULL, 0x0000000000000000ULL, 0x0000000000010000ULL, 0x0000000f03030100ULL,
+    0x0000071f07070503ULL, 0x000f0f3f0f0f0d0fULL, 0x1f1f1f7f1f1f1d1fULL, 0x3f3f3fff3f3f3d3fULL,
+    0x0000000004040000ULL, 0x0000000000000000ULL, 0x0000000001010000ULL, 0x0000000303030100ULL,
+    0x0000070707070503ULL, 0x000f0f0f0f0f0d0fULL, 0x1f1f1f1f1f1f1d1fULL, 0x3f3f3f3f3f3f3d3fULL,
+    0x0000000404050000ULL, 0x0000000000020000ULL, 0x0000000101050000ULL, 0x00000003030b0100ULL,
+    0x0000070707170503ULL, 0x000f0f0f0f2f0d0fULL, 0x1f1f1f1f1f5f1d1fULL, 0x3f3f3f3f3fbf3d3fULL,
+    0x0000040407040000ULL, 0x0000000007000000ULL, 0x0000010107010000ULL, 0x000003030f030100ULL,
+    0x000007071f070503ULL, 0x000f0f0f3f0f0d0fULL, 0x1f1f1f1f7f1f1d1fULL, 0x3f3f3f3fffbf3d3fULL,
+    0x0004040f0f0f0000ULL, 0x0000000f0f0f0000ULL, 0x0001010f0f0f0000ULL, 0x0003030f0f0f0100ULL,
+    0x0007071f1f1f0503ULL, 0x000f0f3f3f3f0d0fULL, 0x1f1f1f7f7f7f1d1fULL, 0x3f3f3fffffff3d3fULL,
+    0x04041f1f1f1f1d00ULL, 0x00001f1f1f1f1d00ULL, 0x01011f1f1f1f1d00ULL, 0x03031f1f1f1f1d00ULL,
+    0x07071f1f1f1f1d03ULL, 0x0f0f3f3f3f3f3d0fULL, 0x1f1f7f7f7f7f7d1fULL, 0x3f3ffffffffffd3fULL,
+    0xfffffffffffff8fcULL, 0xfffffffffffff8f8ULL, 0xfffffffffffff1f1ULL, 0xffffffffffffe3e3ULL,
+    0xffffffffffffc3c7ULL, 0xffffffffffff8b8fULL, 0xffffffffffff1b1fULL, 0xffffffffffff3b3fULL,
+    0xfffffffffffcf8fcULL, 0xfffffffffff8f8f8ULL, 0x0000000000000000ULL, 0xffffffffffe3e3e3ULL,
+    0xffffffffffc7c3c7ULL, 0xffffffffff8f8b8fULL, 0xffffffffff1f1b1fULL, 0xffffffffff3f3b3fULL,
+    0x00003f3f3c3c383cULL, 0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000000000000000ULL,
+    0x00003f3f07070307ULL, 0x001f7f7f0f0f0b1fULL, 0x3f3fffff1f1f1b3fULL, 0x7f7fffff3f3f3b7fULL,
+    0x00003e3c3c3c3a3cULL, 0x0000001818181800ULL, 0x0000000000000000ULL, 0x0000000303030300ULL,
+    0x00000f0707070b07ULL, 0x001f1f0f0f0f1b1fULL, 0x3f3f3f1f1f1f3b3fULL, 0x7f7f7f3f3f3f7b7fULL,
+    0x00003c3c3c3e3b3cULL, 0x00001818181d1b00ULL, 0x00000000000a0a00ULL, 0x0000030303171b00ULL,
+    0x00000707072f3b07ULL, 0x001f0f0f0f5f7b1fULL, 0x3f3f1f1f1fbffb3fULL, 0x7f7f3f3f3f7ffb7fULL,
+    0x003c3c3c3f3f3a3cULL, 0x001818181f1f1800ULL, 0x000000111f1f0000ULL, 0x000303031f1f0300ULL,
+    0x000707073f3f0b07ULL, 0x000f0f0f7f7f1b1fULL, 0x3f1f1f1fffff3b3fULL, 0x7f3f3f3fffff7b7fULL,
+    0x3c3c3c3f3f3f3b3cULL, 0x1818383f3f3f3b00ULL, 0x0000313f3f3f3b00ULL, 0x0303233f3f3f3b00ULL,
+    0x0707073f3f3f3b07ULL, 0x0f0f0f7f7f7f7b1fULL, 0x1f1f1ffffffffb3fULL, 0x3f3f3ffffffffb7fULL,
+    0x3c7c7f7f7f7f7b7fULL, 0x18787f7f7f7f7b7fULL, 0x00717f7f7f7f7b7fULL, 0x03637f7f7f7f7b7fULL,
+    0x07477f7f7f7f7b7fULL, 0x0f0f7f7f7f7f7b7fULL, 0x1f1ffffffffffbffULL, 0x3f3ffffffffffbffULL,
+    0xfffffffffffff8fcULL, 0x00000000000e0808ULL, 0x00000000000e0000ULL, 0x00000000000e0202ULL,
+    0xffffffffffffc3c7ULL, 0xffffffffffff8b8fULL, 0xffffffffffff1b1fULL, 0xffffffffffff3b3fULL,
+    0x00003f3f3f3c383cULL, 0x0000000000080800ULL, 0x0000000000000000ULL, 0x0000000000020200ULL,
+    0x00003f3f3f070307ULL, 0x00003f3f3f0f0b07ULL, 0x001f7f7f7f1f1b1fULL, 0x3f3fffffff3f3b3fULL,
+    0x0000001f1c1c1800ULL, 0x0000000000080000ULL, 0x0000000000000000ULL, 0x0000000000020000ULL,
+    0x0000001f07070300ULL, 0x00000f3f0f0f0b07ULL, 0x001f1f7f1f1f1b1fULL, 0x3f3f3fff3f3f3b3fULL,
+    0x0000001c1c1c1800ULL, 0x0000000008080000ULL, 0x0000000000000000ULL, 0x0000000002020000ULL,
+    0x0000000707070300ULL, 0x00000f0f0f0f0b07ULL, 0x001f1f1f1f1f1b1fULL, 0x3f3f3f3f3f3f3b3fULL,
+    0x0000001c1c1d1800ULL, 0x00000008080a0000ULL, 0x0000000000040000ULL, 0x00000002020a0000ULL,
+    0x0000000707170300ULL, 0x00000f0f0f2f0b07ULL, 0x001f1f1f1f5f1b1fULL, 0x3f3f3f3f3fbf3b3fULL,
+    0x00001c1c1f1c1800ULL, 0x000008080e080000ULL, 0x000000000e000000ULL, 0x000002020e020000ULL,
+    0x000007071f070300ULL, 0x00000f0f3f0f0b07ULL, 0x001f1f1f7f1f1b1fULL, 0x3f3f3f3fff3f3b3fULL,
+    0x001c1c1f1f1f1800ULL, 0x0008081f1f1f0000ULL, 0x0000001f1f1f0000ULL, 0x0002021f1f1f0000ULL,
+    0x0007071f1f1f0300ULL, 0x000f0f3f3f3f0b07ULL, 0x001f1f7f7f7f1b1fULL, 0x3f3f3fffffff3b3fULL,
+    0x1c1c3f3f3f3f3b00ULL, 0x08083f3f3f3f3b00ULL, 0x00003f3f3f3f3b00ULL, 0x02023f3f3f3f3b00ULL,
+    0x07073f3f3f3f3b00ULL, 0x0f0f3f3f3f3f3b07ULL, 0x1f1f7f7f7f7f7b1fULL, 0x3f3ffffffffffb3fULL,
+    0xfffffffffffff4fcULL, 0xfffffffffffff0f8ULL, 0xfffffffffffff1f1ULL, 0xffffffffffffe3e3ULL,
+    0xffffffffffffc7c7ULL, 0xffffffffffff878fULL, 0xffffffffffff171fULL, 0xffffffffffff373fULL,
+    0xfffffffffffcf4fcULL, 0xfffffffffff8f0f8ULL, 0xfffffffffff1f1f1ULL, 0x0000000000000000ULL,
+    0xffffffffffc7c7c7ULL, 0xffffffffff8f878fULL, 0xffffffffff1f171fULL, 0xffffffffff3f373fULL,
+    0x00fefffffcfcf4feULL, 0x00007f7f78787078ULL, 0x0000000000000000ULL, 0x0000000000000000ULL,
+    0x0000000000000000ULL, 0x00007f7f0f0f070fULL, 0x003fffff1f1f173fULL, 0x7f7fffff3f3f377fULL,
+    0x00fefefcfcfcf6feULL, 0x00007c7878787478ULL, 0x0000003030303000ULL, 0x0000000000000000ULL,
+    0x0000000606060600ULL, 0x00001f0f0f0f170fULL, 0x003f3f1f1f1f373fULL, 0x7f7f7f3f3f3f777fULL,
+    0x00fefcfcfcfef7feULL, 0x00007878787d7778ULL, 0x00003030303a3600ULL, 0x0000000000141400ULL,
+    0x00000606062e3600ULL, 0x00000f0f0f5f770fULL, 0x003f1f1f1fbff73fULL, 0x7f7f3f3f3f7ff77fULL,
+    0x00fcfcfcfffff6feULL, 0x007878787f7f7478ULL, 0x003030303e3e3000ULL, 0x000000223e3e0000ULL,
+    0x000606063e3e0600ULL, 0x000f0f0f7f7f170fULL, 0x001f1f1fffff373fULL, 0x7f3f3f3fffff777fULL,
+    0xfcfcfcfffffff7feULL, 0x7878787f7f7f7778ULL, 0x3030717f7f7f7700ULL, 0x0000637f7f7f7700ULL,
+    0x0606477f7f7f7700ULL, 0x0f0f0f7f7f7f770fULL, 0x1f1f1ffffffff73fULL, 0x3f3f3ffffffff77fULL,
+    0xfcfcfffffffff7ffULL, 0x78f8fffffffff7ffULL, 0x30f1fffffffff7ffULL, 0x00e3fffffffff7ffULL,
+    0x06c7fffffffff7ffULL, 0x0f8ffffffffff7ffULL, 0x1f1ffffffffff7ffULL, 0x3f3ffffffffff7ffULL,
+    0xfffffffffffff4fcULL, 0xfffffffffffff0f8ULL, 0x00000000001c1010ULL, 0x00000000001c0000ULL,
+    0x00000000001c0404ULL, 0xffffffffffff878fULL, 0xffffffffffff171fULL, 0xffffffffffff373fULL,
+    0x00007f7f7f7c7478ULL, 0x00007f7f7f787078ULL, 0x0000000000101000ULL, 0x0000000000000000ULL,
+    0x0000000000040400ULL, 0x00007f7f7f0f070fULL, 0x00007f7f7f1f170fULL, 0x003fffffff3f373fULL,
+    0x00007c7f7c7c7478ULL, 0x0000003e38383000ULL, 0x0000000000100000ULL, 0x0000000000000000ULL,
+    0x0000000000040000ULL, 0x0000003e0e0e0600ULL, 0x00001f7f1f1f170fULL, 0x003f3fff3f3f373fULL,
+    0x00007c7c7c7c7478ULL, 0x0000003838383000ULL, 0x0000000010100000ULL, 0x0000000000000000ULL,
+    0x0000000004040000ULL, 0x0000000e0e0e0600ULL, 0x00001f1f1f1f170fULL, 0x003f3f3f3f3f373fULL,
+    0x00007c7c7c7d7478ULL, 0x00000038383a3000ULL, 0x0000001010140000ULL, 0x0000000000080000ULL,
+    0x0000000404140000ULL, 0x0000000e0e2e0600ULL, 0x00001f1f1f5f170fULL, 0x003f3f3f3fbf373fULL,
+    0x00007c7c7f7c7478ULL, 0x000038383e383000ULL, 0x000010101c100000ULL, 0x000000001c000000ULL,
+    0x000004041c040000ULL, 0x00000e0e3e0e0600ULL, 0x00001f1f7f1f170fULL, 0x003f3f3fff3f373fULL,
+    0x007c7c7f7f7f7478ULL, 0x0038383e3e3e3000ULL, 0x0010103e3e3e0000ULL, 0x0000003e3e3e0000ULL,
+    0x0004043e3e3e0000ULL, 0x000e0e3e3e3e0600ULL, 0x001f1f7f7f7f170fULL, 0x003f3fffffff373fULL,
+    0x7c7c7f7f7f7f7778ULL, 0x38387f7f7f7f7700ULL, 0x10107f7f7f7f7700ULL, 0x00007f7f7f7f7700ULL,
+    0x04047f7f7f7f7700ULL, 0x0e0e7f7f7f7f7700ULL, 0x1f1f7f7f7f7f770fULL, 0x3f3ffffffffff73fULL
+  };
 
   // A KPK bitbase index is an integer in [0, IndexMax] range
   //
@@ -46,6 +817,10 @@ namespace {
     return int(wksq) | (bksq << 6) | (stm << 12) | (file_of(psq) << 13) | ((RANK_7 - rank_of(psq)) << 15);
   }
 
+#ifndef NDEBUG
+
+  // Retrograde analysis of KPK, only run by debug builds
+
   enum Result {
     INVALID = 0,
     UNKNOWN = 1,
@@ -66,18 +841,26 @@ namespace {
     Result result;
   };
 
+#endif
+
 } // namespace
 
 bool Bitbases::probe(Square wksq, Square wpsq, Square bksq, Color stm) {
 
   assert(file_of(wpsq) <= FILE_D);
 
-  return KPKBitbase[index(stm, bksq, wksq, wpsq)];
+  unsigned idx = index(stm, bksq, wksq, wpsq);
+  return KPKBitbase[idx / 64] & (uint64_t(1) << (idx % 64));
 }
 
 
+/// Bitbases::init() checks in debug builds that the stored bitbase matches the
+/// retrograde analysis. Release builds have nothing to compute.
+
 void Bitbases::init() {
 
+#ifndef NDEBUG
+
   std::vector<KPKPosition> db(MAX_INDEX);
   unsigned idx, repeat = 1;
 
@@ -91,12 +874,14 @@ void Bitbases::init() {
       for (repeat = idx = 0; idx < MAX_INDEX; ++idx)
           repeat |= (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN);
 
-  // Fill the bitbase with the decisive results
+  // The stored bitbase has the decisive results
   for (idx = 0; idx < MAX_INDEX; ++idx)
-      if (db[idx] == WIN)
-          KPKBitbase.set(idx);
+      assert(bool(KPKBitbase[idx / 64] & (uint64_t(1) << (idx % 64))) == (db[idx] == WIN));
+#endif
 }
 
+#ifndef NDEBUG
+
 namespace {
 
   KPKPosition::KPKPosition(unsigned idx) {
@@ -169,4 +954,6 @@ namespace {
 
 } // namespace
 
+#endif
+
 } // namespace Stockfish
@@ -18,6 +18,7 @@
 
 #include <algorithm>
 #include <bitset>
+#include <utility>
 
 #include "bitboard.h"
 #include "misc.h"
@@ -33,6 +34,94 @@ Bitboard BetweenBB[SQUARE_NB][SQUARE_NB];
 Bitboard PseudoAttacks[PIECE_TYPE_NB][SQUARE_NB];
 Bitboard PawnAttacks[COLOR_NB][SQUARE_NB];
 
+#if defined(USE_DISPATCH) && defined(IS_64BIT)
+bool HasPext;
+#endif
+
+#if defined(USE_COMPACT_SLIDERS)
+
+namespace {
+
+  // Compile time versions of sliding_attack(), popcount(), pext and pdep, used
+  // to build the compact slider attack tables.
+
+  constexpr Bitboard compact_sliding_attack(PieceType pt, Square sq, Bitboard occupied) {
+
+    const int steps[2][4][2] = { { { 0, 1 }, { 0, -1 }, {  1,  0 }, { -1, 0 } },
+                                 { { 1, 1 }, { 1, -1 }, { -1, -1 }, { -1, 1 } } };
+    Bitboard attacks = 0;
+
+    for (const auto& step : steps[pt == BISHOP])
+        for (int f = file_of(sq) + step[0], r = rank_of(sq) + step[1];
+             f >= FILE_A && f <= FILE_H && r >= RANK_1 && r <= RANK_8;
+             f += step[0], r += step[1])
+        {
+            attacks |= 1ULL << (8 * r + f);
+            if (occupied & (1ULL << (8 * r + f)))
+                break;
+        }
+
+    return attacks;
+  }
+
+  constexpr int compact_popcount(Bitboard b) {
+    int n = 0;
+    for ( ; b; b &= b - 1)
+        ++n;
+    return n;
+  }
+
+  constexpr Bitboard compact_pext(Bitboard b, Bitboard mask) {
+    Bitboard r = 0;
+    for (Bitboard bit = 1; mask; mask &= mask - 1, bit += bit)
+        if (b & mask & (0 - mask))
+            r |= bit;
+    return r;
+  }
+
+  constexpr Bitboard compact_pdep(Bitboard b, Bitboard mask) {
+    Bitboard r = 0;
+    for (Bitboard bit = 1; mask; mask &= mask - 1, bit += bit)
+        if (b & bit)
+            r |= mask & (0 - mask);
+    return r;
+  }
+
+  // CompactTable holds the attacks of a slider of type Pt on square S for each
+  // subset of its relevant occupancy, in the order given by pext. As with the
+  // magics, board edges are not part of the relevant occupancy.
+  template<PieceType Pt, Square S>
+  struct CompactTable {
+
+    static constexpr Bitboard Rays = compact_sliding_attack(Pt, S, 0);
+    static constexpr Bitboard Mask = Rays & ~(((Rank1BB | Rank8BB) & ~rank_bb(S))
+                                            | ((FileABB | FileHBB) & ~file_bb(S)));
+    static constexpr int Size = 1 << compact_popcount(Mask);
+
+    static constexpr std::array<uint16_t, Size> build() {
+      std::array<uint16_t, Size> table {};
+      for (int i = 0; i < Size; ++i)
+          table[i] = uint16_t(compact_pext(compact_sliding_attack(Pt, S, compact_pdep(i, Mask)), Rays));
+      return table;
+    }
+
+    static constexpr std::array<uint16_t, Size> Attacks = build();
+  };
+
+  template<PieceType Pt, size_t... S>
+  constexpr std::array<CompactMagic, SQUARE_NB> compact_magics(std::index_sequence<S...>) {
+    return {{ { CompactTable<Pt, Square(S)>::Mask,
+                CompactTable<Pt, Square(S)>::Rays,
+                CompactTable<Pt, Square(S)>::Attacks.data() }... }};
+  }
+
+}
+
+constexpr std::array<CompactMagic, SQUARE_NB> RookCompact   = compact_magics<ROOK  >(std::make_index_sequence<SQUARE_NB>());
+constexpr std::array<CompactMagic, SQUARE_NB> BishopCompact = compact_magics<BISHOP>(std::make_index_sequence<SQUARE_NB>());
+
+#else
+
 Magic RookMagics[SQUARE_NB];
 Magic BishopMagics[SQUARE_NB];
 
@@ -41,10 +130,52 @@ namespace {
   Bitboard RookTable[0x19000];  // To store rook attacks
   Bitboard BishopTable[0x1480]; // To store bishop attacks
 
+  // The 64-bit magics, as found by init_magics() with its PRNG seeds. Knowing
+  // them in advance saves the search at startup, which remains for 32-bit.
+  constexpr Bitboard RookMagicNumbers[SQUARE_NB] = {
+    0x0a80004000801220ULL, 0x8040004010002008ULL, 0x2080200010008008ULL, 0x1100100008210004ULL,
+    0xc200209084020008ULL, 0x2100010004000208ULL, 0x0400081000822421ULL, 0x0200010422048844ULL,
+    0x0800800080400024ULL, 0x0001402000401000ULL, 0x3000801000802001ULL, 0x4400800800100083ULL,
+    0x0904802402480080ULL, 0x4040800400020080ULL, 0x0018808042000100ULL, 0x4040800080004100ULL,
+    0x0040048001458024ULL, 0x00a0004000205000ULL, 0x3100808010002000ULL, 0x4825010010000820ULL,
+    0x5004808008000401ULL, 0x2024818004000a00ULL, 0x0005808002000100ULL, 0x2100060004806104ULL,
+    0x0080400880008421ULL, 0x4062220600410280ULL, 0x010a004a00108022ULL, 0x0000100080080080ULL,
+    0x0021000500080010ULL, 0x0044000202001008ULL, 0x0000100400080102ULL, 0xc020128200040545ULL,
+    0x0080002000400040ULL, 0x0000804000802004ULL, 0x0000120022004080ULL, 0x010a386103001001ULL,
+    0x9010080080800400ULL, 0x8440020080800400ULL, 0x0004228824001001ULL, 0x000000490a000084ULL,
+    0x0080002000504000ULL, 0x200020005000c000ULL, 0x0012088020420010ULL, 0x0010010080080800ULL,
+    0x0085001008010004ULL, 0x0002000204008080ULL, 0x0040413002040008ULL, 0x0000304081020004ULL,
+    0x0080204000800080ULL, 0x3008804000290100ULL, 0x1010100080200080ULL, 0x2008100208028080ULL,
+    0x5000850800910100ULL, 0x8402019004680200ULL, 0x0120911028020400ULL, 0x0000008044010200ULL,
+    0x0020850200244012ULL, 0x0020850200244012ULL, 0x0000102001040841ULL, 0x140900040a100021ULL,
+    0x000200282410a102ULL, 0x000200282410a102ULL, 0x000200282410a102ULL, 0x4048240043802106ULL
+  };
+
+  constexpr Bitboard BishopMagicNumbers[SQUARE_NB] = {
+    0x40106000a1160020ULL, 0x0020010250810120ULL, 0x2010010220280081ULL, 0x002806004050c040ULL,
+    0x0002021018000000ULL, 0x2001112010000400ULL, 0x0881010120218080ULL, 0x1030820110010500ULL,
+    0x0000120222042400ULL, 0x2000020404040044ULL, 0x8000480094208000ULL, 0x0003422a02000001ULL,
+    0x000a220210100040ULL, 0x8004820202226000ULL, 0x0018234854100800ULL, 0x0100004042101040ULL,
+    0x0004001004082820ULL, 0x0010000810010048ULL, 0x1014004208081300ULL, 0x2080818802044202ULL,
+    0x0040880c00a00100ULL, 0x0080400200522010ULL, 0x0001000188180b04ULL, 0x0080249202020204ULL,
+    0x1004400004100410ULL, 0x00013100a0022206ULL, 0x2148500001040080ULL, 0x4241080011004300ULL,
+    0x4020848004002000ULL, 0x10101380d1004100ULL, 0x0008004422020284ULL, 0x01010a1041008080ULL,
+    0x0808080400082121ULL, 0x0808080400082121ULL, 0x0091128200100c00ULL, 0x0202200802010104ULL,
+    0x8c0a020200440085ULL, 0x01a0008080b10040ULL, 0x0889520080122800ULL, 0x100902022202010aULL,
+    0x04081a0816002000ULL, 0x0000681208005000ULL, 0x8170840041008802ULL, 0x0a00004200810805ULL,
+    0x0830404408210100ULL, 0x2602208106006102ULL, 0x1048300680802628ULL, 0x2602208106006102ULL,
+    0x0602010120110040ULL, 0x0941010801043000ULL, 0x000040440a210428ULL, 0x0008240020880021ULL,
+    0x0400002012048200ULL, 0x00ac102001210220ULL, 0x0220021002009900ULL, 0x84440c080a013080ULL,
+    0x0001008044200440ULL, 0x0004c04410841000ULL, 0x2000500104011130ULL, 0x1a0c010011c20229ULL,
+    0x0044800112202200ULL, 0x0434804908100424ULL, 0x0300404822c08200ULL, 0x48081010008a2a80ULL
+  };
+
   void init_magics(PieceType pt, Bitboard table[], Magic magics[]);
 
 }
 
+#endif
+
 /// safe_destination() returns the bitboard of target square for the given step
 /// from the given square. If the step is off the board, returns empty bitboard.
 
@@ -89,8 +220,17 @@ void Bitboards::init() {
       for (Square s2 = SQ_A1; s2 <= SQ_H8; ++s2)
           SquareDistance[s1][s2] = std::max(distance<File>(s1, s2), distance<Rank>(s1, s2));
 
+#if defined(USE_DISPATCH) && defined(IS_64BIT)
+  // PEXT is microcoded on AMD family 17h (Zen 1 and Zen 2) and much slower
+  // than a magic multiply there, elsewhere it is the faster way to index.
+  __builtin_cpu_init();
+  HasPext = __builtin_cpu_supports("bmi2") && !__builtin_cpu_is("amdfam17h");
+#endif
+
+#if !defined(USE_COMPACT_SLIDERS)
   init_magics(ROOK, RookTable, RookMagics);
   init_magics(BISHOP, BishopTable, BishopMagics);
+#endif
 
   for (Square s1 = SQ_A1; s1 <= SQ_H8; ++s1)
   {
@@ -119,6 +259,8 @@ void Bitboards::init() {
   }
 }
 
+#if !defined(USE_COMPACT_SLIDERS)
+
 namespace {
 
   Bitboard sliding_attack(PieceType pt, Square sq, Bitboard occupied) {
@@ -187,6 +329,19 @@ namespace {
         if (HasPext)
             continue;
 
+        if (Is64Bit)
+        {
+            m.magic = (pt == ROOK ? RookMagicNumbers : BishopMagicNumbers)[s];
+
+            for (int i = 0; i < size; ++i)
+                m.attacks[m.index(occupancy[i])] = reference[i];
+
+            for (int i = 0; i < size; ++i)
+                assert(m.attacks[m.index(occupancy[i])] == reference[i]);
+
+            continue;
+        }
+
         PRNG rng(seeds[Is64Bit][rank_of(s)]);
 
         // Find a magic for square 's' picking up an (almost) random number
@@ -219,4 +374,6 @@ namespace {
   }
 }
 
+#endif
+
 } // namespace Stockfish
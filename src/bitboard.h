@@ -19,6 +19,7 @@
 #ifndef BITBOARD_H_INCLUDED
 #define BITBOARD_H_INCLUDED
 
+#include <array>
 #include <string>
 
 #include "types.h"
@@ -103,9 +104,32 @@ struct Magic {
   }
 };
 
+#if defined(USE_COMPACT_SLIDERS)
+
+/// CompactMagic holds the slider attacks of a single square in the compact
+/// layout. The attacks for each subset of 'mask' are stored pext-ed against
+/// 'rays', the attacks on an empty board, so that an entry fits in 16 bits.
+/// The tables are built at compile time, see bitboard.cpp.
+struct CompactMagic {
+  Bitboard        mask;
+  Bitboard        rays;
+  const uint16_t* attacks;
+
+  Bitboard attacks_bb(Bitboard occupied) const {
+    return pdep(attacks[pext(occupied, mask)], rays);
+  }
+};
+
+extern const std::array<CompactMagic, SQUARE_NB> RookCompact;
+extern const std::array<CompactMagic, SQUARE_NB> BishopCompact;
+
+#else
+
 extern Magic RookMagics[SQUARE_NB];
 extern Magic BishopMagics[SQUARE_NB];
 
+#endif
+
 inline Bitboard square_bb(Square s) {
   assert(is_ok(s));
   return SquareBB[s];
@@ -311,8 +335,13 @@ inline Bitboard attacks_bb(Square s, Bitboard occupied) {
 
   switch (Pt)
   {
+#if defined(USE_COMPACT_SLIDERS)
+  case BISHOP: return BishopCompact[s].attacks_bb(occupied);
+  case ROOK  : return   RookCompact[s].attacks_bb(occupied);
+#else
   case BISHOP: return BishopMagics[s].attacks[BishopMagics[s].index(occupied)];
   case ROOK  : return   RookMagics[s].attacks[  RookMagics[s].index(occupied)];
+#endif
   case QUEEN : return attacks_bb<BISHOP>(s, occupied) | attacks_bb<ROOK>(s, occupied);
   default    : return PseudoAttacks[Pt][s];
   }
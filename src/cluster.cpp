@@ -0,0 +1,408 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The cluster mode over MPI, for builds with mpi=yes, see cluster.h
+
+#if defined(USE_MPI)
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Only the C interface is used, the C++ bindings are deprecated
+#define OMPI_SKIP_MPICXX
+#define MPICH_SKIP_MPICXX
+#include <mpi.h>
+
+#include "cluster.h"
+#include "search.h"
+
+namespace Stockfish::Cluster {
+
+namespace {
+
+  // A TT store as sent to the other ranks, with the full key so that it can be
+  // stored in their tables. A depth8 of 0 marks an empty slot.
+  struct KeyedTTEntry {
+    Key key;
+    int16_t value, eval;
+    uint16_t move;
+    uint8_t depth8, pvBound;
+  };
+
+  static_assert(sizeof(KeyedTTEntry) == 16, "Unexpected KeyedTTEntry size");
+
+  // The deepest stores of a thread since the last round. Only stores of at
+  // least SendDepth are worth the traffic, the others are cheaper to search
+  // again than to receive, and each rank sends at most SendSize per round.
+  constexpr Depth SendDepth = 6;
+  constexpr int CacheSize = 32;
+  constexpr int SendSize = 256;
+
+  struct TTCache {
+    std::mutex mutex;
+    std::array<KeyedTTEntry, CacheSize> entries;
+    int count = 0;
+  };
+
+  // The sums exchanged by the rounds of a search. The stop signal is that of
+  // rank 0, the stopped count that of the ranks done with their search.
+  enum Signal { SIG_NODES, SIG_TBHITS, SIG_STOP, SIG_STOPPED, SIG_NB };
+
+  // Discards the output of the ranks other than 0
+  struct NullBuf : public std::streambuf {
+    int overflow(int c) override { return c; }
+  };
+
+  NullBuf nullBuf;
+  int Rank = 0, Size = 1;
+  MPI_Comm InputComm, SignalsComm, TTComm, MoveComm;
+
+  MPI_Request signalsRequest = MPI_REQUEST_NULL, ttRequest = MPI_REQUEST_NULL;
+  uint64_t signalsSent[SIG_NB], signalsReceived[SIG_NB];
+  uint64_t othersNodes, othersTbHits;
+  std::vector<KeyedTTEntry> ttSent, ttReceived;
+  std::unique_ptr<TTCache[]> caches;
+  size_t cacheCount = 0;
+  std::atomic<bool> searching;
+
+  // Posts the next round, in which the TT stores travel along the signals
+  void send_round(bool stopped) {
+
+    signalsSent[SIG_NODES]   = Threads.nodes_searched();
+    signalsSent[SIG_TBHITS]  = Threads.tb_hits();
+    signalsSent[SIG_STOP]    = Rank == 0 && Threads.stop;
+    signalsSent[SIG_STOPPED] = stopped;
+
+    MPI_Iallreduce(signalsSent, signalsReceived, SIG_NB, MPI_UINT64_T, MPI_SUM,
+                   SignalsComm, &signalsRequest);
+
+    ttSent.clear();
+    for (size_t i = 0; i < cacheCount; ++i)
+    {
+        std::lock_guard<std::mutex> lock(caches[i].mutex);
+        ttSent.insert(ttSent.end(), caches[i].entries.begin(), caches[i].entries.begin() + caches[i].count);
+        caches[i].count = 0;
+    }
+
+    if (ttSent.size() > SendSize)
+        std::nth_element(ttSent.begin(), ttSent.begin() + SendSize, ttSent.end(),
+                         [](const KeyedTTEntry& a, const KeyedTTEntry& b) { return a.depth8 > b.depth8; });
+
+    ttSent.resize(SendSize, KeyedTTEntry());
+
+    MPI_Iallgather(ttSent.data(), SendSize * sizeof(KeyedTTEntry), MPI_BYTE,
+                   ttReceived.data(), SendSize * sizeof(KeyedTTEntry), MPI_BYTE,
+                   TTComm, &ttRequest);
+  }
+
+  // Takes in a round whose signals have arrived. The TT stores of the other
+  // ranks replace the local entries of the same position when deeper.
+  void receive_round() {
+
+    MPI_Wait(&ttRequest, MPI_STATUS_IGNORE);
+
+    Thread* main = Threads.main();
+
+    for (int r = 0; r < Size; ++r)
+        if (r != Rank)
+            for (int i = r * SendSize; i < (r + 1) * SendSize && ttReceived[i].depth8; ++i)
+            {
+                const KeyedTTEntry& e = ttReceived[i];
+                Depth d = Depth(e.depth8 + DEPTH_OFFSET);
+                bool found;
+                TTEntry* tte = main->tt->probe(e.key, found, main->ttStats);
+
+                if (!found || tte->depth() < d)
+                    tte->save(e.key, Value(e.value), e.pvBound & 0x4, Bound(e.pvBound & 0x3),
+                              d, Move(e.move), Value(e.eval), main->ttStats);
+            }
+
+    othersNodes  = signalsReceived[SIG_NODES]  - signalsSent[SIG_NODES];
+    othersTbHits = signalsReceived[SIG_TBHITS] - signalsSent[SIG_TBHITS];
+
+    if (signalsReceived[SIG_STOP])
+        Threads.stop = true;
+  }
+
+} // namespace
+
+
+/// init() starts MPI, with threads calling it at the same time as the UCI
+/// thread reads commands while the main thread runs the rounds. Each kind of
+/// message has its own communicator, so that they are never mixed up. It is
+/// called before start_async_output(), which then writes to nowhere on the
+/// ranks other than 0.
+
+void init(int& argc, char**& argv) {
+
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+
+  if (provided < MPI_THREAD_MULTIPLE)
+  {
+      std::cerr << "The MPI library does not support MPI_THREAD_MULTIPLE" << std::endl;
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &Rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &Size);
+
+  MPI_Comm_dup(MPI_COMM_WORLD, &InputComm);
+  MPI_Comm_dup(MPI_COMM_WORLD, &SignalsComm);
+  MPI_Comm_dup(MPI_COMM_WORLD, &TTComm);
+  MPI_Comm_dup(MPI_COMM_WORLD, &MoveComm);
+
+  ttReceived.resize(size_t(Size) * SendSize);
+
+  if (Rank)
+      std::cout.rdbuf(&nullBuf);
+}
+
+
+/// finalize() stops MPI, once every rank is out of UCI::loop()
+
+void finalize() {
+
+  MPI_Comm_free(&InputComm);
+  MPI_Comm_free(&SignalsComm);
+  MPI_Comm_free(&TTComm);
+  MPI_Comm_free(&MoveComm);
+  MPI_Finalize();
+}
+
+int size() { return Size; }
+int rank() { return Rank; }
+
+
+/// getline() reads a command on rank 0 and sends it to the other ranks, a
+/// negative length meaning the end of the input. The other ranks sleep while
+/// they wait, as MPI_Wait() keeps its core busy with some implementations.
+
+bool getline(std::istream& input, std::string& str) {
+
+  if (Size == 1)
+      return bool(std::getline(input, str));
+
+  int length = -1;
+  if (Rank == 0 && std::getline(input, str))
+      length = int(str.size());
+
+  MPI_Request request;
+  MPI_Ibcast(&length, 1, MPI_INT, 0, InputComm, &request);
+
+  for (int done = 0; MPI_Test(&request, &done, MPI_STATUS_IGNORE), !done; )
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  if (length < 0)
+      return false;
+
+  str.resize(size_t(length));
+  MPI_Bcast(str.data(), length, MPI_CHAR, 0, InputComm);
+  return true;
+}
+
+
+/// save() stores in the TT as TTEntry::save() does, and keeps the deep stores
+/// of the thread for the next round. A full cache keeps the deepest ones.
+
+void save(Thread* thread, TTEntry* tte, Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev) {
+
+  tte->save(k, v, pv, b, d, m, ev, thread->ttStats);
+
+  if (d < SendDepth || !searching || thread->id() >= cacheCount)
+      return;
+
+  KeyedTTEntry e = { k, int16_t(v), int16_t(ev), uint16_t(m),
+                     uint8_t(d - DEPTH_OFFSET), uint8_t(pv << 2 | b) };
+
+  TTCache& cache = caches[thread->id()];
+  std::lock_guard<std::mutex> lock(cache.mutex);
+
+  auto begin = cache.entries.begin(), end = begin + cache.count;
+  auto it = std::find_if(begin, end, [&](const KeyedTTEntry& c) { return c.key == k; });
+
+  if (it == end)
+  {
+      if (cache.count < CacheSize)
+          ++cache.count;
+      else
+      {
+          it = std::min_element(begin, end, [](const KeyedTTEntry& x, const KeyedTTEntry& y) {
+                                                return x.depth8 < y.depth8; });
+          if (it->depth8 >= e.depth8)
+              return;
+      }
+  }
+
+  *it = e;
+}
+
+
+/// signals_init() is called by every rank before its search starts and posts
+/// the first round. The TT caches follow the number of threads.
+
+void signals_init() {
+
+  if (Size == 1)
+      return;
+
+  if (cacheCount != Threads.size())
+  {
+      caches = std::make_unique<TTCache[]>(Threads.size());
+      cacheCount = Threads.size();
+  }
+
+  for (size_t i = 0; i < cacheCount; ++i)
+      caches[i].count = 0;
+
+  othersNodes = othersTbHits = 0;
+  searching = true;
+  send_round(false);
+}
+
+
+/// signals_poll() is called by the main thread about every millisecond during
+/// the search, and takes in the last round if done before posting the next one.
+/// This is how the ranks other than 0 learn that the search is stopped.
+
+void signals_poll() {
+
+  if (!searching)
+      return;
+
+  int done;
+  MPI_Test(&signalsRequest, &done, MPI_STATUS_IGNORE);
+
+  if (done)
+  {
+      receive_round();
+      send_round(false);
+  }
+}
+
+
+/// signals_sync() is called by every rank once its search is stopped. The
+/// rounds go on until all the ranks are stopped, and so all of them leave
+/// after the same round, with no request left pending.
+
+void signals_sync() {
+
+  if (!searching)
+      return;
+
+  while (true)
+  {
+      MPI_Wait(&signalsRequest, MPI_STATUS_IGNORE);
+      receive_round();
+
+      if (signalsReceived[SIG_STOPPED] == uint64_t(Size))
+          break;
+
+      send_round(true);
+  }
+
+  searching = false;
+}
+
+uint64_t nodes_searched() { return Threads.nodes_searched() + othersNodes; }
+uint64_t tb_hits() { return Threads.tb_hits() + othersTbHits; }
+
+
+/// pick_move() votes among the ranks with their best lines, given by the best
+/// thread of each one, as ThreadPool::get_best_thread() does among threads.
+/// The line of the winner is then sent to all the ranks. Returns true, with
+/// the line and its depth, when another rank wins.
+
+bool pick_move(Search::RootMove& rm, Depth& depth) {
+
+  if (Size == 1)
+      return false;
+
+  struct MoveInfo {
+    int32_t move, score, depth;
+  };
+
+  MoveInfo mine = { int32_t(rm.pv[0]), int32_t(rm.score), int32_t(depth) };
+  std::vector<MoveInfo> infos(Size);
+
+  MPI_Allgather(&mine, 3, MPI_INT, infos.data(), 3, MPI_INT, MoveComm);
+
+  std::map<int32_t, int64_t> votes;
+  int32_t minScore = VALUE_NONE;
+  int best = 0;
+
+  for (const MoveInfo& i : infos)
+      minScore = std::min(minScore, i.score);
+
+  for (int r = 0; r < Size; ++r)
+  {
+      votes[infos[r].move] += int64_t(infos[r].score - minScore + 14) * infos[r].depth;
+
+      if (abs(infos[best].score) >= VALUE_TB_WIN_IN_MAX_PLY)
+      {
+          if (infos[r].score > infos[best].score)
+              best = r;
+      }
+      else if (   infos[r].score >= VALUE_TB_WIN_IN_MAX_PLY
+               || (   infos[r].score > VALUE_TB_LOSS_IN_MAX_PLY
+                   && votes[infos[r].move] > votes[infos[best].move]))
+          best = r;
+  }
+
+  // The line: score, previous score, seldepth, tb rank, tb score, depth, the
+  // length of the PV and the PV.
+  constexpr int Header = 7;
+  std::array<int32_t, Header + MAX_PLY + 1> line = {};
+
+  if (best == Rank)
+  {
+      int n = int(std::min(rm.pv.size(), size_t(MAX_PLY + 1)));
+      line = { rm.score, rm.previousScore, rm.selDepth, rm.tbRank, rm.tbScore, depth, n };
+      std::copy(rm.pv.begin(), rm.pv.begin() + n, line.begin() + Header);
+  }
+
+  MPI_Bcast(line.data(), int(line.size()), MPI_INT, best, MoveComm);
+
+  if (best == Rank)
+      return false;
+
+  rm.score         = Value(line[0]);
+  rm.previousScore = Value(line[1]);
+  rm.selDepth      = line[2];
+  rm.tbRank        = line[3];
+  rm.tbScore       = Value(line[4]);
+  depth            = Depth(line[5]);
+  rm.pv.resize(size_t(line[6]));
+  for (size_t i = 0; i < rm.pv.size(); ++i)
+      rm.pv[i] = Move(line[Header + i]);
+
+  return true;
+}
+
+} // namespace Stockfish::Cluster
+
+#endif // #if defined(USE_MPI)
@@ -0,0 +1,82 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CLUSTER_H_INCLUDED
+#define CLUSTER_H_INCLUDED
+
+#include <cstdint>
+#include <istream>
+#include <string>
+
+#include "search.h"
+#include "thread.h"
+#include "tt.h"
+
+namespace Stockfish {
+
+/// The Cluster namespace extends Lazy SMP across the processes of an MPI job,
+/// for builds with 'make mpi=yes'. Every process, or rank, reads the commands
+/// of rank 0 and runs its own thread pool on the same root. During a search the
+/// main threads exchange, in rounds posted about every millisecond, their node
+/// and tbhit counts, the stop signal of rank 0 and their deepest TT stores. The
+/// best move is then voted among the ranks, and only rank 0 talks to the GUI.
+/// Without MPI the functions below are inlined to the single process case.
+
+namespace Cluster {
+
+#if defined(USE_MPI)
+
+void init(int& argc, char**& argv);
+void finalize();
+int size();
+int rank();
+inline bool is_root() { return rank() == 0; }
+bool getline(std::istream& input, std::string& str);
+void save(Thread* thread, TTEntry* tte, Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev);
+void signals_init();
+void signals_poll();
+void signals_sync();
+uint64_t nodes_searched();
+uint64_t tb_hits();
+bool pick_move(Search::RootMove& rm, Depth& depth);
+
+#else
+
+inline void init(int&, char**&) {}
+inline void finalize() {}
+constexpr int size() { return 1; }
+constexpr int rank() { return 0; }
+constexpr bool is_root() { return true; }
+inline bool getline(std::istream& input, std::string& str) { return bool(std::getline(input, str)); }
+inline void save(Thread* thread, TTEntry* tte, Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev) {
+  tte->save(k, v, pv, b, d, m, ev, thread->ttStats);
+}
+inline void signals_init() {}
+inline void signals_poll() {}
+inline void signals_sync() {}
+inline uint64_t nodes_searched() { return Threads.nodes_searched(); }
+inline uint64_t tb_hits() { return Threads.tb_hits(); }
+inline bool pick_move(Search::RootMove&, Depth&) { return false; }
+
+#endif // #if defined(USE_MPI)
+
+} // namespace Cluster
+
+} // namespace Stockfish
+
+#endif // #ifndef CLUSTER_H_INCLUDED
@@ -25,6 +25,7 @@
 #include <sstream>
 #include <iostream>
 #include <streambuf>
+#include <thread>
 #include <vector>
 
 #include "bitboard.h"
@@ -36,6 +37,7 @@
 #include "timeman.h"
 #include "uci.h"
 #include "incbin/incbin.h"
+#include "nnue/nnue_compress.h"
 
 
 // Macro to embed the default efficiently updatable neural network (NNUE) file
@@ -44,9 +46,14 @@
 //     const unsigned char        gEmbeddedNNUEData[];  // a pointer to the embedded data
 //     const unsigned char *const gEmbeddedNNUEEnd;     // a marker to the end
 //     const unsigned int         gEmbeddedNNUESize;    // the size of the embedded file
-// Note that this does not work in Microsoft Visual Studio.
+// Note that this does not work in Microsoft Visual Studio. With compressednet=yes
+// the net is embedded as compressed by the Makefile, see nnue/nnue_compress.h.
 #if !defined(_MSC_VER) && !defined(NNUE_EMBEDDING_OFF)
+#if defined(NNUE_EMBED_COMPRESSED)
+  INCBIN(EmbeddedNNUE, EvalFileDefaultName ".nnz");
+#else
   INCBIN(EmbeddedNNUE, EvalFileDefaultName);
+#endif
 #else
   const unsigned char        gEmbeddedNNUEData[1] = {0x0};
   const unsigned char *const gEmbeddedNNUEEnd = &gEmbeddedNNUEData[1];
@@ -92,9 +99,15 @@ namespace Eval {
         {
             if (directory != "<internal>")
             {
-                ifstream stream(directory + eval_file, ios::binary);
-                if (load_eval(eval_file, stream))
+                // A network image is mapped and used in place, see load_image()
+                if (load_image(eval_file, directory + eval_file))
                     eval_file_loaded = eval_file;
+                else
+                {
+                    ifstream stream(directory + eval_file, ios::binary);
+                    if (load_eval(eval_file, stream))
+                        eval_file_loaded = eval_file;
+                }
             }
 
             if (directory == "<internal>" && eval_file == EvalFileDefaultName)
@@ -104,14 +117,32 @@ namespace Eval {
                     public: MemoryBuffer(char* p, size_t n) { setg(p, p, p + n); setp(p, p + n); }
                 };
 
-                MemoryBuffer buffer(const_cast<char*>(reinterpret_cast<const char*>(gEmbeddedNNUEData)),
-                                    size_t(gEmbeddedNNUESize));
+                char* data = const_cast<char*>(reinterpret_cast<const char*>(gEmbeddedNNUEData));
+                size_t size = size_t(gEmbeddedNNUESize);
+
+                // A compressed net is first decoded, by all the cores, into a
+                // temporary buffer that is then read as an uncompressed one.
+                void* decoded = nullptr;
+                if (size_t decodedSize = NNUE::decompressed_size(data, size))
+                {
+                    decoded = aligned_large_pages_alloc(decodedSize);
+                    if (   decoded
+                        && NNUE::decompress_net(data, size, decoded,
+                                                max(thread::hardware_concurrency(), 1u)))
+                        data = static_cast<char*>(decoded), size = decodedSize;
+                }
+
+                MemoryBuffer buffer(data, size);
 
                 istream stream(&buffer);
                 if (load_eval(eval_file, stream))
                     eval_file_loaded = eval_file;
+
+                aligned_large_pages_free(decoded);
             }
         }
+
+    replicate();
   }
 
   /// NNUE::verify() verifies that the last net used was loaded successfully
@@ -402,7 +433,7 @@ namespace {
         // Find attacked squares, including x-ray attacks for bishops and rooks
         b = Pt == BISHOP ? attacks_bb<BISHOP>(s, pos.pieces() ^ pos.pieces(QUEEN))
           : Pt ==   ROOK ? attacks_bb<  ROOK>(s, pos.pieces() ^ pos.pieces(QUEEN) ^ pos.pieces(Us, ROOK))
-                         : attacks_bb<Pt>(s, pos.pieces());
+                         : pos.attacks_from<Pt>(s);
 
         if (pos.blockers_for_king(Us) & s)
             b &= line_bb(pos.square<KING>(Us), s);
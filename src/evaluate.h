@@ -20,8 +20,10 @@
 #define EVALUATE_H_INCLUDED
 
 #include <string>
+#include <vector>
 #include <optional>
 
+#include "misc.h"
 #include "types.h"
 
 namespace Stockfish {
@@ -45,13 +47,24 @@ namespace Eval {
 
     std::string trace(Position& pos);
     Value evaluate(const Position& pos, bool adjusted = false);
+    void evaluate_batch(const Position* const* positions, Value* values, std::size_t count);
+    std::string benchmark(const std::vector<std::string>& fens, int iterations);
+    void prefetch_update(const Position& pos);
 
     void init();
     void verify();
+    void replicate();
+    std::vector<MemoryUsage> memory_usage();
 
     bool load_eval(std::string name, std::istream& stream);
-    bool save_eval(std::ostream& stream);
-    bool save_eval(const std::optional<std::string>& filename);
+    bool save_eval(std::ostream& stream, bool compact = false);
+    bool save_eval(const std::optional<std::string>& filename, bool compact = false);
+    bool load_image(std::string name, const std::string& path);
+    bool save_image(const std::string& path);
+
+#if defined(USE_DISPATCH)
+    const char* target_name(); // Code path selected at startup
+#endif
 
   } // namespace NNUE
 
@@ -16,9 +16,16 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <chrono>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "bitboard.h"
+#include "cluster.h"
 #include "endgame.h"
 #include "position.h"
 #include "psqt.h"
@@ -30,24 +37,78 @@
 
 using namespace Stockfish;
 
+namespace {
+
+  // StartupProfile times the startup stages for "--startup-profile". Stages
+  // may run at the same time on different threads.
+  struct StartupProfile {
+
+    using Clock = std::chrono::steady_clock;
+
+    template<typename F>
+    void run(const char* name, F f) {
+      auto start = Clock::now();
+      f();
+      double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+      std::scoped_lock<std::mutex> lock(mutex);
+      stages.emplace_back(name, ms);
+    }
+
+    void print() const {
+      std::cout << "Startup profile (ms)\n" << std::fixed << std::setprecision(2);
+      for (const auto& [name, ms] : stages)
+          std::cout << std::setw(24) << std::left << name << std::right << std::setw(10) << ms << "\n";
+      std::cout << std::setw(24) << std::left << "Total" << std::right << std::setw(10)
+                << std::chrono::duration<double, std::milli>(Clock::now() - begin).count() << std::endl;
+    }
+
+    Clock::time_point begin = Clock::now();
+    std::vector<std::pair<const char*, double>> stages;
+    std::mutex mutex;
+  };
+
+} // namespace
+
 int main(int argc, char* argv[]) {
 
+  StartupProfile profile;
+
+  Cluster::init(argc, argv);
+  start_async_output();
+
   std::cout << engine_info() << std::endl;
 
+  // "--startup-profile" is taken out of the command line arguments, the others
+  // are UCI commands run by UCI::loop().
+  bool showProfile = argc > 1 && std::string(argv[1]) == "--startup-profile";
+  if (showProfile)
+      argv[1] = argv[0], argv++, argc--;
+
   CommandLine::init(argc, argv);
-  UCI::init(Options);
-  Tune::init();
-  PSQT::init();
-  Bitboards::init();
-  Position::init();
-  Bitbases::init();
-  Endgames::init();
-  Threads.set(size_t(Options["Threads"]));
-  Search::clear(); // After threads are up
-  Eval::NNUE::init();
+  profile.run("UCI::init", [] { UCI::init(Options); });
+  profile.run("Tune::init", [] { Tune::init(); });
+  profile.run("PSQT::init", [] { PSQT::init(); });
+  profile.run("Bitboards::init", [] { Bitboards::init(); });
+  profile.run("Position::init", [] { Position::init(); });
+  profile.run("Bitbases::init", [] { Bitbases::init(); });
+  profile.run("Endgames::init", [] { Endgames::init(); });
+
+  // The material index is only needed by the classical evaluation, the thread
+  // pool and the net do not depend on it.
+  std::thread material([&] { profile.run("Material::init", [] { Material::init(); }); });
+
+  profile.run("Threads.set", [] { Threads.set(size_t(Options["Threads"])); });
+  profile.run("Search::clear", [] { Search::clear(); }); // After threads are up
+  profile.run("Eval::NNUE::init", [] { Eval::NNUE::init(); });
+
+  material.join();
+
+  if (showProfile)
+      profile.print();
 
   UCI::loop(argc, argv);
 
   Threads.set(0);
+  Cluster::finalize();
   return 0;
 }
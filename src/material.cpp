@@ -18,6 +18,7 @@
 
 #include <cassert>
 #include <cstring>   // For std::memset
+#include <vector>
 
 #include "material.h"
 #include "thread.h"
@@ -66,22 +67,39 @@ namespace {
   Endgame<KPsK>   ScaleKPsK[]   = { Endgame<KPsK>(WHITE),   Endgame<KPsK>(BLACK) };
   Endgame<KPKP>   ScaleKPKP[]   = { Endgame<KPKP>(WHITE),   Endgame<KPKP>(BLACK) };
 
+  // The piece counts of a material configuration, kings excluded, or of a
+  // position. The helpers below only depend on them, so that the entries of the
+  // material index can be computed without a position.
+  struct Counts {
+
+    int count[COLOR_NB][PIECE_TYPE_NB];
+
+    Value non_pawn_material(Color c) const {
+      return  count[c][KNIGHT] * KnightValueMg + count[c][BISHOP] * BishopValueMg
+            + count[c][ROOK]   * RookValueMg   + count[c][QUEEN]  * QueenValueMg;
+    }
+
+    bool pieces_only_king(Color c) const {
+      return !(count[c][PAWN] | count[c][KNIGHT] | count[c][BISHOP] | count[c][ROOK] | count[c][QUEEN]);
+    }
+  };
+
   // Helper used to detect a given material distribution
-  bool is_KXK(const Position& pos, Color us) {
-    return  !more_than_one(pos.pieces(~us))
-          && pos.non_pawn_material(us) >= RookValueMg;
+  bool is_KXK(const Counts& m, Color us) {
+    return   m.pieces_only_king(~us)
+          && m.non_pawn_material(us) >= RookValueMg;
   }
 
-  bool is_KBPsK(const Position& pos, Color us) {
-    return   pos.non_pawn_material(us) == BishopValueMg
-          && pos.count<PAWN>(us) >= 1;
+  bool is_KBPsK(const Counts& m, Color us) {
+    return   m.non_pawn_material(us) == BishopValueMg
+          && m.count[us][PAWN] >= 1;
   }
 
-  bool is_KQKRPs(const Position& pos, Color us) {
-    return  !pos.count<PAWN>(us)
-          && pos.non_pawn_material(us) == QueenValueMg
-          && pos.count<ROOK>(~us) == 1
-          && pos.count<PAWN>(~us) >= 1;
+  bool is_KQKRPs(const Counts& m, Color us) {
+    return  !m.count[us][PAWN]
+          && m.non_pawn_material(us) == QueenValueMg
+          && m.count[~us][ROOK] == 1
+          && m.count[~us][PAWN] >= 1;
   }
 
 
@@ -113,114 +131,193 @@ namespace {
     return bonus;
   }
 
-} // namespace
 
-namespace Material {
+  // Material index: one precomputed entry for each configuration with up to 8
+  // pawns, 2 knights, 2 bishops, 2 rooks and 1 queen per color, indexed by the
+  // piece counts. Others, after a promotion, use the table of the thread.
+  constexpr int MaxCount[PIECE_TYPE_NB] = { 0, 8, 2, 2, 2, 1 };
+  constexpr int SideConfigs = 9 * 3 * 3 * 3 * 2;
 
+  std::vector<Material::Entry> MaterialIndex;
 
-/// Material::probe() looks up the current position's material configuration in
-/// the material hash table. It returns a pointer to the Entry if the position
-/// is found. Otherwise a new Entry is computed and stored there, so we don't
-/// have to recompute all when the same material configuration occurs again.
+  // Index of the counts of one color, or -1 if out of the material index
+  int side_index(const int count[PIECE_TYPE_NB]) {
 
-Entry* probe(const Position& pos) {
+    int idx = 0;
 
-  Key key = pos.material_key();
-  Entry* e = pos.this_thread()->materialTable[key];
+    for (PieceType pt = PAWN; pt <= QUEEN; ++pt)
+    {
+        if (count[pt] > MaxCount[pt])
+            return -1;
 
-  if (e->key == key)
-      return e;
+        idx = idx * (MaxCount[pt] + 1) + count[pt];
+    }
 
-  std::memset(e, 0, sizeof(Entry));
-  e->key = key;
-  e->factor[WHITE] = e->factor[BLACK] = (uint8_t)SCALE_FACTOR_NORMAL;
+    return idx;
+  }
 
-  Value npm_w = pos.non_pawn_material(WHITE);
-  Value npm_b = pos.non_pawn_material(BLACK);
-  Value npm   = std::clamp(npm_w + npm_b, EndgameLimit, MidgameLimit);
+  // Compute the entry of the material configuration 'm', of material key 'key'
+  void compute(Material::Entry* e, Key key, const Counts& m) {
 
-  // Map total non-pawn material into [PHASE_ENDGAME, PHASE_MIDGAME]
-  e->gamePhase = Phase(((npm - EndgameLimit) * PHASE_MIDGAME) / (MidgameLimit - EndgameLimit));
+    std::memset(e, 0, sizeof(Material::Entry));
+    e->key = key;
+    e->factor[WHITE] = e->factor[BLACK] = (uint8_t)SCALE_FACTOR_NORMAL;
 
-  // Let's look if we have a specialized evaluation function for this particular
-  // material configuration. Firstly we look for a fixed configuration one, then
-  // for a generic one if the previous search failed.
-  if ((e->evaluationFunction = Endgames::probe<Value>(key)) != nullptr)
-      return e;
+    Value npm_w = m.non_pawn_material(WHITE);
+    Value npm_b = m.non_pawn_material(BLACK);
+    Value npm   = std::clamp(npm_w + npm_b, EndgameLimit, MidgameLimit);
 
-  for (Color c : { WHITE, BLACK })
-      if (is_KXK(pos, c))
-      {
-          e->evaluationFunction = &EvaluateKXK[c];
-          return e;
-      }
+    // Map total non-pawn material into [PHASE_ENDGAME, PHASE_MIDGAME]
+    e->gamePhase = Phase(((npm - EndgameLimit) * PHASE_MIDGAME) / (MidgameLimit - EndgameLimit));
 
-  // OK, we didn't find any special evaluation function for the current material
-  // configuration. Is there a suitable specialized scaling function?
-  const auto* sf = Endgames::probe<ScaleFactor>(key);
+    // Let's look if we have a specialized evaluation function for this particular
+    // material configuration. Firstly we look for a fixed configuration one, then
+    // for a generic one if the previous search failed.
+    if ((e->evaluationFunction = Endgames::probe<Value>(key)) != nullptr)
+        return;
 
-  if (sf)
-  {
-      e->scalingFunction[sf->strongSide] = sf; // Only strong color assigned
-      return e;
+    for (Color c : { WHITE, BLACK })
+        if (is_KXK(m, c))
+        {
+            e->evaluationFunction = &EvaluateKXK[c];
+            return;
+        }
+
+    // OK, we didn't find any special evaluation function for the current material
+    // configuration. Is there a suitable specialized scaling function?
+    const auto* sf = Endgames::probe<ScaleFactor>(key);
+
+    if (sf)
+    {
+        e->scalingFunction[sf->strongSide] = sf; // Only strong color assigned
+        return;
+    }
+
+    // We didn't find any specialized scaling function, so fall back on generic
+    // ones that refer to more than one material distribution. Note that in this
+    // case we don't return after setting the function.
+    for (Color c : { WHITE, BLACK })
+    {
+      if (is_KBPsK(m, c))
+          e->scalingFunction[c] = &ScaleKBPsK[c];
+
+      else if (is_KQKRPs(m, c))
+          e->scalingFunction[c] = &ScaleKQKRPs[c];
+    }
+
+    if (npm_w + npm_b == VALUE_ZERO && (m.count[WHITE][PAWN] || m.count[BLACK][PAWN])) // Only pawns on the board
+    {
+        if (!m.count[BLACK][PAWN])
+        {
+            assert(m.count[WHITE][PAWN] >= 2);
+
+            e->scalingFunction[WHITE] = &ScaleKPsK[WHITE];
+        }
+        else if (!m.count[WHITE][PAWN])
+        {
+            assert(m.count[BLACK][PAWN] >= 2);
+
+            e->scalingFunction[BLACK] = &ScaleKPsK[BLACK];
+        }
+        else if (m.count[WHITE][PAWN] == 1 && m.count[BLACK][PAWN] == 1)
+        {
+            // This is a special case because we set scaling functions
+            // for both colors instead of only one.
+            e->scalingFunction[WHITE] = &ScaleKPKP[WHITE];
+            e->scalingFunction[BLACK] = &ScaleKPKP[BLACK];
+        }
+    }
+
+    // Zero or just one pawn makes it difficult to win, even with a small material
+    // advantage. This catches some trivial draws like KK, KBK and KNK and gives a
+    // drawish scale factor for cases such as KRKBP and KmmKm (except for KBBKN).
+    if (!m.count[WHITE][PAWN] && npm_w - npm_b <= BishopValueMg)
+        e->factor[WHITE] = uint8_t(npm_w <  RookValueMg   ? SCALE_FACTOR_DRAW :
+                                   npm_b <= BishopValueMg ? 4 : 14);
+
+    if (!m.count[BLACK][PAWN] && npm_b - npm_w <= BishopValueMg)
+        e->factor[BLACK] = uint8_t(npm_b <  RookValueMg   ? SCALE_FACTOR_DRAW :
+                                   npm_w <= BishopValueMg ? 4 : 14);
+
+    // Evaluate the material imbalance. We use PIECE_TYPE_NONE as a place holder
+    // for the bishop pair "extended piece", which allows us to be more flexible
+    // in defining bishop pair bonuses.
+    const int pieceCount[COLOR_NB][PIECE_TYPE_NB] = {
+    { m.count[WHITE][BISHOP] > 1, m.count[WHITE][PAWN], m.count[WHITE][KNIGHT],
+      m.count[WHITE][BISHOP]    , m.count[WHITE][ROOK], m.count[WHITE][QUEEN ] },
+    { m.count[BLACK][BISHOP] > 1, m.count[BLACK][PAWN], m.count[BLACK][KNIGHT],
+      m.count[BLACK][BISHOP]    , m.count[BLACK][ROOK], m.count[BLACK][QUEEN ] } };
+
+    e->score = (imbalance<WHITE>(pieceCount) - imbalance<BLACK>(pieceCount)) / 16;
   }
 
-  // We didn't find any specialized scaling function, so fall back on generic
-  // ones that refer to more than one material distribution. Note that in this
-  // case we don't return after setting the function.
-  for (Color c : { WHITE, BLACK })
+} // namespace
+
+namespace Material {
+
+
+/// Material::init() computes the entries of the material index at startup. It
+/// must be called after Position::init() and Endgames::init().
+
+void init() {
+
+  MaterialIndex.resize(SideConfigs * SideConfigs);
+
+  Counts m = {};
+  int pieceCount[PIECE_NB] = {};
+
+  // Enumerate the counts of both colors like an odometer, in index order
+  for (int idx = 0; idx < SideConfigs * SideConfigs; ++idx)
   {
-    if (is_KBPsK(pos, c))
-        e->scalingFunction[c] = &ScaleKBPsK[c];
+      int n = idx;
+
+      for (Color c : { BLACK, WHITE })
+          for (PieceType pt = QUEEN; pt >= PAWN; --pt)
+          {
+              m.count[c][pt] = n % (MaxCount[pt] + 1);
+              n /= MaxCount[pt] + 1;
+              pieceCount[make_piece(c, pt)] = m.count[c][pt];
+          }
+
+      pieceCount[W_KING] = pieceCount[B_KING] = 1;
+
+      assert(side_index(m.count[WHITE]) * SideConfigs + side_index(m.count[BLACK]) == idx);
 
-    else if (is_KQKRPs(pos, c))
-        e->scalingFunction[c] = &ScaleKQKRPs[c];
+      compute(&MaterialIndex[idx], Position::material_key(pieceCount), m);
   }
+}
+
+
+/// Material::probe() looks up the current position's material configuration in
+/// the material index, or for the few configurations out of it in the material
+/// hash table. In this case, if the configuration is not found, a new Entry is
+/// computed and stored there, so we don't have to recompute all when the same
+/// material configuration occurs again.
+
+Entry* probe(const Position& pos) {
+
+  Counts m;
 
-  if (npm_w + npm_b == VALUE_ZERO && pos.pieces(PAWN)) // Only pawns on the board
+  for (Color c : { WHITE, BLACK })
   {
-      if (!pos.count<PAWN>(BLACK))
-      {
-          assert(pos.count<PAWN>(WHITE) >= 2);
-
-          e->scalingFunction[WHITE] = &ScaleKPsK[WHITE];
-      }
-      else if (!pos.count<PAWN>(WHITE))
-      {
-          assert(pos.count<PAWN>(BLACK) >= 2);
-
-          e->scalingFunction[BLACK] = &ScaleKPsK[BLACK];
-      }
-      else if (pos.count<PAWN>(WHITE) == 1 && pos.count<PAWN>(BLACK) == 1)
-      {
-          // This is a special case because we set scaling functions
-          // for both colors instead of only one.
-          e->scalingFunction[WHITE] = &ScaleKPKP[WHITE];
-          e->scalingFunction[BLACK] = &ScaleKPKP[BLACK];
-      }
+      m.count[c][PAWN]   = pos.count<PAWN  >(c);
+      m.count[c][KNIGHT] = pos.count<KNIGHT>(c);
+      m.count[c][BISHOP] = pos.count<BISHOP>(c);
+      m.count[c][ROOK]   = pos.count<ROOK  >(c);
+      m.count[c][QUEEN]  = pos.count<QUEEN >(c);
   }
 
-  // Zero or just one pawn makes it difficult to win, even with a small material
-  // advantage. This catches some trivial draws like KK, KBK and KNK and gives a
-  // drawish scale factor for cases such as KRKBP and KmmKm (except for KBBKN).
-  if (!pos.count<PAWN>(WHITE) && npm_w - npm_b <= BishopValueMg)
-      e->factor[WHITE] = uint8_t(npm_w <  RookValueMg   ? SCALE_FACTOR_DRAW :
-                                 npm_b <= BishopValueMg ? 4 : 14);
-
-  if (!pos.count<PAWN>(BLACK) && npm_b - npm_w <= BishopValueMg)
-      e->factor[BLACK] = uint8_t(npm_b <  RookValueMg   ? SCALE_FACTOR_DRAW :
-                                 npm_w <= BishopValueMg ? 4 : 14);
-
-  // Evaluate the material imbalance. We use PIECE_TYPE_NONE as a place holder
-  // for the bishop pair "extended piece", which allows us to be more flexible
-  // in defining bishop pair bonuses.
-  const int pieceCount[COLOR_NB][PIECE_TYPE_NB] = {
-  { pos.count<BISHOP>(WHITE) > 1, pos.count<PAWN>(WHITE), pos.count<KNIGHT>(WHITE),
-    pos.count<BISHOP>(WHITE)    , pos.count<ROOK>(WHITE), pos.count<QUEEN >(WHITE) },
-  { pos.count<BISHOP>(BLACK) > 1, pos.count<PAWN>(BLACK), pos.count<KNIGHT>(BLACK),
-    pos.count<BISHOP>(BLACK)    , pos.count<ROOK>(BLACK), pos.count<QUEEN >(BLACK) } };
-
-  e->score = (imbalance<WHITE>(pieceCount) - imbalance<BLACK>(pieceCount)) / 16;
+  int w = side_index(m.count[WHITE]), b = side_index(m.count[BLACK]);
+
+  if (w >= 0 && b >= 0)
+      return &MaterialIndex[w * SideConfigs + b];
+
+  Key key = pos.material_key();
+  Entry* e = pos.this_thread()->materialTable[key];
+
+  if (e->key != key)
+      compute(e, key, m);
+
   return e;
 }
 
@@ -39,25 +39,44 @@ typedef bool(*fun3_t)(HANDLE, CONST GROUP_AFFINITY*, PGROUP_AFFINITY);
 }
 #endif
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 #include <cstdlib>
 
 #if defined(__linux__) && !defined(__ANDROID__)
+#include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #endif
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #if defined(__APPLE__) || defined(__ANDROID__) || defined(__OpenBSD__) || (defined(__GLIBCXX__) && !defined(_GLIBCXX_HAVE_ALIGNED_ALLOC) && !defined(_WIN32)) || defined(__e2k__)
 #define POSIXALIGNEDALLOC
 #include <stdlib.h>
 #endif
 
+#include "evaluate.h"
 #include "misc.h"
 #include "thread.h"
+#include "uci.h"
 
 using namespace std;
 
@@ -69,6 +88,126 @@ namespace {
 /// DD-MM-YY and show in engine_info.
 const string Version = "";
 
+/// AsyncOut replaces cout.rdbuf() once start_async_output() is called. What is
+/// written to std::cout is appended to a queue, and a dedicated thread writes
+/// the queue in batches to the original buffer, flushing it once per batch. So
+/// the search threads never wait on a slow pipe or on the debug log file, and
+/// only sync_flush waits until the output has been written out.
+
+class AsyncOut : public streambuf {
+
+  int overflow(int c) override {
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+        return traits_type::not_eof(c);
+
+    std::scoped_lock<std::mutex> lock(mutex);
+    queue.push_back(char(c)), ++queued;
+    return c;
+  }
+
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    std::scoped_lock<std::mutex> lock(mutex);
+    queue.append(s, size_t(n)), queued += uint64_t(n);
+    return n;
+  }
+
+  // Called at each std::endl, it only wakes up the writer
+  int sync() override { pending.notify_one(); return 0; }
+
+  void write_loop() {
+
+    std::string batch;
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true)
+    {
+        pending.wait(lock, [&]{ return !queue.empty() || quit; });
+
+        if (queue.empty())
+            break;
+
+        batch.swap(queue);
+        uint64_t end = queued;
+        streambuf* out = target;
+        lock.unlock();
+
+        out->sputn(batch.data(), std::streamsize(batch.size()));
+        out->pubsync();
+        batch.clear();
+
+        lock.lock();
+        written = end;
+        done.notify_all();
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable pending, done;
+  std::thread writer;
+  std::string queue;
+  streambuf* target = nullptr;
+  uint64_t queued = 0, written = 0;
+  bool quit = false;
+
+public:
+ ~AsyncOut() { stop(); }
+
+  void start() {
+
+    if (writer.joinable())
+        return;
+
+    target = cout.rdbuf();
+    cout.rdbuf(this);
+    writer = std::thread(&AsyncOut::write_loop, this);
+  }
+
+  void stop() {
+
+    if (!writer.joinable())
+        return;
+
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        quit = true;
+    }
+    pending.notify_one();
+    writer.join();
+    cout.rdbuf(target);
+  }
+
+  // Waits until everything queued so far has been written and flushed
+  void flush() {
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (!writer.joinable())
+        return;
+
+    uint64_t end = queued;
+    pending.notify_one();
+    done.wait(lock, [&]{ return written >= end; });
+  }
+
+  // The buffer the output finally goes to, Logger puts its Tie in between
+  streambuf* output() { return writer.joinable() ? target : cout.rdbuf(); }
+
+  void set_output(streambuf* buf) {
+
+    if (!writer.joinable())
+    {
+        cout.rdbuf(buf);
+        return;
+    }
+
+    flush();
+    std::scoped_lock<std::mutex> lock(mutex);
+    target = buf;
+  }
+};
+
+AsyncOut Output;
+
 /// Our fancy logging facility. The trick here is to replace cin.rdbuf() and
 /// cout.rdbuf() with two Tie objects that tie cin and cout to a file stream. We
 /// can toggle the logging of std::cout and std:cin at runtime whilst preserving
@@ -89,6 +228,8 @@ struct Tie: public streambuf { // MSVC requires split streambuf for cin and cout
   int log(int c, const char* prefix) {
 
     static int last = '\n'; // Single log file
+    static std::mutex m; // Output is logged by the writer thread of AsyncOut
+    std::scoped_lock<std::mutex> lock(m);
 
     if (last == '\n')
         logBuf->sputn(prefix, 3);
@@ -99,7 +240,7 @@ struct Tie: public streambuf { // MSVC requires split streambuf for cin and cout
 
 class Logger {
 
-  Logger() : in(cin.rdbuf(), file.rdbuf()), out(cout.rdbuf(), file.rdbuf()) {}
+  Logger() : in(cin.rdbuf(), file.rdbuf()), out(Output.output(), file.rdbuf()) {}
  ~Logger() { start(""); }
 
   ofstream file;
@@ -121,11 +262,11 @@ public:
         }
 
         cin.rdbuf(&l.in);
-        cout.rdbuf(&l.out);
+        Output.set_output(&l.out);
     }
     else if (fname.empty() && l.file.is_open())
     {
-        cout.rdbuf(l.out.buf);
+        Output.set_output(l.out.buf);
         cin.rdbuf(l.in.buf);
         l.file.close();
     }
@@ -265,6 +406,12 @@ std::string compiler_info() {
     compiler += " DEBUG";
   #endif
 
+  #if defined(USE_DISPATCH)
+    compiler += "\nRuntime dispatch selected: NNUE ";
+    compiler += Eval::NNUE::target_name();
+    compiler += (HasPext ? ", pext" : ", magics");
+  #endif
+
   compiler += "\n__VERSION__ macro expands to: ";
   #ifdef __VERSION__
      compiler += __VERSION__;
@@ -306,9 +453,12 @@ std::ostream& operator<<(std::ostream& os, SyncCout sc) {
   if (sc == IO_LOCK)
       m.lock();
 
-  if (sc == IO_UNLOCK)
+  if (sc == IO_UNLOCK || sc == IO_FLUSH)
       m.unlock();
 
+  if (sc == IO_FLUSH)
+      Output.flush();
+
   return os;
 }
 
@@ -316,6 +466,9 @@ std::ostream& operator<<(std::ostream& os, SyncCout sc) {
 /// Trampoline helper to avoid moving Logger to misc.h
 void start_logger(const std::string& fname) { Logger::start(fname); }
 
+/// Sends std::cout through the output queue, until the program exits
+void start_async_output() { Output.start(); }
+
 
 /// prefetch() preloads the given address in L1/L2 cache. This is a non-blocking
 /// function that doesn't stall the CPU waiting for data to be loaded from memory,
@@ -426,11 +579,21 @@ static void* aligned_large_pages_alloc_windows(size_t allocSize) {
   #endif
 }
 
+// Allocations made with large pages, see large_page_bytes()
+static std::mutex largePagesMutex;
+static std::vector<std::pair<void*, size_t>> largePagesAllocs;
+
 void* aligned_large_pages_alloc(size_t allocSize) {
 
   // Try to allocate large pages
   void* mem = aligned_large_pages_alloc_windows(allocSize);
 
+  if (mem)
+  {
+      std::lock_guard<std::mutex> lk(largePagesMutex);
+      largePagesAllocs.emplace_back(mem, allocSize);
+  }
+
   // Fall back to regular, page aligned, allocation if necessary
   if (!mem)
       mem = VirtualAlloc(NULL, allocSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
@@ -440,8 +603,48 @@ void* aligned_large_pages_alloc(size_t allocSize) {
 
 #else
 
+// Largest explicit huge pages to use, see set_huge_page_size(), and the
+// allocations that got them, which are freed with munmap()
+static size_t HugePageSize;
+
+struct HugePagesAlloc {
+  void* mem;
+  size_t size, pageSize;
+};
+
+static std::mutex hugePagesMutex;
+static std::vector<HugePagesAlloc> hugePagesAllocs;
+
 void* aligned_large_pages_alloc(size_t allocSize) {
 
+#if defined(MAP_HUGETLB)
+#if !defined(MAP_HUGE_SHIFT)
+#define MAP_HUGE_SHIFT 26
+#endif
+
+  // Try explicit hugetlbfs pages first, if asked for, of the largest size that
+  // wastes at most 1/16 of the memory in rounding up. They must have been
+  // reserved by the administrator, see /proc/sys/vm/nr_hugepages.
+  for (int shift : { 30, 21 })
+  {
+      const size_t pageSize = size_t(1) << shift;
+      const size_t size = (allocSize + pageSize - 1) / pageSize * pageSize;
+
+      if (pageSize > HugePageSize || size - allocSize > allocSize / 16)
+          continue;
+
+      void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0);
+
+      if (mem != MAP_FAILED)
+      {
+          std::lock_guard<std::mutex> lk(hugePagesMutex);
+          hugePagesAllocs.push_back({ mem, size, pageSize });
+          return mem;
+      }
+  }
+#endif
+
 #if defined(__linux__)
   constexpr size_t alignment = 2 * 1024 * 1024; // assumed 2MB page size
 #else
@@ -466,6 +669,14 @@ void* aligned_large_pages_alloc(size_t allocSize) {
 
 void aligned_large_pages_free(void* mem) {
 
+  {
+      std::lock_guard<std::mutex> lk(largePagesMutex);
+      auto it = std::find_if(largePagesAllocs.begin(), largePagesAllocs.end(),
+                             [mem](const auto& a) { return a.first == mem; });
+      if (it != largePagesAllocs.end())
+          largePagesAllocs.erase(it);
+  }
+
   if (mem && !VirtualFree(mem, 0, MEM_RELEASE))
   {
       DWORD err = GetLastError();
@@ -479,17 +690,421 @@ void aligned_large_pages_free(void* mem) {
 #else
 
 void aligned_large_pages_free(void *mem) {
+
+  {
+      std::lock_guard<std::mutex> lk(hugePagesMutex);
+      auto it = std::find_if(hugePagesAllocs.begin(), hugePagesAllocs.end(),
+                             [mem](const auto& a) { return a.mem == mem; });
+      if (it != hugePagesAllocs.end())
+      {
+          munmap(it->mem, it->size);
+          hugePagesAllocs.erase(it);
+          return;
+      }
+  }
+
   std_aligned_free(mem);
 }
 
 #endif
 
 
+/// map_file() maps a whole file read-only and shared, so that processes mapping
+/// the same file share its pages in the page cache. It returns nullptr on
+/// failure, and stores the size of the file and the handle to pass to
+/// unmap_file() in 'size' and 'mapping'.
+
+void* map_file(const std::string& fname, size_t* size, uint64_t* mapping) {
+
+#if !defined(_WIN32)
+  struct stat statbuf;
+  int fd = ::open(fname.c_str(), O_RDONLY);
+
+  if (fd == -1)
+      return nullptr;
+
+  if (fstat(fd, &statbuf) || statbuf.st_size == 0)
+  {
+      ::close(fd);
+      return nullptr;
+  }
+
+  void* mem = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (mem == MAP_FAILED)
+      return nullptr;
+
+#if defined(MADV_HUGEPAGE)
+  madvise(mem, statbuf.st_size, MADV_HUGEPAGE);
+#endif
+
+  *size = *mapping = statbuf.st_size;
+  return mem;
+#else
+  HANDLE fd = CreateFile(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+  if (fd == INVALID_HANDLE_VALUE)
+      return nullptr;
+
+  DWORD size_high;
+  DWORD size_low = GetFileSize(fd, &size_high);
+  HANDLE fmap = (size_low || size_high) ? CreateFileMapping(fd, nullptr, PAGE_READONLY, size_high, size_low, nullptr)
+                                        : nullptr;
+  CloseHandle(fd);
+
+  if (!fmap)
+      return nullptr;
+
+  void* mem = MapViewOfFile(fmap, FILE_MAP_READ, 0, 0, 0);
+
+  if (!mem)
+  {
+      CloseHandle(fmap);
+      return nullptr;
+  }
+
+  *size = size_t((uint64_t(size_high) << 32) | size_low);
+  *mapping = uint64_t(fmap);
+  return mem;
+#endif
+}
+
+
+/// unmap_file() releases a mapping made by map_file(), nop if mem == nullptr
+
+void unmap_file(void* mem, uint64_t mapping) {
+
+  if (!mem)
+      return;
+
+#if !defined(_WIN32)
+  munmap(mem, mapping);
+#else
+  UnmapViewOfFile(mem);
+  CloseHandle(HANDLE(mapping));
+#endif
+}
+
+
+/// page_faults() returns the major (with disk I/O) and minor page faults of the
+/// process so far, or false where they are not available.
+
+bool page_faults(uint64_t* major, uint64_t* minor) {
+
+#if !defined(_WIN32)
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage))
+      return false;
+
+  *major = uint64_t(usage.ru_majflt);
+  *minor = uint64_t(usage.ru_minflt);
+  return true;
+#else
+  (void)major, (void)minor;
+  return false;
+#endif
+}
+
+
+/// large_page_bytes() returns how many bytes of the given memory are backed by
+/// large pages. On Linux they are the transparent or hugetlbfs huge pages of the
+/// mappings overlapping the memory, as listed in /proc/self/smaps, on Windows the
+/// allocations of aligned_large_pages_alloc() that got large pages.
+
+size_t large_page_bytes(const void* mem, size_t size) {
+
+  if (!mem)
+      return 0;
+
+#if defined(__linux__)
+  std::ifstream smaps("/proc/self/smaps");
+  const uintptr_t first = uintptr_t(mem), last = first + size;
+  bool overlaps = false;
+  size_t bytes = 0;
+  string line;
+
+  while (std::getline(smaps, line))
+  {
+      unsigned long long start, end, kb;
+      char field[64];
+
+      // A mapping starts with its "start-end" address range in hex
+      if (sscanf(line.c_str(), "%llx-%llx ", &start, &end) == 2)
+          overlaps = start < last && first < end;
+
+      else if (   overlaps
+               && sscanf(line.c_str(), "%63[^:]: %llu kB", field, &kb) == 2
+               && (   !strcmp(field, "AnonHugePages")
+                   || !strcmp(field, "ShmemPmdMapped")
+                   || !strcmp(field, "Shared_Hugetlb")
+                   || !strcmp(field, "Private_Hugetlb")))
+          bytes += size_t(kb) * 1024;
+  }
+
+  return std::min(bytes, size);
+#elif defined(_WIN32)
+  std::lock_guard<std::mutex> lk(largePagesMutex);
+
+  for (const auto& [addr, allocSize] : largePagesAllocs)
+      if (addr == mem)
+          return std::min(allocSize, size);
+
+  return 0;
+#else
+  (void)size;
+  return 0;
+#endif
+}
+
+
+/// set_huge_page_size() sets the largest explicit huge pages, 2 MB or 1 GB, that
+/// aligned_large_pages_alloc() tries before its usual path, as set by the "Huge
+/// Pages" option. Zero, the default, keeps to transparent huge pages. Windows
+/// always tries its large pages, so the setting has no effect there.
+
+#if defined(_WIN32)
+
+void set_huge_page_size(size_t) {}
+size_t huge_page_size() { return 0; }
+
+size_t large_page_size(const void* mem) {
+
+  std::lock_guard<std::mutex> lk(largePagesMutex);
+
+  for (const auto& a : largePagesAllocs)
+      if (a.first == mem)
+          return GetLargePageMinimum();
+
+  return 0;
+}
+
+#else
+
+void set_huge_page_size(size_t pageSize) { HugePageSize = pageSize; }
+size_t huge_page_size() { return HugePageSize; }
+
+size_t large_page_size(const void* mem) {
+
+  std::lock_guard<std::mutex> lk(hugePagesMutex);
+
+  for (const auto& a : hugePagesAllocs)
+      if (a.mem == mem)
+          return a.pageSize;
+
+  return 0;
+}
+
+#endif
+
+
+/// page_report() describes the pages backing the given memory, for the info
+/// strings telling which page size an allocation actually got.
+
+string page_report(const void* mem, size_t size) {
+
+  auto mb = [](size_t bytes) { return std::to_string(bytes / (1024 * 1024)) + " MB"; };
+
+  if (size_t pageSize = large_page_size(mem))
+      return pageSize >= (size_t(1) << 30) ? std::to_string(pageSize >> 30) + " GB pages"
+                                           : std::to_string(pageSize >> 20) + " MB pages";
+
+  if (size_t bytes = large_page_bytes(mem, size))
+      return "transparent huge pages for " + mb(bytes) + " of " + mb(size);
+
+  return "default pages, explicit huge pages not available";
+}
+
+
 namespace WinProcGroup {
 
-#ifndef _WIN32
+#if defined(__linux__) && !defined(__ANDROID__)
+
+/// On Linux the NUMA topology is read from sysfs and threads are bound with
+/// pthread_setaffinity_np(), so no dependency on libnuma is needed. Memory then
+/// follows the threads through the kernel's default first-touch policy.
+
+namespace {
+
+  // read_cpu_list() parses a sysfs list file in the "0-3,8-11" format
+  std::vector<int> read_cpu_list(const string& path) {
 
-void bindThisThread(size_t) {}
+    std::vector<int> list;
+    ifstream file(path);
+    string token;
+
+    while (getline(file, token, ','))
+    {
+        int first, last;
+        char dash;
+        istringstream ss(token);
+
+        if (!(ss >> first))
+            break;
+
+        last = (ss >> dash >> last) ? last : first;
+
+        for (int cpu = first; cpu <= last; ++cpu)
+            list.push_back(cpu);
+    }
+
+    return list;
+  }
+
+  // A logical cpu is the primary of its physical core if it is the first of
+  // its hyperthread siblings.
+  bool is_core_primary(int cpu) {
+
+    std::vector<int> siblings = read_cpu_list("/sys/devices/system/cpu/cpu"
+                                + std::to_string(cpu) + "/topology/thread_siblings_list");
+    return siblings.empty() || siblings[0] == cpu;
+  }
+}
+
+
+/// best_node() returns the NUMA node the thread with index idx should run on,
+/// according to the "Thread Binding" policy: "compact" fills the physical cores
+/// of one node before moving to the next (as best_group() does on Windows),
+/// "spread" distributes threads round robin over the nodes, and "off" disables
+/// binding altogether.
+
+int best_node(size_t idx, const std::vector<std::vector<int>>& nodes) {
+
+  if (Options["Thread Binding"] == "off" || nodes.size() < 2)
+      return -1;
+
+  size_t threads = 0;
+  for (const auto& cpus : nodes)
+      threads += cpus.size();
+
+  // If we have more threads than logical processors let the OS decide
+  if (idx >= threads)
+      return -1;
+
+  if (Options["Thread Binding"] == "spread")
+      return int(idx % nodes.size());
+
+  std::vector<int> groups;
+
+  for (size_t n = 0; n < nodes.size(); ++n)
+      for (int cpu : nodes[n])
+          if (is_core_primary(cpu))
+              groups.push_back(int(n));
+
+  // Spread the remaining hyperthreads evenly across the nodes
+  for (size_t t = groups.size(); t < threads; ++t)
+      groups.push_back(int(t % nodes.size()));
+
+  return groups[idx];
+}
+
+
+/// bindThisThread() sets the cpu affinity of the current thread to all the
+/// logical processors of its NUMA node and returns the node, or -1 if the
+/// thread has been left unbound.
+
+int bindThisThread(size_t idx) {
+
+  std::vector<std::vector<int>> nodes;
+
+  for (int n : read_cpu_list("/sys/devices/system/node/online"))
+      nodes.push_back(read_cpu_list("/sys/devices/system/node/node"
+                                    + std::to_string(n) + "/cpulist"));
+
+  int node = best_node(idx, nodes);
+
+  if (node == -1)
+      return -1;
+
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+
+  for (int cpu : nodes[node])
+      if (cpu < CPU_SETSIZE)
+          CPU_SET(cpu, &mask);
+
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &mask) ? -1 : node;
+}
+
+
+/// core_types() splits the logical cpus of a hybrid CPU into performance and
+/// efficiency ones. Intel hybrid CPUs expose one PMU per core type, elsewhere
+/// (ARM big.LITTLE) the cpus with the highest capacity are the performance ones.
+/// Returns false if all the cores are of the same type.
+
+bool core_types(std::vector<int>& perf, std::vector<int>& eff) {
+
+  perf = read_cpu_list("/sys/devices/cpu_core/cpus");
+  eff  = read_cpu_list("/sys/devices/cpu_atom/cpus");
+
+  if (!perf.empty() && !eff.empty())
+      return true;
+
+  std::vector<std::pair<int, int>> capacities;
+  int maxCapacity = 0;
+
+  perf.clear();
+  eff.clear();
+
+  for (int cpu : read_cpu_list("/sys/devices/system/cpu/online"))
+  {
+      ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cpu_capacity");
+      int capacity;
+
+      if (!(file >> capacity))
+          return false;
+
+      capacities.emplace_back(cpu, capacity);
+      maxCapacity = std::max(maxCapacity, capacity);
+  }
+
+  for (auto [cpu, capacity] : capacities)
+      (capacity == maxCapacity ? perf : eff).push_back(cpu);
+
+  return !perf.empty() && !eff.empty();
+}
+
+
+/// hybrid() returns true if the CPU has both performance and efficiency cores.
+
+bool hybrid() {
+
+  std::vector<int> perf, eff;
+  return core_types(perf, eff);
+}
+
+
+/// bindToCoreType() sets the cpu affinity of the current thread to the
+/// performance cores for the first threads and to the efficiency cores for the
+/// rest. Returns 1 if bound to the efficiency cores, 0 if bound to the
+/// performance ones and -1 if the CPU is not hybrid or the thread is left unbound.
+
+int bindToCoreType(size_t idx) {
+
+  std::vector<int> perf, eff;
+
+  if (!core_types(perf, eff) || idx >= perf.size() + eff.size())
+      return -1;
+
+  bool efficiency = idx >= perf.size();
+
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+
+  for (int cpu : efficiency ? eff : perf)
+      if (cpu < CPU_SETSIZE)
+          CPU_SET(cpu, &mask);
+
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &mask) ? -1 : efficiency;
+}
+
+#elif !defined(_WIN32)
+
+int bindThisThread(size_t) { return -1; }
+int bindToCoreType(size_t) { return -1; }
+bool hybrid() { return false; }
 
 #else
 
@@ -544,6 +1159,12 @@ int best_group(size_t idx) {
 
   free(buffer);
 
+  if (Options["Thread Binding"] == "off")
+      return -1;
+
+  if (Options["Thread Binding"] == "spread")
+      return idx < size_t(threads) ? int(idx % nodes) : -1;
+
   std::vector<int> groups;
 
   // Run as many threads as possible on the same node until core limit is
@@ -564,15 +1185,16 @@ int best_group(size_t idx) {
 }
 
 
-/// bindThisThread() set the group affinity of the current thread
+/// bindThisThread() set the group affinity of the current thread and returns
+/// the group, or -1 if the thread has been left unbound.
 
-void bindThisThread(size_t idx) {
+int bindThisThread(size_t idx) {
 
   // Use only local variables to be thread-safe
   int group = best_group(idx);
 
   if (group == -1)
-      return;
+      return -1;
 
   // Early exit if the needed API are not available at runtime
   HMODULE k32 = GetModuleHandle("Kernel32.dll");
@@ -580,13 +1202,19 @@ void bindThisThread(size_t idx) {
   auto fun3 = (fun3_t)(void(*)())GetProcAddress(k32, "SetThreadGroupAffinity");
 
   if (!fun2 || !fun3)
-      return;
+      return -1;
 
   GROUP_AFFINITY affinity;
-  if (fun2(group, &affinity))
-      fun3(GetCurrentThread(), &affinity, nullptr);
+  return fun2(group, &affinity) && fun3(GetCurrentThread(), &affinity, nullptr) ? group : -1;
 }
 
+
+/// bindToCoreType() is not implemented on Windows yet, where the scheduler
+/// (Thread Director) already tells core types apart.
+
+int bindToCoreType(size_t) { return -1; }
+bool hybrid() { return false; }
+
 #endif
 
 } // namespace WinProcGroup
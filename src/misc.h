@@ -19,6 +19,7 @@
 #ifndef MISC_H_INCLUDED
 #define MISC_H_INCLUDED
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <ostream>
@@ -34,10 +35,19 @@ std::string engine_info(bool to_uci = false);
 std::string compiler_info();
 void prefetch(void* addr);
 void start_logger(const std::string& fname);
+void start_async_output();
 void* std_aligned_alloc(size_t alignment, size_t size);
 void std_aligned_free(void* ptr);
 void* aligned_large_pages_alloc(size_t size); // memory aligned by page size, min alignment: 4096 bytes
 void aligned_large_pages_free(void* mem); // nop if mem == nullptr
+void* map_file(const std::string& fname, size_t* size, uint64_t* mapping); // read-only, nullptr on failure
+void unmap_file(void* mem, uint64_t mapping); // nop if mem == nullptr
+bool page_faults(uint64_t* major, uint64_t* minor); // false if not available
+size_t large_page_bytes(const void* mem, size_t size); // 0 if not known
+void set_huge_page_size(size_t pageSize); // largest explicit huge pages to use, 0 for none
+size_t huge_page_size(); // as set by set_huge_page_size()
+size_t large_page_size(const void* mem); // 0 unless allocated with explicit large pages
+std::string page_report(const void* mem, size_t size); // the kind of pages backing the memory
 
 void dbg_hit_on(bool b);
 void dbg_hit_on(bool c, bool b);
@@ -51,20 +61,41 @@ inline TimePoint now() {
         (std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
+/// MemoryUsage is one line of the 'memory' report: the size of an allocation
+/// and how much of it is backed by large pages.
+
+struct MemoryUsage {
+  std::string name;
+  size_t bytes, largePages;
+};
+
 template<class Entry, int Size>
 struct HashTable {
-  Entry* operator[](Key key) { return &table[(uint32_t)key & (Size - 1)]; }
+  static constexpr size_t DefaultSize = Size;
+
+  Entry* operator[](Key key) { return &table[(uint32_t)key & mask]; }
+  void clear() { std::fill(table.begin(), table.end(), Entry()); }
+
+  // The number of entries is Size until resized, always a power of two
+  size_t size() const { return table.size(); }
+  void resize(size_t entries) {
+    assert(entries && !(entries & (entries - 1)));
+    if (entries != table.size())
+        table = std::vector<Entry>(entries), mask = entries - 1;
+  }
 
 private:
   std::vector<Entry> table = std::vector<Entry>(Size); // Allocate on the heap
+  size_t mask = Size - 1;
 };
 
 
-enum SyncCout { IO_LOCK, IO_UNLOCK };
+enum SyncCout { IO_LOCK, IO_UNLOCK, IO_FLUSH };
 std::ostream& operator<<(std::ostream&, SyncCout);
 
 #define sync_cout std::cout << IO_LOCK
 #define sync_endl std::endl << IO_UNLOCK
+#define sync_flush std::endl << IO_FLUSH // Also waits until the line is written out
 
 
 // align_ptr_up() : get the first aligned element of an array.
@@ -182,10 +213,15 @@ inline uint64_t mul_hi64(uint64_t a, uint64_t b) {
 /// logical processor group. This usually means to be limited to use max 64
 /// cores. To overcome this, some special platform specific API should be
 /// called to set group affinity for each thread. Original code from Texel by
-/// Peter Österlund.
+/// Peter Österlund. On Linux the same entry point binds threads to their NUMA
+/// node, following the "Thread Binding" policy. The node (or group) the thread
+/// has been bound to is returned, -1 if left to the OS. On hybrid CPUs threads
+/// can also be bound to performance cores first with bindToCoreType().
 
 namespace WinProcGroup {
-  void bindThisThread(size_t idx);
+  int bindThisThread(size_t idx);
+  int bindToCoreType(size_t idx);
+  bool hybrid();
 }
 
 namespace CommandLine {
@@ -145,8 +145,14 @@ namespace {
 
             assert(b1);
 
+            // An en passant capture may expose the king along the rank of the
+            // captured pawn, it is simpler to let Position::legal() sort it out.
             while (b1)
-                *moveList++ = make<EN_PASSANT>(pop_lsb(b1), pos.ep_square());
+            {
+                Move m = make<EN_PASSANT>(pop_lsb(b1), pos.ep_square());
+                if (pos.legal(m))
+                    *moveList++ = m;
+            }
         }
     }
 
@@ -164,7 +170,11 @@ namespace {
     while (bb)
     {
         Square from = pop_lsb(bb);
-        Bitboard b = attacks_bb<Pt>(from, pos.pieces()) & target;
+        Bitboard b = pos.attacks_from<Pt>(from) & target;
+
+        // A pinned piece can only move along the line of the pin
+        if (pos.blockers_for_king(Us) & from)
+            b &= line_bb(pos.square<KING>(Us), from);
 
         // To check, you either move freely a blocker or make a direct check.
         if (Checks && (Pt == QUEEN || !(pos.blockers_for_king(~Us) & from)))
@@ -195,7 +205,20 @@ namespace {
                : Type == CAPTURES     ?  pos.pieces(~Us)
                                       : ~pos.pieces(   ); // QUIETS || QUIET_CHECKS
 
+        ExtMove* cur = moveList;
         moveList = generate_pawn_moves<Us, Type>(pos, moveList, target);
+
+        // Pawn moves are generated set-wise, so pinned pawns are dealt with afterwards
+        if (pos.blockers_for_king(Us) & pos.pieces(Us, PAWN))
+        {
+            while (cur != moveList)
+                if (   (pos.blockers_for_king(Us) & from_sq(*cur))
+                    && !aligned(from_sq(*cur), to_sq(*cur), ksq))
+                    *cur = (--moveList)->move;
+                else
+                    ++cur;
+        }
+
         moveList = generate_moves<Us, KNIGHT, Checks>(pos, moveList, target);
         moveList = generate_moves<Us, BISHOP, Checks>(pos, moveList, target);
         moveList = generate_moves<Us,   ROOK, Checks>(pos, moveList, target);
@@ -208,13 +231,23 @@ namespace {
         if (Checks)
             b &= ~attacks_bb<QUEEN>(pos.square<KING>(~Us));
 
+        // The king cannot move to an attacked square, nor away from a slider
+        // along the line of its check, hence the king is removed from the board.
         while (b)
-            *moveList++ = make_move(ksq, pop_lsb(b));
+        {
+            Square to = pop_lsb(b);
+            if (!(pos.attackers_to(to, pos.pieces() ^ ksq) & pos.pieces(~Us)))
+                *moveList++ = make_move(ksq, to);
+        }
 
         if ((Type == QUIETS || Type == NON_EVASIONS) && pos.can_castle(Us & ANY_CASTLING))
             for (CastlingRights cr : { Us & KING_SIDE, Us & QUEEN_SIDE } )
                 if (!pos.castling_impeded(cr) && pos.can_castle(cr))
-                    *moveList++ = make<CASTLING>(ksq, pos.castling_rook_square(cr));
+                {
+                    Move m = make<CASTLING>(ksq, pos.castling_rook_square(cr));
+                    if (pos.legal(m))
+                        *moveList++ = m;
+                }
     }
 
     return moveList;
@@ -223,11 +256,15 @@ namespace {
 } // namespace
 
 
-/// <CAPTURES>     Generates all pseudo-legal captures plus queen promotions
-/// <QUIETS>       Generates all pseudo-legal non-captures and underpromotions
-/// <EVASIONS>     Generates all pseudo-legal check evasions when the side to move is in check
-/// <QUIET_CHECKS> Generates all pseudo-legal non-captures giving check, except castling and promotions
-/// <NON_EVASIONS> Generates all pseudo-legal captures and non-captures
+/// <CAPTURES>     Generates all legal captures plus queen promotions
+/// <QUIETS>       Generates all legal non-captures and underpromotions
+/// <EVASIONS>     Generates all legal check evasions when the side to move is in check
+/// <QUIET_CHECKS> Generates all legal non-captures giving check, except castling and promotions
+/// <NON_EVASIONS> Generates all legal captures and non-captures
+///
+/// Moves of pinned pieces are restricted to the line of the pin and king moves
+/// to safe squares, using the blockers stored in StateInfo, so that no move has
+/// to go through Position::legal() afterwards.
 ///
 /// Returns a pointer to the end of the move list.
 
@@ -256,21 +293,8 @@ template ExtMove* generate<NON_EVASIONS>(const Position&, ExtMove*);
 template<>
 ExtMove* generate<LEGAL>(const Position& pos, ExtMove* moveList) {
 
-  Color us = pos.side_to_move();
-  Bitboard pinned = pos.blockers_for_king(us) & pos.pieces(us);
-  Square ksq = pos.square<KING>(us);
-  ExtMove* cur = moveList;
-
-  moveList = pos.checkers() ? generate<EVASIONS    >(pos, moveList)
-                            : generate<NON_EVASIONS>(pos, moveList);
-  while (cur != moveList)
-      if (  ((pinned && pinned & from_sq(*cur)) || from_sq(*cur) == ksq || type_of(*cur) == EN_PASSANT)
-          && !pos.legal(*cur))
-          *cur = (--moveList)->move;
-      else
-          ++cur;
-
-  return moveList;
+  return pos.checkers() ? generate<EVASIONS    >(pos, moveList)
+                        : generate<NON_EVASIONS>(pos, moveList);
 }
 
 } // namespace Stockfish
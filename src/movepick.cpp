@@ -19,6 +19,7 @@
 #include <cassert>
 
 #include "movepick.h"
+#include "thread.h"
 
 namespace Stockfish {
 
@@ -63,8 +64,13 @@ MovePicker::MovePicker(const Position& p, Move ttm, Depth d, const ButterflyHist
 
   assert(d > 0);
 
-  stage = (pos.checkers() ? EVASION_TT : MAIN_TT) +
-          !(ttm && pos.pseudo_legal(ttm));
+  bool ttOk = ttm && pos.pseudo_legal(ttm);
+
+  // A TT move that is not even pseudo legal here comes from a key collision
+  if (ttm && !ttOk)
+      ++pos.this_thread()->ttStats.collisions;
+
+  stage = (pos.checkers() ? EVASION_TT : MAIN_TT) + !(ttOk && pos.legal(ttm));
 }
 
 /// MovePicker constructor for quiescence search
@@ -77,7 +83,8 @@ MovePicker::MovePicker(const Position& p, Move ttm, Depth d, const ButterflyHist
   stage = (pos.checkers() ? EVASION_TT : QSEARCH_TT) +
           !(   ttm
             && (pos.checkers() || depth > DEPTH_QS_RECAPTURES || to_sq(ttm) == recaptureSquare)
-            && pos.pseudo_legal(ttm));
+            && pos.pseudo_legal(ttm)
+            && pos.legal(ttm));
 }
 
 /// MovePicker constructor for ProbCut: we generate captures with SEE greater
@@ -89,6 +96,7 @@ MovePicker::MovePicker(const Position& p, Move ttm, Value th, const CapturePiece
 
   stage = PROBCUT_TT + !(ttm && pos.capture(ttm)
                              && pos.pseudo_legal(ttm)
+                             && pos.legal(ttm)
                              && pos.see_ge(ttm, threshold));
 }
 
@@ -125,6 +133,40 @@ void MovePicker::score() {
       }
 }
 
+/// MovePicker::prefetch_child() prefetches the TT cluster of the position after
+/// the given move and, for pawn moves with 'make pawnprefetch=yes', its pawn
+/// table entry.
+void MovePicker::prefetch_child(Move m) const {
+
+  if (m == MOVE_NONE)
+      return;
+
+  prefetch(pos.this_thread()->tt->first_entry(pos.key_after(m)));
+
+#if defined(PAWN_PREFETCH)
+  if (type_of(pos.moved_piece(m)) == PAWN)
+      prefetch(pos.this_thread()->pawnsTable[pos.pawn_key_after(m)]);
+#endif
+}
+
+/// MovePicker::prefetch_ahead() prefetches the children of the moves following
+/// the current one, up to PrefetchDistance moves ahead. For the lists picked by
+/// score these moves are selected in advance, in the order select() would have
+/// picked them: each one is the first best of the moves left, so select() then
+/// finds it in place.
+template<MovePicker::PickType T>
+void MovePicker::prefetch_ahead() {
+
+  for (prefetched = std::max(prefetched, cur + 1);
+       prefetched < endMoves && prefetched <= cur + PrefetchDistance; ++prefetched)
+  {
+      if (T == Best)
+          std::swap(*prefetched, *std::max_element(prefetched, endMoves));
+
+      prefetch_child(*prefetched);
+  }
+}
+
 /// MovePicker::select() returns the next move satisfying a predicate function.
 /// It never returns the TT move.
 template<MovePicker::PickType T, typename Pred>
@@ -136,15 +178,40 @@ Move MovePicker::select(Pred filter) {
           std::swap(*cur, *std::max_element(cur, endMoves));
 
       if (*cur != ttMove && filter())
+      {
+          if (PrefetchDistance > 0)
+              prefetch_ahead<T>();
+
           return *cur++;
+      }
 
       cur++;
   }
   return MOVE_NONE;
 }
 
+/// MovePicker::picked_stage() returns the stage of the last move returned by
+/// next_move(). The TT move is returned once the stage has been moved to the
+/// generation of the other moves.
+PickStage MovePicker::picked_stage() const {
+
+  switch (stage) {
+
+  case CAPTURE_INIT: case EVASION_INIT: case PROBCUT_INIT: case QCAPTURE_INIT:
+      return PICK_TT;
+
+  case GOOD_CAPTURE: return PICK_GOOD_CAPTURE;
+  case REFUTATION:   return PICK_REFUTATION;
+  case QUIET:        return PICK_QUIET;
+  case BAD_CAPTURE:  return PICK_BAD_CAPTURE;
+  case EVASION:      return PICK_EVASION;
+  case PROBCUT:      return PICK_PROBCUT;
+  default:           return PICK_QSEARCH;
+  }
+}
+
 /// MovePicker::next_move() is the most important method of the MovePicker class. It
-/// returns a new pseudo-legal move every time it is called until there are no more
+/// returns a new legal move every time it is called until there are no more
 /// moves left, picking the move with the highest score from a list of generated moves.
 Move MovePicker::next_move(bool skipQuiets) {
 
@@ -161,7 +228,7 @@ top:
   case CAPTURE_INIT:
   case PROBCUT_INIT:
   case QCAPTURE_INIT:
-      cur = endBadCaptures = moves;
+      cur = endBadCaptures = prefetched = moves;
       endMoves = generate<CAPTURES>(pos, cur);
 
       score<CAPTURES>();
@@ -176,7 +243,7 @@ top:
           return *(cur - 1);
 
       // Prepare the pointers to loop over the refutations array
-      cur = std::begin(refutations);
+      cur = prefetched = std::begin(refutations);
       endMoves = std::end(refutations);
 
       // If the countermove is the same as a killer, skip it
@@ -190,7 +257,8 @@ top:
   case REFUTATION:
       if (select<Next>([&](){ return    *cur != MOVE_NONE
                                     && !pos.capture(*cur)
-                                    &&  pos.pseudo_legal(*cur); }))
+                                    &&  pos.pseudo_legal(*cur)
+                                    &&  pos.legal(*cur); }))
           return *(cur - 1);
       ++stage;
       [[fallthrough]];
@@ -198,7 +266,7 @@ top:
   case QUIET_INIT:
       if (!skipQuiets)
       {
-          cur = endBadCaptures;
+          cur = prefetched = endBadCaptures;
           endMoves = generate<QUIETS>(pos, cur);
 
           score<QUIETS>();
@@ -216,7 +284,7 @@ top:
           return *(cur - 1);
 
       // Prepare the pointers to loop over the bad captures
-      cur = moves;
+      cur = prefetched = moves;
       endMoves = endBadCaptures;
 
       ++stage;
@@ -226,7 +294,7 @@ top:
       return select<Next>([](){ return true; });
 
   case EVASION_INIT:
-      cur = moves;
+      cur = prefetched = moves;
       endMoves = generate<EVASIONS>(pos, cur);
 
       score<EVASIONS>();
@@ -252,7 +320,7 @@ top:
       [[fallthrough]];
 
   case QCHECK_INIT:
-      cur = moves;
+      cur = prefetched = moves;
       endMoves = generate<QUIET_CHECKS>(pos, cur);
 
       ++stage;
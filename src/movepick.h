@@ -54,13 +54,37 @@ public:
   }
 };
 
+/// StatsArray is the storage of one dimension of a Stats table. A dimension of
+/// PIECE_NB entries is always indexed by a piece, and with 'make compacthist=yes'
+/// it only stores the 13 values a piece can take: NO_PIECE, then the white and
+/// the black pieces. The continuation histories, by far the largest tables of a
+/// thread, are indexed by two pieces and shrink to (13/16)^2, about 66% of their
+/// size, i.e. 34% less, at the cost of one shift and sub per access. The layout
+/// of the other dimensions is unchanged.
+template <typename T, int Size>
+struct StatsArray : public std::array<T, Size> {};
+
+#if defined(COMPACT_HISTORY)
+template <typename T>
+struct StatsArray<T, PIECE_NB> : public std::array<T, 13>
+{
+  static constexpr int index(int pc) { return pc - 2 * (pc >> 3); }
+
+  T& operator[](int pc) { return std::array<T, 13>::operator[](index(pc)); }
+  const T& operator[](int pc) const { return std::array<T, 13>::operator[](index(pc)); }
+};
+
+static_assert(StatsArray<int, PIECE_NB>::index(W_KING) + 1 == StatsArray<int, PIECE_NB>::index(B_PAWN)
+           && StatsArray<int, PIECE_NB>::index(B_KING) == 12, "Wrong compact piece index");
+#endif
+
 /// Stats is a generic N-dimensional array used to store various statistics.
 /// The first template parameter T is the base type of the array, the second
 /// template parameter D limits the range of updates in [-D, D] when we update
 /// values with the << operator, while the last parameters (Size and Sizes)
 /// encode the dimensions of the array.
 template <typename T, int D, int Size, int... Sizes>
-struct Stats : public std::array<Stats<T, D, Sizes...>, Size>
+struct Stats : public StatsArray<Stats<T, D, Sizes...>, Size>
 {
   typedef Stats<T, D, Size, Sizes...> stats;
 
@@ -76,7 +100,7 @@ struct Stats : public std::array<Stats<T, D, Sizes...>, Size>
 };
 
 template <typename T, int D, int Size>
-struct Stats<T, D, Size> : public std::array<StatsEntry<T, D>, Size> {};
+struct Stats<T, D, Size> : public StatsArray<StatsEntry<T, D>, Size> {};
 
 /// In stats table, D=0 means that the template parameter is not used
 enum StatsParams { NOT_USED = 0 };
@@ -110,9 +134,28 @@ typedef Stats<int16_t, 29952, PIECE_NB, SQUARE_NB> PieceToHistory;
 typedef Stats<PieceToHistory, NOT_USED, PIECE_NB, SQUARE_NB> ContinuationHistory;
 
 
-/// MovePicker class is used to pick one pseudo-legal move at a time from the
-/// current position. The most important method is next_move(), which returns a
-/// new pseudo-legal move each time it is called, until there are no moves left,
+/// PickStage tells from which stage of the MovePicker a move comes, as counted
+/// by the search statistics.
+enum PickStage {
+  PICK_TT, PICK_GOOD_CAPTURE, PICK_REFUTATION, PICK_QUIET, PICK_BAD_CAPTURE,
+  PICK_EVASION, PICK_PROBCUT, PICK_QSEARCH, PICK_STAGE_NB
+};
+
+
+/// TT_PREFETCH_DISTANCE is the number of moves after the one returned by
+/// MovePicker::next_move() whose TT clusters are already prefetched, so that
+/// the cache misses of the next children overlap the search of the current one.
+/// It is off by default and set at compile time with 'make ttprefetch=2', and
+/// 'make pawnprefetch=yes' also prefetches the pawn table entries of pawn moves.
+
+#ifndef TT_PREFETCH_DISTANCE
+#define TT_PREFETCH_DISTANCE 0
+#endif
+
+
+/// MovePicker class is used to pick one legal move at a time from the current
+/// position. The most important method is next_move(), which returns a new
+/// legal move each time it is called, until there are no moves left,
 /// when MOVE_NONE is returned. In order to improve the efficiency of the
 /// alpha-beta algorithm, MovePicker attempts to return the moves which are most
 /// likely to get a cut-off first.
@@ -120,6 +163,8 @@ class MovePicker {
 
   enum PickType { Next, Best };
 
+  static constexpr int PrefetchDistance = TT_PREFETCH_DISTANCE;
+
 public:
   MovePicker(const MovePicker&) = delete;
   MovePicker& operator=(const MovePicker&) = delete;
@@ -136,9 +181,12 @@ public:
                                            const Move*,
                                            int);
   Move next_move(bool skipQuiets = false);
+  PickStage picked_stage() const;
 
 private:
   template<PickType T, typename Pred> Move select(Pred);
+  template<PickType T> void prefetch_ahead();
+  void prefetch_child(Move m) const;
   template<GenType> void score();
   ExtMove* begin() { return cur; }
   ExtMove* end() { return endMoves; }
@@ -150,6 +198,7 @@ private:
   const PieceToHistory** continuationHistory;
   Move ttMove;
   ExtMove refutations[3], *cur, *endMoves, *endBadCaptures;
+  ExtMove* prefetched; // Last move of the current list with its TT cluster prefetched
   int stage;
   Square recaptureSquare;
   Value threshold;
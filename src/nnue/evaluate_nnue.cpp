@@ -18,27 +18,48 @@
 
 // Code for calculating NNUE evaluation function
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <set>
 #include <sstream>
 #include <iomanip>
+#include <iterator>
 #include <fstream>
+#include <thread>
 
 #include "../evaluate.h"
 #include "../position.h"
 #include "../misc.h"
+#include "../movegen.h"
+#include "../thread.h"
 #include "../uci.h"
 #include "../types.h"
 
 #include "evaluate_nnue.h"
 
 namespace Stockfish::Eval::NNUE {
+NNUE_TARGET_BEGIN
 
-  // Input feature converter
-  LargePagePtr<FeatureTransformer> featureTransformer;
+  // Input feature converter and evaluation function. They point either to the
+  // parameters read from a stream or into a mapped network image, see load_image().
+  FeatureTransformer* featureTransformer;
+  Network* network[LayerStacks];
 
-  // Evaluation function
-  AlignedPtr<Network> network[LayerStacks];
+  // Parameters read from a stream
+  LargePagePtr<FeatureTransformer> featureTransformerStorage;
+  AlignedPtr<Network> networkStorage[LayerStacks];
+
+  // Mapped network image, if any
+  void* imageAddress;
+  std::uint64_t imageMapping;
+
+  // Copies of the network local to each NUMA node, see replicate()
+  struct Replica {
+    LargePagePtr<FeatureTransformer> featureTransformer;
+    AlignedPtr<Network> network[LayerStacks];
+  };
+  std::vector<std::unique_ptr<Replica>> replicas; // Indexed by node, may hold nullptr
 
   // Evaluation function file name
   std::string fileName;
@@ -85,9 +106,16 @@ namespace Stockfish::Eval::NNUE {
   // Initialize the evaluation function parameters
   void initialize() {
 
-    Detail::initialize(featureTransformer);
+    unmap_file(imageAddress, imageMapping);
+    imageAddress = nullptr;
+
+    Detail::initialize(featureTransformerStorage);
+    featureTransformer = featureTransformerStorage.get();
     for (std::size_t i = 0; i < LayerStacks; ++i)
-      Detail::initialize(network[i]);
+    {
+      Detail::initialize(networkStorage[i]);
+      network[i] = networkStorage[i].get();
+    }
   }
 
   // Read network header
@@ -114,28 +142,285 @@ namespace Stockfish::Eval::NNUE {
     return !stream.fail();
   }
 
-  // Read network parameters
+  // Read network parameters. The hash value of the header tells whether the
+  // net is a compact one, see FeatureTransformer::get_hash_value().
   bool read_parameters(std::istream& stream) {
 
     std::uint32_t hashValue;
     if (!read_header(stream, &hashValue, &netDescription)) return false;
-    if (hashValue != HashValue) return false;
-    if (!Detail::read_parameters(stream, *featureTransformer)) return false;
+    const bool compact = hashValue == CompactHashValue;
+    if (hashValue != HashValue && !compact) return false;
+    if (   read_little_endian<std::uint32_t>(stream) != FeatureTransformer::get_hash_value(compact)
+        || !featureTransformer->read_parameters(stream, compact)) return false;
     for (std::size_t i = 0; i < LayerStacks; ++i)
       if (!Detail::read_parameters(stream, *(network[i]))) return false;
     return stream && stream.peek() == std::ios::traits_type::eof();
   }
 
-  // Write network parameters
-  bool write_parameters(std::ostream& stream) {
+  // Write network parameters, as a compact net if requested
+  bool write_parameters(std::ostream& stream, bool compact) {
 
-    if (!write_header(stream, HashValue, netDescription)) return false;
-    if (!Detail::write_parameters(stream, *featureTransformer)) return false;
+    if (!write_header(stream, compact ? CompactHashValue : HashValue, netDescription)) return false;
+    write_little_endian<std::uint32_t>(stream, FeatureTransformer::get_hash_value(compact));
+    if (!featureTransformer->write_parameters(stream, compact)) return false;
     for (std::size_t i = 0; i < LayerStacks; ++i)
       if (!Detail::write_parameters(stream, *(network[i]))) return false;
     return (bool)stream;
   }
 
+  // A network image is the in-memory representation of the parameters, as built
+  // by read_parameters() for the instruction set of this build, so that it can
+  // be mapped and used in place. It starts with an ImageHeader followed by the
+  // net description, then the feature transformer and the LayerStacks networks,
+  // each section beginning at a multiple of ImageAlignment.
+  constexpr char ImageMagic[8] = { 'S', 'F', 'N', 'N', 'I', 'M', 'G', '\0' };
+  constexpr std::size_t ImageAlignment = 4096;
+
+  // Instruction set the parameters are laid out for
+  constexpr char ImageLayout[16] =
+  #if defined(USE_VNNI) && defined(USE_AVX512)
+      "vnni512";
+  #elif defined(USE_VNNI)
+      "vnni256";
+  #elif defined(USE_AVX512)
+      "avx512";
+  #elif defined(USE_AVX2)
+      "avx2";
+  #elif defined(USE_SSSE3)
+      "ssse3";
+  #elif defined(USE_SSE2)
+      "sse2";
+  #elif defined(USE_MMX)
+      "mmx";
+  #elif defined(USE_NEON)
+      "neon";
+  #else
+      "generic";
+  #endif
+
+  struct ImageHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t hashValue;
+    char layout[16];
+    std::uint64_t featureTransformerSize;
+    std::uint64_t networkSize;
+    std::uint64_t descriptionSize;
+  };
+
+  static_assert(std::is_trivially_copyable<FeatureTransformer>::value, "");
+  static_assert(std::is_trivially_copyable<Network>::value, "");
+  static_assert(alignof(FeatureTransformer) <= ImageAlignment && alignof(Network) <= ImageAlignment, "");
+
+  constexpr std::size_t FeatureTransformerImageSize = ceil_to_multiple(sizeof(FeatureTransformer), ImageAlignment);
+  constexpr std::size_t NetworkImageSize = ceil_to_multiple(sizeof(Network), ImageAlignment);
+
+  // Load a network image. Returns false, without changing the current net, if
+  // the file is not an image made by a build with the same layout.
+  bool load_image(std::string name, const std::string& path) {
+
+    std::size_t size;
+    std::uint64_t mapping;
+    char* data = static_cast<char*>(map_file(path, &size, &mapping));
+
+    if (!data)
+        return false;
+
+    ImageHeader h;
+    bool valid = size >= sizeof(h);
+
+    if (valid)
+    {
+        std::memcpy(&h, data, sizeof(h));
+        valid =   !std::memcmp(h.magic, ImageMagic, sizeof(ImageMagic))
+               && h.version == Version
+               && h.hashValue == HashValue
+               && !std::memcmp(h.layout, ImageLayout, sizeof(ImageLayout))
+               && h.featureTransformerSize == sizeof(FeatureTransformer)
+               && h.networkSize == sizeof(Network)
+               && h.descriptionSize <= size;
+    }
+
+    const std::size_t offset = valid ? ceil_to_multiple<std::size_t>(sizeof(h) + h.descriptionSize, ImageAlignment) : 0;
+
+    if (!valid || size != offset + FeatureTransformerImageSize + LayerStacks * NetworkImageSize)
+    {
+        unmap_file(data, mapping);
+        return false;
+    }
+
+    unmap_file(imageAddress, imageMapping);
+    featureTransformerStorage.reset();
+    for (std::size_t i = 0; i < LayerStacks; ++i)
+        networkStorage[i].reset();
+
+    imageAddress = data;
+    imageMapping = mapping;
+    featureTransformer = reinterpret_cast<FeatureTransformer*>(data + offset);
+    for (std::size_t i = 0; i < LayerStacks; ++i)
+        network[i] = reinterpret_cast<Network*>(data + offset + FeatureTransformerImageSize + i * NetworkImageSize);
+
+    fileName = name;
+    netDescription.assign(data + sizeof(h), h.descriptionSize);
+
+    // Cached accumulators and outputs were computed with the previous net
+    for (Thread* th : Threads)
+    {
+        th->accumulatorCache.valid = false;
+        th->nnueEvalCache.clear();
+    }
+
+    return true;
+  }
+
+  // Save the current net as a network image for this build
+  bool save_image(const std::string& path) {
+
+    if (fileName.empty())
+    {
+        sync_cout << "Failed to export a network image, no network is loaded" << sync_endl;
+        return false;
+    }
+
+    ImageHeader h {};
+    std::memcpy(h.magic, ImageMagic, sizeof(ImageMagic));
+    std::memcpy(h.layout, ImageLayout, sizeof(ImageLayout));
+    h.version = Version;
+    h.hashValue = HashValue;
+    h.featureTransformerSize = sizeof(FeatureTransformer);
+    h.networkSize = sizeof(Network);
+    h.descriptionSize = netDescription.size();
+
+    const std::size_t offset = ceil_to_multiple<std::size_t>(sizeof(h) + h.descriptionSize, ImageAlignment);
+
+    // Each section is padded with zeros up to the next one
+    auto write_padded = [](std::ostream& stream, const void* data, std::size_t size, std::size_t paddedSize) {
+      stream.write(static_cast<const char*>(data), size);
+      std::fill_n(std::ostreambuf_iterator<char>(stream), paddedSize - size, '\0');
+    };
+
+    std::ofstream stream(path, std::ios_base::binary);
+    stream.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    write_padded(stream, netDescription.data(), netDescription.size(), offset - sizeof(h));
+    write_padded(stream, featureTransformer, sizeof(FeatureTransformer), FeatureTransformerImageSize);
+    for (std::size_t i = 0; i < LayerStacks; ++i)
+        write_padded(stream, network[i], sizeof(Network), NetworkImageSize);
+
+    const bool saved = bool(stream);
+
+    sync_cout << (saved ? "Network image saved successfully to " + path
+                        : "Failed to export a network image") << sync_endl;
+    return saved;
+  }
+
+  // Replicate the network on every NUMA node the search threads are bound to,
+  // so that each thread reads its weights from node-local memory. Each copy is
+  // allocated and first touched by a helper thread bound to the target node.
+  void replicate() {
+
+    replicas.clear();
+
+    if (   !Options["NUMA Replicate NNUE"]
+        || !useNNUE
+        || eval_file_loaded != std::string(Options["EvalFile"]))
+        return;
+
+    // Index of the first thread bound to each node
+    std::vector<size_t> firstThread;
+    for (Thread* th : Threads)
+        if (th->numaNode >= 0)
+        {
+            if (size_t(th->numaNode) >= firstThread.size())
+                firstThread.resize(th->numaNode + 1, SIZE_MAX);
+
+            if (firstThread[th->numaNode] == SIZE_MAX)
+                firstThread[th->numaNode] = th->id();
+        }
+
+    if (std::count_if(firstThread.begin(), firstThread.end(),
+                      [](size_t idx) { return idx != SIZE_MAX; }) < 2)
+        return;
+
+    replicas.resize(firstThread.size());
+
+    for (std::size_t node = 0; node < firstThread.size(); ++node)
+        if (firstThread[node] != SIZE_MAX)
+            std::thread([&]() {
+                WinProcGroup::bindThisThread(firstThread[node]);
+
+                auto r = std::make_unique<Replica>();
+                Detail::initialize(r->featureTransformer);
+                std::memcpy(r->featureTransformer.get(), featureTransformer, sizeof(FeatureTransformer));
+                for (std::size_t i = 0; i < LayerStacks; ++i)
+                {
+                    Detail::initialize(r->network[i]);
+                    std::memcpy(r->network[i].get(), network[i], sizeof(Network));
+                }
+                replicas[node] = std::move(r);
+            }).join();
+  }
+
+  // Report the memory used by the net, for the 'memory' command: the parameters,
+  // or the mapped image, and the NUMA replicas.
+  std::vector<MemoryUsage> memory_usage() {
+
+    std::vector<MemoryUsage> usage;
+
+    auto add = [&](const std::string& name, LargePagePtr<FeatureTransformer>& ft, AlignedPtr<Network>* net) {
+      // A compact net uses half of its weights array, the memory is the same
+      MemoryUsage ftUsage = { name + " feature transformer" + (ft->compact() ? " (compact)" : ""),
+                              sizeof(FeatureTransformer),
+                              large_page_bytes(ft.get(), sizeof(FeatureTransformer)) };
+      MemoryUsage netUsage = { name + " networks", LayerStacks * sizeof(Network), 0 };
+
+      for (std::size_t i = 0; i < LayerStacks; ++i)
+          netUsage.largePages += large_page_bytes(net[i].get(), sizeof(Network));
+
+      usage.push_back(ftUsage);
+      usage.push_back(netUsage);
+    };
+
+    if (featureTransformerStorage)
+        add("NNUE", featureTransformerStorage, networkStorage);
+
+    if (imageAddress)
+    {
+        const std::size_t size = FeatureTransformerImageSize + LayerStacks * NetworkImageSize;
+        usage.push_back({ "NNUE network image (mapped)", size, large_page_bytes(imageAddress, size) });
+    }
+
+    for (std::size_t node = 0; node < replicas.size(); ++node)
+        if (replicas[node])
+            add("NNUE replica node " + std::to_string(node),
+                replicas[node]->featureTransformer, replicas[node]->network);
+
+    return usage;
+  }
+
+  // Returns the copy of the network local to the thread owning pos, if any
+  inline const Replica* local_replica(const Position& pos) {
+
+    const Thread* th = pos.this_thread();
+    return th && th->numaNode >= 0 && size_t(th->numaNode) < replicas.size()
+          ? replicas[th->numaNode].get() : nullptr;
+  }
+
+  // Returns the accumulator refresh cache of the thread owning pos, if any
+  inline AccumulatorCache* refresh_cache(const Position& pos) {
+
+    Thread* th = pos.this_thread();
+    return th ? &th->accumulatorCache : nullptr;
+  }
+
+  // Prefetch the weights needed by the next accumulator update of pos, see
+  // Position::do_move()
+  void prefetch_update(const Position& pos) {
+
+    const Replica* r = local_replica(pos);
+    if (const FeatureTransformer* ft = r ? r->featureTransformer.get() : featureTransformer)
+        ft->prefetch_update(pos);
+  }
+
   // Evaluation function. Perform differential calculation.
   Value evaluate(const Position& pos, bool adjusted) {
 
@@ -160,12 +445,40 @@ namespace Stockfish::Eval::NNUE {
     ASSERT_ALIGNED(transformedFeatures, alignment);
     ASSERT_ALIGNED(buffer, alignment);
 
-    const std::size_t bucket = (pos.count<ALL_PIECES>() - 1) / 4;
-    const auto psqt = featureTransformer->transform(pos, transformedFeatures, bucket);
-    const auto output = network[bucket]->propagate(transformedFeatures, buffer);
+    int materialist, positional;
+
+    // The output of the net may be in the eval cache of the thread
+    Thread* th = pos.this_thread();
+    EvalCacheEntry* e = th ? th->nnueEvalCache[pos.key()] : nullptr;
+    const bool cacheHit = e && e->key == pos.key();
+
+    if (th)
+    {
+        if (cacheHit)
+            SEARCH_STAT(th, evalCacheHits);
+        else
+            SEARCH_STAT(th, evalCacheMisses);
+    }
+
+    if (cacheHit)
+    {
+        materialist = e->psqt;
+        positional  = e->positional;
+    }
+    else
+    {
+        const Replica* r = local_replica(pos);
+        const std::size_t bucket = (pos.count<ALL_PIECES>() - 1) / 4;
+        const auto psqt = (r ? r->featureTransformer.get() : featureTransformer)->transform(
+            pos, transformedFeatures, bucket, refresh_cache(pos));
+        const auto output = (r ? r->network[bucket].get() : network[bucket])->propagate(transformedFeatures, buffer);
 
-    int materialist = psqt;
-    int positional  = output[0];
+        materialist = psqt;
+        positional  = output[0];
+
+        if (e)
+            *e = { pos.key(), materialist, positional };
+    }
 
     int delta_npm = abs(pos.non_pawn_material(WHITE) - pos.non_pawn_material(BLACK));
     int entertainment = (adjusted && delta_npm <= BishopValueMg - KnightValueMg ? 7 : 0);
@@ -178,6 +491,234 @@ namespace Stockfish::Eval::NNUE {
     return static_cast<Value>( sum / OutputScale );
   }
 
+  // Positions of a batch of evaluate_batch(), which share a layer stack
+  constexpr std::size_t BatchSize = 32;
+
+  // Evaluation of many positions at once. Positions are grouped by layer stack,
+  // and each group goes through the network as a batch, see the batched
+  // AffineTransform::propagate(). The feature transformer and the sparse first
+  // layer still work one position at a time. Values are those of
+  // evaluate(pos, false).
+  void evaluate_batch(const Position* const* positions, Value* values, std::size_t count) {
+
+    // Features and buffer of one position, a batch is an array of them
+    struct alignas(CacheLineSize) Slot {
+      TransformedFeatureType transformedFeatures[FeatureTransformer::BufferSize];
+      char buffer[Network::BufferSize];
+    };
+
+    std::vector<Slot> slots(BatchSize);
+    std::int32_t psqt[BatchSize];
+
+    auto bucket_of = [&](std::size_t i) { return std::size_t(positions[i]->count<ALL_PIECES>() - 1) / 4; };
+
+    std::vector<std::size_t> order(count);
+    for (std::size_t i = 0; i < count; ++i)
+        order[i] = i;
+
+    std::stable_sort(order.begin(), order.end(),
+                     [&](std::size_t a, std::size_t b) { return bucket_of(a) < bucket_of(b); });
+
+    for (std::size_t start = 0, n; start < count; start += n)
+    {
+        const std::size_t bucket = bucket_of(order[start]);
+
+        for (n = 0; n < BatchSize && start + n < count && bucket_of(order[start + n]) == bucket; ++n)
+        {
+            const Position& pos = *positions[order[start + n]];
+            psqt[n] = featureTransformer->transform(pos, slots[n].transformedFeatures,
+                                                    bucket, refresh_cache(pos));
+        }
+
+        const auto output = reinterpret_cast<const char*>(network[bucket]->propagate(
+            slots[0].transformedFeatures, slots[0].buffer, n, sizeof(Slot)));
+
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const int positional = reinterpret_cast<const Network::OutputType*>(output + i * sizeof(Slot))[0];
+            values[order[start + i]] = static_cast<Value>((psqt[i] + positional) / OutputScale);
+        }
+    }
+  }
+
+  // Appends the name of each layer of the network, from the first hidden layer
+  // to the output layer, with the time taken by time_layer(get) for the layer
+  // returned by get() from a network.
+  template <typename Get, typename TimeLayer>
+  void time_layers(Get get, TimeLayer time_layer, std::vector<std::pair<std::string, double>>& layers) {
+
+    using Layer = std::remove_cv_t<std::remove_reference_t<decltype(get(std::declval<const Network&>()))>>;
+
+    if constexpr (!std::is_same_v<Layer, Layers::InputLayer>)
+    {
+        time_layers([get](const Network& net) -> decltype(auto) { return get(net).previous_layer(); },
+                    time_layer, layers);
+        layers.emplace_back(Layer::get_name(), time_layer(get));
+    }
+  }
+
+  // Times each part of the evaluation over the given positions, 'iterations'
+  // calls per position, for the 'nnuebench' command: the refresh of the
+  // accumulators from scratch and from the refresh cache, their incremental
+  // update after a move, the conversion of the accumulators to the input of the
+  // network, and the propagation through each layer and through the network.
+  std::string benchmark(const std::vector<std::string>& fens, int iterations) {
+
+    using Clock = std::chrono::steady_clock;
+
+    // Features and buffer of one position
+    struct alignas(CacheLineSize) Slot {
+      TransformedFeatureType transformedFeatures[FeatureTransformer::BufferSize];
+      char buffer[Network::BufferSize];
+    };
+
+    const std::size_t count = fens.size();
+    std::vector<Position> positions(count), children(count);
+    std::vector<StateInfo> states(count), childStates(2 * count);
+    std::vector<Accumulator> accumulators(3 * count); // Laid out as the states
+    std::vector<std::size_t> buckets(count), moved;
+    std::vector<Slot> slots(count);
+    auto cache = std::make_unique<AccumulatorCache>();
+    std::int64_t sink = 0; // Sum of the results, so that no call is optimized away
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        positions[i].set(fens[i], false, &states[i], Threads.main());
+        states[i].accumulator = &accumulators[i];
+        buckets[i] = std::size_t(positions[i].count<ALL_PIECES>() - 1) / 4;
+
+        // The incremental update is timed after the first legal move that does
+        // not move the king, from the accumulators of the parent position.
+        for (const auto& m : MoveList<LEGAL>(positions[i]))
+            if (type_of(positions[i].moved_piece(m)) != KING)
+            {
+                children[i].set(fens[i], false, &childStates[2 * i], Threads.main());
+                childStates[2 * i].accumulator = &accumulators[count + 2 * i];
+                sink += featureTransformer->transform(children[i], slots[i].transformedFeatures, buckets[i]);
+                children[i].do_move(m, childStates[2 * i + 1]);
+                moved.push_back(i);
+                break;
+            }
+    }
+
+    // Total time in ns of 'iterations' calls of f(i) for each i in 'indices',
+    // after an untimed call for each to warm up the caches.
+    auto time = [&](const std::vector<std::size_t>& indices, auto f) {
+      for (std::size_t i : indices)
+          f(i);
+
+      const auto start = Clock::now();
+      for (int it = 0; it < iterations; ++it)
+          for (std::size_t i : indices)
+              f(i);
+      return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    };
+
+    std::vector<std::size_t> all(count);
+    for (std::size_t i = 0; i < count; ++i)
+        all[i] = i;
+
+    auto reset = [](StateInfo* st) {
+      st->accumulator->computed[WHITE] = st->accumulator->computed[BLACK] = false;
+    };
+
+    const double refresh = time(all, [&](std::size_t i) {
+      reset(positions[i].state());
+      sink += featureTransformer->transform(positions[i], slots[i].transformedFeatures, buckets[i]);
+    });
+
+    cache->valid = false;
+    const double refreshCache = time(all, [&](std::size_t i) {
+      reset(positions[i].state());
+      sink += featureTransformer->transform(positions[i], slots[i].transformedFeatures, buckets[i], cache.get());
+    });
+
+    const double update = time(moved, [&](std::size_t i) {
+      reset(children[i].state());
+      sink += featureTransformer->transform(children[i], slots[i].transformedFeatures, buckets[i]);
+    });
+
+    // The accumulators are now computed and transform() only converts them
+    const double convert = time(all, [&](std::size_t i) {
+      sink += featureTransformer->transform(positions[i], slots[i].transformedFeatures, buckets[i]);
+    });
+
+    // Each layer is timed on its own, from the output of the previous layer
+    std::vector<std::pair<std::string, double>> layers;
+    time_layers([](const Network& net) -> const Network& { return net; },
+                [&](auto get) {
+                  using Layer = std::remove_cv_t<std::remove_reference_t<decltype(get(*network[0]))>>;
+
+                  std::vector<const typename Layer::InputType*> inputs(count);
+                  for (std::size_t i = 0; i < count; ++i)
+                      inputs[i] = get(*network[buckets[i]]).previous_layer().propagate(
+                                      slots[i].transformedFeatures, slots[i].buffer + Layer::SelfBufferSize);
+
+                  return time(all, [&](std::size_t i) {
+                    sink += get(*network[buckets[i]]).forward(inputs[i], slots[i].buffer)[0];
+                  });
+                }, layers);
+
+    const double propagate = time(all, [&](std::size_t i) {
+      sink += network[buckets[i]]->propagate(slots[i].transformedFeatures, slots[i].buffer)[0];
+    });
+
+    // The same propagation in batches of positions of the same layer stack, as
+    // evaluate_batch() makes them
+    std::vector<std::size_t> order(all);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](std::size_t a, std::size_t b) { return buckets[a] < buckets[b]; });
+
+    std::vector<Slot> sorted(count);
+    std::vector<std::size_t> batchStart, batches;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        sorted[i] = slots[order[i]];
+        if (   batchStart.empty()
+            || i - batchStart.back() == BatchSize
+            || buckets[order[i]] != buckets[order[batchStart.back()]])
+            batches.push_back(batchStart.size()), batchStart.push_back(i);
+    }
+    batchStart.push_back(count);
+
+    const double batched = time(batches, [&](std::size_t b) {
+      const std::size_t first = batchStart[b];
+      sink += network[buckets[order[first]]]->propagate(sorted[first].transformedFeatures, sorted[first].buffer,
+                                                       batchStart[b + 1] - first, sizeof(Slot))[0];
+    });
+
+    std::stringstream ss;
+    const double calls = double(iterations) * count;
+
+    auto row = [&](const std::string& name, double ns, double n) {
+      ss << std::setw(36) << std::left << name << std::right << std::fixed
+         << std::setw(12) << std::setprecision(1) << (n ? ns / n : 0.0)
+         << std::setw(14) << std::setprecision(0) << (ns > 0 ? 1e9 * n / ns : 0.0) << "\n";
+    };
+
+    ss << "NNUE benchmark: " << count << " positions, " << iterations << " iterations\n"
+       << "Refreshes and updates are for both perspectives, Transform converts computed\n"
+       << "accumulators, Network is the propagation through all the layers, one position\n"
+       << "at a time or batched by up to " << BatchSize << " positions of the same layer stack\n\n"
+       << std::setw(36) << std::left << "Stage" << std::right
+       << std::setw(12) << "ns/call" << std::setw(14) << "calls/s" << "\n";
+
+    row("Refresh",            refresh - convert, calls);
+    row("Refresh from cache", refreshCache - convert, calls);
+    row("Incremental update", update - convert * moved.size() / count, double(iterations) * moved.size());
+    row("Transform",          convert, calls);
+
+    for (const auto& [name, ns] : layers)
+        row(name, ns, calls);
+
+    row("Network", propagate, calls);
+    row("Network, batched", batched, calls);
+
+    ss << "\nChecksum: " << sink;
+
+    return ss.str();
+  }
+
   struct NnueEvalTrace {
     static_assert(LayerStacks == PSQTBuckets);
 
@@ -212,7 +753,7 @@ namespace Stockfish::Eval::NNUE {
     NnueEvalTrace t{};
     t.correctBucket = (pos.count<ALL_PIECES>() - 1) / 4;
     for (std::size_t bucket = 0; bucket < LayerStacks; ++bucket) {
-      const auto psqt = featureTransformer->transform(pos, transformedFeatures, bucket);
+      const auto psqt = featureTransformer->transform(pos, transformedFeatures, bucket, refresh_cache(pos));
       const auto output = network[bucket]->propagate(transformedFeatures, buffer);
 
       int materialist = psqt;
@@ -315,16 +856,16 @@ namespace Stockfish::Eval::NNUE {
           auto st = pos.state();
 
           pos.remove_piece(sq);
-          st->accumulator.computed[WHITE] = false;
-          st->accumulator.computed[BLACK] = false;
+          if (st->accumulator)
+              st->accumulator->computed[WHITE] = st->accumulator->computed[BLACK] = false;
 
           Value eval = evaluate(pos);
           eval = pos.side_to_move() == WHITE ? eval : -eval;
           v = base - eval;
 
           pos.put_piece(pc, sq);
-          st->accumulator.computed[WHITE] = false;
-          st->accumulator.computed[BLACK] = false;
+          if (st->accumulator)
+              st->accumulator->computed[WHITE] = st->accumulator->computed[BLACK] = false;
         }
 
         writeSquare(f, r, pc, v);
@@ -374,20 +915,35 @@ namespace Stockfish::Eval::NNUE {
 
     initialize();
     fileName = name;
-    return read_parameters(stream);
+
+    // Cached accumulators and outputs were computed with the previous net
+    for (Thread* th : Threads)
+    {
+        th->accumulatorCache.valid = false;
+        th->nnueEvalCache.clear();
+    }
+
+    if (!read_parameters(stream))
+        return false;
+
+    if (huge_page_size())
+        sync_cout << "info string NNUE feature transformer in "
+                  << page_report(featureTransformer, sizeof(FeatureTransformer)) << sync_endl;
+
+    return true;
   }
 
   // Save eval, to a file stream or a memory stream
-  bool save_eval(std::ostream& stream) {
+  bool save_eval(std::ostream& stream, bool compact) {
 
     if (fileName.empty())
       return false;
 
-    return write_parameters(stream);
+    return write_parameters(stream, compact);
   }
 
   /// Save eval, to a file given by its name
-  bool save_eval(const std::optional<std::string>& filename) {
+  bool save_eval(const std::optional<std::string>& filename, bool compact) {
 
     std::string actualFilename;
     std::string msg;
@@ -407,14 +963,15 @@ namespace Stockfish::Eval::NNUE {
     }
 
     std::ofstream stream(actualFilename, std::ios_base::binary);
-    bool saved = save_eval(stream);
+    bool saved = save_eval(stream, compact);
 
     msg = saved ? "Network saved successfully to " + actualFilename
-                : "Failed to export a net";
+        : compact ? "Failed to export a compact net, some weights do not fit in 8 bits"
+                  : "Failed to export a net";
 
     sync_cout << msg << sync_endl;
     return saved;
   }
 
-
+NNUE_TARGET_END
 } // namespace Stockfish::Eval::NNUE
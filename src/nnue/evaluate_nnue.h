@@ -26,11 +26,24 @@
 #include <memory>
 
 namespace Stockfish::Eval::NNUE {
+NNUE_TARGET_BEGIN
 
   // Hash value of evaluation function structure
   constexpr std::uint32_t HashValue =
       FeatureTransformer::get_hash_value() ^ Network::get_hash_value();
 
+  // Hash value of a compact net, see FeatureTransformer::get_hash_value()
+  constexpr std::uint32_t CompactHashValue =
+      FeatureTransformer::get_hash_value(true) ^ Network::get_hash_value();
+
+#if defined(NNUE_TARGET)
+  // Each copy defines the entry points declared in evaluate.h, which forward to
+  // the copy selected at startup, see nnue_dispatch.cpp
+  Value evaluate(const Position& pos, bool adjusted = false);
+#endif
+
+NNUE_TARGET_END
+
   // Deleter for automating release of memory area
   template <typename T>
   struct AlignedDeleter {
@@ -70,6 +70,33 @@ namespace Stockfish::Eval::NNUE::Features {
     }
   }
 
+  // append_changed_indices() : get a list of indices for the features of the
+  // pieces that were added to or removed from the given bitboards to get the
+  // position. Used to refresh an accumulator from a cached one.
+
+  void HalfKAv2::append_changed_indices(
+    const Position& pos,
+    Color perspective,
+    const Bitboard byColorBB[COLOR_NB],
+    const Bitboard byTypeBB[PIECE_TYPE_NB],
+    ValueListInserter<IndexType> removed,
+    ValueListInserter<IndexType> added
+  ) {
+    Square ksq = orient(perspective, pos.square<KING>(perspective));
+    for (Color c : { WHITE, BLACK })
+      for (PieceType pt = PAWN; pt <= KING; ++pt)
+      {
+        Piece pc = make_piece(c, pt);
+        Bitboard oldBB = byColorBB[c] & byTypeBB[pt];
+        Bitboard newBB = pos.pieces(c, pt);
+
+        for (Bitboard b = oldBB & ~newBB; b; )
+          removed.push_back(make_index(perspective, pop_lsb(b), pc, ksq));
+        for (Bitboard b = newBB & ~oldBB; b; )
+          added.push_back(make_index(perspective, pop_lsb(b), pc, ksq));
+      }
+  }
+
   int HalfKAv2::update_cost(StateInfo* st) {
     return st->dirtyPiece.dirty_num;
   }
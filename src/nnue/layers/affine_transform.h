@@ -22,9 +22,12 @@
 #define NNUE_LAYERS_AFFINE_TRANSFORM_H_INCLUDED
 
 #include <iostream>
+#include <string>
 #include "../nnue_common.h"
 
-namespace Stockfish::Eval::NNUE::Layers {
+namespace Stockfish::Eval::NNUE {
+NNUE_TARGET_BEGIN
+namespace Layers {
 
   // Affine transformation layer
   template <typename PreviousLayer, IndexType OutDims>
@@ -64,6 +67,15 @@ namespace Stockfish::Eval::NNUE::Layers {
       return hashValue;
     }
 
+    // Name of the layer, as shown by 'nnuebench'
+    static std::string get_name() {
+      return "AffineTransform[" + std::to_string(OutputDimensions) + "<-"
+                                + std::to_string(InputDimensions) + "]";
+    }
+
+    // Layer giving the input of this one
+    const PreviousLayer& previous_layer() const { return previousLayer; }
+
     // Read network parameters
     bool read_parameters(std::istream& stream) {
       if (!previousLayer.read_parameters(stream)) return false;
@@ -114,6 +126,36 @@ namespace Stockfish::Eval::NNUE::Layers {
         const TransformedFeatureType* transformedFeatures, char* buffer) const {
       const auto input = previousLayer.propagate(
           transformedFeatures, buffer + SelfBufferSize);
+      return forward(input, buffer);
+    }
+
+    // Forward propagation of a batch of positions, one layer at a time. The
+    // layer computes the product of its weights with the matrix of the inputs,
+    // BatchColumns columns at a time, see forward(). The features and the buffer
+    // of each position are 'stride' bytes after those of the previous one.
+    const OutputType* propagate(
+        const TransformedFeatureType* transformedFeatures, char* buffer,
+        std::size_t count, std::size_t stride) const {
+      const auto input = reinterpret_cast<const char*>(previousLayer.propagate(
+          transformedFeatures, buffer + SelfBufferSize, count, stride));
+
+      std::size_t i = 0;
+      if constexpr (BatchColumns > 1)
+          for ( ; i + BatchColumns <= count; i += BatchColumns)
+              forward<BatchColumns>(reinterpret_cast<const InputType*>(input + i * stride), buffer + i * stride, stride);
+      for ( ; i < count; ++i)
+          forward(reinterpret_cast<const InputType*>(input + i * stride), buffer + i * stride);
+
+      return reinterpret_cast<const OutputType*>(buffer);
+    }
+
+    // Output of this layer from the output of the previous one, for N positions
+    // whose inputs and buffers are 'stride' bytes apart. The batched kernel loads
+    // each weight vector once for the N positions, see BatchColumns.
+    template <std::size_t N = 1>
+    const OutputType* forward(const InputType* input, char* buffer, [[maybe_unused]] std::size_t stride = 0) const {
+
+      static_assert(N == 1 || N == BatchColumns);
 
 #if defined (USE_AVX512)
 
@@ -265,22 +307,36 @@ namespace Stockfish::Eval::NNUE::Layers {
       {
           constexpr IndexType NumChunks = InputDimensions / 4;
 
-          const auto input32 = reinterpret_cast<const std::int32_t*>(input);
-          vec_t* outptr = reinterpret_cast<vec_t*>(output);
-          std::memcpy(output, biases, OutputDimensions * sizeof(OutputType));
+          const std::int32_t* input32[N];
+          vec_t* outptr[N];
+
+          for (std::size_t k = 0; k < N; ++k)
+          {
+              input32[k] = reinterpret_cast<const std::int32_t*>(reinterpret_cast<const char*>(input) + k * stride);
+              outptr[k] = reinterpret_cast<vec_t*>(buffer + k * stride);
+              std::memcpy(outptr[k], biases, OutputDimensions * sizeof(OutputType));
+          }
 
           for (int i = 0; i < (int)NumChunks - 3; i += 4)
           {
-              const vec_t in0 = vec_set_32(input32[i + 0]);
-              const vec_t in1 = vec_set_32(input32[i + 1]);
-              const vec_t in2 = vec_set_32(input32[i + 2]);
-              const vec_t in3 = vec_set_32(input32[i + 3]);
+              vec_t in0[N], in1[N], in2[N], in3[N];
+              for (std::size_t k = 0; k < N; ++k)
+              {
+                  in0[k] = vec_set_32(input32[k][i + 0]);
+                  in1[k] = vec_set_32(input32[k][i + 1]);
+                  in2[k] = vec_set_32(input32[k][i + 2]);
+                  in3[k] = vec_set_32(input32[k][i + 3]);
+              }
               const auto col0 = reinterpret_cast<const vec_t*>(&weights[(i + 0) * OutputDimensions * 4]);
               const auto col1 = reinterpret_cast<const vec_t*>(&weights[(i + 1) * OutputDimensions * 4]);
               const auto col2 = reinterpret_cast<const vec_t*>(&weights[(i + 2) * OutputDimensions * 4]);
               const auto col3 = reinterpret_cast<const vec_t*>(&weights[(i + 3) * OutputDimensions * 4]);
               for (int j = 0; j * OutputSimdWidth < OutputDimensions; ++j)
-                  vec_add_dpbusd_32x4(outptr[j], in0, col0[j], in1, col1[j], in2, col2[j], in3, col3[j]);
+              {
+                  const vec_t w0 = col0[j], w1 = col1[j], w2 = col2[j], w3 = col3[j];
+                  for (std::size_t k = 0; k < N; ++k)
+                      vec_add_dpbusd_32x4(outptr[k][j], in0[k], w0, in1[k], w1, in2[k], w2, in3[k], w3);
+              }
           }
       }
       else if constexpr (OutputDimensions == 1)
@@ -424,12 +480,22 @@ namespace Stockfish::Eval::NNUE::Layers {
     using BiasType = OutputType;
     using WeightType = std::int8_t;
 
+    // Number of positions of a batch per call of forward(). Only the SSSE3 kernel
+    // of the layers with many outputs has a batched form.
+#if defined (USE_SSSE3)
+    static constexpr std::size_t BatchColumns = OutputDimensions % OutputSimdWidth == 0 ? 4 : 1;
+#else
+    static constexpr std::size_t BatchColumns = 1;
+#endif
+
     PreviousLayer previousLayer;
 
     alignas(CacheLineSize) BiasType biases[OutputDimensions];
     alignas(CacheLineSize) WeightType weights[OutputDimensions * PaddedInputDimensions];
   };
 
-}  // namespace Stockfish::Eval::NNUE::Layers
+}  // namespace Layers
+NNUE_TARGET_END
+}  // namespace Stockfish::Eval::NNUE
 
 #endif // #ifndef NNUE_LAYERS_AFFINE_TRANSFORM_H_INCLUDED
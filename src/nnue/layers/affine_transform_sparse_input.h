@@ -0,0 +1,343 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Definition of layer AffineTransformSparseInput of NNUE evaluation function
+
+#ifndef NNUE_LAYERS_AFFINE_TRANSFORM_SPARSE_INPUT_H_INCLUDED
+#define NNUE_LAYERS_AFFINE_TRANSFORM_SPARSE_INPUT_H_INCLUDED
+
+#include <array>
+#include <iostream>
+#include <string>
+
+#include "../../bitboard.h"
+#include "../nnue_common.h"
+#include "affine_transform.h"
+
+namespace Stockfish::Eval::NNUE {
+NNUE_TARGET_BEGIN
+namespace Layers {
+
+#if !defined (USE_SSSE3)
+
+  // Without SSSE3 the weights keep the dense layout, and the sparse layer is
+  // the plain affine transformation.
+  template <typename PreviousLayer, IndexType OutDims>
+  using AffineTransformSparseInput = AffineTransform<PreviousLayer, OutDims>;
+
+#else
+
+  // For each byte, the positions of its set bits, used to turn a bitmask of the
+  // nonzero input blocks into a list of their indices.
+  alignas(CacheLineSize) inline constexpr std::array<std::array<std::uint16_t, 8>, 256> NnzLookup = [] {
+    std::array<std::array<std::uint16_t, 8>, 256> v{};
+    for (unsigned i = 0; i < 256; ++i)
+        for (unsigned b = 0, k = 0; b < 8; ++b)
+            if (i & (1 << b))
+                v[i][k++] = std::uint16_t(b);
+    return v;
+  }();
+
+  // Affine transformation layer for an input with many zeros, as the output of
+  // the feature transformer after its clipped ReLU. The inputs are processed by
+  // blocks of 4 bytes: the nonzero blocks are found with SIMD comparisons and
+  // only their weight columns are accumulated. The weights are stored in the
+  // same order as AffineTransform with SSSE3, so that a block of 4 inputs maps
+  // to a contiguous column of OutputDimensions * 4 weights, and the file format
+  // and hash value are the same as those of AffineTransform.
+  template <typename PreviousLayer, IndexType OutDims>
+  class AffineTransformSparseInput {
+   public:
+    // Input/output type
+    using InputType = typename PreviousLayer::OutputType;
+    using OutputType = std::int32_t;
+    static_assert(std::is_same<InputType, std::uint8_t>::value, "");
+
+    // Number of input/output dimensions
+    static constexpr IndexType InputDimensions =
+        PreviousLayer::OutputDimensions;
+    static constexpr IndexType OutputDimensions = OutDims;
+    static constexpr IndexType PaddedInputDimensions =
+        ceil_to_multiple<IndexType>(InputDimensions, MaxSimdWidth);
+#if defined (USE_AVX512)
+    static constexpr const IndexType OutputSimdWidth = SimdWidth / 2;
+#else
+    static constexpr const IndexType OutputSimdWidth = SimdWidth / 4;
+#endif
+
+    // Number of blocks of 4 inputs
+    static constexpr IndexType NumBlocks = PaddedInputDimensions / 4;
+
+    static_assert(OutputDimensions % OutputSimdWidth == 0, "");
+    static_assert(NumBlocks % 16 == 0, "");
+
+    // Size of forward propagation buffer used in this layer
+    static constexpr std::size_t SelfBufferSize =
+        ceil_to_multiple(OutputDimensions * sizeof(OutputType), CacheLineSize);
+
+    // Size of the forward propagation buffer used from the input layer to this layer
+    static constexpr std::size_t BufferSize =
+        PreviousLayer::BufferSize + SelfBufferSize;
+
+    // Hash value embedded in the evaluation file
+    static constexpr std::uint32_t get_hash_value() {
+      return AffineTransform<PreviousLayer, OutDims>::get_hash_value();
+    }
+
+    // Name of the layer, as shown by 'nnuebench'
+    static std::string get_name() {
+      return "AffineTransformSparseInput[" + std::to_string(OutputDimensions) + "<-"
+                                           + std::to_string(InputDimensions) + "]";
+    }
+
+    // Layer giving the input of this one
+    const PreviousLayer& previous_layer() const { return previousLayer; }
+
+    // Read network parameters
+    bool read_parameters(std::istream& stream) {
+      if (!previousLayer.read_parameters(stream)) return false;
+      for (std::size_t i = 0; i < OutputDimensions; ++i)
+          biases[i] = read_little_endian<BiasType>(stream);
+      for (std::size_t i = 0; i < OutputDimensions * PaddedInputDimensions; ++i)
+          weights[get_weight_index(i)] = read_little_endian<WeightType>(stream);
+
+      return !stream.fail();
+    }
+
+    // Write network parameters
+    bool write_parameters(std::ostream& stream) const {
+      if (!previousLayer.write_parameters(stream)) return false;
+      for (std::size_t i = 0; i < OutputDimensions; ++i)
+          write_little_endian<BiasType>(stream, biases[i]);
+      for (std::size_t i = 0; i < OutputDimensions * PaddedInputDimensions; ++i)
+          write_little_endian<WeightType>(stream, weights[get_weight_index(i)]);
+
+      return !stream.fail();
+    }
+
+    // Forward propagation
+    const OutputType* propagate(
+        const TransformedFeatureType* transformedFeatures, char* buffer) const {
+      const auto input = previousLayer.propagate(
+          transformedFeatures, buffer + SelfBufferSize);
+      return forward(input, buffer);
+    }
+
+    // Forward propagation of a batch, see AffineTransform
+    const OutputType* propagate(
+        const TransformedFeatureType* transformedFeatures, char* buffer,
+        std::size_t count, std::size_t stride) const {
+      const auto input = reinterpret_cast<const char*>(previousLayer.propagate(
+          transformedFeatures, buffer + SelfBufferSize, count, stride));
+
+      for (std::size_t i = 0; i < count; ++i)
+          forward(reinterpret_cast<const InputType*>(input + i * stride), buffer + i * stride);
+
+      return reinterpret_cast<const OutputType*>(buffer);
+    }
+
+   private:
+    // Position of the i-th weight of the file (row major) in the weights array
+    static constexpr std::size_t get_weight_index(std::size_t i) {
+      return (i / 4) % (PaddedInputDimensions / 4) * OutputDimensions * 4
+            + i / PaddedInputDimensions * 4
+            + i % 4;
+    }
+
+    // Write the indices of the nonzero blocks of 4 inputs to 'nnz', in
+    // increasing order, and return their number. Up to 7 entries past the
+    // returned count may be overwritten.
+    static IndexType find_nnz(const std::int32_t* input, std::uint16_t* nnz) {
+
+#if defined (USE_AVX512)
+      using vec_t = __m512i;
+      auto nonzero = [](vec_t v) -> unsigned {
+        return _mm512_cmpgt_epi32_mask(v, _mm512_setzero_si512());
+      };
+#elif defined (USE_AVX2)
+      using vec_t = __m256i;
+      auto nonzero = [](vec_t v) -> unsigned {
+        return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, _mm256_setzero_si256())));
+      };
+#else
+      using vec_t = __m128i;
+      auto nonzero = [](vec_t v) -> unsigned {
+        return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, _mm_setzero_si128())));
+      };
+#endif
+
+      // Blocks are tested SimdWidth / 4 at a time and their indices are written
+      // 8 at a time, so the input is processed by chunks of 16 blocks.
+      constexpr IndexType BlocksPerVector = sizeof(vec_t) / 4;
+      constexpr IndexType VectorsPerChunk = 16 / BlocksPerVector;
+      constexpr IndexType NumChunks = NumBlocks / 16;
+
+      const auto inputVector = reinterpret_cast<const vec_t*>(input);
+      const __m128i Increment = _mm_set1_epi16(8);
+      __m128i base = _mm_setzero_si128();
+      IndexType count = 0;
+
+      for (IndexType i = 0; i < NumChunks; ++i)
+      {
+          // Input values are in [0, 127], so a block is nonzero iff it is positive
+          unsigned mask = 0;
+          for (IndexType j = 0; j < VectorsPerChunk; ++j)
+              mask |= nonzero(inputVector[i * VectorsPerChunk + j]) << (j * BlocksPerVector);
+
+          for (IndexType j = 0; j < 2; ++j)
+          {
+              const unsigned byte = (mask >> (j * 8)) & 0xFF;
+              const __m128i offsets = _mm_load_si128(reinterpret_cast<const __m128i*>(&NnzLookup[byte]));
+              _mm_storeu_si128(reinterpret_cast<__m128i*>(nnz + count), _mm_add_epi16(base, offsets));
+              count += popcount(byte);
+              base = _mm_add_epi16(base, Increment);
+          }
+      }
+
+      return count;
+    }
+
+   public:
+    // Output of this layer from the output of the previous one
+    const OutputType* forward(const InputType* input, char* buffer) const {
+
+#if defined (USE_AVX512)
+      using vec_t = __m512i;
+      #define vec_broadcast_32 _mm512_set1_epi32
+      #define vec_add_32 _mm512_add_epi32
+      [[maybe_unused]] const vec_t Ones = _mm512_set1_epi16(1);
+      auto add_dpbusd_32 = [=](vec_t& acc, vec_t a, vec_t b) {
+#if defined (USE_VNNI)
+        acc = _mm512_dpbusd_epi32(acc, a, b);
+#else
+        acc = _mm512_add_epi32(acc, _mm512_madd_epi16(_mm512_maddubs_epi16(a, b), Ones));
+#endif
+      };
+      auto add_dpbusd_32x2 = [=](vec_t& acc0, [[maybe_unused]] vec_t& acc1,
+                                 vec_t a0, vec_t b0, vec_t a1, vec_t b1) {
+#if defined (USE_VNNI)
+        acc0 = _mm512_dpbusd_epi32(acc0, a0, b0);
+        acc1 = _mm512_dpbusd_epi32(acc1, a1, b1);
+#else
+        const vec_t product0 = _mm512_madd_epi16(_mm512_maddubs_epi16(a0, b0), Ones);
+        const vec_t product1 = _mm512_madd_epi16(_mm512_maddubs_epi16(a1, b1), Ones);
+        acc0 = _mm512_add_epi32(acc0, _mm512_add_epi32(product0, product1));
+#endif
+      };
+#elif defined (USE_AVX2)
+      using vec_t = __m256i;
+      #define vec_broadcast_32 _mm256_set1_epi32
+      #define vec_add_32 _mm256_add_epi32
+      [[maybe_unused]] const vec_t Ones = _mm256_set1_epi16(1);
+      auto add_dpbusd_32 = [=](vec_t& acc, vec_t a, vec_t b) {
+#if defined (USE_VNNI)
+        acc = _mm256_dpbusd_epi32(acc, a, b);
+#else
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(a, b), Ones));
+#endif
+      };
+      auto add_dpbusd_32x2 = [=](vec_t& acc0, [[maybe_unused]] vec_t& acc1,
+                                 vec_t a0, vec_t b0, vec_t a1, vec_t b1) {
+#if defined (USE_VNNI)
+        acc0 = _mm256_dpbusd_epi32(acc0, a0, b0);
+        acc1 = _mm256_dpbusd_epi32(acc1, a1, b1);
+#else
+        const vec_t product0 = _mm256_madd_epi16(_mm256_maddubs_epi16(a0, b0), Ones);
+        const vec_t product1 = _mm256_madd_epi16(_mm256_maddubs_epi16(a1, b1), Ones);
+        acc0 = _mm256_add_epi32(acc0, _mm256_add_epi32(product0, product1));
+#endif
+      };
+#else
+      using vec_t = __m128i;
+      #define vec_broadcast_32 _mm_set1_epi32
+      #define vec_add_32 _mm_add_epi32
+      const vec_t Ones = _mm_set1_epi16(1);
+      auto add_dpbusd_32 = [=](vec_t& acc, vec_t a, vec_t b) {
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_maddubs_epi16(a, b), Ones));
+      };
+      auto add_dpbusd_32x2 = [=](vec_t& acc0, vec_t& /*acc1*/, vec_t a0, vec_t b0, vec_t a1, vec_t b1) {
+        const vec_t product0 = _mm_madd_epi16(_mm_maddubs_epi16(a0, b0), Ones);
+        const vec_t product1 = _mm_madd_epi16(_mm_maddubs_epi16(a1, b1), Ones);
+        acc0 = _mm_add_epi32(acc0, _mm_add_epi32(product0, product1));
+      };
+#endif
+
+      constexpr IndexType NumRegs = OutputDimensions / OutputSimdWidth;
+
+      const auto input32 = reinterpret_cast<const std::int32_t*>(input);
+      std::uint16_t nnz[NumBlocks];
+      const IndexType count = find_nnz(input32, nnz);
+
+      // With VNNI the second block of each pair goes to its own accumulators, so
+      // that two chains of dot products run in parallel.
+      vec_t acc[NumRegs], acc1[NumRegs] = {};
+      const auto biasVector = reinterpret_cast<const vec_t*>(biases);
+      for (IndexType k = 0; k < NumRegs; ++k)
+          acc[k] = biasVector[k];
+
+      // Nonzero blocks are accumulated by pairs, and the last one alone if count
+      // is odd. The products of each block are widened to 32 bits before they
+      // are summed, so that the result is that of one block at a time.
+      IndexType j = 0;
+      for ( ; j + 1 < count; j += 2)
+      {
+          const IndexType i0 = nnz[j], i1 = nnz[j + 1];
+          const vec_t in0 = vec_broadcast_32(input32[i0]);
+          const vec_t in1 = vec_broadcast_32(input32[i1]);
+          const auto col0 = reinterpret_cast<const vec_t*>(&weights[i0 * OutputDimensions * 4]);
+          const auto col1 = reinterpret_cast<const vec_t*>(&weights[i1 * OutputDimensions * 4]);
+          for (IndexType k = 0; k < NumRegs; ++k)
+              add_dpbusd_32x2(acc[k], acc1[k], in0, col0[k], in1, col1[k]);
+      }
+      if (j < count)
+      {
+          const IndexType i = nnz[j];
+          const vec_t in = vec_broadcast_32(input32[i]);
+          const auto col = reinterpret_cast<const vec_t*>(&weights[i * OutputDimensions * 4]);
+          for (IndexType k = 0; k < NumRegs; ++k)
+              add_dpbusd_32(acc[k], in, col[k]);
+      }
+
+      const auto output = reinterpret_cast<OutputType*>(buffer);
+      const auto outputVector = reinterpret_cast<vec_t*>(output);
+      for (IndexType k = 0; k < NumRegs; ++k)
+          outputVector[k] = vec_add_32(acc[k], acc1[k]);
+
+      #undef vec_broadcast_32
+      #undef vec_add_32
+
+      return output;
+    }
+
+   private:
+    using BiasType = OutputType;
+    using WeightType = std::int8_t;
+
+    PreviousLayer previousLayer;
+
+    alignas(CacheLineSize) BiasType biases[OutputDimensions];
+    alignas(CacheLineSize) WeightType weights[OutputDimensions * PaddedInputDimensions];
+  };
+
+#endif // #if !defined (USE_SSSE3)
+
+}  // namespace Layers
+NNUE_TARGET_END
+}  // namespace Stockfish::Eval::NNUE
+
+#endif // #ifndef NNUE_LAYERS_AFFINE_TRANSFORM_SPARSE_INPUT_H_INCLUDED
@@ -21,9 +21,13 @@
 #ifndef NNUE_LAYERS_CLIPPED_RELU_H_INCLUDED
 #define NNUE_LAYERS_CLIPPED_RELU_H_INCLUDED
 
+#include <string>
+
 #include "../nnue_common.h"
 
-namespace Stockfish::Eval::NNUE::Layers {
+namespace Stockfish::Eval::NNUE {
+NNUE_TARGET_BEGIN
+namespace Layers {
 
   // Clipped ReLU
   template <typename PreviousLayer>
@@ -54,6 +58,14 @@ namespace Stockfish::Eval::NNUE::Layers {
       return hashValue;
     }
 
+    // Name of the layer, as shown by 'nnuebench'
+    static std::string get_name() {
+      return "ClippedReLU[" + std::to_string(OutputDimensions) + "]";
+    }
+
+    // Layer giving the input of this one
+    const PreviousLayer& previous_layer() const { return previousLayer; }
+
     // Read network parameters
     bool read_parameters(std::istream& stream) {
       return previousLayer.read_parameters(stream);
@@ -69,6 +81,24 @@ namespace Stockfish::Eval::NNUE::Layers {
         const TransformedFeatureType* transformedFeatures, char* buffer) const {
       const auto input = previousLayer.propagate(
           transformedFeatures, buffer + SelfBufferSize);
+      return forward(input, buffer);
+    }
+
+    // Forward propagation of a batch, see AffineTransform
+    const OutputType* propagate(
+        const TransformedFeatureType* transformedFeatures, char* buffer,
+        std::size_t count, std::size_t stride) const {
+      const auto input = reinterpret_cast<const char*>(previousLayer.propagate(
+          transformedFeatures, buffer + SelfBufferSize, count, stride));
+
+      for (std::size_t i = 0; i < count; ++i)
+          forward(reinterpret_cast<const InputType*>(input + i * stride), buffer + i * stride);
+
+      return reinterpret_cast<const OutputType*>(buffer);
+    }
+
+    // Output of this layer from the output of the previous one
+    const OutputType* forward(const InputType* input, char* buffer) const {
       const auto output = reinterpret_cast<OutputType*>(buffer);
 
   #if defined(USE_AVX2)
@@ -186,6 +216,8 @@ namespace Stockfish::Eval::NNUE::Layers {
     PreviousLayer previousLayer;
   };
 
-}  // namespace Stockfish::Eval::NNUE::Layers
+}  // namespace Layers
+NNUE_TARGET_END
+}  // namespace Stockfish::Eval::NNUE
 
 #endif // NNUE_LAYERS_CLIPPED_RELU_H_INCLUDED
@@ -23,7 +23,9 @@
 
 #include "../nnue_common.h"
 
-namespace Stockfish::Eval::NNUE::Layers {
+namespace Stockfish::Eval::NNUE {
+NNUE_TARGET_BEGIN
+namespace Layers {
 
 // Input layer
 template <IndexType OutDims, IndexType Offset = 0>
@@ -65,9 +67,18 @@ class InputSlice {
     return transformedFeatures + Offset;
   }
 
+  // Forward propagation of a batch, see AffineTransform
+  const OutputType* propagate(
+      const TransformedFeatureType* transformedFeatures,
+      char* /*buffer*/, std::size_t /*count*/, std::size_t /*stride*/) const {
+    return transformedFeatures + Offset;
+  }
+
  private:
 };
 
-}  // namespace Stockfish::Eval::NNUE::Layers
+}  // namespace Layers
+NNUE_TARGET_END
+}  // namespace Stockfish::Eval::NNUE
 
 #endif // #ifndef NNUE_LAYERS_INPUT_SLICE_H_INCLUDED
@@ -22,6 +22,7 @@
 #define NNUE_ACCUMULATOR_H_INCLUDED
 
 #include "nnue_architecture.h"
+#include "../misc.h"
 
 namespace Stockfish::Eval::NNUE {
 
@@ -32,6 +33,34 @@ namespace Stockfish::Eval::NNUE {
     bool computed[2];
   };
 
+  // Accumulator of the last refresh for each king square and perspective, along
+  // with the pieces it was computed for, so that the next refresh only has to add
+  // and remove the pieces that differ. Each thread has its own. Entries are set up
+  // from the biases of the net at the first refresh after 'valid' is cleared.
+  struct AccumulatorCache {
+
+    struct alignas(CacheLineSize) Entry {
+      std::int16_t accumulation[TransformedFeatureDimensions];
+      std::int32_t psqtAccumulation[PSQTBuckets];
+      Bitboard byColorBB[COLOR_NB];
+      Bitboard byTypeBB[PIECE_TYPE_NB];
+    };
+
+    Entry entries[SQUARE_NB][COLOR_NB];
+    bool valid = false;
+  };
+
+  // Output of the net for the last positions evaluated by a thread, indexed by
+  // position key, so that a position evaluated again skips the feature transformer
+  // and the network. It must be cleared when another net is loaded.
+  struct EvalCacheEntry {
+    Key key;
+    std::int32_t psqt;
+    std::int32_t positional;
+  };
+
+  typedef HashTable<EvalCacheEntry, 65536> EvalCache;
+
 }  // namespace Stockfish::Eval::NNUE
 
 #endif // NNUE_ACCUMULATOR_H_INCLUDED
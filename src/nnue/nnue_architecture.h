@@ -27,6 +27,7 @@
 
 #include "layers/input_slice.h"
 #include "layers/affine_transform.h"
+#include "layers/affine_transform_sparse_input.h"
 #include "layers/clipped_relu.h"
 
 namespace Stockfish::Eval::NNUE {
@@ -39,11 +40,12 @@ namespace Stockfish::Eval::NNUE {
   constexpr IndexType PSQTBuckets = 8;
   constexpr IndexType LayerStacks = 8;
 
+NNUE_TARGET_BEGIN
   namespace Layers {
 
     // Define network structure
     using InputLayer = InputSlice<TransformedFeatureDimensions * 2>;
-    using HiddenLayer1 = ClippedReLU<AffineTransform<InputLayer, 16>>;
+    using HiddenLayer1 = ClippedReLU<AffineTransformSparseInput<InputLayer, 16>>;
     using HiddenLayer2 = ClippedReLU<AffineTransform<HiddenLayer1, 32>>;
     using OutputLayer = AffineTransform<HiddenLayer2, 1>;
 
@@ -54,6 +56,7 @@ namespace Stockfish::Eval::NNUE {
   static_assert(TransformedFeatureDimensions % MaxSimdWidth == 0, "");
   static_assert(Network::OutputDimensions == 1, "");
   static_assert(std::is_same<Network::OutputType, std::int32_t>::value, "");
+NNUE_TARGET_END
 
 }  // namespace Stockfish::Eval::NNUE
 
@@ -45,6 +45,28 @@
 #include <arm_neon.h>
 #endif
 
+// Builds with runtime dispatch (see 'dispatch' in the Makefile) compile the SIMD
+// code once per target. Each copy lives in its own namespace, so that its types
+// and templates never collide with another copy at link time, and is compiled
+// for its own instruction set while the rest of the file keeps the baseline one.
+#if defined(NNUE_TARGET)
+#define NNUE_STRINGIFY(x) #x
+#define NNUE_EXPAND_STRINGIFY(x) NNUE_STRINGIFY(x)
+#define NNUE_PRAGMA(x) _Pragma(NNUE_STRINGIFY(x))
+#define NNUE_TARGET_NAME NNUE_EXPAND_STRINGIFY(NNUE_TARGET)
+#if defined(NNUE_TARGET_ISA)
+#define NNUE_TARGET_BEGIN NNUE_PRAGMA(GCC push_options) NNUE_PRAGMA(GCC target(NNUE_TARGET_ISA)) \
+                          namespace NNUE_TARGET {
+#define NNUE_TARGET_END   } NNUE_PRAGMA(GCC pop_options)
+#else
+#define NNUE_TARGET_BEGIN namespace NNUE_TARGET {
+#define NNUE_TARGET_END   }
+#endif
+#else
+#define NNUE_TARGET_BEGIN
+#define NNUE_TARGET_END
+#endif
+
 namespace Stockfish::Eval::NNUE {
 
   // Version of the evaluation file
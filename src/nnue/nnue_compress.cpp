@@ -0,0 +1,397 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Compression of the embedded network, see nnue_compress.h
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "nnue_compress.h"
+
+namespace Stockfish::Eval::NNUE {
+
+namespace {
+
+  // The layout of a compressed net: the magic number, the block size, the size
+  // of the net and the number of blocks, then the offset of each block in the
+  // coded data and the end of the last one, all little-endian, then the blocks.
+  // A block is made of the code lengths of each context, one byte per symbol,
+  // followed by the codes of its bytes written from the lowest bit.
+  constexpr std::uint32_t Magic = 0x315A4E4E; // "NNZ1"
+  constexpr std::size_t HeaderSize = 4 + 4 + 8 + 4;
+  constexpr std::size_t BlockSize = 1 << 20;
+  constexpr int Contexts = 2;
+  constexpr int MaxCodeLength = 12; // Decoded by a single lookup in a 4096 entries table
+
+  void put(std::string& s, std::uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i)
+        s += char(v >> (8 * i));
+  }
+
+  std::uint64_t get(const unsigned char* p, int bytes) {
+    std::uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i)
+        v |= std::uint64_t(p[i]) << (8 * i);
+    return v;
+  }
+
+  // Code lengths of a Huffman code for the given frequencies. Frequencies are
+  // halved until no code is longer than MaxCodeLength, which costs little as
+  // only the rarest symbols are concerned.
+  void code_lengths(std::vector<std::uint64_t> freq, std::uint8_t* lengths) {
+
+    std::memset(lengths, 0, 256);
+
+    const int used = int(std::count_if(freq.begin(), freq.end(), [](std::uint64_t f) { return f > 0; }));
+
+    // A single symbol still needs a one bit code
+    if (used <= 1)
+    {
+        for (int s = 0; s < 256; ++s)
+            lengths[s] = freq[s] > 0;
+        return;
+    }
+
+    while (true)
+    {
+        // Nodes below 256 are the symbols, the next ones the internal nodes
+        using Node = std::pair<std::uint64_t, int>;
+        std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+        std::vector<int> parent(512, -1);
+        int next = 256, maxLength = 0;
+
+        for (int s = 0; s < 256; ++s)
+            if (freq[s])
+                queue.push({ freq[s], s });
+
+        while (queue.size() > 1)
+        {
+            const Node a = queue.top(); queue.pop();
+            const Node b = queue.top(); queue.pop();
+            parent[a.second] = parent[b.second] = next;
+            queue.push({ a.first + b.first, next++ });
+        }
+
+        for (int s = 0; s < 256; ++s)
+            if (freq[s])
+            {
+                int length = 0;
+                for (int n = s; parent[n] >= 0; n = parent[n])
+                    ++length;
+
+                lengths[s] = std::uint8_t(std::min(length, 255));
+                maxLength = std::max(maxLength, length);
+            }
+
+        if (maxLength <= MaxCodeLength)
+            return;
+
+        for (std::uint64_t& f : freq)
+            f = (f + 1) / 2;
+    }
+  }
+
+  // Canonical codes of the given lengths, bit reversed since the codes are
+  // written from the lowest bit. Returns false if the lengths are not those of
+  // a prefix code, as in corrupted data.
+  bool canonical_codes(const std::uint8_t* lengths, std::uint16_t* codes) {
+
+    int count[MaxCodeLength + 1] = {};
+    std::uint32_t next[MaxCodeLength + 1] = {};
+
+    for (int s = 0; s < 256; ++s)
+    {
+        if (lengths[s] > MaxCodeLength)
+            return false;
+        ++count[lengths[s]];
+    }
+
+    count[0] = 0;
+    for (int length = 1, code = 0; length <= MaxCodeLength; ++length)
+    {
+        code = (code + count[length - 1]) << 1;
+        next[length] = std::uint32_t(code);
+
+        if (next[length] + count[length] > (1u << length))
+            return false;
+    }
+
+    for (int s = 0; s < 256; ++s)
+        if (lengths[s])
+        {
+            std::uint32_t code = next[lengths[s]]++, reversed = 0;
+            for (int i = 0; i < lengths[s]; ++i, code >>= 1)
+                reversed = (reversed << 1) | (code & 1);
+
+            codes[s] = std::uint16_t(reversed);
+        }
+
+    return true;
+  }
+
+  std::string compress_block(const unsigned char* data, std::size_t size) {
+
+    std::uint8_t lengths[Contexts][256];
+    std::uint16_t codes[Contexts][256] = {};
+
+    for (int c = 0; c < Contexts; ++c)
+    {
+        std::vector<std::uint64_t> freq(256);
+        for (std::size_t i = c; i < size; i += Contexts)
+            ++freq[data[i]];
+
+        code_lengths(freq, lengths[c]);
+        canonical_codes(lengths[c], codes[c]);
+    }
+
+    std::string out(reinterpret_cast<const char*>(lengths), sizeof(lengths));
+    std::uint64_t bits = 0;
+    int count = 0;
+
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        const int c = int(i % Contexts);
+        bits |= std::uint64_t(codes[c][data[i]]) << count;
+        count += lengths[c][data[i]];
+
+        for ( ; count >= 8; count -= 8, bits >>= 8)
+            out += char(bits);
+    }
+
+    if (count)
+        out += char(bits);
+
+    return out;
+  }
+
+  bool decompress_block(const unsigned char* data, std::size_t size,
+                        unsigned char* out, std::size_t outSize) {
+
+    struct Entry {
+      std::uint8_t symbol, length; // Length 0 for the bit patterns of no code
+    };
+
+    constexpr std::uint64_t Mask = (1 << MaxCodeLength) - 1;
+    Entry table[Contexts][1 << MaxCodeLength] = {};
+
+    if (size < Contexts * 256)
+        return false;
+
+    for (int c = 0; c < Contexts; ++c)
+    {
+        const std::uint8_t* lengths = data + c * 256;
+        std::uint16_t codes[256];
+
+        if (!canonical_codes(lengths, codes))
+            return false;
+
+        for (int s = 0; s < 256; ++s)
+            if (lengths[s])
+                for (std::uint32_t i = codes[s]; i <= Mask; i += 1u << lengths[s])
+                    table[c][i] = { std::uint8_t(s), lengths[s] };
+    }
+
+    const unsigned char* p = data + Contexts * 256;
+    const unsigned char* end = data + size;
+    std::size_t padding = 0; // Zero bytes read past the end
+    std::uint64_t bits = 0;
+    int count = 0;
+
+    for (std::size_t i = 0; i < outSize; )
+    {
+        // Refill to at least 57 bits, with a single load far from the end
+        if (end - p >= 8)
+        {
+            bits |= get(p, 8) << count;
+            p += (63 - count) >> 3;
+            count |= 56;
+        }
+        else
+            for ( ; count <= 56; count += 8)
+                if (p < end)
+                    bits |= std::uint64_t(*p++) << count;
+                else
+                    ++padding;
+
+        // Enough bits for four codes
+        for (std::size_t n = std::min(i + 4, outSize); i < n; ++i)
+        {
+            const Entry& e = table[i % Contexts][bits & Mask];
+            if (!e.length)
+                return false;
+
+            out[i] = e.symbol;
+            bits >>= e.length;
+            count -= e.length;
+        }
+    }
+
+    // All the bits decoded must come from the block
+    return padding * 8 <= std::size_t(count);
+  }
+
+} // namespace
+
+
+  /// compress_net() codes the whole net, block by block
+
+  std::string compress_net(const std::string& net) {
+
+    const auto* data = reinterpret_cast<const unsigned char*>(net.data());
+    const std::size_t blocks = (net.size() + BlockSize - 1) / BlockSize;
+    std::vector<std::string> coded(blocks);
+    std::string out;
+
+    for (std::size_t b = 0; b < blocks; ++b)
+        coded[b] = compress_block(data + b * BlockSize, std::min(BlockSize, net.size() - b * BlockSize));
+
+    put(out, Magic, 4);
+    put(out, BlockSize, 4);
+    put(out, net.size(), 8);
+    put(out, blocks, 4);
+
+    std::uint64_t offset = 0;
+    for (std::size_t b = 0; b <= blocks; ++b)
+    {
+        put(out, offset, 8);
+        if (b < blocks)
+            offset += coded[b].size();
+    }
+
+    for (const std::string& block : coded)
+        out += block;
+
+    return out;
+  }
+
+
+  /// decompressed_size() reads the size of the net from the header
+
+  std::size_t decompressed_size(const void* data, std::size_t size) {
+
+    const auto* p = static_cast<const unsigned char*>(data);
+
+    return size >= HeaderSize && get(p, 4) == Magic ? std::size_t(get(p + 8, 8)) : 0;
+  }
+
+
+  /// decompress_net() decodes the blocks in parallel, the calling thread being
+  /// one of the decoders. Each thread takes the next block not yet decoded.
+
+  bool decompress_net(const void* data, std::size_t size, void* out, std::size_t threads) {
+
+    const auto* p = static_cast<const unsigned char*>(data);
+    const std::size_t outSize = decompressed_size(data, size);
+
+    if (!outSize)
+        return false;
+
+    const std::size_t blockSize = std::size_t(get(p + 4, 4));
+    const std::size_t blocks = std::size_t(get(p + 16, 4));
+    const std::size_t codedBegin = HeaderSize + (blocks + 1) * 8;
+
+    if (   !blockSize
+        || blocks != (outSize + blockSize - 1) / blockSize
+        || size < codedBegin)
+        return false;
+
+    std::atomic<std::size_t> nextBlock(0);
+    std::atomic<bool> ok(true);
+
+    auto decode = [&]() {
+      for (std::size_t b; (b = nextBlock++) < blocks; )
+      {
+          const std::uint64_t first = get(p + HeaderSize + 8 * b, 8);
+          const std::uint64_t last = get(p + HeaderSize + 8 * (b + 1), 8);
+          const std::size_t begin = b * blockSize;
+
+          if (   first > last
+              || last > size - codedBegin
+              || !decompress_block(p + codedBegin + first, std::size_t(last - first),
+                                   static_cast<unsigned char*>(out) + begin,
+                                   std::min(blockSize, outSize - begin)))
+              ok = false;
+      }
+    };
+
+    std::vector<std::thread> decoders;
+    for (std::size_t t = 1; t < std::min(threads, blocks); ++t)
+        decoders.emplace_back(decode);
+
+    decode();
+
+    for (std::thread& t : decoders)
+        t.join();
+
+    return ok;
+  }
+
+} // namespace Stockfish::Eval::NNUE
+
+
+#if defined(NNZ_TOOL)
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+/// The 'nnzip' tool, built by the Makefile to compress the net to embed. The
+/// result is decompressed again and compared to the net before it is written.
+
+int main(int argc, char* argv[]) {
+
+  using namespace Stockfish::Eval::NNUE;
+
+  if (argc != 3)
+  {
+      std::cerr << "Usage: nnzip <net> <compressed net>" << std::endl;
+      return 1;
+  }
+
+  std::ifstream in(argv[1], std::ios::binary);
+  const std::string net((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  const std::string coded = compress_net(net);
+  std::string check(net.size(), '\0');
+
+  if (   net.empty()
+      || !decompress_net(coded.data(), coded.size(), check.data(), std::thread::hardware_concurrency())
+      || check != net)
+  {
+      std::cerr << "Failed to compress " << argv[1] << std::endl;
+      return 1;
+  }
+
+  std::ofstream outFile(argv[2], std::ios::binary);
+  if (!outFile.write(coded.data(), coded.size()))
+  {
+      std::cerr << "Failed to write " << argv[2] << std::endl;
+      return 1;
+  }
+
+  std::cout << "Compressed " << argv[1] << " from " << net.size()
+            << " to " << coded.size() << " bytes" << std::endl;
+  return 0;
+}
+
+#endif // #if defined(NNZ_TOOL)
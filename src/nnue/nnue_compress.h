@@ -0,0 +1,47 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Compression of the network embedded in the binary, for builds with
+// compressednet=yes. The codec does not depend on the rest of the engine, so
+// that the Makefile can build it alone as the 'nnzip' tool.
+
+#ifndef NNUE_COMPRESS_H_INCLUDED
+#define NNUE_COMPRESS_H_INCLUDED
+
+#include <cstddef>
+#include <string>
+
+namespace Stockfish::Eval::NNUE {
+
+  // A compressed net is cut into blocks coded independently of each other, so
+  // that they are decoded in parallel. Each block codes its bytes with two
+  // canonical Huffman codes, one for the bytes at even offsets and one for those
+  // at odd offsets: the high bytes of the int16 weights, nearly all 0x00 or 0xFF,
+  // then take about one bit each while the low bytes keep their own code.
+  std::string compress_net(const std::string& net);
+
+  // Size of the net once decompressed, 0 if the data is not a compressed net
+  std::size_t decompressed_size(const void* data, std::size_t size);
+
+  // Decompress into 'out', of decompressed_size() bytes, with up to the given
+  // number of threads. Returns false if the data is corrupted.
+  bool decompress_net(const void* data, std::size_t size, void* out, std::size_t threads);
+
+} // namespace Stockfish::Eval::NNUE
+
+#endif // #ifndef NNUE_COMPRESS_H_INCLUDED
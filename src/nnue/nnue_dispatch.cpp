@@ -0,0 +1,137 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Runtime selection of the NNUE code path, for builds with dispatch=yes
+
+#if defined(USE_DISPATCH)
+
+#include <iostream>
+
+#include "../evaluate.h"
+
+namespace Stockfish::Eval::NNUE {
+
+  // Entry points of each copy of evaluate_nnue.cpp, see NNUE_TARGET_BEGIN
+  #define DECLARE_TARGET(target)                                  \
+    namespace target {                                            \
+      Value evaluate(const Position& pos, bool adjusted);         \
+      void evaluate_batch(const Position* const* positions,       \
+                          Value* values, std::size_t count);      \
+      std::string benchmark(const std::vector<std::string>& fens, \
+                            int iterations);                      \
+      void prefetch_update(const Position& pos);                  \
+      std::string trace(Position& pos);                           \
+      void replicate();                                           \
+      std::vector<MemoryUsage> memory_usage();                    \
+      bool load_eval(std::string name, std::istream& stream);     \
+      bool save_eval(std::ostream& stream, bool compact);         \
+      bool save_eval(const std::optional<std::string>& filename,  \
+                     bool compact);                               \
+      bool load_image(std::string name, const std::string& path); \
+      bool save_image(const std::string& path);                   \
+    }
+
+  DECLARE_TARGET(base)
+  DECLARE_TARGET(avx2)
+  DECLARE_TARGET(avx512)
+  DECLARE_TARGET(vnni512)
+
+  #undef DECLARE_TARGET
+
+  namespace {
+
+  struct Target {
+    const char* name;
+    Value (*evaluate)(const Position&, bool);
+    void (*evaluate_batch)(const Position* const*, Value*, std::size_t);
+    std::string (*benchmark)(const std::vector<std::string>&, int);
+    void (*prefetch_update)(const Position&);
+    std::string (*trace)(Position&);
+    void (*replicate)();
+    std::vector<MemoryUsage> (*memory_usage)();
+    bool (*load_eval)(std::string, std::istream&);
+    bool (*save_stream)(std::ostream&, bool);
+    bool (*save_file)(const std::optional<std::string>&, bool);
+    bool (*load_image)(std::string, const std::string&);
+    bool (*save_image)(const std::string&);
+  };
+
+  #define TARGET(target) { #target, target::evaluate, target::evaluate_batch, target::benchmark, \
+                           target::prefetch_update, target::trace, target::replicate,           \
+                           target::memory_usage,                                                \
+                           target::load_eval, target::save_eval, target::save_eval,             \
+                           target::load_image, target::save_image }
+
+  // The best copy the CPU supports, the baseline one is always supported. The
+  // weights layout is the same for all of them, so a net is simply loaded into
+  // the selected copy.
+  const Target& select_target() {
+
+    static const Target targets[] = { TARGET(vnni512), TARGET(avx512), TARGET(avx2), TARGET(base) };
+
+    __builtin_cpu_init();
+
+    if (   __builtin_cpu_supports("avx512vnni")
+        && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx512dq")
+        && __builtin_cpu_supports("avx512vl"))
+        return targets[0];
+
+    if (__builtin_cpu_supports("avx512bw"))
+        return targets[1];
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi"))
+        return targets[2];
+
+    return targets[3];
+  }
+
+  #undef TARGET
+
+  const Target& target = select_target();
+
+  } // namespace
+
+  const char* target_name() { return target.name; }
+
+  Value evaluate(const Position& pos, bool adjusted) { return target.evaluate(pos, adjusted); }
+  std::string trace(Position& pos) { return target.trace(pos); }
+
+  void evaluate_batch(const Position* const* positions, Value* values, std::size_t count) {
+    target.evaluate_batch(positions, values, count);
+  }
+
+  std::string benchmark(const std::vector<std::string>& fens, int iterations) {
+    return target.benchmark(fens, iterations);
+  }
+
+  void prefetch_update(const Position& pos) { target.prefetch_update(pos); }
+  void replicate() { target.replicate(); }
+  std::vector<MemoryUsage> memory_usage() { return target.memory_usage(); }
+
+  bool load_eval(std::string name, std::istream& stream) { return target.load_eval(name, stream); }
+  bool save_eval(std::ostream& stream, bool compact) { return target.save_stream(stream, compact); }
+  bool save_eval(const std::optional<std::string>& filename, bool compact) {
+    return target.save_file(filename, compact);
+  }
+  bool load_image(std::string name, const std::string& path) { return target.load_image(name, path); }
+  bool save_image(const std::string& path) { return target.save_image(path); }
+
+} // namespace Stockfish::Eval::NNUE
+
+#endif // #if defined(USE_DISPATCH)
@@ -24,12 +24,16 @@
 #include "nnue_common.h"
 #include "nnue_architecture.h"
 
+#include <algorithm> // std::any_of()
 #include <cstring> // std::memset()
+#include <vector>
 
 namespace Stockfish::Eval::NNUE {
+NNUE_TARGET_BEGIN
 
   using BiasType       = std::int16_t;
   using WeightType     = std::int16_t;
+  using CompactWeightType = std::int8_t; // Weights of a compact net, see read_parameters()
   using PSQTWeightType = std::int32_t;
 
   // If vector instructions are enabled, we update and refresh the
@@ -47,6 +51,7 @@ namespace Stockfish::Eval::NNUE {
   #define vec_store(a,b) _mm512_store_si512(a,b)
   #define vec_add_16(a,b) _mm512_add_epi16(a,b)
   #define vec_sub_16(a,b) _mm512_sub_epi16(a,b)
+  #define vec_widen_8(a) _mm512_cvtepi8_epi16(_mm256_load_si256(reinterpret_cast<const __m256i*>(a)))
   #define vec_load_psqt(a) _mm256_load_si256(a)
   #define vec_store_psqt(a,b) _mm256_store_si256(a,b)
   #define vec_add_psqt_32(a,b) _mm256_add_epi32(a,b)
@@ -61,6 +66,7 @@ namespace Stockfish::Eval::NNUE {
   #define vec_store(a,b) _mm256_store_si256(a,b)
   #define vec_add_16(a,b) _mm256_add_epi16(a,b)
   #define vec_sub_16(a,b) _mm256_sub_epi16(a,b)
+  #define vec_widen_8(a) _mm256_cvtepi8_epi16(_mm_load_si128(reinterpret_cast<const __m128i*>(a)))
   #define vec_load_psqt(a) _mm256_load_si256(a)
   #define vec_store_psqt(a,b) _mm256_store_si256(a,b)
   #define vec_add_psqt_32(a,b) _mm256_add_epi32(a,b)
@@ -75,6 +81,12 @@ namespace Stockfish::Eval::NNUE {
   #define vec_store(a,b) *(a)=(b)
   #define vec_add_16(a,b) _mm_add_epi16(a,b)
   #define vec_sub_16(a,b) _mm_sub_epi16(a,b)
+  #ifdef USE_SSE41
+  #define vec_widen_8(a) _mm_cvtepi8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a)))
+  #else
+  #define vec_widen_8(a) _mm_srai_epi16(_mm_unpacklo_epi8(_mm_setzero_si128(), \
+                                        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(a))), 8)
+  #endif
   #define vec_load_psqt(a) (*(a))
   #define vec_store_psqt(a,b) *(a)=(b)
   #define vec_add_psqt_32(a,b) _mm_add_epi32(a,b)
@@ -89,6 +101,8 @@ namespace Stockfish::Eval::NNUE {
   #define vec_store(a,b) *(a)=(b)
   #define vec_add_16(a,b) _mm_add_pi16(a,b)
   #define vec_sub_16(a,b) _mm_sub_pi16(a,b)
+  #define vec_widen_8(a) _mm_srai_pi16(_mm_unpacklo_pi8(_mm_setzero_si64(), \
+                                       _mm_cvtsi32_si64(*reinterpret_cast<const int*>(a))), 8)
   #define vec_load_psqt(a) (*(a))
   #define vec_store_psqt(a,b) *(a)=(b)
   #define vec_add_psqt_32(a,b) _mm_add_pi32(a,b)
@@ -103,6 +117,7 @@ namespace Stockfish::Eval::NNUE {
   #define vec_store(a,b) *(a)=(b)
   #define vec_add_16(a,b) vaddq_s16(a,b)
   #define vec_sub_16(a,b) vsubq_s16(a,b)
+  #define vec_widen_8(a) vmovl_s8(vld1_s8(a))
   #define vec_load_psqt(a) (*(a))
   #define vec_store_psqt(a,b) *(a)=(b)
   #define vec_add_psqt_32(a,b) vaddq_s32(a,b)
@@ -115,6 +130,12 @@ namespace Stockfish::Eval::NNUE {
 
   #endif
 
+  // Load the k-th register of a row of weights starting at a, which holds either
+  // WeightType or CompactWeightType values, the latter sign extended to 16 bits
+  #define vec_load_weights(a,k) (sizeof(*(a)) == sizeof(CompactWeightType)                          \
+    ? vec_widen_8(reinterpret_cast<const CompactWeightType*>(a) + (k) * (sizeof(vec_t) / 2)) \
+    : vec_load(reinterpret_cast<const vec_t*>(a) + (k)))
+
 
   #ifdef VECTOR
 
@@ -189,39 +210,143 @@ namespace Stockfish::Eval::NNUE {
     static constexpr std::size_t BufferSize =
         OutputDimensions * sizeof(OutputType);
 
-    // Hash value embedded in the evaluation file
-    static constexpr std::uint32_t get_hash_value() {
-      return FeatureSet::HashValue ^ OutputDimensions;
+    // Hash value embedded in the evaluation file. A compact net stores the
+    // weights as CompactWeightType, which halves the weight bytes the
+    // accumulator updates read, and is told apart by its hash value.
+    static constexpr std::uint32_t get_hash_value(bool compact = false) {
+      return FeatureSet::HashValue ^ OutputDimensions ^ (compact ? 0x5A3C96E1u : 0);
     }
 
-    // Read network parameters
-    bool read_parameters(std::istream& stream) {
+    // True if the weights were read from a compact net
+    bool compact() const { return compactWeights; }
+
+    // Read network parameters. The weights of a compact net are kept as they
+    // are, in the first half of the weights array: the array keeps its size,
+    // so a compact net takes as much memory as a usual one.
+    bool read_parameters(std::istream& stream, bool compact = false) {
+
+      compactWeights = compact;
 
       read_little_endian<BiasType      >(stream, biases     , HalfDimensions                  );
-      read_little_endian<WeightType    >(stream, weights    , HalfDimensions * InputDimensions);
+      if (compact)
+          read_little_endian<CompactWeightType>(stream, weights_of<CompactWeightType>(),
+                                                HalfDimensions * InputDimensions);
+      else
+          read_little_endian<WeightType>(stream, weights, HalfDimensions * InputDimensions);
       read_little_endian<PSQTWeightType>(stream, psqtWeights, PSQTBuckets    * InputDimensions);
 
       return !stream.fail();
     }
 
-    // Write network parameters
-    bool write_parameters(std::ostream& stream) const {
+    // Write network parameters, converting the weights to the requested format.
+    // Fails if a weight does not fit in a CompactWeightType for a compact net.
+    bool write_parameters(std::ostream& stream, bool compact = false) const {
+
+      constexpr std::size_t Count = HalfDimensions * InputDimensions;
 
       write_little_endian<BiasType      >(stream, biases     , HalfDimensions                  );
-      write_little_endian<WeightType    >(stream, weights    , HalfDimensions * InputDimensions);
+      if (compact == compactWeights)
+      {
+          if (compact)
+              write_little_endian<CompactWeightType>(stream, weights_of<CompactWeightType>(), Count);
+          else
+              write_little_endian<WeightType>(stream, weights, Count);
+      }
+      else if (compact)
+      {
+          if (std::any_of(weights, weights + Count, [](WeightType w) {
+                  return w != CompactWeightType(w); }))
+              return false;
+
+          std::vector<CompactWeightType> converted(weights, weights + Count);
+          write_little_endian<CompactWeightType>(stream, converted.data(), Count);
+      }
+      else
+      {
+          const CompactWeightType* w = weights_of<CompactWeightType>();
+          std::vector<WeightType> converted(w, w + Count);
+          write_little_endian<WeightType>(stream, converted.data(), Count);
+      }
       write_little_endian<PSQTWeightType>(stream, psqtWeights, PSQTBuckets    * InputDimensions);
 
       return !stream.fail();
     }
 
-    // Convert input features
-    std::int32_t transform(const Position& pos, OutputType* output, int bucket) const {
-      update_accumulator(pos, WHITE);
-      update_accumulator(pos, BLACK);
+    // Prefetch the weights of the features changed by the last move, which the
+    // next incremental update of the accumulators of pos will read. Only the
+    // start of each row is requested: the update walks the rows tile by tile,
+    // and prefetching whole rows costs more than it saves. Nothing is done for
+    // a perspective whose king moved, as it needs a refresh anyway.
+    void prefetch_update(const Position& pos) const {
+
+      using IndexList = ValueList<IndexType, FeatureSet::MaxActiveDimensions>;
+
+      for (const auto perspective : {WHITE, BLACK})
+      {
+        if (FeatureSet::requires_refresh(pos.state(), perspective))
+          continue;
+
+        IndexList removed, added;
+        FeatureSet::append_changed_indices(pos.square<KING>(perspective),
+          pos.state(), perspective, removed, added);
+
+        for (const IndexList* list : {&removed, &added})
+          for (const auto index : *list)
+          {
+            if (compactWeights)
+                prefetch(const_cast<CompactWeightType*>(weights_of<CompactWeightType>() + HalfDimensions * index));
+            else
+                prefetch(const_cast<WeightType*>(&weights[HalfDimensions * index]));
+            prefetch(const_cast<PSQTWeightType*>(&psqtWeights[PSQTBuckets * index]));
+          }
+      }
+    }
+
+    // Convert input features. Refreshes go through the cache, if given.
+    std::int32_t transform(const Position& pos, OutputType* output, int bucket,
+                           AccumulatorCache* cache = nullptr) const {
+
+      StateInfo* st = pos.state();
+
+      if (st->accumulator)
+          return transform_accumulated(pos, output, bucket, cache);
+
+      // Positions outside of a search, as those of the game history, have no
+      // accumulator: they get a temporary one, refreshed from scratch.
+#if defined(ALIGNAS_ON_STACK_VARIABLES_BROKEN)
+      char temporaryUnaligned[sizeof(Accumulator) + alignof(Accumulator)];
+      auto* temporary = reinterpret_cast<Accumulator*>(
+          align_ptr_up<alignof(Accumulator)>(&temporaryUnaligned[0]));
+#else
+      alignas(Accumulator) char temporaryBuffer[sizeof(Accumulator)];
+      auto* temporary = reinterpret_cast<Accumulator*>(&temporaryBuffer[0]);
+#endif
+
+      temporary->computed[WHITE] = temporary->computed[BLACK] = false;
+      st->accumulator = temporary;
+      std::int32_t psqt = transform_accumulated(pos, output, bucket, cache);
+      st->accumulator = nullptr;
+      return psqt;
+    }
+
+   private:
+    std::int32_t transform_accumulated(const Position& pos, OutputType* output, int bucket,
+                                       AccumulatorCache* cache) const {
+
+      if (compactWeights)
+      {
+          update_accumulator<CompactWeightType>(pos, WHITE, cache);
+          update_accumulator<CompactWeightType>(pos, BLACK, cache);
+      }
+      else
+      {
+          update_accumulator<WeightType>(pos, WHITE, cache);
+          update_accumulator<WeightType>(pos, BLACK, cache);
+      }
 
       const Color perspectives[2] = {pos.side_to_move(), ~pos.side_to_move()};
-      const auto& accumulation = pos.state()->accumulator.accumulation;
-      const auto& psqtAccumulation = pos.state()->accumulator.psqtAccumulation;
+      const auto& accumulation = pos.state()->accumulator->accumulation;
+      const auto& psqtAccumulation = pos.state()->accumulator->psqtAccumulation;
 
       const auto psqt = (
             psqtAccumulation[perspectives[0]][bucket]
@@ -359,12 +484,23 @@ namespace Stockfish::Eval::NNUE {
 
   #endif
 
-   } // end of function transform()
+   } // end of function transform_accumulated()
 
+    // Weights of the features, as W values. For a compact net only the first
+    // half of the weights array is used.
+    template <typename W>
+    const W* weights_of() const { return reinterpret_cast<const W*>(weights); }
 
+    template <typename W>
+    W* weights_of() { return reinterpret_cast<W*>(weights); }
 
-   private:
-    void update_accumulator(const Position& pos, const Color perspective) const {
+    // Update the accumulator of pos for the given perspective, reading the
+    // weights as W values
+    template <typename W>
+    void update_accumulator(const Position& pos, const Color perspective,
+                            AccumulatorCache* cache) const {
+
+      const W* featureWeights = weights_of<W>();
 
       // The size must be enough to contain the largest possible update.
       // That might depend on the feature set and generally relies on the
@@ -381,75 +517,87 @@ namespace Stockfish::Eval::NNUE {
 
       // Look for a usable accumulator of an earlier position. We keep track
       // of the estimated gain in terms of features to be added/subtracted.
-      StateInfo *st = pos.state(), *next = nullptr;
+      StateInfo *st = pos.state();
+      IndexType updates = 0;
       int gain = FeatureSet::refresh_cost(pos);
-      while (st->previous && !st->accumulator.computed[perspective])
+      while (   st->previous && st->previous->accumulator
+             && !st->accumulator->computed[perspective])
       {
         // This governs when a full feature refresh is needed and how many
         // updates are better than just one full refresh.
         if (   FeatureSet::requires_refresh(st, perspective)
             || (gain -= FeatureSet::update_cost(st) + 1) < 0)
           break;
-        next = st;
+        ++updates;
         st = st->previous;
       }
 
-      if (st->accumulator.computed[perspective])
+      if (st->accumulator->computed[perspective])
       {
-        if (next == nullptr)
+        if (updates == 0)
           return;
 
-        // Update incrementally in two steps. First, we update the "next"
-        // accumulator. Then, we update the current accumulator (pos.state()).
-
-        // Gather all features to be updated.
+        // Update incrementally all the accumulators from the one after st up
+        // to the current one (pos.state()) in a single pass, so that each tile
+        // is loaded once and the intermediate positions, which were never
+        // evaluated, get their accumulator too and can be reused by siblings.
+        // The gain computed above bounds both the number of states and the
+        // total number of features to update by MaxActiveDimensions.
+        constexpr IndexType MaxUpdates = FeatureSet::MaxActiveDimensions;
+        StateInfo* states_to_update[MaxUpdates];
+        std::size_t removedEnd[MaxUpdates], addedEnd[MaxUpdates];
+        IndexType i = updates;
+        for (StateInfo *st2 = pos.state(); st2 != st; st2 = st2->previous)
+          states_to_update[--i] = st2;
+
+        // Gather all features to be updated, from the oldest state to the
+        // newest. The features of state i are those of removed/added from the
+        // end of the ones of state i - 1 up to removedEnd[i]/addedEnd[i].
         const Square ksq = pos.square<KING>(perspective);
-        IndexList removed[2], added[2];
-        FeatureSet::append_changed_indices(
-          ksq, next, perspective, removed[0], added[0]);
-        for (StateInfo *st2 = pos.state(); st2 != next; st2 = st2->previous)
+        IndexList removed, added;
+        for (i = 0; i < updates; ++i)
+        {
           FeatureSet::append_changed_indices(
-            ksq, st2, perspective, removed[1], added[1]);
+            ksq, states_to_update[i], perspective, removed, added);
+          removedEnd[i] = removed.size();
+          addedEnd[i] = added.size();
 
-        // Mark the accumulators as computed.
-        next->accumulator.computed[perspective] = true;
-        pos.state()->accumulator.computed[perspective] = true;
+          // Mark the accumulators as computed.
+          states_to_update[i]->accumulator->computed[perspective] = true;
+        }
 
-        // Now update the accumulators listed in states_to_update[], where the last element is a sentinel.
-        StateInfo *states_to_update[3] =
-          { next, next == pos.state() ? nullptr : pos.state(), nullptr };
   #ifdef VECTOR
         for (IndexType j = 0; j < HalfDimensions / TileHeight; ++j)
         {
           // Load accumulator
           auto accTile = reinterpret_cast<vec_t*>(
-            &st->accumulator.accumulation[perspective][j * TileHeight]);
+            &st->accumulator->accumulation[perspective][j * TileHeight]);
           for (IndexType k = 0; k < NumRegs; ++k)
             acc[k] = vec_load(&accTile[k]);
 
-          for (IndexType i = 0; states_to_update[i]; ++i)
+          for (std::size_t r = 0, a = 0, u = 0; u < updates; ++u)
           {
             // Difference calculation for the deactivated features
-            for (const auto index : removed[i])
+            for ( ; r < removedEnd[u]; ++r)
             {
-              const IndexType offset = HalfDimensions * index + j * TileHeight;
-              auto column = reinterpret_cast<const vec_t*>(&weights[offset]);
+              const IndexType offset = HalfDimensions * removed[r] + j * TileHeight;
+              auto column = &featureWeights[offset];
               for (IndexType k = 0; k < NumRegs; ++k)
-                acc[k] = vec_sub_16(acc[k], column[k]);
+                acc[k] = vec_sub_16(acc[k], vec_load_weights(column, k));
             }
 
             // Difference calculation for the activated features
-            for (const auto index : added[i])
+            for ( ; a < addedEnd[u]; ++a)
             {
-              const IndexType offset = HalfDimensions * index + j * TileHeight;
-              auto column = reinterpret_cast<const vec_t*>(&weights[offset]);
+              const IndexType offset = HalfDimensions * added[a] + j * TileHeight;
+              auto column = &featureWeights[offset];
               for (IndexType k = 0; k < NumRegs; ++k)
-                acc[k] = vec_add_16(acc[k], column[k]);
+                acc[k] = vec_add_16(acc[k], vec_load_weights(column, k));
             }
 
             // Store accumulator
             accTile = reinterpret_cast<vec_t*>(
-              &states_to_update[i]->accumulator.accumulation[perspective][j * TileHeight]);
+              &states_to_update[u]->accumulator->accumulation[perspective][j * TileHeight]);
             for (IndexType k = 0; k < NumRegs; ++k)
               vec_store(&accTile[k], acc[k]);
           }
@@ -459,25 +607,25 @@ namespace Stockfish::Eval::NNUE {
         {
           // Load accumulator
           auto accTilePsqt = reinterpret_cast<psqt_vec_t*>(
-            &st->accumulator.psqtAccumulation[perspective][j * PsqtTileHeight]);
+            &st->accumulator->psqtAccumulation[perspective][j * PsqtTileHeight]);
           for (std::size_t k = 0; k < NumPsqtRegs; ++k)
             psqt[k] = vec_load_psqt(&accTilePsqt[k]);
 
-          for (IndexType i = 0; states_to_update[i]; ++i)
+          for (std::size_t r = 0, a = 0, u = 0; u < updates; ++u)
           {
             // Difference calculation for the deactivated features
-            for (const auto index : removed[i])
+            for ( ; r < removedEnd[u]; ++r)
             {
-              const IndexType offset = PSQTBuckets * index + j * PsqtTileHeight;
+              const IndexType offset = PSQTBuckets * removed[r] + j * PsqtTileHeight;
               auto columnPsqt = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
               for (std::size_t k = 0; k < NumPsqtRegs; ++k)
                 psqt[k] = vec_sub_psqt_32(psqt[k], columnPsqt[k]);
             }
 
             // Difference calculation for the activated features
-            for (const auto index : added[i])
+            for ( ; a < addedEnd[u]; ++a)
             {
-              const IndexType offset = PSQTBuckets * index + j * PsqtTileHeight;
+              const IndexType offset = PSQTBuckets * added[a] + j * PsqtTileHeight;
               auto columnPsqt = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
               for (std::size_t k = 0; k < NumPsqtRegs; ++k)
                 psqt[k] = vec_add_psqt_32(psqt[k], columnPsqt[k]);
@@ -485,54 +633,56 @@ namespace Stockfish::Eval::NNUE {
 
             // Store accumulator
             accTilePsqt = reinterpret_cast<psqt_vec_t*>(
-              &states_to_update[i]->accumulator.psqtAccumulation[perspective][j * PsqtTileHeight]);
+              &states_to_update[u]->accumulator->psqtAccumulation[perspective][j * PsqtTileHeight]);
             for (std::size_t k = 0; k < NumPsqtRegs; ++k)
               vec_store_psqt(&accTilePsqt[k], psqt[k]);
           }
         }
 
   #else
-        for (IndexType i = 0; states_to_update[i]; ++i)
+        for (std::size_t r = 0, a = 0, u = 0; u < updates; ++u)
         {
-          std::memcpy(states_to_update[i]->accumulator.accumulation[perspective],
-              st->accumulator.accumulation[perspective],
+          std::memcpy(states_to_update[u]->accumulator->accumulation[perspective],
+              st->accumulator->accumulation[perspective],
               HalfDimensions * sizeof(BiasType));
 
           for (std::size_t k = 0; k < PSQTBuckets; ++k)
-            states_to_update[i]->accumulator.psqtAccumulation[perspective][k] = st->accumulator.psqtAccumulation[perspective][k];
+            states_to_update[u]->accumulator->psqtAccumulation[perspective][k] = st->accumulator->psqtAccumulation[perspective][k];
 
-          st = states_to_update[i];
+          st = states_to_update[u];
 
           // Difference calculation for the deactivated features
-          for (const auto index : removed[i])
+          for ( ; r < removedEnd[u]; ++r)
           {
-            const IndexType offset = HalfDimensions * index;
+            const IndexType offset = HalfDimensions * removed[r];
 
             for (IndexType j = 0; j < HalfDimensions; ++j)
-              st->accumulator.accumulation[perspective][j] -= weights[offset + j];
+              st->accumulator->accumulation[perspective][j] -= featureWeights[offset + j];
 
             for (std::size_t k = 0; k < PSQTBuckets; ++k)
-              st->accumulator.psqtAccumulation[perspective][k] -= psqtWeights[index * PSQTBuckets + k];
+              st->accumulator->psqtAccumulation[perspective][k] -= psqtWeights[removed[r] * PSQTBuckets + k];
           }
 
           // Difference calculation for the activated features
-          for (const auto index : added[i])
+          for ( ; a < addedEnd[u]; ++a)
           {
-            const IndexType offset = HalfDimensions * index;
+            const IndexType offset = HalfDimensions * added[a];
 
             for (IndexType j = 0; j < HalfDimensions; ++j)
-              st->accumulator.accumulation[perspective][j] += weights[offset + j];
+              st->accumulator->accumulation[perspective][j] += featureWeights[offset + j];
 
             for (std::size_t k = 0; k < PSQTBuckets; ++k)
-              st->accumulator.psqtAccumulation[perspective][k] += psqtWeights[index * PSQTBuckets + k];
+              st->accumulator->psqtAccumulation[perspective][k] += psqtWeights[added[a] * PSQTBuckets + k];
           }
         }
   #endif
       }
+      else if (cache)
+        refresh_from_cache<W>(pos, perspective, *cache);
       else
       {
         // Refresh the accumulator
-        auto& accumulator = pos.state()->accumulator;
+        auto& accumulator = *pos.state()->accumulator;
         accumulator.computed[perspective] = true;
         IndexList active;
         FeatureSet::append_active_indices(pos, perspective, active);
@@ -548,10 +698,10 @@ namespace Stockfish::Eval::NNUE {
           for (const auto index : active)
           {
             const IndexType offset = HalfDimensions * index + j * TileHeight;
-            auto column = reinterpret_cast<const vec_t*>(&weights[offset]);
+            auto column = &featureWeights[offset];
 
             for (unsigned k = 0; k < NumRegs; ++k)
-              acc[k] = vec_add_16(acc[k], column[k]);
+              acc[k] = vec_add_16(acc[k], vec_load_weights(column, k));
           }
 
           auto accTile = reinterpret_cast<vec_t*>(
@@ -592,7 +742,7 @@ namespace Stockfish::Eval::NNUE {
           const IndexType offset = HalfDimensions * index;
 
           for (IndexType j = 0; j < HalfDimensions; ++j)
-            accumulator.accumulation[perspective][j] += weights[offset + j];
+            accumulator.accumulation[perspective][j] += featureWeights[offset + j];
 
           for (std::size_t k = 0; k < PSQTBuckets; ++k)
             accumulator.psqtAccumulation[perspective][k] += psqtWeights[index * PSQTBuckets + k];
@@ -605,11 +755,147 @@ namespace Stockfish::Eval::NNUE {
   #endif
     }
 
+    // Refresh the accumulator starting from the one cached for the king square,
+    // adding and removing only the pieces that changed since, and update the
+    // cached one. Usually much fewer features than a refresh from scratch.
+    template <typename W>
+    void refresh_from_cache(const Position& pos, const Color perspective,
+                            AccumulatorCache& cache) const {
+
+      const W* featureWeights = weights_of<W>();
+
+      using IndexList = ValueList<IndexType, FeatureSet::MaxActiveDimensions>;
+
+      if (!cache.valid)
+      {
+        for (auto& entries : cache.entries)
+          for (auto& entry : entries)
+          {
+            std::memcpy(entry.accumulation, biases, HalfDimensions * sizeof(BiasType));
+            std::memset(entry.psqtAccumulation, 0, sizeof(entry.psqtAccumulation));
+            std::memset(entry.byColorBB, 0, sizeof(entry.byColorBB));
+            std::memset(entry.byTypeBB, 0, sizeof(entry.byTypeBB));
+          }
+        cache.valid = true;
+      }
+
+      auto& entry = cache.entries[pos.square<KING>(perspective)][perspective];
+      auto& accumulator = *pos.state()->accumulator;
+      accumulator.computed[perspective] = true;
+      IndexList removed, added;
+      FeatureSet::append_changed_indices(
+        pos, perspective, entry.byColorBB, entry.byTypeBB, removed, added);
+
+  #ifdef VECTOR
+      vec_t acc[NumRegs];
+      psqt_vec_t psqt[NumPsqtRegs];
+
+      for (IndexType j = 0; j < HalfDimensions / TileHeight; ++j)
+      {
+        auto entryTile = reinterpret_cast<vec_t*>(
+          &entry.accumulation[j * TileHeight]);
+        for (IndexType k = 0; k < NumRegs; ++k)
+          acc[k] = vec_load(&entryTile[k]);
+
+        for (const auto index : removed)
+        {
+          const IndexType offset = HalfDimensions * index + j * TileHeight;
+          auto column = &featureWeights[offset];
+          for (IndexType k = 0; k < NumRegs; ++k)
+            acc[k] = vec_sub_16(acc[k], vec_load_weights(column, k));
+        }
+
+        for (const auto index : added)
+        {
+          const IndexType offset = HalfDimensions * index + j * TileHeight;
+          auto column = &featureWeights[offset];
+          for (IndexType k = 0; k < NumRegs; ++k)
+            acc[k] = vec_add_16(acc[k], vec_load_weights(column, k));
+        }
+
+        auto accTile = reinterpret_cast<vec_t*>(
+          &accumulator.accumulation[perspective][j * TileHeight]);
+        for (IndexType k = 0; k < NumRegs; ++k)
+        {
+          vec_store(&entryTile[k], acc[k]);
+          vec_store(&accTile[k], acc[k]);
+        }
+      }
+
+      for (IndexType j = 0; j < PSQTBuckets / PsqtTileHeight; ++j)
+      {
+        auto entryTilePsqt = reinterpret_cast<psqt_vec_t*>(
+          &entry.psqtAccumulation[j * PsqtTileHeight]);
+        for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+          psqt[k] = vec_load_psqt(&entryTilePsqt[k]);
+
+        for (const auto index : removed)
+        {
+          const IndexType offset = PSQTBuckets * index + j * PsqtTileHeight;
+          auto columnPsqt = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
+          for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+            psqt[k] = vec_sub_psqt_32(psqt[k], columnPsqt[k]);
+        }
+
+        for (const auto index : added)
+        {
+          const IndexType offset = PSQTBuckets * index + j * PsqtTileHeight;
+          auto columnPsqt = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offset]);
+          for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+            psqt[k] = vec_add_psqt_32(psqt[k], columnPsqt[k]);
+        }
+
+        auto accTilePsqt = reinterpret_cast<psqt_vec_t*>(
+          &accumulator.psqtAccumulation[perspective][j * PsqtTileHeight]);
+        for (std::size_t k = 0; k < NumPsqtRegs; ++k)
+        {
+          vec_store_psqt(&entryTilePsqt[k], psqt[k]);
+          vec_store_psqt(&accTilePsqt[k], psqt[k]);
+        }
+      }
+
+  #else
+      for (const auto index : removed)
+      {
+        const IndexType offset = HalfDimensions * index;
+
+        for (IndexType j = 0; j < HalfDimensions; ++j)
+          entry.accumulation[j] -= featureWeights[offset + j];
+
+        for (std::size_t k = 0; k < PSQTBuckets; ++k)
+          entry.psqtAccumulation[k] -= psqtWeights[index * PSQTBuckets + k];
+      }
+
+      for (const auto index : added)
+      {
+        const IndexType offset = HalfDimensions * index;
+
+        for (IndexType j = 0; j < HalfDimensions; ++j)
+          entry.accumulation[j] += featureWeights[offset + j];
+
+        for (std::size_t k = 0; k < PSQTBuckets; ++k)
+          entry.psqtAccumulation[k] += psqtWeights[index * PSQTBuckets + k];
+      }
+
+      std::memcpy(accumulator.accumulation[perspective], entry.accumulation,
+          HalfDimensions * sizeof(BiasType));
+      std::memcpy(accumulator.psqtAccumulation[perspective], entry.psqtAccumulation,
+          PSQTBuckets * sizeof(PSQTWeightType));
+  #endif
+
+      for (Color c : { WHITE, BLACK })
+        entry.byColorBB[c] = pos.pieces(c);
+      for (PieceType pt = PAWN; pt <= KING; ++pt)
+        entry.byTypeBB[pt] = pos.pieces(pt);
+    }
+
+    bool compactWeights;
     alignas(CacheLineSize) BiasType biases[HalfDimensions];
     alignas(CacheLineSize) WeightType weights[HalfDimensions * InputDimensions];
     alignas(CacheLineSize) PSQTWeightType psqtWeights[InputDimensions * PSQTBuckets];
   };
 
+NNUE_TARGET_END
 }  // namespace Stockfish::Eval::NNUE
 
 #endif // #ifndef NNUE_FEATURE_TRANSFORMER_H_INCLUDED
@@ -18,6 +18,8 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>   // For std::memcpy
+#include <vector>
 
 #include "bitboard.h"
 #include "pawns.h"
@@ -201,6 +203,73 @@ namespace {
 
 namespace Pawns {
 
+namespace {
+
+  // SharedTable is the optional pawn hash table shared by all threads, behind
+  // the table of each thread. Entries are written and read without a lock, as
+  // in the TT, and stored with a checksum of their words so that an entry torn
+  // by concurrent writes is found invalid and is simply a miss.
+  class SharedTable {
+
+    static_assert(sizeof(Entry) % sizeof(Key) == 0, "Entry must be made of whole words");
+
+    struct Slot {
+      Key check;
+      Entry entry;
+    };
+
+    std::vector<Slot> table;
+    size_t mask = 0;
+
+    static Key checksum(const Entry& e) {
+      Key words[sizeof(Entry) / sizeof(Key)], sum = 0;
+      std::memcpy(words, &e, sizeof(Entry));
+      for (Key w : words)
+          sum ^= w;
+      return sum;
+    }
+
+  public:
+    void resize(size_t mbSize) {
+      size_t count = mbSize * 1024 * 1024 / sizeof(Slot);
+
+      while (count & (count - 1))
+          count &= count - 1;
+
+      table = std::vector<Slot>(count); // Zeroed, so with a valid checksum
+      mask = count - 1;
+    }
+
+    // Copy the entry of the given key to 'e' and return true, if found
+    bool probe(Key key, Entry* e) const {
+      if (table.empty())
+          return false;
+
+      const Slot& s = table[size_t(key) & mask];
+      std::memcpy((void*)e, &s.entry, sizeof(Entry));
+      return e->key == key && checksum(*e) == s.check;
+    }
+
+    void save(const Entry& e) {
+      if (table.empty())
+          return;
+
+      Slot& s = table[size_t(e.key) & mask];
+      std::memcpy((void*)&s.entry, &e, sizeof(Entry));
+      s.check = checksum(e);
+    }
+  };
+
+  SharedTable Shared;
+
+} // namespace
+
+
+/// Pawns::resize_shared() sets the size in MB of the shared pawn hash table, 0
+/// to use only the tables of the threads. Threads must be idle.
+
+void resize_shared(size_t mbSize) { Shared.resize(mbSize); }
+
 
 /// Pawns::probe() looks up the current position's pawns configuration in
 /// the pawns hash table. It returns a pointer to the Entry if the position
@@ -212,7 +281,7 @@ Entry* probe(const Position& pos) {
   Key key = pos.pawn_key();
   Entry* e = pos.this_thread()->pawnsTable[key];
 
-  if (e->key == key)
+  if (e->key == key || Shared.probe(key, e))
       return e;
 
   e->key = key;
@@ -220,6 +289,7 @@ Entry* probe(const Position& pos) {
   e->scores[WHITE] = evaluate<WHITE>(pos, e);
   e->scores[BLACK] = evaluate<BLACK>(pos, e);
 
+  Shared.save(*e);
   return e;
 }
 
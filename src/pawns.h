@@ -64,6 +64,7 @@ struct Entry {
 typedef HashTable<Entry, 131072> Table;
 
 Entry* probe(const Position& pos);
+void resize_shared(size_t mbSize);
 
 } // namespace Stockfish::Pawns
 
@@ -79,7 +79,6 @@ std::ostream& operator<<(std::ostream& os, const Position& pos) {
       && !pos.can_castle(ANY_CASTLING))
   {
       StateInfo st;
-      ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
       Position p;
       p.set(pos.fen(), pos.is_chess960(), &st, pos.this_thread());
@@ -358,6 +357,11 @@ void Position::set_state(StateInfo* si) const {
   if (si->epSquare != SQ_NONE)
       si->key ^= Zobrist::enpassant[file_of(si->epSquare)];
 
+#if defined(USE_ATTACK_MAPS)
+  for (Square s = SQ_A1; s <= SQ_H8; ++s)
+      si->attacks[s] = empty(s) ? 0 : piece_attacks(s);
+#endif
+
   if (sideToMove == BLACK)
       si->key ^= Zobrist::side;
 
@@ -369,6 +373,21 @@ void Position::set_state(StateInfo* si) const {
 }
 
 
+/// Position::material_key() computes the material key of the given piece counts,
+/// kings included, as set_state() does for the pieces on the board.
+
+Key Position::material_key(const int pieceCount[PIECE_NB]) {
+
+  Key key = 0;
+
+  for (Piece pc : Pieces)
+      for (int cnt = 0; cnt < pieceCount[pc]; ++cnt)
+          key ^= Zobrist::psq[pc][cnt];
+
+  return key;
+}
+
+
 /// Position::set() is an overload to initialize the position object with
 /// the given endgame code string like "KBPKN". It is mainly a helper to
 /// get the material key out of an endgame code.
@@ -395,6 +414,84 @@ Position& Position::set(const string& code, Color c, StateInfo* si) {
 /// Position::fen() returns a FEN representation of the position. In case of
 /// Chess960 the Shredder-FEN notation is used. This is mainly a debugging function.
 
+/// Position::set() overload to initialize the position object from a packed
+/// one, without the parsing of a FEN string.
+
+Position& Position::set(const PackedPosition& pp, StateInfo* si, Thread* th) {
+
+  std::memset(this, 0, sizeof(Position));
+  std::memset(si, 0, sizeof(StateInfo));
+  st = si;
+
+  Bitboard b = pp.occupied;
+  for (int i = 0; b; ++i)
+  {
+      Piece pc = Piece((pp.pieces[i / 2] >> (4 * (i & 1))) & 0xF);
+      Square s = pop_lsb(b);
+
+      if (pc != NO_PIECE)
+          put_piece(pc, s);
+  }
+
+  sideToMove = Color(pp.flags & 1);
+
+  // Castling rights of the outermost rooks, as for "KQkq" in a FEN string
+  for (Color c : { WHITE, BLACK })
+  {
+      Piece rook = make_piece(c, ROOK);
+      Square rsq;
+
+      if (   (pp.flags & (2 << (2 * c)))
+          && (pieces(c, ROOK) & rank_bb(relative_rank(c, RANK_1))))
+      {
+          for (rsq = relative_square(c, SQ_H1); piece_on(rsq) != rook; --rsq) {}
+          set_castling_right(c, rsq);
+      }
+
+      if (   (pp.flags & (4 << (2 * c)))
+          && (pieces(c, ROOK) & rank_bb(relative_rank(c, RANK_1))))
+      {
+          for (rsq = relative_square(c, SQ_A1); piece_on(rsq) != rook; ++rsq) {}
+          set_castling_right(c, rsq);
+      }
+  }
+
+  st->epSquare = pp.epSquare < SQUARE_NB ? Square(pp.epSquare) : SQ_NONE;
+  st->rule50 = pp.rule50;
+  gamePly = pp.gamePly;
+  chess960 = pp.flags & 32;
+  thisThread = th;
+  set_state(st);
+
+  assert(pos_is_ok());
+
+  return *this;
+}
+
+
+/// Position::pack() returns the packed form of the position, without result
+
+PackedPosition Position::pack() const {
+
+  PackedPosition pp = {};
+  Bitboard b = pp.occupied = pieces();
+
+  for (int i = 0; b; ++i)
+      pp.pieces[i / 2] |= uint8_t(piece_on(pop_lsb(b)) << (4 * (i & 1)));
+
+  pp.flags =  uint8_t(sideToMove)
+            | uint8_t(st->castlingRights << 1)
+            | uint8_t(chess960 ? 32 : 0);
+  pp.epSquare = uint8_t(st->epSquare);
+  pp.rule50 = uint8_t(std::min(st->rule50, 255));
+  pp.gamePly = uint16_t(gamePly);
+  pp.score = int16_t(VALUE_NONE);
+  pp.move = uint16_t(MOVE_NONE);
+
+  return pp;
+}
+
+
 string Position::fen() const {
 
   int emptyCnt;
@@ -596,7 +693,7 @@ bool Position::pseudo_legal(const Move m) const {
                && empty(to - pawn_push(us))))
           return false;
   }
-  else if (!(attacks_bb(type_of(pc), from, pieces()) & to))
+  else if (!(attacks_from(from) & to))
       return false;
 
   // Evasions generator already takes care to avoid some kind of illegal moves
@@ -702,8 +799,9 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   ++st->pliesFromNull;
 
   // Used by NNUE
-  st->accumulator.computed[WHITE] = false;
-  st->accumulator.computed[BLACK] = false;
+  st->accumulator = st->previous->accumulator ? st->previous->accumulator + 1 : nullptr;
+  if (st->accumulator)
+      st->accumulator->computed[WHITE] = st->accumulator->computed[BLACK] = false;
   auto& dp = st->dirtyPiece;
   dp.dirty_num = 1;
 
@@ -713,6 +811,7 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   Square to = to_sq(m);
   Piece pc = piece_on(from);
   Piece captured = type_of(m) == EN_PASSANT ? make_piece(them, PAWN) : piece_on(to);
+  [[maybe_unused]] Bitboard changed = square_bb(from) | to; // Squares for the attack maps
 
   assert(color_of(pc) == us);
   assert(captured == NO_PIECE || color_of(captured) == (type_of(m) != CASTLING ? them : us));
@@ -725,6 +824,7 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 
       Square rfrom, rto;
       do_castling<true>(us, from, to, rfrom, rto);
+      changed |= square_bb(to) | rto;
 
       k ^= Zobrist::psq[captured][rfrom] ^ Zobrist::psq[captured][rto];
       captured = NO_PIECE;
@@ -764,14 +864,15 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 
       // Update board and piece lists
       remove_piece(capsq);
+      changed |= capsq;
 
       if (type_of(m) == EN_PASSANT)
           board[capsq] = NO_PIECE;
 
-      // Update material hash key and prefetch access to materialTable
+      // Update material hash key, the material entry is found by its piece
+      // counts in most positions, see Material::probe().
       k ^= Zobrist::psq[captured][capsq];
       st->materialKey ^= Zobrist::psq[captured][pieceCount[captured]];
-      prefetch(thisThread->materialTable[st->materialKey]);
 
       // Reset rule 50 counter
       st->rule50 = 0;
@@ -859,6 +960,16 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   // Set capture piece
   st->capturedPiece = captured;
 
+#if defined(USE_ATTACK_MAPS)
+  update_attacks(changed);
+#endif
+
+#if defined(NNUE_PREFETCH)
+  // Prefetch the NNUE weights the next accumulator update will need
+  if (Eval::useNNUE)
+      Eval::NNUE::prefetch_update(*this);
+#endif
+
   // Update the key with the final value
   st->key = k;
 
@@ -957,6 +1068,44 @@ void Position::undo_move(Move m) {
 }
 
 
+#if defined(USE_ATTACK_MAPS)
+
+/// Position::piece_attacks() computes the attacks of the piece on the given
+/// square, as stored in the attack maps.
+
+Bitboard Position::piece_attacks(Square s) const {
+
+  Piece pc = piece_on(s);
+
+  return type_of(pc) == PAWN ? pawn_attacks_bb(color_of(pc), s)
+                             : attacks_bb(type_of(pc), s, pieces());
+}
+
+
+/// Position::update_attacks() updates the attack maps of a new state after the
+/// pieces on the changed squares were moved, captured or promoted. The other
+/// pieces keep their attacks, except the sliders attacking a changed square:
+/// their rays are the ones opened or blocked by the move.
+
+void Position::update_attacks(Bitboard changed) {
+
+  for (Bitboard b = changed; b; )
+  {
+      Square s = pop_lsb(b);
+      st->attacks[s] = empty(s) ? 0 : piece_attacks(s);
+  }
+
+  for (Bitboard b = (pieces(BISHOP, ROOK) | pieces(QUEEN)) & ~changed; b; )
+  {
+      Square s = pop_lsb(b);
+      if (st->attacks[s] & changed)
+          st->attacks[s] = piece_attacks(s);
+  }
+}
+
+#endif
+
+
 /// Position::do_castling() is a helper used to do/undo a castling move. This
 /// is a bit tricky in Chess960 where from/to squares can overlap.
 template<bool Do>
@@ -1003,8 +1152,9 @@ void Position::do_null_move(StateInfo& newSt) {
 
   st->dirtyPiece.dirty_num = 0;
   st->dirtyPiece.piece[0] = NO_PIECE; // Avoid checks in UpdateAccumulator()
-  st->accumulator.computed[WHITE] = false;
-  st->accumulator.computed[BLACK] = false;
+  st->accumulator = st->previous->accumulator ? st->previous->accumulator + 1 : nullptr;
+  if (st->accumulator)
+      st->accumulator->computed[WHITE] = st->accumulator->computed[BLACK] = false;
 
   if (st->epSquare != SQ_NONE)
   {
@@ -1058,6 +1208,24 @@ Key Position::key_after(Move m) const {
 }
 
 
+/// Position::pawn_key_after() computes the new pawn hash key after the given
+/// pawn move, with the same limitations as key_after().
+
+Key Position::pawn_key_after(Move m) const {
+
+  Square from = from_sq(m);
+  Square to = to_sq(m);
+  Piece pc = piece_on(from);
+  Piece captured = piece_on(to);
+  Key k = st->pawnKey;
+
+  if (type_of(captured) == PAWN)
+      k ^= Zobrist::psq[captured][to];
+
+  return k ^ Zobrist::psq[pc][to] ^ Zobrist::psq[pc][from];
+}
+
+
 /// Position::see_ge (Static Exchange Evaluation Greater or Equal) tests if the
 /// SEE value of move is greater or equal to the given threshold. We'll use an
 /// algorithm similar to alpha-beta pruning with a null window.
@@ -1319,7 +1487,6 @@ bool Position::pos_is_ok() const {
               assert(0 && "pos_is_ok: Bitboards");
 
   StateInfo si = *st;
-  ASSERT_ALIGNED(&si, Eval::NNUE::CacheLineSize);
 
   set_state(&si);
   if (std::memcmp(&si, st, sizeof(StateInfo)))
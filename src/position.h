@@ -47,6 +47,9 @@ struct StateInfo {
   int    rule50;
   int    pliesFromNull;
   Square epSquare;
+#if defined(USE_ATTACK_MAPS)
+  Bitboard attacks[SQUARE_NB]; // Of the piece on each square, see Position::update_attacks()
+#endif
 
   // Not copied when making a move (will be recomputed anyhow)
   Key        key;
@@ -58,8 +61,9 @@ struct StateInfo {
   Piece      capturedPiece;
   int        repetition;
 
-  // Used by NNUE
-  Eval::NNUE::Accumulator accumulator;
+  // Used by NNUE. The accumulator is owned by the searching thread, see
+  // Thread::accumulators, and is null for the states of the game history.
+  Eval::NNUE::Accumulator* accumulator;
   DirtyPiece dirtyPiece;
 };
 
@@ -67,8 +71,33 @@ struct StateInfo {
 /// A list to keep track of the position states along the setup moves (from the
 /// start position to the position just before the search starts). Needed by
 /// 'draw by repetition' detection. Use a std::deque because pointers to
-/// elements are not invalidated upon list resizing.
-typedef std::unique_ptr<std::deque<StateInfo>> StateListPtr;
+/// elements are not invalidated upon list resizing. The list is shared by the
+/// UCI loop, which appends the moves of the next position command to it, and
+/// the threads searching from its last position.
+typedef std::shared_ptr<std::deque<StateInfo>> StateListPtr;
+
+
+/// PackedPosition is the 40 bytes binary position read and written by the
+/// 'score' command. The pieces are stored 4 bits each in the order of their
+/// squares. The castling rights are those of the outermost rooks, and the
+/// multi-byte fields are little-endian. The fields after gamePly hold a search
+/// result, except the game result which is only carried along.
+struct PackedPosition {
+  uint64_t occupied;
+  uint8_t  pieces[16];
+  uint8_t  flags;    // Side to move in bit 0, castling rights in bits 1-4, Chess960 in bit 5
+  uint8_t  epSquare; // SQ_NONE if none
+  uint8_t  rule50;
+  uint8_t  depth;    // Depth of the search, 0 for a static evaluation
+  uint16_t gamePly;
+  int16_t  score;    // Value for the side to move, VALUE_NONE if none
+  uint16_t move;
+  uint8_t  selDepth;
+  uint8_t  result;   // For the side to move: 0 unknown, 1 loss, 2 draw, 3 win
+  uint32_t nodes;
+};
+
+static_assert(sizeof(PackedPosition) == 40, "PackedPosition should be 40 bytes");
 
 
 /// Position class stores information regarding the board representation as
@@ -80,6 +109,7 @@ class Thread;
 class Position {
 public:
   static void init();
+  static Key material_key(const int pieceCount[PIECE_NB]);
 
   Position() = default;
   Position(const Position&) = delete;
@@ -90,6 +120,10 @@ public:
   Position& set(const std::string& code, Color c, StateInfo* si);
   std::string fen() const;
 
+  // Binary input/output
+  Position& set(const PackedPosition& pp, StateInfo* si, Thread* th);
+  PackedPosition pack() const;
+
   // Position representation
   Bitboard pieces(PieceType pt) const;
   Bitboard pieces(PieceType pt1, PieceType pt2) const;
@@ -120,6 +154,8 @@ public:
   Bitboard attackers_to(Square s) const;
   Bitboard attackers_to(Square s, Bitboard occupied) const;
   Bitboard slider_blockers(Bitboard sliders, Square s, Bitboard& pinners) const;
+  template<PieceType Pt> Bitboard attacks_from(Square s) const;
+  Bitboard attacks_from(Square s) const;
 
   // Properties of moves
   bool legal(Move m) const;
@@ -148,6 +184,7 @@ public:
   // Accessing hash keys
   Key key() const;
   Key key_after(Move m) const;
+  Key pawn_key_after(Move m) const;
   Key material_key() const;
   Key pawn_key() const;
 
@@ -179,6 +216,10 @@ private:
   void set_castling_right(Color c, Square rfrom);
   void set_state(StateInfo* si) const;
   void set_check_info(StateInfo* si) const;
+#if defined(USE_ATTACK_MAPS)
+  Bitboard piece_attacks(Square s) const;
+  void update_attacks(Bitboard changed);
+#endif
 
   // Other helpers
   void move_piece(Square from, Square to);
@@ -281,6 +322,30 @@ inline Square Position::castling_rook_square(CastlingRights cr) const {
   return castlingRookSquare[cr];
 }
 
+/// Position::attacks_from() returns the attacks of the piece on the given square,
+/// which must not be a pawn, read from the attack maps of 'make attackmaps=yes'.
+
+template<PieceType Pt>
+inline Bitboard Position::attacks_from(Square s) const {
+
+  assert(type_of(piece_on(s)) == Pt);
+#if defined(USE_ATTACK_MAPS)
+  return st->attacks[s];
+#else
+  return attacks_bb<Pt>(s, pieces());
+#endif
+}
+
+inline Bitboard Position::attacks_from(Square s) const {
+
+  assert(type_of(piece_on(s)) != PAWN);
+#if defined(USE_ATTACK_MAPS)
+  return st->attacks[s];
+#else
+  return attacks_bb(type_of(piece_on(s)), s, pieces());
+#endif
+}
+
 inline Bitboard Position::attackers_to(Square s) const {
   return attackers_to(s, pieces());
 }
@@ -20,9 +20,11 @@
 #include <cassert>
 #include <cmath>
 #include <cstring>   // For std::memset
+#include <deque>
 #include <iostream>
 #include <sstream>
 
+#include "cluster.h"
 #include "evaluate.h"
 #include "misc.h"
 #include "movegen.h"
@@ -116,31 +118,49 @@ namespace {
   void update_all_stats(const Position& pos, Stack* ss, Move bestMove, Value bestValue, Value beta, Square prevSq,
                         Move* quietsSearched, int quietCount, Move* capturesSearched, int captureCount, Depth depth);
 
+  // Perft hash table, see Thread::search_perft(). The key of an entry is xored
+  // with its count, so that an entry torn by concurrent writes never matches.
+  struct PerftEntry {
+    Key key;
+    uint64_t nodes;
+  };
+
+  std::vector<PerftEntry> PerftTable;
+
   // perft() is our utility to verify move generation. All the leaf nodes up
   // to the given depth are generated and counted, and the sum is returned.
-  template<bool Root>
   uint64_t perft(Position& pos, Depth depth) {
 
+    if (depth == 1)
+        return MoveList<LEGAL>(pos).size();
+
+    PerftEntry* e = nullptr;
+    const Key key = pos.key() ^ (Key(depth) << 56);
+
+    if (!PerftTable.empty())
+    {
+        e = &PerftTable[mul_hi64(key, PerftTable.size())];
+        if ((e->key ^ e->nodes) == key)
+            return e->nodes;
+    }
+
     StateInfo st;
-    ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
-    uint64_t cnt, nodes = 0;
-    const bool leaf = (depth == 2);
+    uint64_t nodes = 0;
 
     for (const auto& m : MoveList<LEGAL>(pos))
     {
-        if (Root && depth <= 1)
-            cnt = 1, nodes++;
-        else
-        {
-            pos.do_move(m, st);
-            cnt = leaf ? MoveList<LEGAL>(pos).size() : perft<false>(pos, depth - 1);
-            nodes += cnt;
-            pos.undo_move(m);
-        }
-        if (Root)
-            sync_cout << UCI::move(m, pos.is_chess960()) << ": " << cnt << sync_endl;
+        pos.do_move(m, st);
+        nodes += perft(pos, depth - 1);
+        pos.undo_move(m);
     }
+
+    if (e)
+    {
+        e->key = key ^ nodes;
+        e->nodes = nodes;
+    }
+
     return nodes;
   }
 
@@ -162,10 +182,10 @@ void Search::clear() {
 
   Threads.main()->wait_for_search_finished();
 
-  Time.availableNodes = 0;
+  Time.new_game();
   TT.clear();
   Threads.clear();
-  Tablebases::init(Options["SyzygyPath"]); // Free mapped files
+  Tablebases::clear(); // Free mapped files
 }
 
 
@@ -174,19 +194,15 @@ void Search::clear() {
 
 void MainThread::search() {
 
-  if (Limits.perft)
-  {
-      nodes = perft<true>(rootPos, Limits.perft);
-      sync_cout << "\nNodes searched: " << nodes << "\n" << sync_endl;
-      return;
-  }
-
   Color us = rootPos.side_to_move();
+  bool pondered = ponder;
   Time.init(Limits, us, rootPos.game_ply());
   TT.new_search();
 
   Eval::NNUE::verify();
 
+  Cluster::signals_init();
+
   if (rootMoves.empty())
   {
       rootMoves.emplace_back(MOVE_NONE);
@@ -206,15 +222,40 @@ void MainThread::search() {
   // GUI sends a "stop" or "ponderhit" command. We therefore simply wait here
   // until the GUI sends one of those commands.
 
+  // In a split MultiPV search, the other groups have their own lines to finish
+  // when the search is limited by depth.
+  if (Threads.splitRoot && Limits.depth)
+      Threads.wait_for_search_finished();
+
   while (!Threads.stop && (ponder || Limits.infinite))
-  {} // Busy wait for a stop or a ponder reset
+      Cluster::signals_poll(); // Busy wait for a stop or a ponder reset
 
   // Stop the threads if not already stopped (also raise the stop if
   // "ponderhit" just reset Threads.ponder).
+  if (!stopTime)
+      stopTime = now();
+
   Threads.stop = true;
 
-  // Wait until all threads have finished
-  Threads.wait_for_search_finished();
+  // The ranks of a cluster wait for each other, so that the vote below sees
+  // the final lines of all of them.
+  Cluster::signals_sync();
+
+  bool vote =   int(Options["MultiPV"]) == 1
+             && !Limits.depth
+             && !(Skill(Options["Skill Level"]).enabled() || int(Options["UCI_LimitStrength"]))
+             && rootMoves[0].pv[0] != MOVE_NONE;
+
+  // Wait until all threads have finished when the best move depends on their
+  // root moves, or for an exact node count. Otherwise the best move is sent at
+  // once and the helpers are waited for afterwards. The lines of a split
+  // MultiPV search are published under a lock, so they are safe to read.
+  // The vote of a timed single-PV game does wait: until a helper sees the stop
+  // it still sorts its root moves and rewrites their PVs, so reading them now
+  // would race. The helpers leave the search within a node of the stop, so the
+  // wait is short.
+  if ((vote && !Threads.splitRoot) || Limits.npmsec)
+      Threads.wait_for_search_finished();
 
   // When playing in 'nodes as time' mode, subtract the searched nodes from
   // the available ones before exiting.
@@ -222,17 +263,42 @@ void MainThread::search() {
       Time.availableNodes += Limits.inc[us] - Threads.nodes_searched();
 
   Thread* bestThread = this;
+  bool remoteBest = false;
+
+  // The best move of a split MultiPV search is that of the best merged line
+  if (Threads.splitRoot)
+  {
+      std::vector<SplitLine> lines = Threads.split_lines();
 
-  if (   int(Options["MultiPV"]) == 1
-      && !Limits.depth
-      && !(Skill(Options["Skill Level"]).enabled() || int(Options["UCI_LimitStrength"]))
-      && rootMoves[0].pv[0] != MOVE_NONE)
+      if (!lines.empty())
+      {
+          rootMoves[0] = lines[0].rootMove;
+          sync_cout << UCI::pv(rootPos, completedDepth, -VALUE_INFINITE, VALUE_INFINITE) << sync_endl;
+      }
+  }
+
+  else if (vote)
+  {
       bestThread = Threads.get_best_thread();
 
+      // The best thread of each rank of a cluster then votes for its move.
+      // The line of another rank replaces that of the main thread.
+      RootMove rm = bestThread->rootMoves[0];
+      Depth depth = bestThread->completedDepth;
+
+      if (Cluster::pick_move(rm, depth))
+      {
+          rootMoves[0] = rm;
+          completedDepth = depth;
+          bestThread = this;
+          remoteBest = true;
+      }
+  }
+
   bestPreviousScore = bestThread->rootMoves[0].score;
 
   // Send again PV info if we have a new best thread
-  if (bestThread != this)
+  if (bestThread != this || remoteBest)
       sync_cout << UCI::pv(bestThread->rootPos, bestThread->completedDepth, -VALUE_INFINITE, VALUE_INFINITE) << sync_endl;
 
   sync_cout << "bestmove " << UCI::move(bestThread->rootMoves[0].pv[0], rootPos.is_chess960());
@@ -240,7 +306,485 @@ void MainThread::search() {
   if (bestThread->rootMoves[0].pv.size() > 1 || bestThread->rootMoves[0].extract_ponder_from_tt(rootPos))
       std::cout << " ponder " << UCI::move(bestThread->rootMoves[0].pv[1], rootPos.is_chess960());
 
-  std::cout << sync_endl;
+  std::cout << sync_flush;
+
+  Time.move_played(pondered);
+
+  if (!std::string(Options["Debug Log File"]).empty())
+      sync_cout << "info string stop latency " << now() - stopTime << " ms"
+                << " measured move overhead " << Time.measuredOverhead << " ms" << sync_endl;
+
+  // The helpers must be done before the next search can start
+  Threads.wait_for_search_finished();
+}
+
+
+/// Thread::search_batch() is started instead of search() when the program
+/// receives the 'go batch' command. Each thread takes the next position of
+/// the batch, searches it on its own to the given depth and outputs the result
+/// as soon as it is done, sharing only the TT and the network with the others.
+/// The main thread also reports the totals once all the threads have finished.
+/// For the 'score' command, the results are stored in Threads.batchRecords
+/// instead, and at depth 0 the positions not in check get their static eval.
+
+void Thread::search_batch() {
+
+  if (this == Threads.main())
+  {
+      Time.init(Limits, WHITE, 0);
+      TT.new_search();
+      Tablebases::set_probe_limits();
+
+      Eval::NNUE::verify();
+
+      Threads.start_searching(); // start non-main threads
+  }
+
+  size_t n;
+
+  while (!Threads.stop && (n = Threads.batchNext++) < Threads.batchSize)
+  {
+      PackedPosition* record = Threads.batchRecords ? Threads.batchRecords + n : nullptr;
+
+      if (record && Threads.batchFens.empty())
+          rootPos.set(*record, &rootState, this);
+      else
+          rootPos.set(Threads.batchFens[n], Threads.batchChess960, &rootState, this);
+
+      uint8_t result = record && Threads.batchFens.empty() ? record->result : 0;
+
+      if (record && !Limits.depth)
+      {
+          *record = rootPos.pack();
+          record->result = result;
+
+          trend = SCORE_ZERO; // No dynamic contempt left from a search
+
+          if (!rootPos.checkers())
+              record->score = int16_t(Eval::evaluate(rootPos));
+
+          ++Threads.batchDone;
+          continue;
+      }
+
+      rootMoves.clear();
+      for (const auto& m : MoveList<LEGAL>(rootPos))
+          rootMoves.emplace_back(m);
+
+      nodes = tbHits = nmpMinPly = bestMoveChanges = 0;
+      rootDepth = completedDepth = 0;
+
+      if (rootMoves.empty())
+          rootMoves.emplace_back(MOVE_NONE);
+      else
+          Thread::search();
+
+      if (Threads.stop)
+          break;
+
+      const RootMove& rm = rootMoves[0];
+      Value v = rm.score == -VALUE_INFINITE ? (rootPos.checkers() ? -VALUE_MATE : VALUE_DRAW)
+                                            : rm.score;
+      Threads.batchNodes += nodes;
+
+      if (record)
+      {
+          *record = rootPos.pack();
+          record->result = result;
+          record->depth = uint8_t(completedDepth);
+          record->selDepth = uint8_t(rm.selDepth);
+          record->score = int16_t(v);
+          record->move = uint16_t(rm.pv[0]);
+          record->nodes = uint32_t(std::min(nodes.load(), uint64_t(UINT32_MAX)));
+          ++Threads.batchDone;
+          continue;
+      }
+
+      std::stringstream ss;
+
+      ss << "batch " << n
+         << " depth "    << completedDepth
+         << " seldepth " << rm.selDepth
+         << " score "    << UCI::value(v)
+         << " nodes "    << nodes
+         << " pv";
+
+      for (Move m : rm.pv)
+          ss << " " << UCI::move(m, rootPos.is_chess960());
+
+      ++Threads.batchDone;
+
+      sync_cout << ss.str() << sync_endl;
+  }
+
+  if (this != Threads.main())
+      return;
+
+  // Wait until the other threads are done with their last positions
+  Threads.wait_for_search_finished();
+  Threads.stop = true;
+
+  if (Threads.batchRecords)
+      return;
+
+  TimePoint elapsed = Time.elapsed() + 1;
+
+  sync_cout << "batchdone positions " << Threads.batchDone
+            << " nodes " << Threads.batchNodes
+            << " nps "   << Threads.batchNodes * 1000 / elapsed
+            << " time "  << elapsed << sync_endl;
+}
+
+
+/// Thread::search_gensfen() is started instead of search() on the 'gensfen'
+/// command. Each thread plays whole self-play games in turn from the start
+/// position, with its own small hash table cleared before each game: a few
+/// random moves first, then the best move of a fixed depth or nodes search.
+/// A game ends on mate, on a draw by the rules, a repetition or insufficient
+/// material, on a tablebase position, or when the score reaches the eval
+/// limit. The searched positions are stored as PackedPosition records with
+/// the score, best move and the result of the game, and are written together
+/// when the game ends, so that a 'stop' leaves only whole games in the file.
+
+void Thread::search_gensfen() {
+
+  constexpr int MaxGamePly = 400;
+  constexpr const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+  const GensfenParams& params = Threads.gensfenParams;
+
+  if (this == Threads.main())
+  {
+      Time.init(Limits, WHITE, 0);
+      TT.new_search();
+      Tablebases::set_probe_limits();
+
+      Eval::NNUE::verify();
+
+      Threads.start_searching(); // start non-main threads
+  }
+
+  TranspositionTable table;
+  table.allocate(params.hash);
+  tt = &table;
+
+  std::vector<PackedPosition> records;
+  size_t n;
+
+  while (!Threads.stop && (n = Threads.batchNext++) < Threads.batchSize)
+  {
+      PRNG rng((params.seed ^ (n * 0x9E3779B97F4A7C15ULL)) | 1);
+      std::deque<StateInfo> states(1);
+      int result = -1; // Of the game for white, 0 loss, 1 draw, 2 win
+
+      table.reset();
+      records.clear();
+      rootPos.set(StartFEN, false, &states.back(), this);
+
+      while (result == -1 && !Threads.stop)
+      {
+          MoveList<LEGAL> moves(rootPos);
+          Color us = rootPos.side_to_move();
+          Tablebases::ProbeState ps = Tablebases::FAIL;
+          Tablebases::WDLScore wdl = Tablebases::WDLDraw;
+
+          if (   rootPos.count<ALL_PIECES>() <= Tablebases::MaxCardinality
+              && !rootPos.can_castle(ANY_CASTLING))
+              wdl = Tablebases::probe_wdl(rootPos, &ps);
+
+          if (!moves.size())
+              result = rootPos.checkers() ? (us == WHITE ? 0 : 2) : 1;
+
+          else if (   rootPos.is_draw(MAX_PLY)
+                   || rootPos.game_ply() >= MaxGamePly
+                   || (!rootPos.count<PAWN>() && rootPos.non_pawn_material() <= BishopValueMg))
+              result = 1;
+
+          // Cursed wins and blessed losses are draws under the 50 moves rule
+          else if (ps != Tablebases::FAIL)
+              result = wdl > Tablebases::WDLCursedWin  ? (us == WHITE ? 2 : 0)
+                     : wdl < Tablebases::WDLBlessedLoss ? (us == WHITE ? 0 : 2) : 1;
+
+          if (result != -1)
+              break;
+
+          Move m;
+
+          if (rootPos.game_ply() < params.randomPlies)
+              m = *(moves.begin() + rng.rand<unsigned>() % moves.size());
+          else
+          {
+              rootMoves.clear();
+              for (const auto& rm : moves)
+                  rootMoves.emplace_back(rm);
+
+              nodes = tbHits = nmpMinPly = bestMoveChanges = 0;
+              rootDepth = completedDepth = 0;
+
+              Thread::search();
+
+              if (Threads.stop)
+                  break;
+
+              const RootMove& rm = rootMoves[0];
+              Threads.batchNodes += nodes;
+
+              PackedPosition record = rootPos.pack();
+              record.depth = uint8_t(completedDepth);
+              record.selDepth = uint8_t(rm.selDepth);
+              record.score = int16_t(rm.score);
+              record.move = uint16_t(rm.pv[0]);
+              record.nodes = uint32_t(std::min(nodes.load(), uint64_t(UINT32_MAX)));
+              records.push_back(record);
+
+              if (abs(rm.score) >= params.evalLimit)
+                  result = (rm.score > 0) == (us == WHITE) ? 2 : 0;
+
+              m = rm.pv[0];
+          }
+
+          states.emplace_back();
+          rootPos.do_move(m, states.back());
+      }
+
+      if (result == -1)
+          break;
+
+      // The result is stored for the side to move, 1 loss, 2 draw, 3 win
+      for (PackedPosition& record : records)
+          record.result = uint8_t(1 + ((record.flags & 1) ? 2 - result : result));
+
+      std::lock_guard<std::mutex> lk(Threads.gensfenMutex);
+
+      Threads.gensfenFile.write(reinterpret_cast<const char*>(records.data()),
+                                std::streamsize(records.size() * sizeof(PackedPosition)));
+      Threads.gensfenPositions += records.size();
+
+      if (++Threads.batchDone % 100 == 0)
+          sync_cout << "info string gensfen games " << Threads.batchDone
+                    << " positions " << Threads.gensfenPositions << sync_endl;
+  }
+
+  tt = &TT;
+  rootPos.set(StartFEN, false, &rootState, this); // Not left on the game states
+
+  if (this != Threads.main())
+      return;
+
+  // Wait until the other threads are done with their last games
+  Threads.wait_for_search_finished();
+  Threads.stop = true;
+
+  Threads.gensfenFile.close();
+
+  TimePoint elapsed = Time.elapsed() + 1;
+
+  sync_cout << "gensfendone games " << Threads.batchDone
+            << " positions " << Threads.gensfenPositions
+            << " nodes "     << Threads.batchNodes
+            << " positions/second " << Threads.gensfenPositions * 1000 / elapsed
+            << " time "      << elapsed << sync_endl;
+}
+
+
+/// Thread::search_server() is started instead of search() on the 'server'
+/// command. Each thread takes the next queued job, that is the 'go' of a
+/// session, and searches it on its own with the limits, clock and stop flag of
+/// the job, sharing only the network and the TT, unless the session has its own
+/// table. The result is output as soon as the job is done, prefixed with the
+/// name of its session. The threads wait for more jobs until the server quits.
+
+void Thread::search_server() {
+
+  if (this == Threads.main())
+  {
+      Tablebases::set_probe_limits();
+
+      Eval::NNUE::verify();
+
+      Threads.start_searching(); // start non-main threads
+  }
+
+  while (true)
+  {
+      {
+          std::unique_lock<std::mutex> lk(Threads.serverMutex);
+          Threads.serverCv.wait(lk, [&]{ return Threads.serverQuit || !Threads.serverJobs.empty(); });
+
+          if (Threads.serverQuit)
+              break;
+
+          job = Threads.serverJobs.front();
+          Threads.serverJobs.pop_front();
+          job->started = true;
+      }
+
+      // As in 'go batch', the root moves are not ranked with the tablebases,
+      // which would change the probe limits shared by all the jobs.
+      rootPos.set(job->fen, job->chess960, &rootState, this);
+      rootState = job->states->back();
+
+      rootMoves.clear();
+      for (const auto& m : MoveList<LEGAL>(rootPos))
+          if (   job->limits.searchmoves.empty()
+              || std::count(job->limits.searchmoves.begin(), job->limits.searchmoves.end(), m))
+              rootMoves.emplace_back(m);
+
+      tt = job->tt ? job->tt : &TT;
+      tt->new_search();
+      stopFlag = &job->stop;
+      jobCallsCnt = 0;
+
+      nodes = tbHits = nmpMinPly = bestMoveChanges = 0;
+      rootDepth = completedDepth = 0;
+
+      if (rootMoves.empty())
+          rootMoves.emplace_back(MOVE_NONE);
+      else
+          Thread::search();
+
+      RootMove& rm = rootMoves[0];
+      Value v = rm.score != -VALUE_INFINITE ? rm.score : rm.previousScore;
+      TimePoint elapsed = now() - job->limits.startTime + 1;
+      std::stringstream ss;
+
+      if (v == -VALUE_INFINITE)
+          v = VALUE_ZERO;
+
+      if (rm.pv[0] != MOVE_NONE)
+      {
+          ss << job->session << " info"
+             << " depth "    << completedDepth
+             << " seldepth " << rm.selDepth
+             << " score "    << UCI::value(v)
+             << " nodes "    << nodes
+             << " nps "      << nodes * 1000 / elapsed
+             << " time "     << elapsed
+             << " pv";
+
+          for (Move m : rm.pv)
+              ss << " " << UCI::move(m, rootPos.is_chess960());
+
+          ss << "\n";
+      }
+
+      ss << job->session << " bestmove " << UCI::move(rm.pv[0], rootPos.is_chess960());
+
+      if (rm.pv[0] != MOVE_NONE && (rm.pv.size() > 1 || rm.extract_ponder_from_tt(rootPos)))
+          ss << " ponder " << UCI::move(rm.pv[1], rootPos.is_chess960());
+
+      sync_cout << ss.str() << sync_endl;
+
+      tt = &TT;
+      stopFlag = &Threads.stop;
+      rootPos.set(rootPos.fen(), rootPos.is_chess960(), &rootState, this); // Not left on the job states
+
+      std::scoped_lock<std::mutex> lk(Threads.serverMutex);
+      job->done = true;
+      job = nullptr;
+  }
+
+  if (this != Threads.main())
+      return;
+
+  // Wait until the other threads are done with their last jobs
+  Threads.wait_for_search_finished();
+  Threads.stop = true;
+}
+
+
+/// Thread::search_perft() is started instead of search() when the program
+/// receives the 'go perft' command. The threads share the subtrees of the root
+/// moves, or of the replies to them when deep enough to keep all the threads
+/// busy until the end, and optionally a hash table of the subtree counts.
+
+void Thread::search_perft() {
+
+  const Depth depth = Limits.perft;
+  const TimePoint start = now();
+
+  if (this == Threads.main())
+  {
+      PerftTable.assign(size_t(Limits.perftHash) * 1024 * 1024 / sizeof(PerftEntry), PerftEntry());
+
+      Threads.perftNext = 0;
+      for (auto& cnt : Threads.perftCounts)
+          cnt = 0;
+
+      Threads.start_searching(); // start non-main threads
+  }
+
+  // Each thread builds the same list of subtrees from its copy of the root
+  std::vector<std::pair<size_t, Move>> subtrees;
+  StateInfo st[2];
+
+  for (size_t i = 0; i < rootMoves.size(); ++i)
+      if (depth < 3)
+          subtrees.emplace_back(i, MOVE_NONE);
+      else
+      {
+          rootPos.do_move(rootMoves[i].pv[0], st[0]);
+          for (const auto& m : MoveList<LEGAL>(rootPos))
+              subtrees.emplace_back(i, m);
+          rootPos.undo_move(rootMoves[i].pv[0]);
+      }
+
+  size_t n;
+
+  while ((n = Threads.perftNext++) < subtrees.size())
+  {
+      const auto [i, reply] = subtrees[n];
+      const Move m = rootMoves[i].pv[0];
+      uint64_t cnt = 1;
+
+      if (depth > 1)
+      {
+          rootPos.do_move(m, st[0]);
+
+          if (reply != MOVE_NONE)
+          {
+              rootPos.do_move(reply, st[1]);
+              cnt = perft(rootPos, depth - 2);
+              rootPos.undo_move(reply);
+          }
+          else
+              cnt = perft(rootPos, depth - 1);
+
+          rootPos.undo_move(m);
+      }
+
+      Threads.perftCounts[i] += cnt;
+  }
+
+  if (this != Threads.main())
+      return;
+
+  // Wait until the other threads are done with their last subtrees
+  Threads.wait_for_search_finished();
+  std::vector<PerftEntry>().swap(PerftTable);
+
+  uint64_t total = 0;
+
+  for (size_t i = 0; i < rootMoves.size(); ++i)
+  {
+      total += Threads.perftCounts[i];
+      sync_cout << UCI::move(rootMoves[i].pv[0], rootPos.is_chess960())
+                << ": " << Threads.perftCounts[i] << sync_endl;
+  }
+
+  // The nodes counted by do_move() are replaced by the leaf nodes, which is
+  // what 'bench' sums up over the threads
+  for (Thread* th : Threads)
+      th->nodes = 0;
+  nodes = total;
+
+  const TimePoint elapsed = now() - start + 1;
+
+  sync_cout << "\nNodes searched: " << total
+            << "\nThreads: " << Threads.size()
+            << " time (ms): " << elapsed
+            << " Mnps: " << double(total) / elapsed / 1000
+            << "\n" << sync_endl;
 }
 
 
@@ -259,7 +803,8 @@ void Thread::search() {
   Value bestValue, alpha, beta, delta;
   Move  lastBestMove = MOVE_NONE;
   Depth lastBestMoveDepth = 0;
-  MainThread* mainThread = (this == Threads.main() ? Threads.main() : nullptr);
+  MainThread* mainThread = (this == Threads.main() && !Threads.batching() ? Threads.main() : nullptr);
+  const Search::LimitsType& limits = job ? job->limits : Limits;
   double timeReduction = 1, totBestMoveChanges = 0;
   Color us = rootPos.side_to_move();
   int iterIdx = 0;
@@ -273,6 +818,11 @@ void Thread::search() {
 
   ss->pv = pv;
 
+  // The positions of the search take their accumulators from the arena of
+  // the thread, ply by ply, starting with the root
+  rootPos.state()->accumulator = accumulators;
+  accumulators->computed[WHITE] = accumulators->computed[BLACK] = false;
+
   bestValue = delta = alpha = -VALUE_INFINITE;
   beta = VALUE_INFINITE;
 
@@ -318,8 +868,9 @@ void Thread::search() {
 
   // Iterative deepening loop until requested to stop or the target depth is reached
   while (   ++rootDepth < MAX_PLY
-         && !Threads.stop
-         && !(Limits.depth && mainThread && rootDepth > Limits.depth))
+         && !stopped()
+         && !(limits.depth && (mainThread || Threads.batching() || Threads.splitRoot) && rootDepth > limits.depth)
+         && !(limits.nodes && Threads.batching() && nodes >= uint64_t(limits.nodes)))
   {
       // Age out PV variability metric
       if (mainThread)
@@ -337,7 +888,7 @@ void Thread::search() {
          searchAgainCounter++;
 
       // MultiPV loop. We perform a full root search for each PV line
-      for (pvIdx = 0; pvIdx < multiPV && !Threads.stop; ++pvIdx)
+      for (pvIdx = 0; pvIdx < multiPV && !stopped(); ++pvIdx)
       {
           if (pvIdx == pvLast)
           {
@@ -385,7 +936,7 @@ void Thread::search() {
               // If search has been stopped, we break immediately. Sorting is
               // safe because RootMoves is still valid, although it refers to
               // the previous iteration.
-              if (Threads.stop)
+              if (stopped())
                   break;
 
               // When failing high/low give some update (without cluttering
@@ -423,24 +974,57 @@ void Thread::search() {
           // Sort the PV lines searched so far and update the GUI
           std::stable_sort(rootMoves.begin() + pvFirst, rootMoves.begin() + pvIdx + 1);
 
+          // In a split MultiPV search, publish the lines for the merged output.
+          // The lines still to be searched keep their score of the last iteration.
+          if (Threads.splitRoot)
+          {
+              std::lock_guard<std::mutex> lk(Threads.splitMutex);
+              splitLines.clear();
+
+              for (size_t i = 0; i < multiPV; ++i)
+              {
+                  bool updated = rootMoves[i].score != -VALUE_INFINITE;
+
+                  if (!updated && rootMoves[i].previousScore == -VALUE_INFINITE)
+                      continue;
+
+                  splitLines.push_back({ rootMoves[i], updated ? rootDepth : std::max(1, rootDepth - 1) });
+
+                  if (!updated)
+                      splitLines.back().rootMove.score = rootMoves[i].previousScore;
+              }
+          }
+
           if (    mainThread
               && (Threads.stop || pvIdx + 1 == multiPV || Time.elapsed() > 3000))
               sync_cout << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
       }
 
-      if (!Threads.stop)
+      if (!stopped())
+      {
           completedDepth = rootDepth;
 
+          if (mainThread)
+              mainThread->depthTime[rootDepth] = Time.elapsed();
+      }
+
       if (rootMoves[0].pv[0] != lastBestMove) {
          lastBestMove = rootMoves[0].pv[0];
          lastBestMoveDepth = rootDepth;
       }
 
       // Have we found a "mate in x"?
-      if (   Limits.mate
+      if (   limits.mate
           && bestValue >= VALUE_MATE_IN_MAX_PLY
-          && VALUE_MATE - bestValue <= 2 * Limits.mate)
-          Threads.stop = true;
+          && VALUE_MATE - bestValue <= 2 * limits.mate)
+          *stopFlag = true;
+
+      // A job of the 'server' command with a clock does not start an iteration
+      // past its optimum time, see Thread::check_job() for the maximum.
+      if (   job
+          && limits.use_time_management()
+          && job->elapsed(nodes) > job->optimum)
+          job->stop = true;
 
       if (!mainThread)
           continue;
@@ -450,7 +1034,9 @@ void Thread::search() {
           skill.pick_best(multiPV);
 
       // Do we have time for the next iteration? Can we stop searching now?
+      // In a cluster only rank 0 decides, the others are told to stop.
       if (    Limits.use_time_management()
+          &&  Cluster::is_root()
           && !Threads.stop
           && !mainThread->stopOnPonderhit)
       {
@@ -474,7 +1060,7 @@ void Thread::search() {
 
           // Cap used time in case of a single legal move for a better viewer experience in tournaments
           // yielding correct scores and sufficiently fast moves.
-          if (rootMoves.size() == 1)
+          if (rootMoves.size() == 1 && !Threads.splitRoot)
               totalTime = std::min(500.0, totalTime);
 
           // Stop the search if we have exceeded the totalTime
@@ -499,6 +1085,9 @@ void Thread::search() {
       iterIdx = (iterIdx + 1) & 3;
   }
 
+  // The root state may outlive the search, as in 'gensfen'
+  rootPos.state()->accumulator = nullptr;
+
   if (!mainThread)
       return;
 
@@ -545,7 +1134,6 @@ namespace {
 
     Move pv[MAX_PLY+1], capturesSearched[32], quietsSearched[64];
     StateInfo st;
-    ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
     TTEntry* tte;
     Key posKey;
@@ -567,8 +1155,12 @@ namespace {
     bestValue          = -VALUE_INFINITE;
     maxValue           = VALUE_INFINITE;
 
+    SEARCH_STAT(thisThread, nodes);
+
     // Check for the available remaining time
-    if (thisThread == Threads.main())
+    if (thisThread->job)
+        thisThread->check_job();
+    else if (thisThread == Threads.main())
         static_cast<MainThread*>(thisThread)->check_time();
 
     // Used to send selDepth info to GUI (selDepth counts from 1, ply from 0)
@@ -578,7 +1170,7 @@ namespace {
     if (!rootNode)
     {
         // Step 2. Check for aborted search and immediate draw
-        if (   Threads.stop.load(std::memory_order_relaxed)
+        if (   thisThread->stopped()
             || pos.is_draw(ss->ply)
             || ss->ply >= MAX_PLY)
             return (ss->ply >= MAX_PLY && !ss->inCheck) ? evaluate(pos)
@@ -617,7 +1209,7 @@ namespace {
     // position key in case of an excluded move.
     excludedMove = ss->excludedMove;
     posKey = excludedMove == MOVE_NONE ? pos.key() : pos.key() ^ make_key(excludedMove);
-    tte = TT.probe(posKey, ss->ttHit);
+    tte = thisThread->tt->probe(posKey, ss->ttHit, thisThread->ttStats);
     ttValue = ss->ttHit ? value_from_tt(tte->value(), ss->ply, pos.rule50_count()) : VALUE_NONE;
     ttMove =  rootNode ? thisThread->rootMoves[thisThread->pvIdx].pv[0]
             : ss->ttHit    ? tte->move() : MOVE_NONE;
@@ -706,7 +1298,7 @@ namespace {
                 if (    b == BOUND_EXACT
                     || (b == BOUND_LOWER ? value >= beta : value <= alpha))
                 {
-                    tte->save(posKey, value_to_tt(value, ss->ply), ss->ttPv, b,
+                    Cluster::save(thisThread, tte, posKey, value_to_tt(value, ss->ply), ss->ttPv, b,
                               std::min(MAX_PLY - 1, depth + 6),
                               MOVE_NONE, VALUE_NONE);
 
@@ -761,7 +1353,7 @@ namespace {
 
         // Save static evaluation into transposition table
         if(!excludedMove)
-        tte->save(posKey, VALUE_NONE, ss->ttPv, BOUND_NONE, DEPTH_NONE, MOVE_NONE, eval);
+        Cluster::save(thisThread, tte, posKey, VALUE_NONE, ss->ttPv, BOUND_NONE, DEPTH_NONE, MOVE_NONE, eval);
     }
 
     // Use static evaluation difference to improve quiet move ordering
@@ -810,8 +1402,12 @@ namespace {
 
         pos.undo_null_move();
 
+        SEARCH_STAT(thisThread, nullMoveSearches);
+
         if (nullValue >= beta)
         {
+            SEARCH_STAT(thisThread, nullMoveCutoffs);
+
             // Do not return unproven mate or TB scores
             if (nullValue >= VALUE_TB_WIN_IN_MAX_PLY)
                 nullValue = beta;
@@ -861,7 +1457,7 @@ namespace {
 
         while (   (move = mp.next_move()) != MOVE_NONE
                && probCutCount < 2 + 2 * cutNode)
-            if (move != excludedMove && pos.legal(move))
+            if (move != excludedMove)
             {
                 assert(pos.capture_or_promotion(move));
                 assert(depth >= 5);
@@ -892,7 +1488,7 @@ namespace {
                     if ( !(ss->ttHit
                        && tte->depth() >= depth - 3
                        && ttValue != VALUE_NONE))
-                        tte->save(posKey, value_to_tt(value, ss->ply), ttPv,
+                        Cluster::save(thisThread, tte, posKey, value_to_tt(value, ss->ply), ttPv,
                             BOUND_LOWER,
                             depth - 3, move, ss->staticEval);
                     return value;
@@ -951,30 +1547,26 @@ moves_loop: // When in check, search starts from here
                          && (tte->bound() & BOUND_UPPER)
                          && tte->depth() >= depth;
 
-    // Step 12. Loop through all pseudo-legal moves until no moves remain
+    // Step 12. Loop through all legal moves until no moves remain
     // or a beta cutoff occurs.
     while ((move = mp.next_move(moveCountPruning)) != MOVE_NONE)
     {
       assert(is_ok(move));
+      assert(pos.legal(move));
 
       if (move == excludedMove)
           continue;
 
       // At root obey the "searchmoves" option and skip moves not listed in Root
-      // Move List. As a consequence any illegal move is also skipped. In MultiPV
-      // mode we also skip PV moves which have been already searched and those
-      // of lower "TB rank" if we are in a TB root position.
+      // Move List. In MultiPV mode we also skip PV moves which have been already
+      // searched and those of lower "TB rank" if we are in a TB root position.
       if (rootNode && !std::count(thisThread->rootMoves.begin() + thisThread->pvIdx,
                                   thisThread->rootMoves.begin() + thisThread->pvLast, move))
           continue;
 
-      // Check for legality
-      if (!rootNode && !pos.legal(move))
-          continue;
-
       ss->moveCount = ++moveCount;
 
-      if (rootNode && thisThread == Threads.main() && Time.elapsed() > 3000)
+      if (rootNode && thisThread == Threads.main() && !Threads.batching() && Time.elapsed() > 3000)
           sync_cout << "info depth " << depth
                     << " currmove " << UCI::move(move, pos.is_chess960())
                     << " currmovenumber " << moveCount + thisThread->pvIdx << sync_endl;
@@ -1059,8 +1651,11 @@ moves_loop: // When in check, search starts from here
           value = search<NonPV>(pos, ss, singularBeta - 1, singularBeta, singularDepth, cutNode);
           ss->excludedMove = MOVE_NONE;
 
+          SEARCH_STAT(thisThread, singularSearches);
+
           if (value < singularBeta)
           {
+              SEARCH_STAT(thisThread, singularExtensions);
               extension = 1;
               singularQuietLMR = !ttCapture;
 
@@ -1104,7 +1699,7 @@ moves_loop: // When in check, search starts from here
       ss->doubleExtensions = (ss-1)->doubleExtensions + (extension == 2);
 
       // Speculative prefetch as early as possible
-      prefetch(TT.first_entry(pos.key_after(move)));
+      prefetch(thisThread->tt->first_entry(pos.key_after(move)));
 
       // Update the current move (this must be done after singular extension search)
       ss->currentMove = move;
@@ -1186,6 +1781,10 @@ moves_loop: // When in check, search starts from here
           // If the son is reduced and fails high it will be re-searched at full depth
           doFullDepthSearch = value > alpha && d < newDepth;
           didLMR = true;
+
+          SEARCH_STAT(thisThread, lmrSearches);
+          if (doFullDepthSearch)
+              SEARCH_STAT(thisThread, lmrResearches);
       }
       else
       {
@@ -1229,7 +1828,7 @@ moves_loop: // When in check, search starts from here
       // Finished searching the move. If a stop occurred, the return value of
       // the search cannot be trusted, and we return immediately without
       // updating best move, PV and TT.
-      if (Threads.stop.load(std::memory_order_relaxed))
+      if (thisThread->stopped())
           return VALUE_ZERO;
 
       if (rootNode)
@@ -1277,6 +1876,11 @@ moves_loop: // When in check, search starts from here
               else
               {
                   assert(value >= beta); // Fail high
+
+                  SEARCH_STAT(thisThread, cutoffs);
+                  SEARCH_STAT(thisThread, stageCutoffs[mp.picked_stage()]);
+                  if (moveCount == 1)
+                      SEARCH_STAT(thisThread, firstMoveCutoffs);
                   break;
               }
           }
@@ -1337,7 +1941,7 @@ moves_loop: // When in check, search starts from here
 
     // Write gathered information in transposition table
     if (!excludedMove && !(rootNode && thisThread->pvIdx))
-        tte->save(posKey, value_to_tt(bestValue, ss->ply), ss->ttPv,
+        Cluster::save(thisThread, tte, posKey, value_to_tt(bestValue, ss->ply), ss->ttPv,
                   bestValue >= beta ? BOUND_LOWER :
                   PvNode && bestMove ? BOUND_EXACT : BOUND_UPPER,
                   depth, bestMove, ss->staticEval);
@@ -1362,7 +1966,6 @@ moves_loop: // When in check, search starts from here
 
     Move pv[MAX_PLY+1];
     StateInfo st;
-    ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
     TTEntry* tte;
     Key posKey;
@@ -1384,6 +1987,8 @@ moves_loop: // When in check, search starts from here
     ss->inCheck = pos.checkers();
     moveCount = 0;
 
+    SEARCH_STAT(thisThread, qnodes);
+
     // Check for an immediate draw or maximum ply reached
     if (   pos.is_draw(ss->ply)
         || ss->ply >= MAX_PLY)
@@ -1398,7 +2003,7 @@ moves_loop: // When in check, search starts from here
                                                   : DEPTH_QS_NO_CHECKS;
     // Transposition table lookup
     posKey = pos.key();
-    tte = TT.probe(posKey, ss->ttHit);
+    tte = thisThread->tt->probe(posKey, ss->ttHit, thisThread->ttStats);
     ttValue = ss->ttHit ? value_from_tt(tte->value(), ss->ply, pos.rule50_count()) : VALUE_NONE;
     ttMove = ss->ttHit ? tte->move() : MOVE_NONE;
     pvHit = ss->ttHit && tte->is_pv();
@@ -1442,7 +2047,7 @@ moves_loop: // When in check, search starts from here
         {
             // Save gathered info in transposition table
             if (!ss->ttHit)
-                tte->save(posKey, value_to_tt(bestValue, ss->ply), false, BOUND_LOWER,
+                Cluster::save(thisThread, tte, posKey, value_to_tt(bestValue, ss->ply), false, BOUND_LOWER,
                           DEPTH_NONE, MOVE_NONE, ss->staticEval);
 
             return bestValue;
@@ -1471,6 +2076,7 @@ moves_loop: // When in check, search starts from here
     while ((move = mp.next_move()) != MOVE_NONE)
     {
       assert(is_ok(move));
+      assert(pos.legal(move));
 
       givesCheck = pos.gives_check(move);
       captureOrPromotion = pos.capture_or_promotion(move);
@@ -1508,14 +2114,7 @@ moves_loop: // When in check, search starts from here
           continue;
 
       // Speculative prefetch as early as possible
-      prefetch(TT.first_entry(pos.key_after(move)));
-
-      // Check for legality just before making the move
-      if (!pos.legal(move))
-      {
-          moveCount--;
-          continue;
-      }
+      prefetch(thisThread->tt->first_entry(pos.key_after(move)));
 
       ss->currentMove = move;
       ss->continuationHistory = &thisThread->continuationHistory[ss->inCheck]
@@ -1567,7 +2166,7 @@ moves_loop: // When in check, search starts from here
     }
 
     // Save gathered info in transposition table
-    tte->save(posKey, value_to_tt(bestValue, ss->ply), pvHit,
+    Cluster::save(thisThread, tte, posKey, value_to_tt(bestValue, ss->ply), pvHit,
               bestValue >= beta ? BOUND_LOWER :
               PvNode && bestValue > oldAlpha  ? BOUND_EXACT : BOUND_UPPER,
               ttDepth, bestMove, ss->staticEval);
@@ -1772,8 +2371,23 @@ void MainThread::check_time() {
   if (--callsCnt > 0)
       return;
 
-  // When using nodes, ensure checking rate is not lower than 0.1% of nodes
-  callsCnt = Limits.nodes ? std::min(1024, int(Limits.nodes / 1024)) : 1024;
+  // When using nodes, ensure checking rate is not lower than 0.1% of nodes.
+  // Otherwise the interval follows the speed of the search, so that the time
+  // is checked about every millisecond whatever the nps: the interval doubles
+  // while the checks fall in the same millisecond, and halves when they are
+  // further apart.
+  if (Limits.nodes)
+      callsCnt = std::min(1024, int(Limits.nodes / 1024));
+  else
+  {
+      TimePoint t = now();
+
+      checkInterval = t == lastCheckTime     ? std::min(2 * checkInterval, 65536)
+                    : t >  lastCheckTime + 1 ? std::max(checkInterval / 2, 16)
+                                             : checkInterval;
+      callsCnt = checkInterval;
+      lastCheckTime = t;
+  }
 
   static TimePoint lastInfoTime = now();
 
@@ -1786,14 +2400,39 @@ void MainThread::check_time() {
       dbg_print();
   }
 
-  // We should not stop pondering until told so by the GUI
-  if (ponder)
+  Cluster::signals_poll();
+
+  // We should not stop pondering until told so by the GUI, and the ranks of a
+  // cluster other than 0 until told so by rank 0.
+  if (ponder || !Cluster::is_root())
       return;
 
   if (   (Limits.use_time_management() && (elapsed > Time.maximum() - 10 || stopOnPonderhit))
       || (Limits.movetime && elapsed >= Limits.movetime)
-      || (Limits.nodes && Threads.nodes_searched() >= (uint64_t)Limits.nodes))
+      || (Limits.nodes && !Threads.batching() && Cluster::nodes_searched() >= (uint64_t)Limits.nodes))
+  {
+      stopTime = now();
       Threads.stop = true;
+  }
+}
+
+
+/// Thread::check_job() stops the job of a 'server' command once out of time or
+/// nodes. Unlike check_time(), it is called by the thread searching the job.
+
+void Thread::check_job() {
+
+  if (--jobCallsCnt > 0)
+      return;
+
+  jobCallsCnt = job->limits.nodes ? std::min(1024, int(job->limits.nodes / 1024)) : 1024;
+
+  TimePoint elapsed = job->elapsed(nodes);
+
+  if (   (job->limits.use_time_management() && elapsed > job->maximum - 10)
+      || (job->limits.movetime && elapsed >= job->limits.movetime)
+      || (job->limits.nodes && nodes >= uint64_t(job->limits.nodes)))
+      job->stop = true;
 }
 
 
@@ -1807,38 +2446,30 @@ string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta) {
   const RootMoves& rootMoves = pos.this_thread()->rootMoves;
   size_t pvIdx = pos.this_thread()->pvIdx;
   size_t multiPV = std::min((size_t)Options["MultiPV"], rootMoves.size());
-  uint64_t nodesSearched = Threads.nodes_searched();
-  uint64_t tbHits = Threads.tb_hits() + (TB::RootInTB ? rootMoves.size() : 0);
+  uint64_t nodesSearched = Cluster::nodes_searched();
+  uint64_t tbHits = Cluster::tb_hits() + (TB::RootInTB ? rootMoves.size() : 0);
 
-  for (size_t i = 0; i < multiPV; ++i)
-  {
-      bool updated = rootMoves[i].score != -VALUE_INFINITE;
-
-      if (depth == 1 && !updated && i > 0)
-          continue;
-
-      Depth d = updated ? depth : std::max(1, depth - 1);
-      Value v = updated ? rootMoves[i].score : rootMoves[i].previousScore;
+  auto line = [&](const RootMove& rm, Depth d, Value v, size_t n, bool bounded) {
 
       if (v == -VALUE_INFINITE)
           v = VALUE_ZERO;
 
       bool tb = TB::RootInTB && abs(v) < VALUE_MATE_IN_MAX_PLY;
-      v = tb ? rootMoves[i].tbScore : v;
+      v = tb ? rm.tbScore : v;
 
       if (ss.rdbuf()->in_avail()) // Not at first line
           ss << "\n";
 
       ss << "info"
          << " depth "    << d
-         << " seldepth " << rootMoves[i].selDepth
-         << " multipv "  << i + 1
+         << " seldepth " << rm.selDepth
+         << " multipv "  << n
          << " score "    << UCI::value(v);
 
       if (Options["UCI_ShowWDL"])
           ss << UCI::wdl(v, pos.game_ply());
 
-      if (!tb && i == pvIdx)
+      if (!tb && bounded)
           ss << (v >= beta ? " lowerbound" : v <= alpha ? " upperbound" : "");
 
       ss << " nodes "    << nodesSearched
@@ -1851,8 +2482,33 @@ string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta) {
          << " time "     << elapsed
          << " pv";
 
-      for (Move m : rootMoves[i].pv)
+      for (Move m : rm.pv)
           ss << " " << UCI::move(m, pos.is_chess960());
+  };
+
+  // A split MultiPV search shows the merged lines of all the threads instead,
+  // each with its own depth. They are published once their search is done, so
+  // they are never bounds.
+  if (Threads.splitRoot)
+  {
+      size_t n = 0;
+      for (const SplitLine& l : Threads.split_lines())
+          line(l.rootMove, l.depth, l.rootMove.score, ++n, false);
+
+      return ss.str();
+  }
+
+  for (size_t i = 0; i < multiPV; ++i)
+  {
+      bool updated = rootMoves[i].score != -VALUE_INFINITE;
+
+      if (depth == 1 && !updated && i > 0)
+          continue;
+
+      Depth d = updated ? depth : std::max(1, depth - 1);
+      Value v = updated ? rootMoves[i].score : rootMoves[i].previousScore;
+
+      line(rootMoves[i], d, v, i + 1, i == pvIdx);
   }
 
   return ss.str();
@@ -1867,7 +2523,6 @@ string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta) {
 bool RootMove::extract_ponder_from_tt(Position& pos) {
 
     StateInfo st;
-    ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
     bool ttHit;
 
@@ -1877,7 +2532,7 @@ bool RootMove::extract_ponder_from_tt(Position& pos) {
         return false;
 
     pos.do_move(pv[0], st);
-    TTEntry* tte = TT.probe(pos.key(), ttHit);
+    TTEntry* tte = pos.this_thread()->tt->probe(pos.key(), ttHit, pos.this_thread()->ttStats);
 
     if (ttHit)
     {
@@ -1890,13 +2545,15 @@ bool RootMove::extract_ponder_from_tt(Position& pos) {
     return pv.size() > 1;
 }
 
-void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
+/// Tablebases::set_probe_limits() sets up the tablebase probing done during
+/// the search from the UCI options.
+
+void Tablebases::set_probe_limits() {
 
     RootInTB = false;
     UseRule50 = bool(Options["Syzygy50MoveRule"]);
     ProbeDepth = int(Options["SyzygyProbeDepth"]);
     Cardinality = int(Options["SyzygyProbeLimit"]);
-    bool dtz_available = true;
 
     // Tables with fewer pieces than SyzygyProbeLimit are searched with
     // ProbeDepth == DEPTH_ZERO
@@ -1905,6 +2562,12 @@ void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
         Cardinality = MaxCardinality;
         ProbeDepth = 0;
     }
+}
+
+void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
+
+    set_probe_limits();
+    bool dtz_available = true;
 
     if (Cardinality >= popcount(pos.pieces()) && !pos.can_castle(ANY_CASTLING))
     {
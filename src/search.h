@@ -81,6 +81,37 @@ struct RootMove {
 typedef std::vector<RootMove> RootMoves;
 
 
+/// SearchStats counts some events of the search of one thread, see the 'stats'
+/// command. As with TTStats, each thread only updates its own counters. They are
+/// compiled out with 'make searchstats=no'. Cutoffs are the fail highs of the
+/// move loop of search(), also counted by the MovePicker stage of the move.
+/// The eval cache hits and misses are those of the NNUE evaluation.
+
+struct SearchStats {
+  uint64_t nodes, qnodes;
+  uint64_t cutoffs, firstMoveCutoffs, stageCutoffs[PICK_STAGE_NB];
+  uint64_t lmrSearches, lmrResearches;
+  uint64_t nullMoveSearches, nullMoveCutoffs;
+  uint64_t singularSearches, singularExtensions;
+  uint64_t evalCacheHits, evalCacheMisses;
+
+  SearchStats& operator+=(const SearchStats& s) {
+    auto a = reinterpret_cast<uint64_t*>(this);
+    auto b = reinterpret_cast<const uint64_t*>(&s);
+    for (size_t i = 0; i < sizeof(SearchStats) / sizeof(uint64_t); ++i)
+        a[i] += b[i];
+    return *this;
+  }
+};
+
+// Counts an event of the search in the thread's SearchStats
+#if defined(NO_SEARCH_STATS)
+  #define SEARCH_STAT(th, stat) do {} while (false)
+#else
+  #define SEARCH_STAT(th, stat) (++(th)->searchStats.stat)
+#endif
+
+
 /// LimitsType struct stores information sent by GUI about available time to
 /// search the current move, maximum depth/time, or if we are in analysis mode.
 
@@ -88,7 +119,7 @@ struct LimitsType {
 
   LimitsType() { // Init explicitly due to broken value-initialization of non POD in MSVC
     time[WHITE] = time[BLACK] = inc[WHITE] = inc[BLACK] = npmsec = movetime = TimePoint(0);
-    movestogo = depth = mate = perft = infinite = 0;
+    movestogo = depth = mate = perft = perftHash = infinite = 0;
     nodes = 0;
   }
 
@@ -98,7 +129,7 @@ struct LimitsType {
 
   std::vector<Move> searchmoves;
   TimePoint time[COLOR_NB], inc[COLOR_NB], npmsec, movetime, startTime;
-  int movestogo, depth, mate, perft, infinite;
+  int movestogo, depth, mate, perft, perftHash, infinite;
   int64_t nodes;
 };
 
@@ -24,20 +24,25 @@
 #include <fstream>
 #include <iostream>
 #include <list>
+#include <memory>
 #include <sstream>
+#include <thread>
 #include <type_traits>
+#include <unordered_map>
 #include <mutex>
 
 #include "../bitboard.h"
 #include "../movegen.h"
 #include "../position.h"
 #include "../search.h"
+#include "../thread.h"
 #include "../types.h"
 #include "../uci.h"
 
 #include "tbprobe.h"
 
 #ifndef _WIN32
+#include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
@@ -71,6 +76,9 @@ inline Square operator^(Square s, int i) { return Square(int(s) ^ i); }
 
 const std::string PieceToChar = " PNBRQK  pnbrqk";
 
+std::atomic<size_t> MappedBytes; // Size of the files mapped so far, see memory_usage()
+bool Preloaded; // Tables preloaded by init(), kept by clear()
+
 int MapPawns[SQUARE_NB];
 int MapB1H1H7[SQUARE_NB];
 int MapA1D1D4[SQUARE_NB];
@@ -165,21 +173,66 @@ static_assert(sizeof(LR) == 3, "LR tree entry must be 3 bytes");
 
 // class TBFile memory maps/unmaps the single .rtbw and .rtbz files. Files are
 // memory mapped for best performance. Files are mapped at first access: at init
-// time only existence of the file is checked.
+// time the Paths directories are only listed, see scan().
 class TBFile : public std::ifstream {
 
     std::string fname;
 
+    // Full path of each .rtbw and .rtbz file found, by file name
+    static std::unordered_map<std::string, std::string> Files;
+
+    // The names of the tablebase files in a directory
+    static std::vector<std::string> list(const std::string& path) {
+
+        std::vector<std::string> names;
+
+        auto add = [&](const std::string& name) {
+            size_t n = name.size();
+            if (n > 5 && (!name.compare(n - 5, 5, ".rtbw") || !name.compare(n - 5, 5, ".rtbz")))
+                names.push_back(name);
+        };
+
+#ifndef _WIN32
+        if (DIR* dir = opendir(path.c_str()))
+        {
+            while (const dirent* entry = readdir(dir))
+                add(entry->d_name);
+
+            closedir(dir);
+        }
+#else
+        WIN32_FIND_DATAA data;
+        HANDLE find = FindFirstFileA((path + "\\*.rtb?").c_str(), &data);
+
+        if (find != INVALID_HANDLE_VALUE)
+        {
+            do add(data.cFileName);
+            while (FindNextFileA(find, &data));
+
+            FindClose(find);
+        }
+#endif
+        return names;
+    }
+
 public:
-    // Look for and open the file among the Paths directories where the .rtbw
-    // and .rtbz files can be found. Multiple directories are separated by ";"
-    // on Windows and by ":" on Unix-based operating systems.
+    // Directories where the .rtbw and .rtbz files can be found. Multiple
+    // directories are separated by ";" on Windows and by ":" on Unix-based
+    // operating systems.
     //
     // Example:
     // C:\tb\wdl345;C:\tb\wdl6;D:\tb\dtz345;D:\tb\dtz6
     static std::string Paths;
 
-    TBFile(const std::string& f) {
+    // Access pattern hint given to the kernel for the mapped WDL and DTZ files,
+    // one of the posix_madvise() advice values. Set by Tablebases::init().
+    static int Advice[2];
+
+    // List the Paths directories, in parallel as they may be on different
+    // disks or network shares, and index the files found. As when looking up
+    // each file in turn, a file present in several directories is taken from
+    // the first one.
+    static void scan() {
 
 #ifndef _WIN32
         constexpr char SepChar = ':';
@@ -187,14 +240,42 @@ public:
         constexpr char SepChar = ';';
 #endif
         std::stringstream ss(Paths);
+        std::vector<std::string> paths;
         std::string path;
 
         while (std::getline(ss, path, SepChar))
+            paths.push_back(path);
+
+        std::vector<std::vector<std::string>> names(paths.size());
+        std::vector<std::thread> threads;
+
+        for (size_t i = 1; i < paths.size(); ++i)
+            threads.emplace_back([&, i]() { names[i] = list(paths[i]); });
+
+        if (!paths.empty())
+            names[0] = list(paths[0]);
+
+        for (std::thread& th : threads)
+            th.join();
+
+        Files.clear();
+
+        for (size_t i = 0; i < paths.size(); ++i)
+            for (const std::string& name : names[i])
+                Files.emplace(name, paths[i] + "/" + name);
+    }
+
+    static bool exists(const std::string& f) { return Files.count(f); }
+
+    // Open the file from the directory where scan() found it
+    TBFile(const std::string& f) {
+
+        auto it = Files.find(f);
+
+        if (it != Files.end())
         {
-            fname = path + "/" + f;
+            fname = it->second;
             std::ifstream::open(fname);
-            if (is_open())
-                return;
         }
     }
 
@@ -223,9 +304,6 @@ public:
 
         *mapping = statbuf.st_size;
         *baseAddress = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
-#if defined(MADV_RANDOM)
-        madvise(*baseAddress, statbuf.st_size, MADV_RANDOM);
-#endif
         ::close(fd);
 
         if (*baseAddress == MAP_FAILED)
@@ -233,6 +311,10 @@ public:
             std::cerr << "Could not mmap() " << fname << std::endl;
             exit(EXIT_FAILURE);
         }
+
+#if defined(POSIX_MADV_NORMAL)
+        posix_madvise(*baseAddress, statbuf.st_size, Advice[type]);
+#endif
 #else
         // Note FILE_FLAG_RANDOM_ACCESS is only a hint to Windows and as such may get ignored.
         HANDLE fd = CreateFile(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
@@ -281,9 +363,44 @@ public:
             return *baseAddress = nullptr, nullptr;
         }
 
+#ifndef _WIN32
+        MappedBytes += size_t(statbuf.st_size);
+#else
+        MappedBytes += size_t((uint64_t(size_high) << 32) | size_low);
+#endif
         return data + 4; // Skip Magics's header
     }
 
+    // Read the whole mapped file in memory, or lock it there, so that the search
+    // does not take the page faults at first probe. Returns false if locking
+    // failed, for instance because of RLIMIT_MEMLOCK, in which case the pages
+    // are read only.
+    static bool preload(void* baseAddress, size_t size, bool lock) {
+
+        bool locked = false;
+
+#ifndef _WIN32
+        if (lock)
+            locked = !mlock(baseAddress, size);
+#if defined(POSIX_MADV_WILLNEED)
+        if (!locked)
+            posix_madvise(baseAddress, size, POSIX_MADV_WILLNEED);
+#endif
+#else
+        if (lock)
+            locked = VirtualLock(baseAddress, size);
+#endif
+
+        if (!locked)
+        {
+            volatile uint8_t sum = 0;
+            for (size_t i = 0; i < size; i += 4096)
+                sum += ((const uint8_t*)baseAddress)[i];
+        }
+
+        return locked || !lock;
+    }
+
     static void unmap(void* baseAddress, uint64_t mapping) {
 
 #ifndef _WIN32
@@ -296,6 +413,8 @@ public:
 };
 
 std::string TBFile::Paths;
+std::unordered_map<std::string, std::string> TBFile::Files;
+int TBFile::Advice[2];
 
 // struct PairsData contains low level indexing information to access TB data.
 // There are 8, 4 or 2 PairsData records for each TBTable, according to type of
@@ -333,6 +452,7 @@ struct TBTable {
     static constexpr int Sides = Type == WDL ? 2 : 1;
 
     std::atomic_bool ready;
+    std::mutex mutex; // Taken only while the file is mapped, see mapped()
     void* baseAddress;
     uint8_t* map;
     uint64_t mapping;
@@ -416,20 +536,22 @@ class TBTables {
         }
     };
 
-    static constexpr int Size = 1 << 12; // 4K table, indexed by key's 12 lsb
     static constexpr int Overflow = 1;  // Number of elements allowed to map to the last bucket
 
-    Entry hashTable[Size + Overflow];
+    // Indexed by the key's lsb, sized by index() to the number of tables found
+    std::vector<Entry> hashTable = std::vector<Entry>(1 + Overflow);
+    uint32_t buckets = 1;
 
     std::deque<TBTable<WDL>> wdlTable;
     std::deque<TBTable<DTZ>> dtzTable;
+    std::vector<std::string> names; // Like "KRvK", one for each TBTable<WDL>
 
     void insert(Key key, TBTable<WDL>* wdl, TBTable<DTZ>* dtz) {
-        uint32_t homeBucket = (uint32_t)key & (Size - 1);
+        uint32_t homeBucket = (uint32_t)key & (buckets - 1);
         Entry entry{ key, wdl, dtz };
 
         // Ensure last element is empty to avoid overflow when looking up
-        for (uint32_t bucket = homeBucket; bucket < Size + Overflow - 1; ++bucket) {
+        for (uint32_t bucket = homeBucket; bucket < buckets + Overflow - 1; ++bucket) {
             Key otherKey = hashTable[bucket].key;
             if (otherKey == key || !hashTable[bucket].get<WDL>()) {
                 hashTable[bucket] = entry;
@@ -438,7 +560,7 @@ class TBTables {
 
             // Robin Hood hashing: If we've probed for longer than this element,
             // insert here and search for a new spot for the other element instead.
-            uint32_t otherHomeBucket = (uint32_t)otherKey & (Size - 1);
+            uint32_t otherHomeBucket = (uint32_t)otherKey & (buckets - 1);
             if (otherHomeBucket > homeBucket) {
                 std::swap(entry, hashTable[bucket]);
                 key = otherKey;
@@ -452,23 +574,111 @@ class TBTables {
 public:
     template<TBType Type>
     TBTable<Type>* get(Key key) {
-        for (const Entry* entry = &hashTable[(uint32_t)key & (Size - 1)]; ; ++entry) {
+        for (const Entry* entry = &hashTable[(uint32_t)key & (buckets - 1)]; ; ++entry) {
             if (entry->key == key || !entry->get<Type>())
                 return entry->get<Type>();
         }
     }
 
     void clear() {
-        memset(hashTable, 0, sizeof(hashTable));
+        hashTable.assign(1 + Overflow, Entry());
+        buckets = 1;
         wdlTable.clear();
         dtzTable.clear();
+        names.clear();
+        MappedBytes = 0; // All unmapped by the destructors
     }
     size_t size() const { return wdlTable.size(); }
     void add(const std::vector<PieceType>& pieces);
+    void index();
+    void preload(size_t budget, bool lock);
 };
 
 TBTables TBTables;
 
+// class ProbeCache is a lockless, fixed size cache of the WDL and DTZ probe
+// results, shared by all threads like the transposition table. Each entry
+// stores the key xor-ed with the data, so that an entry torn by concurrent
+// writes fails the key test and is simply a miss. DTZ results are keyed by
+// the position key xor-ed with a constant, to have both in the same table.
+class ProbeCache {
+
+    struct Entry {
+        std::atomic<uint64_t> check;
+        std::atomic<uint64_t> data;
+    };
+
+    static constexpr Key DTZSalt = 0x9E3779B97F4A7C15ULL;
+
+    std::unique_ptr<Entry[]> table;
+    size_t mask = 0;
+    size_t bytes = 0;
+
+    Entry* entry(Key key) const { return &table[size_t(key) & mask]; }
+
+public:
+    // Allocate about 'mb' MB, rounded down to a power of two number of entries,
+    // and clear them. 0 disables the cache. The table is only allocated again
+    // when its size changes.
+    void resize(size_t mb) {
+
+        size_t count = mb * 1024 * 1024 / sizeof(Entry);
+
+        while (count & (count - 1))
+            count &= count - 1;
+
+        if (count * sizeof(Entry) != bytes)
+        {
+            table.reset(count ? new Entry[count] : nullptr);
+            mask = count - 1;
+            bytes = count * sizeof(Entry);
+        }
+
+        clear();
+    }
+
+    void clear() {
+        for (size_t i = 0; i < bytes / sizeof(Entry); ++i)
+            table[i].check = table[i].data = 0;
+    }
+
+    size_t size() const { return bytes; }
+
+    template<TBType Type>
+    bool probe(Key key, int* value, ProbeState* result) const {
+
+        if (!table)
+            return false;
+
+        key ^= Type == DTZ ? DTZSalt : 0;
+        Entry* e = entry(key);
+        uint64_t data = e->data.load(std::memory_order_relaxed);
+
+        if ((e->check.load(std::memory_order_relaxed) ^ data) != key)
+            return false;
+
+        *value = int32_t(uint32_t(data));
+        *result = ProbeState(int8_t(data >> 32));
+        return true;
+    }
+
+    template<TBType Type>
+    void save(Key key, int value, ProbeState result) {
+
+        if (!table)
+            return;
+
+        key ^= Type == DTZ ? DTZSalt : 0;
+        Entry* e = entry(key);
+        uint64_t data = uint32_t(value) | uint64_t(uint8_t(result)) << 32;
+
+        e->data.store(data, std::memory_order_relaxed);
+        e->check.store(key ^ data, std::memory_order_relaxed);
+    }
+};
+
+ProbeCache ProbeCache;
+
 // If the corresponding file exists two new objects TBTable<WDL> and TBTable<DTZ>
 // are created and added to the lists and hash table. Called at init time.
 void TBTables::add(const std::vector<PieceType>& pieces) {
@@ -478,21 +688,32 @@ void TBTables::add(const std::vector<PieceType>& pieces) {
     for (PieceType pt : pieces)
         code += PieceToChar[pt];
 
-    TBFile file(code.insert(code.find('K', 1), "v") + ".rtbw"); // KRK -> KRvK
+    code.insert(code.find('K', 1), "v"); // KRK -> KRvK
 
-    if (!file.is_open()) // Only WDL file is checked
+    if (!TBFile::exists(code + ".rtbw")) // Only WDL file is checked
         return;
 
-    file.close();
-
     MaxCardinality = std::max((int)pieces.size(), MaxCardinality);
 
     wdlTable.emplace_back(code);
     dtzTable.emplace_back(wdlTable.back());
+    names.push_back(code);
+}
+
+// Size the hash table to 4 buckets per key at least and insert the tables. Called
+// at init time, once all of them are added.
+void TBTables::index() {
+
+    for (buckets = 1; buckets < 4 * 2 * wdlTable.size(); buckets *= 2) {}
+
+    hashTable.assign(buckets + Overflow, Entry());
 
     // Insert into the hash keys for both colors: KRvK with KR white and black
-    insert(wdlTable.back().key , &wdlTable.back(), &dtzTable.back());
-    insert(wdlTable.back().key2, &wdlTable.back(), &dtzTable.back());
+    for (size_t i = 0; i < wdlTable.size(); ++i)
+    {
+        insert(wdlTable[i].key , &wdlTable[i], &dtzTable[i]);
+        insert(wdlTable[i].key2, &wdlTable[i], &dtzTable[i]);
+    }
 }
 
 // TB tables are compressed with canonical Huffman code. The compressed data is divided into
@@ -1131,39 +1352,92 @@ void set(T& e, uint8_t* data) {
 // If the TB file corresponding to the given position is already memory mapped
 // then return its base address, otherwise try to memory map and init it. Called
 // at every probe, memory map and init only at first access. Function is thread
-// safe and can be called concurrently.
+// safe and can be called concurrently. Each table has its own lock, so a thread
+// only waits for the mapping of the table it probes, not for the others.
 template<TBType Type>
-void* mapped(TBTable<Type>& e, const Position& pos) {
+void* mapped(TBTable<Type>& e, const std::string& fname) {
 
-    static std::mutex mutex;
+    std::scoped_lock<std::mutex> lk(e.mutex);
+
+    if (e.ready.load(std::memory_order_relaxed)) // Recheck under lock
+        return e.baseAddress;
+
+    uint8_t* data = TBFile(fname).map(&e.baseAddress, &e.mapping, Type);
+
+    if (data)
+        set(e, data);
+
+    e.ready.store(true, std::memory_order_release);
+    return e.baseAddress;
+}
+
+template<TBType Type>
+void* mapped(TBTable<Type>& e, const Position& pos) {
 
     // Use 'acquire' to avoid a thread reading 'ready' == true while
     // another is still working. (compiler reordering may cause this).
     if (e.ready.load(std::memory_order_acquire))
         return e.baseAddress; // Could be nullptr if file does not exist
 
-    std::scoped_lock<std::mutex> lk(mutex);
-
-    if (e.ready.load(std::memory_order_relaxed)) // Recheck under lock
-        return e.baseAddress;
-
     // Pieces strings in decreasing order for each color, like ("KPP","KR")
-    std::string fname, w, b;
+    std::string w, b;
     for (PieceType pt = KING; pt >= PAWN; --pt) {
         w += std::string(popcount(pos.pieces(WHITE, pt)), PieceToChar[pt]);
         b += std::string(popcount(pos.pieces(BLACK, pt)), PieceToChar[pt]);
     }
 
-    fname =  (e.key == pos.material_key() ? w + 'v' + b : b + 'v' + w)
-           + (Type == WDL ? ".rtbw" : ".rtbz");
+    return mapped(e,  (e.key == pos.material_key() ? w + 'v' + b : b + 'v' + w)
+                    + (Type == WDL ? ".rtbw" : ".rtbz"));
+}
+
+// Map the WDL tables, fewest pieces and smallest first, and read them in memory
+// or lock them there while their total size fits in the budget, so that the
+// search does not take the page faults at first probe. Called at init time.
+void TBTables::preload(size_t budget, bool lock) {
 
-    uint8_t* data = TBFile(fname).map(&e.baseAddress, &e.mapping, Type);
+    struct File { int pieceCount; size_t size; size_t idx; };
+    std::vector<File> files;
 
-    if (data)
-        set(e, data);
+    for (size_t i = 0; i < wdlTable.size(); ++i)
+    {
+        TBFile file(names[i] + ".rtbw");
+        if (file.seekg(0, std::ios::end))
+            files.push_back({ wdlTable[i].pieceCount, size_t(file.tellg()), i });
+    }
 
-    e.ready.store(true, std::memory_order_release);
-    return e.baseAddress;
+    std::sort(files.begin(), files.end(), [](const File& a, const File& b) {
+        return a.pieceCount != b.pieceCount ? a.pieceCount < b.pieceCount : a.size < b.size;
+    });
+
+    uint64_t major = 0, minor = 0, major0, minor0;
+    bool faults = page_faults(&major0, &minor0);
+    size_t total = 0, cnt = 0, unlocked = 0;
+
+    for (const File& f : files)
+    {
+        if (total + f.size > budget)
+            continue;
+
+        TBTable<WDL>& e = wdlTable[f.idx];
+
+        if (!mapped(e, names[f.idx] + ".rtbw"))
+            continue;
+
+        unlocked += !TBFile::preload(e.baseAddress, f.size, lock);
+        total += f.size;
+        cnt++;
+    }
+
+    sync_cout << "info string Preloaded " << cnt << " WDL tablebases, "
+              << total / (1024 * 1024) << " MB";
+
+    if (lock)
+        std::cout << (unlocked ? ", " + std::to_string(unlocked) + " could not be locked" : ", locked");
+
+    if (faults && page_faults(&major, &minor))
+        std::cout << ", page faults " << major - major0 << " major " << minor - minor0 << " minor";
+
+    std::cout << sync_endl;
 }
 
 template<TBType Type, typename Ret = typename TBTable<Type>::Ret>
@@ -1255,9 +1529,141 @@ WDLScore search(Position& pos, ProbeState* result) {
     return *result = OK, value;
 }
 
+// Probe the DTZ table for a particular position, without the ProbeCache. See
+// Tablebases::probe_dtz() for the meaning of the return value.
+int probe_dtz_uncached(Position& pos, ProbeState* result) {
+
+    *result = OK;
+    WDLScore wdl = search<true>(pos, result);
+
+    if (*result == FAIL || wdl == WDLDraw) // DTZ tables don't store draws
+        return 0;
+
+    // DTZ stores a 'don't care' value in this case, or even a plain wrong
+    // one as in case the best move is a losing ep, so it cannot be probed.
+    if (*result == ZEROING_BEST_MOVE)
+        return dtz_before_zeroing(wdl);
+
+    int dtz = probe_table<DTZ>(pos, result, wdl);
+
+    if (*result == FAIL)
+        return 0;
+
+    if (*result != CHANGE_STM)
+        return (dtz + 100 * (wdl == WDLBlessedLoss || wdl == WDLCursedWin)) * sign_of(wdl);
+
+    // DTZ stores results for the other side, so we need to do a 1-ply search and
+    // find the winning move that minimizes DTZ.
+    StateInfo st;
+    int minDTZ = 0xFFFF;
+
+    for (const Move move : MoveList<LEGAL>(pos))
+    {
+        bool zeroing = pos.capture(move) || type_of(pos.moved_piece(move)) == PAWN;
+
+        pos.do_move(move, st);
+
+        // For zeroing moves we want the dtz of the move _before_ doing it,
+        // otherwise we will get the dtz of the next move sequence. Search the
+        // position after the move to get the score sign (because even in a
+        // winning position we could make a losing capture or going for a draw).
+        dtz = zeroing ? -dtz_before_zeroing(search<false>(pos, result))
+                      : -probe_dtz(pos, result);
+
+        // If the move mates, force minDTZ to 1
+        if (dtz == 1 && pos.checkers() && MoveList<LEGAL>(pos).size() == 0)
+            minDTZ = 1;
+
+        // Convert result from 1-ply search. Zeroing moves are already accounted
+        // by dtz_before_zeroing() that returns the DTZ of the previous move.
+        if (!zeroing)
+            dtz += sign_of(dtz);
+
+        // Skip the draws and if we are winning only pick positive dtz
+        if (dtz < minDTZ && sign_of(dtz) == sign_of(wdl))
+            minDTZ = dtz;
+
+        pos.undo_move(move);
+
+        if (*result == FAIL)
+            return 0;
+    }
+
+    // When there are no legal moves, the position is mate: we return -1
+    return minDTZ == 0xFFFF ? -1 : minDTZ;
+}
+
+
+// RootChild is the position after a root move, as probed by root_probe() and
+// root_probe_wdl(). Draws are not probed, their value is 0.
+struct RootChild {
+    std::string fen;
+    bool zeroing = false, draw = false, mate = false;
+    int value = 0;
+};
+
+// Probe the positions after the root moves with probe(), in parallel on as many
+// threads as the "Threads" option allows, the calling one included. The pool is
+// idle then, the root moves are ranked before the search starts. No new probe
+// is started after 'deadline', if not 0. Returns false if a probe failed or the
+// time ran out, the root moves are then ranked with the WDL tables.
+template<typename Probe>
+bool probe_children(const Position& root, std::vector<RootChild>& children,
+                    TimePoint deadline, Probe probe) {
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+
+    auto worker = [&]() {
+        for (size_t i; !failed && (i = next++) < children.size(); )
+        {
+            if (children[i].draw)
+                continue;
+
+            if (deadline && now() > deadline)
+            {
+                failed = true;
+                break;
+            }
+
+            StateInfo st;
+            Position pos;
+            ProbeState result = OK;
+
+            pos.set(children[i].fen, root.is_chess960(), &st, root.this_thread());
+            probe(pos, children[i], &result);
+
+            if (result == FAIL)
+                failed = true;
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (size_t i = 1; i < std::min(children.size(), Threads.size()); ++i)
+        threads.emplace_back(worker);
+
+    worker();
+
+    for (std::thread& th : threads)
+        th.join();
+
+    return !failed;
+}
+
 } // namespace
 
 
+/// Tablebases::memory_usage() reports the mapped tablebase files and the probe
+/// cache, for the 'memory' command. Files are mapped lazily at their first probe,
+/// and their pages are only resident once read.
+std::vector<MemoryUsage> Tablebases::memory_usage() {
+
+    return { { "Syzygy mapped files", MappedBytes, 0 },
+             { "Syzygy probe cache", ProbeCache.size(), 0 } };
+}
+
+
 /// Tablebases::init() is called at startup and after every change to
 /// "SyzygyPath" UCI option to (re)create the various tables. It is not thread
 /// safe, nor it needs to be.
@@ -1265,10 +1671,18 @@ void Tablebases::init(const std::string& paths) {
 
     TBTables.clear();
     MaxCardinality = 0;
+    Preloaded = false;
     TBFile::Paths = paths;
 
+    set_access();
+
     if (paths.empty() || paths == "<empty>")
+    {
+        ProbeCache.resize(0);
         return;
+    }
+
+    TBFile::scan();
 
     // MapB1H1H7[] encodes a square below a1-h8 diagonal to 0..27
     int code = 0;
@@ -1402,7 +1816,51 @@ void Tablebases::init(const std::string& paths) {
         }
     }
 
+    TBTables.index();
+
     sync_cout << "info string Found " << TBTables.size() << " tablebases" << sync_endl;
+
+    ProbeCache.resize(TBTables.size() ? size_t(int(Options["SyzygyCache"])) : 0);
+
+    if (int(Options["SyzygyPreload"]) && TBTables.size())
+    {
+        TBTables.preload(size_t(int(Options["SyzygyPreload"])) * 1024 * 1024, Options["SyzygyLock"]);
+        Preloaded = true;
+    }
+}
+
+// Tablebases::clear() is called on ucinewgame. The files mapped on demand are
+// freed by a new init(), but preloaded tables are kept, as reading or locking
+// them again would delay every new game. Only a change of SyzygyPath,
+// SyzygyPreload or SyzygyLock preloads them again.
+void Tablebases::clear() {
+
+    if (Preloaded)
+        ProbeCache.clear();
+    else
+        init(Options["SyzygyPath"]);
+}
+
+// Tablebases::resize_cache() is called when SyzygyCache changes
+void Tablebases::resize_cache() {
+
+    ProbeCache.resize(TBTables.size() ? size_t(int(Options["SyzygyCache"])) : 0);
+}
+
+// Tablebases::set_access() reads the access hints for the WDL and DTZ files,
+// used for the files mapped from then on.
+void Tablebases::set_access() {
+
+#if defined(POSIX_MADV_NORMAL)
+    for (TBType type : { WDL, DTZ })
+    {
+        const UCI::Option& access = Options[type == WDL ? "SyzygyWDLAccess" : "SyzygyDTZAccess"];
+
+        TBFile::Advice[type] = access == "Normal"   ? POSIX_MADV_NORMAL
+                             : access == "WillNeed" ? POSIX_MADV_WILLNEED
+                                                    : POSIX_MADV_RANDOM;
+    }
+#endif
 }
 
 // Probe the WDL table for a particular position.
@@ -1415,8 +1873,18 @@ void Tablebases::init(const std::string& paths) {
 //  2 : win
 WDLScore Tablebases::probe_wdl(Position& pos, ProbeState* result) {
 
+    int wdl;
+
+    if (ProbeCache.probe<WDL>(pos.key(), &wdl, result))
+        return WDLScore(wdl);
+
     *result = OK;
-    return search<false>(pos, result);
+    wdl = search<false>(pos, result);
+
+    if (*result != FAIL)
+        ProbeCache.save<WDL>(pos.key(), wdl, *result);
+
+    return WDLScore(wdl);
 }
 
 // Probe the DTZ table for a particular position.
@@ -1447,64 +1915,17 @@ WDLScore Tablebases::probe_wdl(Position& pos, ProbeState* result) {
 // then do not accept moves leading to dtz + 50-move-counter == 100.
 int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
 
-    *result = OK;
-    WDLScore wdl = search<true>(pos, result);
-
-    if (*result == FAIL || wdl == WDLDraw) // DTZ tables don't store draws
-        return 0;
-
-    // DTZ stores a 'don't care' value in this case, or even a plain wrong
-    // one as in case the best move is a losing ep, so it cannot be probed.
-    if (*result == ZEROING_BEST_MOVE)
-        return dtz_before_zeroing(wdl);
-
-    int dtz = probe_table<DTZ>(pos, result, wdl);
-
-    if (*result == FAIL)
-        return 0;
-
-    if (*result != CHANGE_STM)
-        return (dtz + 100 * (wdl == WDLBlessedLoss || wdl == WDLCursedWin)) * sign_of(wdl);
-
-    // DTZ stores results for the other side, so we need to do a 1-ply search and
-    // find the winning move that minimizes DTZ.
-    StateInfo st;
-    int minDTZ = 0xFFFF;
-
-    for (const Move move : MoveList<LEGAL>(pos))
-    {
-        bool zeroing = pos.capture(move) || type_of(pos.moved_piece(move)) == PAWN;
-
-        pos.do_move(move, st);
-
-        // For zeroing moves we want the dtz of the move _before_ doing it,
-        // otherwise we will get the dtz of the next move sequence. Search the
-        // position after the move to get the score sign (because even in a
-        // winning position we could make a losing capture or going for a draw).
-        dtz = zeroing ? -dtz_before_zeroing(search<false>(pos, result))
-                      : -probe_dtz(pos, result);
-
-        // If the move mates, force minDTZ to 1
-        if (dtz == 1 && pos.checkers() && MoveList<LEGAL>(pos).size() == 0)
-            minDTZ = 1;
-
-        // Convert result from 1-ply search. Zeroing moves are already accounted
-        // by dtz_before_zeroing() that returns the DTZ of the previous move.
-        if (!zeroing)
-            dtz += sign_of(dtz);
+    int dtz;
 
-        // Skip the draws and if we are winning only pick positive dtz
-        if (dtz < minDTZ && sign_of(dtz) == sign_of(wdl))
-            minDTZ = dtz;
+    if (ProbeCache.probe<DTZ>(pos.key(), &dtz, result))
+        return dtz;
 
-        pos.undo_move(move);
+    dtz = probe_dtz_uncached(pos, result);
 
-        if (*result == FAIL)
-            return 0;
-    }
+    if (*result != FAIL)
+        ProbeCache.save<DTZ>(pos.key(), dtz, *result);
 
-    // When there are no legal moves, the position is mate: we return -1
-    return minDTZ == 0xFFFF ? -1 : minDTZ;
+    return dtz;
 }
 
 
@@ -1513,7 +1934,6 @@ int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
 // A return value false indicates that not all probes were successful.
 bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves) {
 
-    ProbeState result;
     StateInfo st;
 
     // Obtain 50-move counter for the root position
@@ -1522,46 +1942,62 @@ bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves) {
     // Check whether a position was repeated since the last zeroing move.
     bool rep = pos.has_repeated();
 
-    int dtz, bound = Options["Syzygy50MoveRule"] ? 900 : 1;
+    int bound = Options["Syzygy50MoveRule"] ? 900 : 1;
+
+    // The draws by repetition need the game history and are found here, the
+    // positions after the other moves are probed in parallel below.
+    std::vector<RootChild> children(rootMoves.size());
 
-    // Probe and rank each move
-    for (auto& m : rootMoves)
+    for (size_t i = 0; i < rootMoves.size(); ++i)
     {
-        pos.do_move(m.pv[0], st);
+        RootChild& c = children[i];
 
-        // Calculate dtz for the current move counting from the root position
-        if (pos.rule50_count() == 0)
-        {
-            // In case of a zeroing move, dtz is one of -101/-1/0/1/101
-            WDLScore wdl = -probe_wdl(pos, &result);
-            dtz = dtz_before_zeroing(wdl);
-        }
-        else if (pos.is_draw(1))
-        {
-            // In case a root move leads to a draw by repetition or
-            // 50-move rule, we set dtz to zero. Note: since we are
-            // only 1 ply from the root, this must be a true 3-fold
-            // repetition inside the game history.
-            dtz = 0;
-        }
+        pos.do_move(rootMoves[i].pv[0], st);
+
+        // In case of a zeroing move, dtz is one of -101/-1/0/1/101
+        c.zeroing = pos.rule50_count() == 0;
+
+        // In case a root move leads to a draw by repetition or 50-move rule,
+        // we set dtz to zero. Note: since we are only 1 ply from the root,
+        // this must be a true 3-fold repetition inside the game history.
+        c.draw = !c.zeroing && pos.is_draw(1);
+
+        // Make sure that a mating move is assigned a dtz value of 1
+        c.mate = pos.checkers() && MoveList<LEGAL>(pos).size() == 0;
+
+        if (!c.draw)
+            c.fen = pos.fen();
+
+        pos.undo_move(rootMoves[i].pv[0]);
+    }
+
+    TimePoint budget = TimePoint(int(Options["SyzygyRootProbeTime"]));
+
+    bool ok = probe_children(pos, children, budget ? now() + budget : 0,
+                             [](Position& p, RootChild& c, ProbeState* result) {
+
+        if (c.zeroing)
+            c.value = dtz_before_zeroing(-probe_wdl(p, result));
         else
         {
             // Otherwise, take dtz for the new position and correct by 1 ply
-            dtz = -probe_dtz(pos, &result);
-            dtz =  dtz > 0 ? dtz + 1
-                 : dtz < 0 ? dtz - 1 : dtz;
+            int dtz = -probe_dtz(p, result);
+            c.value =  dtz > 0 ? dtz + 1
+                     : dtz < 0 ? dtz - 1 : dtz;
         }
 
-        // Make sure that a mating move is assigned a dtz value of 1
-        if (   pos.checkers()
-            && dtz == 2
-            && MoveList<LEGAL>(pos).size() == 0)
-            dtz = 1;
+        if (c.mate && c.value == 2)
+            c.value = 1;
+    });
 
-        pos.undo_move(m.pv[0]);
+    if (!ok)
+        return false;
 
-        if (result == FAIL)
-            return false;
+    // Rank each move
+    for (size_t i = 0; i < rootMoves.size(); ++i)
+    {
+        Search::RootMove& m = rootMoves[i];
+        int dtz = children[i].value;
 
         // Better moves are ranked higher. Certain wins are ranked equally.
         // Losing moves are ranked equally unless a 50-move draw is in sight.
@@ -1592,26 +2028,34 @@ bool Tablebases::root_probe_wdl(Position& pos, Search::RootMoves& rootMoves) {
 
     static const int WDL_to_rank[] = { -1000, -899, 0, 899, 1000 };
 
-    ProbeState result;
     StateInfo st;
-    WDLScore wdl;
 
     bool rule50 = Options["Syzygy50MoveRule"];
 
-    // Probe and rank each move
-    for (auto& m : rootMoves)
+    std::vector<RootChild> children(rootMoves.size());
+
+    for (size_t i = 0; i < rootMoves.size(); ++i)
     {
-        pos.do_move(m.pv[0], st);
+        pos.do_move(rootMoves[i].pv[0], st);
 
-        if (pos.is_draw(1))
-            wdl = WDLDraw;
-        else
-            wdl = -probe_wdl(pos, &result);
+        if (!(children[i].draw = pos.is_draw(1)))
+            children[i].fen = pos.fen();
+
+        pos.undo_move(rootMoves[i].pv[0]);
+    }
 
-        pos.undo_move(m.pv[0]);
+    auto probe = [](Position& p, RootChild& c, ProbeState* result) {
+        c.value = -probe_wdl(p, result);
+    };
 
-        if (result == FAIL)
-            return false;
+    if (!probe_children(pos, children, 0, probe))
+        return false;
+
+    // Rank each move
+    for (size_t i = 0; i < rootMoves.size(); ++i)
+    {
+        Search::RootMove& m = rootMoves[i];
+        WDLScore wdl = WDLScore(children[i].value);
 
         m.tbRank = WDL_to_rank[wdl + 2];
 
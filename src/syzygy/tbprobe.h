@@ -20,6 +20,7 @@
 #define TBPROBE_H
 
 #include <ostream>
+#include <vector>
 
 #include "../search.h"
 
@@ -46,11 +47,16 @@ enum ProbeState {
 extern int MaxCardinality;
 
 void init(const std::string& paths);
+void clear();
+void set_access();
+void resize_cache();
 WDLScore probe_wdl(Position& pos, ProbeState* result);
 int probe_dtz(Position& pos, ProbeState* result);
 bool root_probe(Position& pos, Search::RootMoves& rootMoves);
 bool root_probe_wdl(Position& pos, Search::RootMoves& rootMoves);
 void rank_root_moves(Position& pos, Search::RootMoves& rootMoves);
+void set_probe_limits();
+std::vector<MemoryUsage> memory_usage();
 
 inline std::ostream& operator<<(std::ostream& os, const WDLScore v) {
 
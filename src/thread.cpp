@@ -19,6 +19,7 @@
 #include <cassert>
 
 #include <algorithm> // For std::count
+#include "evaluate.h"
 #include "movegen.h"
 #include "search.h"
 #include "thread.h"
@@ -30,12 +31,40 @@ namespace Stockfish {
 
 ThreadPool Threads; // Global object
 
+namespace {
+
+  // The largest power of two number of entries of the given type that fits in
+  // the given size in KB, as set by the "Pawn Hash" and "Material Hash" options.
+  template<typename Entry>
+  size_t table_entries(size_t kbSize) {
+
+    size_t count = std::max(kbSize * 1024 / sizeof(Entry), size_t(1));
+
+    while (count & (count - 1))
+        count &= count - 1;
+
+    return count;
+  }
+
+} // namespace
+
 
 /// Thread constructor launches the thread and waits until it goes to sleep
 /// in idle_loop(). Note that 'searching' and 'exit' should be already set.
 
 Thread::Thread(size_t n) : idx(n), stdThread(&Thread::idle_loop, this) {
 
+  stopFlag = &Threads.stop;
+
+  accumulators = static_cast<Eval::NNUE::Accumulator*>(
+      aligned_large_pages_alloc(AccumulatorArenaSize * sizeof(Eval::NNUE::Accumulator)));
+
+  if (!accumulators)
+  {
+      std::cerr << "Failed to allocate the NNUE accumulators of thread " << n << std::endl;
+      std::exit(EXIT_FAILURE);
+  }
+
   wait_for_search_finished();
 }
 
@@ -50,6 +79,7 @@ Thread::~Thread() {
   exit = true;
   start_searching();
   stdThread.join();
+  aligned_large_pages_free(accumulators);
 }
 
 
@@ -61,6 +91,10 @@ void Thread::clear() {
   mainHistory.fill(0);
   lowPlyHistory.fill(0);
   captureHistory.fill(0);
+  accumulatorCache.valid = false;
+  nnueEvalCache.clear();
+  pawnsTable.resize(table_entries<Pawns::Entry>(size_t(Options["Pawn Hash"])));
+  materialTable.resize(table_entries<Material::Entry>(size_t(Options["Material Hash"])));
 
   for (bool inCheck : { false, true })
       for (StatsType c : { NoCaptures, Captures })
@@ -104,7 +138,13 @@ void Thread::idle_loop() {
   // just check if running threads are below a threshold, in this case all this
   // NUMA machinery is not needed.
   if (Options["Threads"] > 8)
-      WinProcGroup::bindThisThread(idx);
+      numaNode = WinProcGroup::bindThisThread(idx);
+
+  // On hybrid CPUs keep the main thread and the first helpers on performance
+  // cores, efficiency cores only get the remaining threads. One-threaded
+  // processes are left alone for the same reason as above.
+  if (numaNode == -1 && Options["Threads"] > 1 && Options["Hybrid Binding"])
+      efficiencyCore = WinProcGroup::bindToCoreType(idx) == 1;
 
   while (true)
   {
@@ -118,38 +158,84 @@ void Thread::idle_loop() {
 
       lk.unlock();
 
-      search();
+      if (Threads.clearing)
+          clear();
+      else if (Threads.gensfen)
+          search_gensfen();
+      else if (Threads.serving)
+          search_server();
+      else if (Threads.batching())
+          search_batch();
+      else if (Search::Limits.perft)
+          search_perft();
+      else
+          search();
   }
 }
 
 /// ThreadPool::set() creates/destroys threads to match the requested number.
 /// Created and launched threads will immediately go to sleep in idle_loop.
-/// Upon resizing, threads are recreated to allow for binding if necessary.
+/// Surviving threads keep their tables, unless the binding changes with the new
+/// number of threads: then all threads are recreated to allow for binding. This
+/// happens across 8 threads (NUMA) and, with hybrid binding on a hybrid CPU,
+/// across 1 thread.
 
 void ThreadPool::set(size_t requested) {
 
-  if (size() > 0)   // destroy any existing thread(s)
+  if (size() > 0)   // destroy any thread(s) we don't need
   {
       main()->wait_for_search_finished();
 
-      while (size() > 0)
+      // Binding depends on the number of threads, see idle_loop()
+      bool hybrid = Options["Hybrid Binding"] && WinProcGroup::hybrid();
+      auto binding = [hybrid](size_t n) { return n > 8 ? 2 : hybrid && n > 1 ? 1 : 0; };
+      size_t keep = binding(size()) == binding(requested) ? requested : 0;
+
+      while (size() > keep)
           delete back(), pop_back();
   }
 
   if (requested > 0)   // create new thread(s)
   {
-      push_back(new MainThread(0));
+      bool fresh = empty();
+      size_t first = size();
 
       while (size() < requested)
-          push_back(new Thread(size()));
-      clear();
+      {
+          size_t idx = size();
+          auto create = [idx]() -> Thread* { return idx ? new Thread(idx) : new MainThread(idx); };
+          Thread* th;
+
+          // With NUMA binding in use (see idle_loop()), allocate each thread
+          // from a helper bound to the thread's node. Its tables are first
+          // touched by the thread itself, when it clears them.
+          if (requested > 8)
+              std::thread([&]() {
+                  WinProcGroup::bindThisThread(idx);
+                  th = create();
+              }).join();
+          else
+              th = create();
+
+          push_back(th);
+      }
 
-      // Reallocate the hash with the new threadpool size
-      TT.resize(size_t(Options["Hash"]));
+      if (fresh)
+      {
+          clear();
+
+          // Reallocate the hash with the new threadpool size
+          TT.resize(size_t(Options["Hash"]));
+      }
+      else
+          clear_tables(first);
 
       // Init thread number dependent search params.
       Search::init();
   }
+
+  // Threads may have moved to other nodes, refresh the node-local nets
+  Eval::NNUE::replicate();
 }
 
 
@@ -157,15 +243,37 @@ void ThreadPool::set(size_t requested) {
 
 void ThreadPool::clear() {
 
-  for (Thread* th : *this)
-      th->clear();
+  clear_tables(0);
 
   main()->callsCnt = 0;
+  main()->checkInterval = 1024;
+  main()->lastCheckTime = 0;
   main()->bestPreviousScore = VALUE_INFINITE;
   main()->previousTimeReduction = 1.0;
 }
 
 
+/// ThreadPool::clear_tables() has each thread from index 'first' on clear its
+/// own tables with Thread::clear(), all of them at the same time, in the same
+/// way TranspositionTable::clear() splits the hash. Being done by the thread
+/// itself, the clear also first touches the tables on the thread's NUMA node.
+
+void ThreadPool::clear_tables(size_t first) {
+
+  main()->wait_for_search_finished();
+
+  clearing = true;
+
+  for (size_t i = first; i < size(); ++i)
+      at(i)->start_searching();
+
+  for (size_t i = first; i < size(); ++i)
+      at(i)->wait_for_search_finished();
+
+  clearing = false;
+}
+
+
 /// ThreadPool::start_thinking() wakes up main thread waiting in idle_loop() and
 /// returns immediately. Main thread will wake up other threads and start the search.
 
@@ -173,12 +281,17 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
                                 const Search::LimitsType& limits, bool ponderMode) {
 
   main()->wait_for_search_finished();
+  TT.wait_for_clear();
 
   main()->stopOnPonderhit = stop = false;
+  main()->stopTime = 0;
   increaseDepth = true;
   main()->ponder = ponderMode;
   Search::Limits = limits;
   Search::RootMoves rootMoves;
+  batchFens.clear();
+  batchSize = 0;
+  gensfen = false;
 
   for (const auto& m : MoveList<LEGAL>(pos))
       if (   limits.searchmoves.empty()
@@ -188,12 +301,27 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
   if (!rootMoves.empty())
       Tablebases::rank_root_moves(pos, rootMoves);
 
-  // After ownership transfer 'states' becomes empty, so if we stop the search
-  // and call 'go' again without setting a new position states.get() == NULL.
+  // The states are shared with the caller, which may append moves to them
+  // while we search, see position() in uci.cpp.
   assert(states.get() || setupStates.get());
 
   if (states.get())
-      setupStates = std::move(states); // Ownership transfer, states is now empty
+      setupStates = states;
+
+  // With "Split MultiPV" the root moves are dealt out to groups of threads, so
+  // that the PV lines are searched at the same time instead of one after the
+  // other. Each group runs its own MultiPV search over its share, and the best
+  // lines of all the groups are merged, see split_lines(). The best lines
+  // overall are always among the best lines of their share.
+  size_t multiPV = size_t(Options["MultiPV"]);
+  size_t groups = std::min(size(), rootMoves.size());
+
+  splitRoot =   Options["Split MultiPV"]
+             && multiPV > 1
+             && groups > 1
+             && !limits.perft
+             && int(Options["Skill Level"]) == 20
+             && !Options["UCI_LimitStrength"];
 
   // We use Position::set() to set root position across threads. But there are
   // some StateInfo fields (previous, pliesFromNull, capturedPiece) that cannot
@@ -204,7 +332,21 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
   {
       th->nodes = th->tbHits = th->nmpMinPly = th->bestMoveChanges = 0;
       th->rootDepth = th->completedDepth = 0;
-      th->rootMoves = rootMoves;
+      th->ttStats = {};
+      th->searchStats = {};
+      th->splitLines.clear();
+
+      if (splitRoot)
+      {
+          // Moves are dealt in turn, so that each share gets some of the best
+          // moves of the TB ranking, which comes first in the order.
+          th->rootMoves.clear();
+          for (size_t i = th->id() % groups; i < rootMoves.size(); i += groups)
+              th->rootMoves.push_back(rootMoves[i]);
+      }
+      else
+          th->rootMoves = rootMoves;
+
       th->rootPos.set(pos.fen(), pos.is_chess960(), &th->rootState, th);
       th->rootState = setupStates->back();
   }
@@ -212,6 +354,136 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
   main()->start_searching();
 }
 
+/// ThreadPool::start_batch() wakes up main thread to search all the given
+/// positions independently, see Thread::search_batch(), and returns immediately.
+/// With records, the results of the count positions are stored there.
+
+void ThreadPool::start_batch(const std::vector<std::string>& fens, bool chess960,
+                             const Search::LimitsType& limits,
+                             PackedPosition* records, size_t count) {
+
+  main()->wait_for_search_finished();
+  TT.wait_for_clear();
+
+  main()->stopOnPonderhit = stop = false;
+  increaseDepth = true;
+  main()->ponder = false;
+  Search::Limits = limits;
+  splitRoot = false;
+
+  batchFens = fens;
+  batchRecords = records;
+  batchSize = records ? count : fens.size();
+  batchChess960 = chess960;
+  batchNext = batchDone = 0;
+  batchNodes = 0;
+  gensfen = false;
+
+  main()->start_searching();
+}
+
+/// ThreadPool::start_gensfen() wakes up main thread to play the self-play games
+/// of a 'gensfen' command on all the threads, see Thread::search_gensfen(), and
+/// returns immediately. Returns false if the output file cannot be created.
+
+bool ThreadPool::start_gensfen(const std::string& file, const GensfenParams& params,
+                               const Search::LimitsType& limits) {
+
+  main()->wait_for_search_finished();
+  TT.wait_for_clear();
+
+  gensfenFile.close();
+  gensfenFile.clear();
+  gensfenFile.open(file, std::ios::binary | std::ios::trunc);
+
+  if (!gensfenFile.is_open())
+      return false;
+
+  main()->stopOnPonderhit = stop = false;
+  increaseDepth = true;
+  main()->ponder = false;
+  Search::Limits = limits;
+  splitRoot = false;
+
+  batchFens.clear();
+  batchRecords = nullptr;
+  batchSize = params.games;
+  batchNext = batchDone = 0;
+  batchNodes = 0;
+  gensfen = true;
+  gensfenParams = params;
+  gensfenPositions = 0;
+
+  main()->start_searching();
+  return true;
+}
+
+/// ThreadPool::start_server() wakes up main thread to search the jobs of a
+/// 'server' command on all the threads, see Thread::search_server(), and
+/// returns immediately. Jobs are then given with queue_job().
+
+void ThreadPool::start_server() {
+
+  main()->wait_for_search_finished();
+  TT.wait_for_clear();
+
+  main()->stopOnPonderhit = stop = false;
+  increaseDepth = true;
+  main()->ponder = false;
+  Search::LimitsType limits; // Each job has its own
+  limits.startTime = now();
+  Search::Limits = limits;
+  splitRoot = false;
+
+  batchFens.clear();
+  batchRecords = nullptr;
+  batchSize = 0;
+  gensfen = false;
+  serving = true;
+  serverJobs.clear();
+  serverQuit = false;
+
+  for (Thread* th : *this)
+  {
+      th->nodes = th->tbHits = th->nmpMinPly = th->bestMoveChanges = 0;
+      th->ttStats = {};
+      th->searchStats = {};
+  }
+
+  main()->start_searching();
+}
+
+/// ThreadPool::queue_job() queues a job for the next idle thread
+
+void ThreadPool::queue_job(std::shared_ptr<ServerJob> job) {
+
+  {
+      std::scoped_lock<std::mutex> lk(serverMutex);
+      serverJobs.push_back(std::move(job));
+  }
+  serverCv.notify_one();
+}
+
+/// ThreadPool::stop_server() stops the running jobs, drops the queued ones and
+/// waits for the threads to leave the server mode.
+
+void ThreadPool::stop_server() {
+
+  {
+      std::scoped_lock<std::mutex> lk(serverMutex);
+      serverQuit = true;
+      serverJobs.clear();
+
+      for (Thread* th : *this)
+          if (th->job)
+              th->job->stop = true;
+  }
+
+  serverCv.notify_all();
+  main()->wait_for_search_finished();
+  serving = false;
+}
+
 Thread* ThreadPool::get_best_thread() const {
 
     Thread* bestThread = front();
@@ -222,11 +494,18 @@ Thread* ThreadPool::get_best_thread() const {
     for (Thread* th: *this)
         minScore = std::min(minScore, th->rootMoves[0].score);
 
-    // Vote according to score and depth, and select the best thread
+    // Vote according to score and depth, and select the best thread. Threads
+    // running on efficiency cores search shallower, so their vote can be
+    // down-weighted or ignored.
     for (Thread* th : *this)
     {
+        int weight = th->efficiencyCore ? int(Options["Efficiency Core Weight"]) : 100;
+
+        if (!weight)
+            continue;
+
         votes[th->rootMoves[0].pv[0]] +=
-            (th->rootMoves[0].score - minScore + 14) * int(th->completedDepth);
+            int64_t(th->rootMoves[0].score - minScore + 14) * int(th->completedDepth) * weight / 100;
 
         if (abs(bestThread->rootMoves[0].score) >= VALUE_TB_WIN_IN_MAX_PLY)
         {
@@ -244,6 +523,64 @@ Thread* ThreadPool::get_best_thread() const {
 }
 
 
+/// ThreadPool::split_lines() merges the lines published by the threads of a
+/// split MultiPV search. A move searched by several threads of its group keeps
+/// its deepest line, and the lines are then sorted by score.
+
+std::vector<SplitLine> ThreadPool::split_lines() const {
+
+    std::vector<SplitLine> lines;
+    std::lock_guard<std::mutex> lk(splitMutex);
+
+    for (Thread* th : *this)
+        for (const SplitLine& l : th->splitLines)
+        {
+            auto it = std::find_if(lines.begin(), lines.end(), [&](const SplitLine& o) {
+                          return o.rootMove.pv[0] == l.rootMove.pv[0]; });
+
+            if (it == lines.end())
+                lines.push_back(l);
+            else if (l.depth > it->depth)
+                *it = l;
+        }
+
+    std::stable_sort(lines.begin(), lines.end(), [](const SplitLine& a, const SplitLine& b) {
+                         return a.rootMove.score > b.rootMove.score; });
+
+    if (lines.size() > size_t(Options["MultiPV"]))
+        lines.erase(lines.begin() + size_t(Options["MultiPV"]), lines.end());
+    return lines;
+}
+
+
+/// ThreadPool::tt_stats() sums the transposition table counters of all threads
+
+TTStats ThreadPool::tt_stats() const {
+
+    TTStats sum = {};
+    for (Thread* th : *this)
+    {
+        sum.hits                += th->ttStats.hits;
+        sum.misses              += th->ttStats.misses;
+        sum.collisions          += th->ttStats.collisions;
+        sum.deeperOverwrites    += th->ttStats.deeperOverwrites;
+        sum.sameGenReplacements += th->ttStats.sameGenReplacements;
+    }
+    return sum;
+}
+
+
+/// ThreadPool::search_stats() sums the search counters of all threads
+
+Search::SearchStats ThreadPool::search_stats() const {
+
+    Search::SearchStats sum = {};
+    for (Thread* th : *this)
+        sum += th->searchStats;
+    return sum;
+}
+
+
 /// Start non-main threads
 
 void ThreadPool::start_searching() {
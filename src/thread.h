@@ -21,6 +21,9 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -30,10 +33,41 @@
 #include "pawns.h"
 #include "position.h"
 #include "search.h"
+#include "tt.h"
 #include "thread_win32_osx.h"
 
 namespace Stockfish {
 
+/// SplitLine is a PV line published by a thread of a split MultiPV search,
+/// with the depth it was searched to, see ThreadPool::split_lines().
+
+struct SplitLine {
+  Search::RootMove rootMove;
+  Depth depth;
+};
+
+
+/// ServerJob is a search of a session of the 'server' command, see
+/// Thread::search_server(). It has its own position, limits, clock and stop
+/// flag, and the private transposition table of its session, if any.
+
+struct ServerJob {
+  std::string session;
+  std::string fen;
+  bool chess960;
+  StateListPtr states; // Game history, back() is the root
+  Search::LimitsType limits;
+  TimePoint optimum, maximum; // With a clock, from TimeManagement::init()
+  TranspositionTable* tt;
+  std::atomic_bool stop;
+  bool started, done; // Guarded by ThreadPool::serverMutex
+
+  // As TimeManagement::elapsed(), in nodes with "nodestime"
+  TimePoint elapsed(uint64_t nodes) const { return limits.npmsec ? TimePoint(nodes)
+                                                                 : now() - limits.startTime; }
+};
+
+
 /// Thread class keeps together all the thread-related stuff. We use
 /// per-thread pawn and material hash tables so that once we get a
 /// pointer to an entry its life time is unlimited and we don't have
@@ -48,15 +82,27 @@ class Thread {
   NativeThread stdThread;
 
 public:
+  // Accumulators in the arena: one per ply of the search, with some room for
+  // the moves made by the tablebase probes of the deepest plies.
+  static constexpr size_t AccumulatorArenaSize = MAX_PLY + 16;
+
   explicit Thread(size_t);
   virtual ~Thread();
   virtual void search();
+  void search_batch();
+  void search_gensfen();
+  void search_perft();
+  void search_server();
+  void check_job();
   void clear();
   void idle_loop();
   void start_searching();
   void wait_for_search_finished();
   size_t id() const { return idx; }
+  bool stopped() const { return stopFlag->load(std::memory_order_relaxed); }
 
+  int numaNode = -1; // Set by idle_loop() when the thread is bound
+  bool efficiencyCore = false; // Bound to the efficiency cores of a hybrid CPU
   Pawns::Table pawnsTable;
   Material::Table materialTable;
   size_t pvIdx, pvLast;
@@ -64,11 +110,21 @@ public:
   int selDepth, nmpMinPly;
   Color nmpColor;
   std::atomic<uint64_t> nodes, tbHits, bestMoveChanges;
+  TranspositionTable* tt = &TT; // A private table instead in 'gensfen' and 'server'
+  std::atomic_bool* stopFlag;   // Threads.stop, or the stop flag of the job
+  std::shared_ptr<ServerJob> job; // Job of a 'server' command, guarded by ThreadPool::serverMutex
+  int jobCallsCnt;
+  TTStats ttStats;
+  Search::SearchStats searchStats;
+  Eval::NNUE::AccumulatorCache accumulatorCache;
+  Eval::NNUE::EvalCache nnueEvalCache;
+  Eval::NNUE::Accumulator* accumulators; // One for each ply of the search, see Thread::search()
 
   Position rootPos;
   StateInfo rootState;
   Search::RootMoves rootMoves;
   Depth rootDepth, completedDepth;
+  std::vector<SplitLine> splitLines; // Guarded by ThreadPool::splitMutex
   CounterMoveHistory counterMoves;
   ButterflyHistory mainHistory;
   LowPlyHistory lowPlyHistory;
@@ -90,12 +146,25 @@ struct MainThread : public Thread {
   double previousTimeReduction;
   Value bestPreviousScore;
   Value iterValue[4];
-  int callsCnt;
+  int callsCnt, checkInterval;
+  TimePoint lastCheckTime;
+  std::atomic<TimePoint> stopTime; // When the stop was raised, for the stop latency
+  TimePoint depthTime[MAX_PLY + 1]; // Elapsed time at each completed depth, up to completedDepth
   bool stopOnPonderhit;
   std::atomic_bool ponder;
 };
 
 
+/// GensfenParams are the settings of a 'gensfen' command, see Thread::search_gensfen()
+
+struct GensfenParams {
+  size_t games, hash; // Number of games, size in MB of the table of each thread
+  int randomPlies;    // Random moves played at the start of each game
+  Value evalLimit;    // Score adjudicating a game as won, in internal units
+  uint64_t seed;
+};
+
+
 /// ThreadPool struct handles all the threads-related stuff like init, starting,
 /// parking and, most importantly, launching a thread. All the access to threads
 /// is done through this class.
@@ -103,21 +172,72 @@ struct MainThread : public Thread {
 struct ThreadPool : public std::vector<Thread*> {
 
   void start_thinking(Position&, StateListPtr&, const Search::LimitsType&, bool = false);
+  void start_batch(const std::vector<std::string>&, bool, const Search::LimitsType&,
+                   PackedPosition* records = nullptr, size_t count = 0);
+  bool start_gensfen(const std::string&, const GensfenParams&, const Search::LimitsType&);
+  void start_server();
+  void queue_job(std::shared_ptr<ServerJob>);
+  void stop_server();
   void clear();
   void set(size_t);
 
   MainThread* main()        const { return static_cast<MainThread*>(front()); }
   uint64_t nodes_searched() const { return accumulate(&Thread::nodes); }
   uint64_t tb_hits()        const { return accumulate(&Thread::tbHits); }
+  TTStats tt_stats() const;
+  Search::SearchStats search_stats() const;
+  std::vector<SplitLine> split_lines() const;
+  bool batching()           const { return batchSize || serving; }
   Thread* get_best_thread() const;
   void start_searching();
   void wait_for_search_finished() const;
 
   std::atomic_bool stop, increaseDepth;
 
+  // Set while the threads clear their own tables, see ThreadPool::clear()
+  bool clearing;
+
+  // With "Split MultiPV", each group of threads searches its own share of the
+  // root moves, see start_thinking(), and publishes its best lines.
+  bool splitRoot;
+  mutable std::mutex splitMutex;
+
+  // Positions of a 'go batch' command, see Thread::search_batch(). For the
+  // 'score' command, the results are stored in batchRecords instead, and the
+  // positions come from there too if there are no FENs.
+  std::vector<std::string> batchFens;
+  PackedPosition* batchRecords;
+  size_t batchSize;
+  bool batchChess960;
+  std::atomic<size_t> batchNext, batchDone;
+  std::atomic<uint64_t> batchNodes;
+
+  // Self-play games of a 'gensfen' command, see Thread::search_gensfen(). They
+  // are counted with batchSize, batchNext and batchDone like the positions of
+  // a batch, and their records are written to gensfenFile as each game ends.
+  bool gensfen;
+  GensfenParams gensfenParams;
+  std::ofstream gensfenFile; // Guarded by gensfenMutex
+  std::mutex gensfenMutex;
+  std::atomic<uint64_t> gensfenPositions;
+
+  // Jobs of a 'server' command, see Thread::search_server(). Each thread takes
+  // the next queued job and searches it on its own, until serverQuit is set.
+  bool serving;
+  std::deque<std::shared_ptr<ServerJob>> serverJobs; // Guarded by serverMutex
+  bool serverQuit;                                   // Guarded by serverMutex
+  std::mutex serverMutex;
+  std::condition_variable serverCv;
+
+  // Shared work of a 'go perft' command, see Thread::search_perft()
+  std::atomic<size_t> perftNext;
+  std::atomic<uint64_t> perftCounts[MAX_MOVES]; // Indexed by root move
+
 private:
   StateListPtr setupStates;
 
+  void clear_tables(size_t first);
+
   uint64_t accumulate(std::atomic<uint64_t> Thread::* member) const {
 
     uint64_t sum = 0;
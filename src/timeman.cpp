@@ -40,6 +40,27 @@ void TimeManagement::init(Search::LimitsType& limits, Color us, int ply) {
   TimePoint slowMover       = TimePoint(Options["Slow Mover"]);
   TimePoint npmsec          = TimePoint(Options["nodestime"]);
 
+  // The GUI charged us for our last move the time it thought about it plus the
+  // lag of the link and of the GUI itself, which is what Move Overhead covers.
+  // The lag of a move is only known when the clock of the next one arrives.
+  clock = { limits.use_time_management() && !npmsec && limits.movestogo != 1,
+            us, ply, limits.time[us], limits.inc[us], 0 };
+
+  // Only the next move of the same game can be compared, with the same clock
+  const MoveClock& last = lastMove[us];
+
+  if (last.valid && clock.valid && last.ply + 2 == ply)
+  {
+      TimePoint lag = last.time + last.inc - limits.time[us] - last.thinkTime;
+
+      // Keep the worst lag seen lately, slowly forgetting older ones
+      measuredOverhead = std::clamp(std::max(lag, measuredOverhead - measuredOverhead / 16),
+                                    TimePoint(0), TimePoint(5000));
+  }
+
+  if (Options["Adaptive Move Overhead"] && measuredOverhead)
+      moveOverhead = std::min(TimePoint(5000), measuredOverhead + measuredOverhead / 4 + 2);
+
   // optScale is a percentage of available time to use for the current move.
   // maxScale is a multiplier applied to optimumTime.
   double optScale, maxScale;
@@ -98,4 +119,19 @@ void TimeManagement::init(Search::LimitsType& limits, Color us, int ply) {
       optimumTime += optimumTime / 4;
 }
 
+
+/// TimeManagement::move_played() is called once the bestmove has been sent. It
+/// keeps what the next init() needs to measure the lag of this move. A search
+/// that started as a ponder search is charged from the ponderhit, which we do
+/// not time, so it is not used.
+
+void TimeManagement::move_played(bool pondered) {
+
+  MoveClock& last = lastMove[clock.us];
+
+  last = clock;
+  last.valid = clock.valid && !pondered;
+  last.thinkTime = now() - startTime;
+}
+
 } // namespace Stockfish
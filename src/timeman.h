@@ -31,17 +31,30 @@ namespace Stockfish {
 class TimeManagement {
 public:
   void init(Search::LimitsType& limits, Color us, int ply);
+  void move_played(bool pondered);
+  void new_game() { availableNodes = 0; lastMove[WHITE] = lastMove[BLACK] = {}; }
   TimePoint optimum() const { return optimumTime; }
   TimePoint maximum() const { return maximumTime; }
   TimePoint elapsed() const { return Search::Limits.npmsec ?
                                      TimePoint(Threads.nodes_searched()) : now() - startTime; }
 
   int64_t availableNodes; // When in 'nodes as time' mode
+  TimePoint measuredOverhead; // With "Adaptive Move Overhead", see move_played()
 
 private:
   TimePoint startTime;
   TimePoint optimumTime;
   TimePoint maximumTime;
+
+  // Our clock when the current search started, and what we know of the last
+  // move played by each side, to compare its thinking time with what the GUI
+  // charged for it. Both sides are ours when the engine plays itself.
+  struct MoveClock {
+    bool valid;
+    Color us;
+    int ply;
+    TimePoint time, inc, thinkTime;
+  } clock, lastMove[COLOR_NB];
 };
 
 extern TimeManagement Time;
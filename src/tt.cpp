@@ -16,10 +16,19 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm> // For std::min
 #include <cstring>   // For std::memset
+#include <fstream>
 #include <iostream>
 #include <thread>
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "bitboard.h"
 #include "misc.h"
 #include "thread.h"
@@ -29,16 +38,39 @@
 namespace Stockfish {
 
 TranspositionTable TT; // Our global transposition table
+uint8_t TranspositionTable::generation8;
+
+// Header of a transposition table file, see save() and load()
+namespace {
+
+  struct TTFileHeader {
+    char     magic[8];
+    uint64_t clusterCount;
+    uint64_t clusterSize;
+    uint8_t  generation8;
+    char     padding[7];
+  };
+
+  constexpr char TTFileMagic[8] = { 'S', 'F', 'T', 'T', 'v', '0', '0', '1' };
+}
+
 
 /// TTEntry::save() populates the TTEntry with a new node's data, possibly
 /// overwriting an old position. Update is not atomic and can be racy.
 
-void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev) {
+void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, TTStats& stats) {
 
   // Preserve any existing move for the same position
   if (m || (uint16_t)k != key16)
       move16 = (uint16_t)m;
 
+  // Keep track of the valuable entries we are about to replace
+  if ((uint16_t)k != key16 && depth8)
+  {
+      stats.deeperOverwrites    += depth8 > d - DEPTH_OFFSET;
+      stats.sameGenReplacements += (genBound8 & TranspositionTable::GENERATION_MASK) == TT.generation8;
+  }
+
   // Overwrite less valuable entries (cheapest checks first)
   if (b == BOUND_EXACT
       || (uint16_t)k != key16
@@ -59,15 +91,24 @@ void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev)
 /// TranspositionTable::resize() sets the size of the transposition table,
 /// measured in megabytes. Transposition table consists of a power of 2 number
 /// of clusters and each cluster consists of ClusterSize number of TTEntry.
+/// If the "Shared Hash" option is set the table is attached to the shared memory
+/// segment of that name instead, which is not cleared as others may be using it.
+/// Clearing a new table is done in the background, see clear(). Resizing again,
+/// as when both Hash and Threads are set, aborts the clear still in progress.
 
 void TranspositionTable::resize(size_t mbSize) {
 
   Threads.main()->wait_for_search_finished();
 
-  aligned_large_pages_free(table);
+  abort_clear();
+  free_table();
 
   clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
 
+  std::string name = Options["Shared Hash"];
+  if (!name.empty() && attach_shared(name))
+      return;
+
   table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
   if (!table)
   {
@@ -76,37 +117,252 @@ void TranspositionTable::resize(size_t mbSize) {
       exit(EXIT_FAILURE);
   }
 
+  if (huge_page_size())
+      sync_cout << "info string Hash in " << page_report(table, clusterCount * sizeof(Cluster))
+                << sync_endl;
+
   clear();
 }
 
 
-/// TranspositionTable::clear() initializes the entire transposition table to zero,
-//  in a multi-threaded way.
+/// TranspositionTable::allocate() sets the size of a private table, as used by each
+/// thread in 'gensfen'. Unlike resize() it never attaches a shared segment and
+/// clears at once, as the table is used straight away by the calling thread.
+
+void TranspositionTable::allocate(size_t mbSize) {
+
+  abort_clear();
+  free_table();
+
+  clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
+  table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
+  if (!table)
+  {
+      std::cerr << "Failed to allocate " << mbSize
+                << "MB for transposition table." << std::endl;
+      exit(EXIT_FAILURE);
+  }
+
+  reset();
+}
 
-void TranspositionTable::clear() {
 
-  std::vector<std::thread> threads;
+/// TranspositionTable::attach_shared() maps the table from the named POSIX shared
+/// memory segment, creating it if it does not exist yet, so that engine processes
+/// on the same host share a single table. As with threads, the lockless probe()
+/// and save() scheme tolerates the races. All processes must use the same Hash
+/// size, otherwise we fall back to a private table.
 
-  for (size_t idx = 0; idx < Options["Threads"]; ++idx)
+bool TranspositionTable::attach_shared(const std::string& name) {
+
+#if defined(_WIN32)
+  sync_cout << "info string Shared Hash is not supported on this platform" << sync_endl;
+  return false;
+#else
+  const size_t size = clusterCount * sizeof(Cluster);
+  const std::string shmName = name[0] == '/' ? name : "/" + name;
+  struct stat st;
+
+  int fd = shm_open(shmName.c_str(), O_RDWR | O_CREAT, 0600);
+  if (fd == -1 || fstat(fd, &st) == -1)
+  {
+      if (fd != -1)
+          close(fd);
+
+      sync_cout << "info string Failed to open shared hash " << shmName << sync_endl;
+      return false;
+  }
+
+  // A newly created segment is empty: size it, the kernel fills it with zeros
+  if (   (st.st_size == 0 && ftruncate(fd, off_t(size)) == -1)
+      || (st.st_size != 0 && size_t(st.st_size) != size))
+  {
+      close(fd);
+      sync_cout << "info string Shared hash " << shmName << " has "
+                << st.st_size / (1024 * 1024) << "MB, not matching Hash" << sync_endl;
+      return false;
+  }
+
+  void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (mem == MAP_FAILED)
+  {
+      sync_cout << "info string Failed to map shared hash " << shmName << sync_endl;
+      return false;
+  }
+
+#if defined(MADV_HUGEPAGE)
+  madvise(mem, size, MADV_HUGEPAGE); // Effective if shmem transparent huge pages are enabled
+#endif
+
+  table = static_cast<Cluster*>(mem);
+  shared = true;
+  return true;
+#endif
+}
+
+
+/// TranspositionTable::free_table() releases the table, unmapping it if shared.
+/// The shared memory segment itself is kept, so that other processes and later
+/// runs can keep using it.
+
+void TranspositionTable::free_table() {
+
+#if !defined(_WIN32)
+  if (shared)
   {
-      threads.emplace_back([this, idx]() {
+      munmap(table, clusterCount * sizeof(Cluster));
+      shared = false;
+      table = nullptr;
+      return;
+  }
+#endif
+
+  aligned_large_pages_free(table);
+  table = nullptr;
+}
+
+
+/// TranspositionTable::clear() initializes the entire transposition table to zero,
+/// in a multi-threaded way. Zeroing runs in the background and returns at once:
+/// wait_for_clear() must be called before the table is used. A table that is still
+/// being cleared has not been written to since, so a repeated call is a no-op.
+/// A shared table is only cleared when asked explicitly, by "Clear Hash", as
+/// other processes may be searching with it.
 
-          // Thread binding gives faster search on systems with a first-touch policy
-          if (Options["Threads"] > 8)
-              WinProcGroup::bindThisThread(idx);
+void TranspositionTable::clear(bool clearShared) {
 
-          // Each thread will zero its part of the hash table
-          const size_t stride = size_t(clusterCount / Options["Threads"]),
-                       start  = size_t(stride * idx),
-                       len    = idx != Options["Threads"] - 1 ?
-                                stride : clusterCount - start;
+  if (clearThread.joinable() || (shared && !clearShared))
+      return;
 
-          std::memset(&table[start], 0, len * sizeof(Cluster));
-      });
+  const size_t threadCount = size_t(Options["Threads"]);
+
+  abortClear = false;
+  clearThread = std::thread([this, threadCount]() {
+
+      std::vector<std::thread> threads;
+
+      for (size_t idx = 0; idx < threadCount; ++idx)
+      {
+          threads.emplace_back([this, idx, threadCount]() {
+
+              // Thread binding gives faster search on systems with a first-touch policy
+              if (threadCount > 8)
+                  WinProcGroup::bindThisThread(idx);
+
+              // Each thread will zero its part of the hash table
+              const size_t stride = clusterCount / threadCount,
+                           start  = stride * idx,
+                           len    = idx != threadCount - 1 ?
+                                    stride : clusterCount - start;
+
+              // Zero in chunks, so that an abort from resize() is noticed quickly
+              constexpr size_t ChunkSize = (64 * 1024 * 1024) / sizeof(Cluster);
+
+              for (size_t i = 0; i < len && !abortClear; i += ChunkSize)
+                  std::memset(&table[start + i], 0, std::min(ChunkSize, len - i) * sizeof(Cluster));
+          });
+      }
+
+      for (std::thread& th : threads)
+          th.join();
+  });
+}
+
+
+/// TranspositionTable::reset() zeroes the table in the calling thread, for small
+/// private tables that are cleared between games.
+
+void TranspositionTable::reset() {
+
+  std::memset(table, 0, clusterCount * sizeof(Cluster));
+}
+
+
+/// TranspositionTable::wait_for_clear() blocks until a pending clear() is done
+
+void TranspositionTable::wait_for_clear() {
+
+  if (clearThread.joinable())
+      clearThread.join();
+}
+
+
+/// TranspositionTable::abort_clear() stops a pending clear(), leaving the table
+/// partially cleared, before the table is freed or reallocated.
+
+void TranspositionTable::abort_clear() {
+
+  abortClear = true;
+  wait_for_clear();
+}
+
+
+/// TranspositionTable::memory_usage() reports the size of the table, for the
+/// 'memory' command.
+
+MemoryUsage TranspositionTable::memory_usage() const {
+
+  const size_t bytes = table ? clusterCount * sizeof(Cluster) : 0;
+
+  return { shared ? "Hash (shared)" : "Hash", bytes, large_page_bytes(table, bytes) };
+}
+
+
+/// TranspositionTable::save() writes the whole table to a file, preceded by a
+/// small header with the number of clusters and the current generation, so that
+/// a later load() can reject a file saved with a different Hash size.
+
+bool TranspositionTable::save(const std::string& fname) {
+
+  Threads.main()->wait_for_search_finished();
+  wait_for_clear();
+
+  TTFileHeader header {};
+  std::memcpy(header.magic, TTFileMagic, sizeof(TTFileMagic));
+  header.clusterCount = clusterCount;
+  header.clusterSize  = sizeof(Cluster);
+  header.generation8  = generation8;
+
+  std::ofstream file(fname, std::ios::binary);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(table), clusterCount * sizeof(Cluster));
+
+  return !file.fail();
+}
+
+
+/// TranspositionTable::load() reads back a table written by save(). The file is
+/// read straight into the already allocated table, so the current Hash value must
+/// match the one used when saving. A file with a mismatching header is rejected
+/// and the table is left untouched, a truncated file leaves the table cleared.
+
+bool TranspositionTable::load(const std::string& fname) {
+
+  Threads.main()->wait_for_search_finished();
+  wait_for_clear();
+
+  TTFileHeader header {};
+  std::ifstream file(fname, std::ios::binary);
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+  if (   !file
+      || std::memcmp(header.magic, TTFileMagic, sizeof(TTFileMagic))
+      || header.clusterCount != clusterCount
+      || header.clusterSize  != sizeof(Cluster))
+      return false;
+
+  file.read(reinterpret_cast<char*>(table), clusterCount * sizeof(Cluster));
+
+  if (!file || file.peek() != std::ios::traits_type::eof())
+  {
+      clear();
+      return false;
   }
 
-  for (std::thread& th : threads)
-      th.join();
+  generation8 = header.generation8;
+  return true;
 }
 
 
@@ -117,7 +373,7 @@ void TranspositionTable::clear() {
 /// minus 8 times its relative age. TTEntry t1 is considered more valuable than
 /// TTEntry t2 if its replace value is greater than that of t2.
 
-TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
+TTEntry* TranspositionTable::probe(const Key key, bool& found, TTStats& stats) const {
 
   TTEntry* const tte = first_entry(key);
   const uint16_t key16 = (uint16_t)key;  // Use the low 16 bits as key inside the cluster
@@ -127,9 +383,14 @@ TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
       {
           tte[i].genBound8 = uint8_t(generation8 | (tte[i].genBound8 & (GENERATION_DELTA - 1))); // Refresh
 
-          return found = (bool)tte[i].depth8, &tte[i];
+          found = (bool)tte[i].depth8;
+          stats.hits += found;
+          stats.misses += !found;
+          return &tte[i];
       }
 
+  ++stats.misses;
+
   // Find an entry to be replaced according to the replacement strategy
   TTEntry* replace = tte;
   for (int i = 1; i < ClusterSize; ++i)
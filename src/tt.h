@@ -19,11 +19,25 @@
 #ifndef TT_H_INCLUDED
 #define TT_H_INCLUDED
 
+#include <atomic>
+#include <string>
+#include <thread>
+
 #include "misc.h"
 #include "types.h"
 
 namespace Stockfish {
 
+/// TTStats counts what happens to the probes and stores of one thread during a
+/// search, see the 'ttstats' command. Every thread only updates its own counters,
+/// so no atomics or locks are needed. Collisions are counted when the move of a
+/// hit is not even pseudo legal in the position, so they are a lower bound.
+
+struct TTStats {
+  uint64_t hits, misses, collisions, deeperOverwrites, sameGenReplacements;
+};
+
+
 /// TTEntry struct is the 10 bytes transposition table entry, defined as below:
 ///
 /// key        16 bit
@@ -43,7 +57,7 @@ struct TTEntry {
   Depth depth() const { return (Depth)depth8 + DEPTH_OFFSET; }
   bool is_pv()  const { return (bool)(genBound8 & 0x4); }
   Bound bound() const { return (Bound)(genBound8 & 0x3); }
-  void save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev);
+  void save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, TTStats& stats);
 
 private:
   friend class TranspositionTable;
@@ -57,22 +71,37 @@ private:
 };
 
 
+/// TTCluster is a group of Size entries sharing the same index, padded to
+/// 32 bytes (3 entries) or to a full 64 bytes cache line (6 entries).
+
+template<int Size>
+struct TTCluster {
+
+  static constexpr int Bytes = Size * sizeof(TTEntry) <= 32 ? 32 : 64;
+
+  TTEntry entry[Size];
+  char padding[Bytes - Size * sizeof(TTEntry)];
+};
+
+
 /// A TranspositionTable is an array of Cluster, of size clusterCount. Each
 /// cluster consists of ClusterSize number of TTEntry. Each non-empty TTEntry
 /// contains information on exactly one position. The size of a Cluster should
 /// divide the size of a cache line for best performance, as the cacheline is
-/// prefetched when possible.
+/// prefetched when possible. The default of 3 entries can be changed at compile
+/// time with 'make ttcluster=6', so that a cluster uses the whole prefetched line.
+
+#ifndef TT_CLUSTER_SIZE
+#define TT_CLUSTER_SIZE 3
+#endif
 
 class TranspositionTable {
 
-  static constexpr int ClusterSize = 3;
+  static constexpr int ClusterSize = TT_CLUSTER_SIZE;
 
-  struct Cluster {
-    TTEntry entry[ClusterSize];
-    char padding[2]; // Pad to 32 bytes
-  };
+  using Cluster = TTCluster<ClusterSize>;
 
-  static_assert(sizeof(Cluster) == 32, "Unexpected Cluster size");
+  static_assert(sizeof(Cluster) == 32 || sizeof(Cluster) == 64, "Unexpected Cluster size");
 
   // Constants used to refresh the hash table periodically
   static constexpr unsigned GENERATION_BITS  = 3;                                // nb of bits reserved for other things
@@ -81,12 +110,18 @@ class TranspositionTable {
   static constexpr int      GENERATION_MASK  = (0xFF << GENERATION_BITS) & 0xFF; // mask to pull out generation number
 
 public:
- ~TranspositionTable() { aligned_large_pages_free(table); }
+ ~TranspositionTable() { abort_clear(); free_table(); }
   void new_search() { generation8 += GENERATION_DELTA; } // Lower bits are used for other things
-  TTEntry* probe(const Key key, bool& found) const;
+  TTEntry* probe(const Key key, bool& found, TTStats& stats) const;
   int hashfull() const;
+  MemoryUsage memory_usage() const;
   void resize(size_t mbSize);
-  void clear();
+  void allocate(size_t mbSize);
+  void clear(bool clearShared = false);
+  void reset();
+  void wait_for_clear();
+  bool save(const std::string& fname);
+  bool load(const std::string& fname);
 
   TTEntry* first_entry(const Key key) const {
     return &table[mul_hi64(key, clusterCount)].entry[0];
@@ -95,9 +130,16 @@ public:
 private:
   friend struct TTEntry;
 
+  bool attach_shared(const std::string& name);
+  void free_table();
+  void abort_clear();
+
   size_t clusterCount;
   Cluster* table;
-  uint8_t generation8; // Size must be not bigger than TTEntry::genBound8
+  bool shared; // Table is mapped from a shared memory segment
+  std::thread clearThread;
+  std::atomic_bool abortClear;
+  static uint8_t generation8; // Shared by all tables, size must be not bigger than TTEntry::genBound8
 };
 
 extern TranspositionTable TT;
@@ -35,6 +35,12 @@
 ///
 /// -DUSE_PEXT    | Add runtime support for use of pext asm-instruction. Works
 ///               | only in 64-bit mode and requires hardware with pext support.
+///
+/// -DUSE_DISPATCH| Select the NNUE code path and the use of pext at startup,
+///               | from the instruction sets the hardware supports.
+///
+/// -DUSE_COMPACT_SLIDERS | Use 16-bit slider attack tables built at compile
+///               | time, looked up with pext and pdep. Requires -DUSE_PEXT.
 
 #include <cassert>
 #include <cctype>
@@ -79,6 +85,15 @@
 #if defined(USE_PEXT)
 #  include <immintrin.h> // Header for _pext_u64() intrinsic
 #  define pext(b, m) _pext_u64(b, m)
+#  define pdep(b, m) _pdep_u64(b, m)
+#elif defined(USE_DISPATCH) && defined(IS_64BIT)
+// The baseline target of a dispatch build does not include BMI2, so the
+// instruction is emitted directly. It is only reached when HasPext is set.
+inline uint64_t pext(uint64_t b, uint64_t m) {
+  uint64_t r;
+  asm("pextq %2, %1, %0" : "=r"(r) : "r"(b), "rm"(m));
+  return r;
+}
 #else
 #  define pext(b, m) 0
 #endif
@@ -93,6 +108,8 @@ constexpr bool HasPopCnt = false;
 
 #ifdef USE_PEXT
 constexpr bool HasPext = true;
+#elif defined(USE_DISPATCH) && defined(IS_64BIT)
+extern bool HasPext; // Selected at startup from CPUID, see Bitboards::init()
 #else
 constexpr bool HasPext = false;
 #endif
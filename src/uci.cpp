@@ -16,12 +16,23 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 
+#include "cluster.h"
 #include "evaluate.h"
 #include "movegen.h"
 #include "position.h"
@@ -43,16 +54,53 @@ namespace {
   // FEN string of the initial position, normal chess
   const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
+  // Set by the UCI "debug on" command, isready then also reports the memory
+  bool debugMode = false;
+
+
+  // The last position set up by position(), with the moves actually made
+  struct LastPosition {
+    string fen;
+    bool chess960;
+    vector<string> moves;
+    const StateInfo* state;
+    Key key;
+  } lastPosition;
+
+
+  // read_int() reads an optional integer argument of a command, at least min.
+  // A missing or non-numeric argument gives the default, and a non-numeric one
+  // is left for the next argument.
+
+  int read_int(istream& args, int def, int min) {
+
+    std::streampos start = args.tellg();
+    int n;
+
+    if (args >> n)
+        return std::max(n, min);
+
+    args.clear();
+    if (start != std::streampos(-1))
+        args.seekg(start);
+
+    return def;
+  }
+
 
   // position() is called when engine receives the "position" UCI command.
   // The function sets up the position described in the given FEN string ("fen")
   // or the starting position ("startpos") and then makes the moves given in the
-  // following move list ("moves").
+  // following move list ("moves"). GUIs send the whole game before each search,
+  // so when the command only appends moves to the previous one, the moves made
+  // so far are kept and only the new ones are made.
 
   void position(Position& pos, istringstream& is, StateListPtr& states) {
 
     Move m;
     string token, fen;
+    vector<string> moves;
+    LastPosition& last = lastPosition;
 
     is >> token;
 
@@ -67,15 +115,42 @@ namespace {
     else
         return;
 
-    states = StateListPtr(new std::deque<StateInfo>(1)); // Drop old and create a new one
-    pos.set(fen, Options["UCI_Chess960"], &states->back(), Threads.main());
+    while (is >> token)
+        moves.push_back(token);
+
+    const bool chess960 = Options["UCI_Chess960"];
+
+    if (   states
+        && pos.state() == &states->back()
+        && pos.state() == last.state
+        && pos.key() == last.key
+        && pos.this_thread() == Threads.main()
+        && fen == last.fen
+        && chess960 == last.chess960
+        && moves.size() >= last.moves.size()
+        && std::equal(last.moves.begin(), last.moves.end(), moves.begin()))
+        moves.erase(moves.begin(), moves.begin() + last.moves.size());
+    else
+    {
+        states = StateListPtr(new std::deque<StateInfo>(1)); // Drop old and create a new one
+        pos.set(fen, chess960, &states->back(), Threads.main());
+        last = { fen, chess960, {}, nullptr, 0 };
+    }
 
     // Parse move list (if any)
-    while (is >> token && (m = UCI::to_move(pos, token)) != MOVE_NONE)
+    for (const string& move : moves)
     {
-        states->emplace_back();
+        token = move; // UCI::to_move() may change its argument
+        if ((m = UCI::to_move(pos, token)) == MOVE_NONE)
+            break;
+
+        states->emplace_back(); // References to the earlier states stay valid
         pos.do_move(m, states->back());
+        last.moves.push_back(move);
     }
+
+    last.state = pos.state();
+    last.key = pos.key();
   }
 
   // trace_eval() prints the evaluation for the current position, consistent with the UCI
@@ -117,15 +192,619 @@ namespace {
   }
 
 
-  // go() is called when engine receives the "go" UCI command. The function sets
-  // the thinking time and other parameters from the input string, then starts
-  // the search.
+  // go_batch() is called on "go batch <file> depth <n>". It reads one FEN per
+  // line from the file and lets the threads search them to the given depth,
+  // each on its own. Results are printed in completion order, see search_batch().
 
-  void go(Position& pos, istringstream& is, StateListPtr& states) {
+  void go_batch(const string& file, int depth) {
+
+    ifstream in(file);
+    vector<string> fens;
+    string fen;
+
+    while (getline(in, fen))
+        if (!fen.empty() && fen[0] != '#')
+            fens.push_back(fen);
+
+    if (fens.empty() || depth <= 0)
+    {
+        sync_cout << (fens.empty() ? "No positions in " + file
+                                   : string("Missing depth for go batch")) << sync_endl;
+        return;
+    }
+
+    Search::LimitsType limits;
+    limits.startTime = now();
+    limits.depth = depth;
+
+    Threads.start_batch(fens, Options["UCI_Chess960"], limits);
+  }
+
+
+  // eval_batch() is called on "evalbatch <file>". It reads one FEN per line from
+  // the file and prints the NNUE evaluation of each position, from the point of
+  // view of the side to move and in file order. Positions are evaluated a chunk
+  // at a time with Eval::NNUE::evaluate_batch().
+
+  void eval_batch(const string& file) {
+
+    constexpr size_t ChunkSize = 4096;
+
+    Threads.main()->wait_for_search_finished();
+    Eval::NNUE::verify();
+
+    if (!Eval::useNNUE)
+    {
+        sync_cout << "evalbatch needs the NNUE evaluation" << sync_endl;
+        return;
+    }
+
+    ifstream in(file);
+    vector<Position> positions(ChunkSize);
+    vector<StateInfo> states(ChunkSize);
+    vector<const Position*> batch;
+    vector<Value> values(ChunkSize);
+    bool chess960 = Options["UCI_Chess960"];
+    uint64_t cnt = 0;
+    string fen;
+    TimePoint elapsed = now();
+
+    auto evaluate = [&]() {
+
+        ostringstream ss;
+        Eval::NNUE::evaluate_batch(batch.data(), values.data(), batch.size());
+
+        for (size_t i = 0; i < batch.size(); ++i)
+            ss << (i ? "\n" : "") << "batch " << cnt++ << " score " << UCI::value(values[i]);
+
+        sync_cout << ss.str() << sync_endl;
+        batch.clear();
+    };
+
+    while (getline(in, fen))
+        if (!fen.empty() && fen[0] != '#')
+        {
+            size_t i = batch.size();
+            positions[i].set(fen, chess960, &states[i], Threads.main());
+            batch.push_back(&positions[i]);
+
+            if (batch.size() == ChunkSize)
+                evaluate();
+        }
+
+    if (!batch.empty())
+        evaluate();
+
+    elapsed = now() - elapsed + 1;
+
+    sync_cout << "evalbatchdone positions " << cnt
+              << " pps "  << cnt * 1000 / elapsed
+              << " time " << elapsed << sync_endl;
+  }
+
+
+  // score() is called on "score <input> <output> [depth]". The positions of the
+  // input file, one FEN or EPD per line or packed ones if its name ends with
+  // ".bin", are scored in chunks by all the threads, each on its own, with a
+  // search of the given depth or with the static eval by default. The input is
+  // memory mapped, the results are written in large blocks, as packed positions
+  // if the output name ends with ".bin", otherwise as EPD with "ce" (or "dm"),
+  // "bm" and "acd" operations.
+
+  void score(istream& args) {
+
+    constexpr size_t ChunkSize = 1 << 20;
+
+    string input, output, token;
+    args >> input >> output;
+    int depth = read_int(args, 0, 0);
+
+    auto binary = [](const string& name) {
+      return name.size() > 4 && name.compare(name.size() - 4, 4, ".bin") == 0;
+    };
+
+    size_t size = 0;
+    uint64_t mapping = 0;
+    const char* data = static_cast<const char*>(map_file(input, &size, &mapping));
+    std::ofstream out;
+    vector<char> outBuffer(1 << 24);
+
+    out.rdbuf()->pubsetbuf(outBuffer.data(), std::streamsize(outBuffer.size()));
+    out.open(output, binary(output) ? ios::binary | ios::out : ios::out);
+
+    if (!data || !out.is_open())
+    {
+        sync_cout << "Unable to open " << (data ? output : input) << sync_endl;
+        unmap_file(const_cast<char*>(data), mapping);
+        return;
+    }
+
+    Threads.main()->wait_for_search_finished();
+
+    Search::LimitsType limits;
+    limits.depth = depth;
+
+    vector<PackedPosition> records(ChunkSize);
+    vector<string> fens;
+    size_t offset = 0, total = 0;
+    uint64_t nodes = 0;
+    TimePoint start = now();
+    const bool packed = binary(input);
+
+    while (offset < size)
+    {
+        size_t count = 0;
+        fens.clear();
+
+        if (packed)
+        {
+            count = std::min(ChunkSize, (size - offset) / sizeof(PackedPosition));
+            std::memcpy(records.data(), data + offset, count * sizeof(PackedPosition));
+            offset = count ? offset + count * sizeof(PackedPosition) : size;
+        }
+        else
+            while (offset < size && fens.size() < ChunkSize)
+            {
+                const char* end = static_cast<const char*>(std::memchr(data + offset, '\n', size - offset));
+                size_t len = (end ? size_t(end - data) : size) - offset;
+
+                if (len && data[offset] != '#' && data[offset] != '\r')
+                    fens.emplace_back(data + offset, len);
+
+                // An EPD has 4 fields followed by operations ending with ';',
+                // "hmvc" and "fmvn" give the last two fields of the FEN.
+                if (!fens.empty() && fens.back().find(';') != string::npos)
+                {
+                    istringstream epd(fens.back());
+                    string fen, field, hmvc = "0", fmvn = "1";
+
+                    for (int f = 0; f < 4 && epd >> field; ++f)
+                        fen += field + " ";
+
+                    while (epd >> field)
+                        if (field == "hmvc" || field == "fmvn")
+                            (field == "hmvc" ? hmvc : fmvn) = (epd >> token, token.substr(0, token.find(';')));
+
+                    fens.back() = fen + hmvc + " " + fmvn;
+                }
+
+                offset += len + 1;
+            }
+
+        if (!packed && !(count = fens.size()))
+            break;
+
+        Threads.start_batch(fens, Options["UCI_Chess960"], limits, records.data(), count);
+        Threads.main()->wait_for_search_finished();
+
+        if (binary(output))
+            out.write(reinterpret_cast<const char*>(records.data()),
+                      std::streamsize(count * sizeof(PackedPosition)));
+        else
+            for (size_t i = 0; i < count; ++i)
+            {
+                StateInfo st;
+                Position pos;
+                const PackedPosition& r = records[i];
+                istringstream fen(pos.set(r, &st, nullptr).fen());
+                string field;
+
+                for (int f = 0; f < 4 && fen >> field; ++f)
+                    out << field << (f < 3 ? " " : "");
+
+                out << " hmvc " << int(r.rule50) << "; fmvn " << 1 + r.gamePly / 2 << ";";
+
+                // Centipawns, or moves to mate, as for the "score" of an info line
+                if (r.score != VALUE_NONE)
+                {
+                    string v = UCI::value(Value(r.score));
+                    out << (v[0] == 'c' ? " ce" : " dm") << v.substr(v.find(' ')) << ";";
+                }
+
+                if (r.move != MOVE_NONE)
+                    out << " bm " << UCI::move(Move(r.move), pos.is_chess960()) << ";";
+
+                out << " acd " << int(r.depth) << ";\n";
+            }
+
+        total += count, nodes += Threads.batchNodes;
+        cerr << "\rScored " << total << " positions" << flush;
+    }
+
+    out.close();
+    unmap_file(const_cast<char*>(data), mapping);
+
+    TimePoint elapsed = now() - start + 1;
+
+    cerr << endl;
+    sync_cout << "info string scored " << total << " positions"
+              << " nodes " << nodes
+              << " time " << elapsed
+              << " positions/second " << total * 1000 / elapsed << sync_endl;
+  }
+
+
+  // gensfen() is called on "gensfen <output> games <n> depth <d> | nodes <n>
+  // [random_plies <r>] [eval_limit <v>] [hash <mb>] [seed <s>]". All the threads
+  // play self-play games in the background, see Thread::search_gensfen(), and the
+  // searched positions are written to output as packed positions, the format of
+  // the "score" command. 'stop' ends the generation after the games being played.
+
+  void gensfen(istream& args) {
+
+    GensfenParams params = { 1, 4, 8, Value(3000), 1 };
+    Search::LimitsType limits;
+    string output, token;
+
+    args >> output;
+
+    while (args >> token)
+        if (token == "games")             args >> params.games;
+        else if (token == "depth")        args >> limits.depth;
+        else if (token == "nodes")        args >> limits.nodes;
+        else if (token == "random_plies") args >> params.randomPlies;
+        else if (token == "eval_limit")
+        {
+            int v;
+            args >> v;
+            params.evalLimit = Value(std::clamp(v, 1, int(VALUE_INFINITE)));
+        }
+        else if (token == "hash")         args >> params.hash;
+        else if (token == "seed")         args >> params.seed;
+
+    if (output.empty() || (!limits.depth && !limits.nodes))
+    {
+        sync_cout << "Usage: gensfen <output> games <n> depth <d> | nodes <n>"
+                     " [random_plies <r>] [eval_limit <v>] [hash <mb>] [seed <s>]" << sync_endl;
+        return;
+    }
+
+    params.hash = std::max(params.hash, size_t(1));
+    limits.startTime = now();
+
+    if (!Threads.start_gensfen(output, params, limits))
+        sync_cout << "Unable to open " << output << sync_endl;
+  }
+
+
+  // nnue_bench() is called on "nnuebench [iterations] [fenFile]". It times each
+  // part of the NNUE evaluation, see Eval::NNUE::benchmark(), over the bench
+  // positions or those of fenFile. Chess960 positions are left out.
+
+  void nnue_bench(Position& current, istream& args) {
+
+    string token;
+    int iterations = read_int(args, 1000, 1);
+    string fenFile = (args >> token) ? token : "default";
+
+    Threads.main()->wait_for_search_finished();
+    Eval::NNUE::verify();
+
+    if (!Eval::useNNUE)
+    {
+        sync_cout << "nnuebench needs the NNUE evaluation" << sync_endl;
+        return;
+    }
+
+    istringstream ss("16 1 1 " + fenFile + " depth NNUE");
+    vector<string> fens;
+    Position pos;
+    StateListPtr states;
+    bool chess960 = false;
+
+    for (const string& cmd : setup_bench(current, ss))
+    {
+        istringstream is(cmd);
+        is >> token;
+
+        if (token == "setoption" && cmd.find("UCI_Chess960") != string::npos)
+            chess960 = cmd.find("value true") != string::npos;
+
+        else if (token == "position" && !chess960)
+        {
+            position(pos, is, states);
+            fens.push_back(pos.fen());
+        }
+    }
+
+    string report = Eval::NNUE::benchmark(fens, iterations);
+    sync_cout << report << sync_endl;
+  }
+
+
+  // movegen_bench() is called on "movegenbench [iterations] [fenFile]". It times
+  // the generators used by the MovePicker stages over the bench positions or
+  // those of fenFile, and the Position::legal() test that the search no longer
+  // has to do on each of their moves.
+
+  void movegen_bench(Position& current, istream& args) {
+
+    using Clock = std::chrono::steady_clock;
+
+    string token;
+    int iterations = read_int(args, 10000, 1);
+    string fenFile = (args >> token) ? token : "default";
+
+    Threads.main()->wait_for_search_finished();
+
+    istringstream ss("16 1 1 " + fenFile + " depth");
+    std::deque<Position> positions;
+    std::deque<StateInfo> states;
+    Position pos;
+    StateListPtr posStates;
+    bool chess960 = false;
+
+    for (const string& cmd : setup_bench(current, ss))
+    {
+        istringstream is(cmd);
+        is >> token;
+
+        if (token == "setoption" && cmd.find("UCI_Chess960") != string::npos)
+            chess960 = cmd.find("value true") != string::npos;
+
+        else if (token == "position")
+        {
+            position(pos, is, posStates);
+            states.emplace_back();
+            positions.emplace_back().set(pos.fen(), chess960, &states.back(), Threads.main());
+        }
+    }
+
+    ExtMove moves[MAX_MOVES];
+    uint64_t sink = 0; // Sum of the results, so that no call is optimized away
+    std::ostringstream report;
+
+    const char* sliders =
+#if defined(USE_COMPACT_SLIDERS)
+                          "compact pext/pdep";
+#else
+                          HasPext ? "fancy magics, pext index" : "fancy magics";
+#endif
+
+    report << "Move generation benchmark: " << positions.size() << " positions, "
+           << iterations << " iterations, slider attacks: " << sliders << "\n\n"
+           << std::setw(16) << std::left << "Stage" << std::right
+           << std::setw(12) << "ns/call" << std::setw(12) << "moves/call" << "\n";
+
+    // Time of 'iterations' calls of f() on each position where it applies
+    auto row = [&](const string& name, auto applies, auto f) {
+      size_t calls = 0, cnt = 0;
+      auto start = Clock::now();
+
+      for (int it = 0; it < iterations; ++it)
+          for (const Position& p : positions)
+              if (applies(p))
+              {
+                  size_t n = f(p);
+                  calls += 1, cnt += n, sink += n;
+              }
+
+      double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+      report << std::setw(16) << std::left << name << std::right << std::fixed
+             << std::setw(12) << std::setprecision(1) << (calls ? ns / calls : 0.0)
+             << std::setw(12) << std::setprecision(1) << (calls ? double(cnt) / calls : 0.0) << "\n";
+    };
+
+    auto quiet   = [](const Position& p) { return !p.checkers(); };
+    auto evasion = [](const Position& p) { return bool(p.checkers()); };
+
+    row("Captures",     quiet,   [&](const Position& p) { return generate<CAPTURES    >(p, moves) - moves; });
+    row("Quiets",       quiet,   [&](const Position& p) { return generate<QUIETS      >(p, moves) - moves; });
+    row("Quiet checks", quiet,   [&](const Position& p) { return generate<QUIET_CHECKS>(p, moves) - moves; });
+    row("Evasions",     evasion, [&](const Position& p) { return generate<EVASIONS    >(p, moves) - moves; });
+    row("Legal",        [](const Position&) { return true; },
+                                 [&](const Position& p) { return generate<LEGAL       >(p, moves) - moves; });
+
+    // Rook and bishop attacks from every square, for the occupancy of the
+    // position. The count is the number of attacked squares.
+    row("Slider attacks", [](const Position&) { return true; }, [&](const Position& p) {
+      size_t n = 0;
+      for (Square s = SQ_A1; s <= SQ_H8; ++s)
+          n += popcount(attacks_bb<ROOK>(s, p.pieces())) + popcount(attacks_bb<BISHOP>(s, p.pieces()));
+      return n;
+    });
+
+    // The legality test each generated move used to go through in the search
+    row("legal() saved", [](const Position&) { return true; }, [&](const Position& p) {
+      ExtMove* end = generate<LEGAL>(p, moves);
+      size_t n = 0;
+      for (ExtMove* m = moves; m != end; ++m)
+          n += p.legal(*m);
+      return n;
+    });
+
+    sync_cout << report.str()
+              << "\nThe last row includes the generation of the moves it tests,"
+              << " the difference with\nthe Legal row is the cost the search no longer pays at each node."
+              << "\n\nChecksum: " << sink << sync_endl;
+  }
+
+
+  // micro_bench() is called on "microbench [iterations] [repeats] [fenFile]". It
+  // times the primitives the search is made of over the bench positions or those
+  // of fenFile and over all their legal moves: the generators, do_move() and
+  // undo_move(), gives_check(), see_ge(), TT probes and both evaluations. Each
+  // row is measured repeats times (5 by default) over iterations passes (1000 by
+  // default), and gives the median, minimum, mean and relative deviation of the
+  // ns per operation.
+
+  void micro_bench(Position& current, istream& args) {
+
+    using Clock = std::chrono::steady_clock;
+
+    string token;
+    int iterations = read_int(args, 1000, 1);
+    int repeats    = read_int(args, 5, 1);
+    string fenFile = (args >> token) ? token : "default";
+
+    Threads.main()->wait_for_search_finished();
+    Eval::NNUE::verify();
+
+    istringstream ss("16 1 1 " + fenFile + " depth current");
+    std::deque<Position> positions;
+    std::deque<StateInfo> states;
+    vector<vector<Move>> moves;
+    vector<Key> keys;
+    Position pos;
+    StateListPtr posStates;
+    bool chess960 = false;
+
+    for (const string& cmd : setup_bench(current, ss))
+    {
+        istringstream is(cmd);
+        is >> token;
+
+        if (token == "setoption" && cmd.find("UCI_Chess960") != string::npos)
+            chess960 = cmd.find("value true") != string::npos;
+
+        else if (token == "position")
+        {
+            position(pos, is, posStates);
+            states.emplace_back();
+            positions.emplace_back().set(pos.fen(), chess960, &states.back(), Threads.main());
+            moves.emplace_back();
+
+            for (const auto& m : MoveList<LEGAL>(pos))
+                moves.back().push_back(m), keys.push_back(pos.key_after(m));
+        }
+    }
+
+    // Random keys too, most of their probes miss the CPU caches like in the search
+    PRNG rng(1070372);
+    vector<Key> randomKeys(keys.size());
+    for (Key& k : randomKeys)
+        k = rng.rand<Key>();
+
+    ExtMove list[MAX_MOVES];
+    StateInfo st;
+    TTStats ttStats = {};
+    uint64_t sink = 0; // Sum of the results, so that no call is optimized away
+    std::ostringstream report;
+    bool useNNUE = Eval::useNNUE;
+
+    report << "Micro benchmark: " << positions.size() << " positions, " << keys.size() << " moves, "
+           << iterations << " iterations, " << repeats << " repeats\n\n"
+           << std::setw(20) << std::left << "Operation" << std::right
+           << std::setw(10) << "median" << std::setw(10) << "min" << std::setw(10) << "mean"
+           << std::setw(10) << "stddev" << "  (ns/op)\n";
+
+    // Times 'iterations' passes of f(), which returns the number of operations
+    // it did, repeats times
+    auto row = [&](const string& name, auto f) {
+      vector<double> ns;
+
+      for (int r = 0; r < repeats; ++r)
+      {
+          uint64_t ops = 0;
+          auto start = Clock::now();
+
+          for (int it = 0; it < iterations; ++it)
+              ops += f();
+
+          ns.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count() / std::max(ops, uint64_t(1)));
+      }
+
+      std::sort(ns.begin(), ns.end());
+      double mean = 0, var = 0;
+
+      for (double x : ns)
+          mean += x / repeats;
+
+      for (double x : ns)
+          var += (x - mean) * (x - mean) / std::max(repeats - 1, 1);
+
+      report << std::setw(20) << std::left << name << std::right << std::fixed << std::setprecision(1)
+             << std::setw(10) << (ns[(repeats - 1) / 2] + ns[repeats / 2]) / 2
+             << std::setw(10) << ns.front() << std::setw(10) << mean
+             << std::setw(9)  << 100 * std::sqrt(var) / std::max(mean, 1e-9) << "%\n";
+    };
+
+    // f() over every position, it returns 1 if it applies to the position
+    auto each_position = [&](std::deque<Position>& set, auto f) {
+      return [&, f]() {
+        uint64_t ops = 0;
+        for (Position& p : set)
+            ops += f(p);
+        return ops;
+      };
+    };
+
+    // f() over every legal move of every position
+    auto each_move = [&](auto f) {
+      return [&, f]() {
+        for (size_t i = 0; i < positions.size(); ++i)
+            for (Move m : moves[i])
+                f(positions[i], m);
+        return uint64_t(keys.size());
+      };
+    };
+
+    row("generate captures", each_position(positions, [&](Position& p) {
+      return !p.checkers() && (sink += generate<CAPTURES>(p, list) - list, true); }));
+    row("generate quiets",   each_position(positions, [&](Position& p) {
+      return !p.checkers() && (sink += generate<QUIETS>(p, list) - list, true); }));
+    row("generate evasions", each_position(positions, [&](Position& p) {
+      return p.checkers() && (sink += generate<EVASIONS>(p, list) - list, true); }));
+    row("generate legal",    each_position(positions, [&](Position& p) {
+      return sink += generate<LEGAL>(p, list) - list, true; }));
+    row("do+undo move",      each_move([&](Position& p, Move m) {
+      p.do_move(m, st), sink += st.key, p.undo_move(m); }));
+    row("gives_check",       each_move([&](Position& p, Move m) { sink += p.gives_check(m); }));
+    row("see_ge",            each_move([&](Position& p, Move m) { sink += p.see_ge(m); }));
+
+    auto probe = [&](const vector<Key>& k) {
+      return [&]() {
+        bool found;
+        for (Key key : k)
+            sink += uintptr_t(TT.probe(key, found, ttStats)) + found;
+        return uint64_t(k.size());
+      };
+    };
+
+    // Not against a table still being cleared, as after ucinewgame
+    TT.wait_for_clear();
+
+    row("TT probe", probe(keys));
+    row("TT probe random", probe(randomKeys));
+
+    Eval::useNNUE = false;
+    row("evaluate classical", each_position(positions, [&](Position& p) {
+      return sink += Eval::evaluate(p), true; }));
+    Eval::useNNUE = useNNUE;
+
+    // The positions have no thread, so that the eval cache of the thread is not
+    // used and the net is run on every call.
+    if (useNNUE)
+    {
+        std::deque<Position> netPositions;
+        std::deque<StateInfo> netStates;
+        std::deque<Eval::NNUE::Accumulator> netAccumulators;
+
+        for (const Position& p : positions)
+        {
+            netStates.emplace_back();
+            netPositions.emplace_back().set(p.fen(), p.is_chess960(), &netStates.back(), nullptr);
+            netStates.back().accumulator = &netAccumulators.emplace_back();
+        }
+
+        row("evaluate NNUE", each_position(netPositions, [&](Position& p) {
+          return sink += Eval::NNUE::evaluate(p, true), true; }));
+    }
+
+    sync_cout << report.str()
+              << "\nThe generators count per call, not per generated move. The NNUE row runs the"
+              << " net\nwith the accumulators already computed, see nnuebench for their refresh."
+              << "\n\nChecksum: " << sink << sync_endl;
+  }
+
+
+  // read_limits() reads the thinking time and other parameters of a "go" command,
+  // for go() and for the sessions of server().
+
+  Search::LimitsType read_limits(Position& pos, istream& is, bool& ponderMode, string& batchFile) {
 
     Search::LimitsType limits;
     string token;
-    bool ponderMode = false;
 
     limits.startTime = now(); // As early as possible!
 
@@ -134,6 +813,8 @@ namespace {
             while (is >> token)
                 limits.searchmoves.push_back(UCI::to_move(pos, token));
 
+        else if (token == "batch")     is >> batchFile;
+
         else if (token == "wtime")     is >> limits.time[WHITE];
         else if (token == "btime")     is >> limits.time[BLACK];
         else if (token == "winc")      is >> limits.inc[WHITE];
@@ -144,10 +825,28 @@ namespace {
         else if (token == "movetime")  is >> limits.movetime;
         else if (token == "mate")      is >> limits.mate;
         else if (token == "perft")     is >> limits.perft;
+        else if (token == "perfthash") is >> limits.perftHash;
         else if (token == "infinite")  limits.infinite = 1;
         else if (token == "ponder")    ponderMode = true;
 
-    Threads.start_thinking(pos, states, limits, ponderMode);
+    return limits;
+  }
+
+
+  // go() is called when engine receives the "go" UCI command. The function sets
+  // the thinking time and other parameters from the input string, then starts
+  // the search.
+
+  void go(Position& pos, istringstream& is, StateListPtr& states) {
+
+    string batchFile;
+    bool ponderMode = false;
+    Search::LimitsType limits = read_limits(pos, is, ponderMode, batchFile);
+
+    if (!batchFile.empty())
+        go_batch(batchFile, limits.depth);
+    else
+        Threads.start_thinking(pos, states, limits, ponderMode);
   }
 
 
@@ -184,7 +883,7 @@ namespace {
         }
         else if (token == "setoption")  setoption(is);
         else if (token == "position")   position(pos, is, states);
-        else if (token == "ucinewgame") { Search::clear(); elapsed = now(); } // Search::clear() may take some while
+        else if (token == "ucinewgame") { Search::clear(); TT.wait_for_clear(); elapsed = now(); } // Search::clear() may take some while
     }
 
     elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
@@ -197,6 +896,558 @@ namespace {
          << "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
   }
 
+
+  // QuietBuf replaces cout.rdbuf() to hide the output of the searches run by
+  // bench_stats() and speed_test(), except error lines that go to stderr.
+
+  struct QuietBuf : streambuf {
+
+    int overflow(int c) override {
+      if (c != '\n')
+          line += char(c);
+      else
+      {
+          if (line.rfind("info string ERROR", 0) == 0)
+              cerr << line << endl;
+          line.clear();
+      }
+      return c;
+    }
+
+    string line;
+  };
+
+
+  // bench_stats() is called on "benchstats [runs] [warmup] [format] [bench
+  // parameters]". It runs the commands of bench() warmup + runs times and times
+  // each search on its own, without the position setup and the "eval" commands.
+  // The nodes, time and nps of each position and of each run are printed as JSON
+  // or as CSV, with the mean, standard deviation and 95% confidence interval of
+  // the nps over the runs, warm-up runs excluded. The output of the searches
+  // is not shown, except errors.
+
+  void bench_stats(Position& pos, istream& args, StateListPtr& states) {
+
+    string token;
+    int runs      = read_int(args, 5, 1);
+    int warmup    = read_int(args, 1, 0);
+    string format = (args >> token) ? token : "json";
+
+    vector<string> list = setup_bench(pos, args);
+    size_t num = count_if(list.begin(), list.end(), [](string s) { return s.find("go ") == 0; });
+
+    // Nodes and time in microseconds of search idx of each run
+    vector<vector<uint64_t>> nodes(runs, vector<uint64_t>(num)), micros = nodes;
+    vector<string> fens;
+
+    QuietBuf quietBuf;
+    streambuf* out = cout.rdbuf(&quietBuf);
+
+    for (int run = -warmup; run < runs; ++run)
+    {
+        size_t idx = 0;
+
+        for (const auto& cmd : list)
+        {
+            istringstream is(cmd);
+            is >> skipws >> token;
+
+            if (token == "go")
+            {
+                cerr << "\r" << (run < 0 ? "Warm-up " : "Run ") << run + (run < 0 ? warmup : 0) + 1
+                     << " position " << idx + 1 << '/' << num << "   " << flush;
+
+                auto start = chrono::steady_clock::now();
+                go(pos, is, states);
+                Threads.main()->wait_for_search_finished();
+                auto elapsed = chrono::steady_clock::now() - start;
+
+                if (run == 0)
+                    fens.push_back(pos.fen());
+
+                if (run >= 0)
+                {
+                    nodes[run][idx] = Threads.nodes_searched();
+                    micros[run][idx] = std::max(uint64_t(1),
+                                                uint64_t(chrono::duration_cast<chrono::microseconds>(elapsed).count()));
+                }
+                ++idx;
+            }
+            else if (token == "setoption")  setoption(is);
+            else if (token == "position")   position(pos, is, states);
+            else if (token == "ucinewgame") { Search::clear(); TT.wait_for_clear(); }
+        }
+    }
+
+    cout.rdbuf(out);
+    cerr << endl;
+
+    struct Stats { double mean, stddev, low, high; };
+
+    // Mean, sample standard deviation and Student's t 95% confidence interval
+    auto stats = [](const vector<double>& v) {
+
+        constexpr double T95[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+                                   2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+                                   2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064,
+                                   2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+        size_t n = v.size();
+        double mean = 0, var = 0;
+
+        for (double x : v)
+            mean += x / n;
+
+        for (double x : v)
+            var += (x - mean) * (x - mean) / std::max(n - 1, size_t(1));
+
+        double stddev = std::sqrt(var);
+        double half = n < 2 ? 0 : (n - 1 <= 30 ? T95[n - 2] : 1.960) * stddev / std::sqrt(double(n));
+        return Stats{ mean, stddev, mean - half, mean + half };
+    };
+
+    auto nps = [](uint64_t n, uint64_t us) { return 1000000.0 * n / us; };
+
+    vector<uint64_t> runNodes(runs), runMicros(runs);
+    vector<double> runNps(runs);
+
+    for (int run = 0; run < runs; ++run)
+    {
+        for (size_t idx = 0; idx < num; ++idx)
+            runNodes[run] += nodes[run][idx], runMicros[run] += micros[run][idx];
+
+        runNps[run] = nps(runNodes[run], runMicros[run]);
+    }
+
+    Stats total = stats(runNps);
+    stringstream ss;
+    ss << fixed << setprecision(1);
+
+    if (format == "csv")
+    {
+        ss << "run,position,nodes,time_us,nps,fen";
+
+        for (int run = 0; run < runs; ++run)
+        {
+            for (size_t idx = 0; idx < num; ++idx)
+                ss << "\n" << run + 1 << "," << idx + 1 << "," << nodes[run][idx] << "," << micros[run][idx]
+                   << "," << nps(nodes[run][idx], micros[run][idx]) << "," << fens[idx];
+
+            ss << "\n" << run + 1 << ",all," << runNodes[run] << "," << runMicros[run] << "," << runNps[run] << ",";
+        }
+
+        ss << "\nmean,all,,," << total.mean << ","
+           << "\nstddev,all,,," << total.stddev << ","
+           << "\nci95low,all,,," << total.low << ","
+           << "\nci95high,all,,," << total.high << ",";
+    }
+    else
+    {
+        auto json = [](const Stats& st) {
+            stringstream js;
+            js << fixed << setprecision(1) << "{ \"mean\": " << st.mean << ", \"stddev\": " << st.stddev
+               << ", \"ci95\": [" << st.low << ", " << st.high << "] }";
+            return js.str();
+        };
+
+        ss << "{\n  \"runs\": " << runs << ", \"warmup\": " << warmup << ", \"positions\": " << num
+           << ",\n  \"nps\": " << json(total) << ",\n  \"run\": [";
+
+        for (int run = 0; run < runs; ++run)
+            ss << (run ? "," : "") << "\n    { \"nodes\": " << runNodes[run] << ", \"time_us\": "
+               << runMicros[run] << ", \"nps\": " << runNps[run] << " }";
+
+        ss << "\n  ],\n  \"position\": [";
+
+        for (size_t idx = 0; idx < num; ++idx)
+        {
+            vector<double> v;
+            for (int run = 0; run < runs; ++run)
+                v.push_back(nps(nodes[run][idx], micros[run][idx]));
+
+            ss << (idx ? "," : "") << "\n    { \"fen\": \"" << fens[idx] << "\", \"nodes\": " << nodes[0][idx]
+               << ", \"nps\": " << json(stats(v)) << " }";
+        }
+
+        ss << "\n  ]\n}";
+    }
+
+    sync_cout << ss.str() << sync_endl;
+
+    cerr << "\n==========================="
+         << "\nRuns            : " << runs << " (+" << warmup << " warm-up)"
+         << "\nNodes searched  : " << (runs ? runNodes[0] : 0)
+         << "\nNodes/second    : " << uint64_t(total.mean) << " +- " << uint64_t(total.high - total.mean)
+         << " (95%)" << endl;
+  }
+
+
+  // speed_test() is called on "speedtest [threads] [hash] [movetime]". It searches
+  // the bench positions, Chess960 and finished games left out, for movetime ms
+  // each (1000 by default) with 1, 2, 4, ... threads up to the given number (the
+  // hardware threads by default) and Hash set to hash MB (the current value by
+  // default), the table being cleared for each thread count. A row is printed for
+  // each thread count: nps, nps per thread, scaling efficiency against one thread,
+  // average hashfull and depth of the searches, and the time-to-depth speedup, the
+  // ratio of the times the main thread took to complete, on each position, the
+  // depth it reached with one thread.
+
+  void speed_test(Position& current, istream& args) {
+
+    string token;
+    int maxThreads = read_int(args, std::max(int(std::thread::hardware_concurrency()), 1), 1);
+    int hash       = read_int(args, int(Options["Hash"]), 1);
+    int movetime   = read_int(args, 1000, 1);
+
+    Threads.main()->wait_for_search_finished();
+
+    istringstream ss("16 1 1 default depth current");
+    vector<string> fens;
+    Position pos;
+    StateListPtr states;
+    bool chess960 = false;
+
+    for (const string& cmd : setup_bench(current, ss))
+    {
+        istringstream is(cmd);
+        is >> token;
+
+        if (token == "setoption" && cmd.find("UCI_Chess960") != string::npos)
+            chess960 = cmd.find("value true") != string::npos;
+
+        else if (token == "position" && !chess960)
+        {
+            position(pos, is, states);
+            if (MoveList<LEGAL>(pos).size())
+                fens.push_back(pos.fen());
+        }
+    }
+
+    auto set_option = [](const string& name, int value) {
+      istringstream is("name " + name + " value " + std::to_string(value));
+      setoption(is);
+    };
+
+    int oldThreads = int(Options["Threads"]), oldHash = int(Options["Hash"]);
+    vector<int> depth1(fens.size()), counts;
+    vector<TimePoint> time1(fens.size());
+    std::ostringstream report;
+    double nps1 = 0;
+
+    for (int n = 1; n < maxThreads; n *= 2)
+        counts.push_back(n);
+    counts.push_back(maxThreads);
+
+    report << "Speed test: " << fens.size() << " positions, " << movetime << " ms per move, Hash "
+           << hash << " MB\n\n" << std::right
+           << std::setw(8)  << "Threads" << std::setw(12) << "nps"   << std::setw(12) << "nps/thread"
+           << std::setw(12) << "efficiency" << std::setw(10) << "hashfull" << std::setw(8) << "depth"
+           << std::setw(14) << "ttd speedup" << "\n";
+
+    set_option("Hash", hash);
+    QuietBuf quietBuf;
+    streambuf* out = cout.rdbuf(&quietBuf);
+
+    for (int n : counts)
+    {
+        set_option("Threads", n);
+        Search::clear();
+        TT.wait_for_clear();
+
+        uint64_t nodes = 0;
+        TimePoint elapsed = 0, ttd1 = 0, ttdN = 0;
+        int hashfull = 0, depth = 0, reached = 0;
+
+        for (size_t i = 0; i < fens.size(); ++i)
+        {
+            cerr << "\rThreads " << n << " position " << i + 1 << '/' << fens.size() << "   " << flush;
+
+            states = StateListPtr(new std::deque<StateInfo>(1));
+            pos.set(fens[i], false, &states->back(), Threads.main());
+
+            Search::LimitsType limits;
+            limits.startTime = now();
+            limits.movetime = movetime;
+            Threads.start_thinking(pos, states, limits);
+            Threads.main()->wait_for_search_finished();
+
+            MainThread* mainThread = Threads.main();
+            nodes += Threads.nodes_searched();
+            elapsed += now() - limits.startTime;
+            hashfull += TT.hashfull();
+            depth += mainThread->completedDepth;
+
+            if (n == 1)
+                depth1[i] = mainThread->completedDepth, time1[i] = mainThread->depthTime[depth1[i]];
+
+            if (depth1[i] && mainThread->completedDepth >= depth1[i])
+                ttd1 += time1[i], ttdN += mainThread->depthTime[depth1[i]], ++reached;
+        }
+
+        double nps = 1000.0 * nodes / std::max(elapsed, TimePoint(1));
+        double count = double(std::max(fens.size(), size_t(1)));
+
+        if (n == 1)
+            nps1 = nps;
+
+        report << std::fixed << std::setprecision(0)
+               << std::setw(8)  << n << std::setw(12) << nps << std::setw(12) << nps / n
+               << std::setw(11) << std::setprecision(1) << 100 * nps / (n * std::max(nps1, 1.0)) << "%"
+               << std::setw(10) << std::setprecision(0) << hashfull / count
+               << std::setw(8)  << std::setprecision(1) << depth / count
+               << std::setw(6)  << std::setprecision(2) << double(std::max(ttd1, TimePoint(1))) / std::max(ttdN, TimePoint(1))
+               << " (" << reached << "/" << fens.size() << ")\n";
+    }
+
+    cout.rdbuf(out);
+    cerr << endl;
+
+    set_option("Threads", oldThreads);
+    set_option("Hash", oldHash);
+
+    sync_cout << report.str()
+              << "\nTime-to-depth is counted on the positions where the depth of one thread was reached."
+              << sync_endl;
+  }
+
+
+  // memory_report() lists the memory allocated by each subsystem, with the part
+  // backed by large pages, followed by an estimate of the total for the given
+  // Hash and Threads. The sizes of the threads come from the main thread, all
+  // the threads having the same tables.
+
+  string memory_report(const StateListPtr& states, size_t hash, size_t threads) {
+
+    const Thread* th = Threads.main();
+    const size_t n = Threads.size();
+    const size_t historyBytes =  sizeof(th->counterMoves) + sizeof(th->mainHistory)
+                               + sizeof(th->lowPlyHistory) + sizeof(th->captureHistory)
+                               + sizeof(th->continuationHistory);
+    const size_t pawnBytes = th->pawnsTable.size() * sizeof(Pawns::Entry);
+    const size_t materialBytes = th->materialTable.size() * sizeof(Material::Entry);
+    const size_t evalCacheBytes = th->nnueEvalCache.size() * sizeof(Eval::NNUE::EvalCacheEntry);
+    const size_t otherBytes = sizeof(Thread) - historyBytes - sizeof(th->accumulatorCache);
+    const size_t arenaBytes = Thread::AccumulatorArenaSize * sizeof(Eval::NNUE::Accumulator);
+    const size_t threadBytes = sizeof(Thread) + pawnBytes + materialBytes + evalCacheBytes + arenaBytes;
+    const string tn = " (" + std::to_string(n) + ")";
+
+    vector<MemoryUsage> usage = {
+        TT.memory_usage(),
+        { "Threads" + tn + " histories",          n * historyBytes, 0 },
+        { "Threads" + tn + " pawn tables",        n * pawnBytes, 0 },
+        { "Threads" + tn + " material tables",    n * materialBytes, 0 },
+        { "Threads" + tn + " NNUE caches",        n * (sizeof(th->accumulatorCache) + evalCacheBytes), 0 },
+        { "Threads" + tn + " NNUE accumulators",  n * arenaBytes,
+                                                  n * large_page_bytes(th->accumulators, arenaBytes) },
+        { "Threads" + tn + " other",              n * otherBytes, 0 } };
+
+    for (const MemoryUsage& u : Eval::NNUE::memory_usage())
+        usage.push_back(u);
+
+    for (const MemoryUsage& u : Tablebases::memory_usage())
+        usage.push_back(u);
+
+    usage.push_back({ "Position states (" + std::to_string(states->size()) + ")",
+                      states->size() * sizeof(StateInfo), 0 });
+
+    auto mb = [](size_t bytes) {
+      std::ostringstream ss;
+      ss << std::fixed << std::setprecision(1) << bytes / (1024.0 * 1024.0);
+      return ss.str();
+    };
+
+    std::ostringstream ss;
+    size_t total = 0, totalLarge = 0;
+
+    ss << std::left << std::setw(36) << "Memory" << std::right
+       << std::setw(12) << "MB" << std::setw(16) << "large pages MB";
+
+    for (const MemoryUsage& u : usage)
+    {
+        ss << "\n" << std::left << std::setw(36) << u.name << std::right
+           << std::setw(12) << mb(u.bytes) << std::setw(16) << mb(u.largePages);
+        total += u.bytes, totalLarge += u.largePages;
+    }
+
+    ss << "\n" << std::left << std::setw(36) << "Total" << std::right
+       << std::setw(12) << mb(total) << std::setw(16) << mb(totalLarge);
+
+    // Hash and the threads are freed before they are allocated again with the
+    // new sizes, so the new total is also the peak while the options are set.
+    const size_t ttBytes = usage[0].bytes;
+    const size_t estimate = total - ttBytes - n * threadBytes
+                          + hash * 1024 * 1024 + threads * threadBytes;
+
+    ss << "\nEstimate for Hash " << hash << " Threads " << threads << ": "
+       << mb(estimate) << " MB, Hash " << hash << " MB, threads " << mb(threads * threadBytes) << " MB";
+
+    return ss.str();
+  }
+
+
+  // memory() is called on "memory [hash <mb>] [threads <n>]", by default with
+  // the current Hash and Threads for the estimate.
+
+  void memory(const StateListPtr& states, istream& args) {
+
+    size_t hash = size_t(Options["Hash"]), threads = size_t(Options["Threads"]);
+    string token;
+
+    while (args >> token)
+        if (token == "hash")         args >> hash;
+        else if (token == "threads") args >> threads;
+
+    sync_cout << memory_report(states, hash, threads) << sync_endl;
+  }
+
+
+  // server() is called on "server [hash]". Until "quit" or EOF, each input line
+  // is "<session> <command>", for any number of sessions named by the first token.
+  // A session has its own position and supports "position", "go", "stop",
+  // "ucinewgame" and "isready". Each "go" is a job searched by the next idle
+  // thread on its own, see Thread::search_server(), so that up to Threads
+  // sessions search at the same time with their own limits and clock. They
+  // share the net and the TT, unless hash is given: then each session has a
+  // private table of hash MB. Options are shared, a line "setoption ..."
+  // without session sets them while no job is queued or running.
+
+  void server(istream& args) {
+
+    struct Session {
+      string position = "startpos";
+      std::shared_ptr<ServerJob> job;
+      std::unique_ptr<TranspositionTable> tt;
+    };
+
+    const int hash = read_int(args, 0, 0);
+    std::map<string, Session> sessions;
+    string cmd, name, token;
+
+    auto idle = [&]() {
+        std::scoped_lock<std::mutex> lk(Threads.serverMutex);
+        return std::all_of(sessions.begin(), sessions.end(),
+                           [](const auto& p) { return !p.second.job || p.second.job->done; });
+    };
+
+    Threads.start_server();
+
+    while (getline(cin, cmd))
+    {
+        istringstream is(cmd);
+        name.clear(), token.clear();
+        is >> skipws >> name;
+
+        if (name == "quit")
+            break;
+
+        if (name == "setoption")
+        {
+            // The threads leave the server mode meanwhile, as Threads and Hash
+            // rebuild the thread pool and the TT.
+            if (idle())
+            {
+                Threads.stop_server();
+                setoption(is);
+                Threads.start_server();
+            }
+            else
+                sync_cout << "info string setoption needs all the searches to be finished" << sync_endl;
+            continue;
+        }
+
+        if (name.empty() || name[0] == '#')
+            continue;
+
+        is >> token;
+
+        auto [it, created] = sessions.try_emplace(name);
+        Session& session = it->second;
+
+        if (created && hash)
+        {
+            session.tt = std::make_unique<TranspositionTable>();
+            session.tt->allocate(size_t(hash));
+        }
+
+        bool running;
+        {
+            std::scoped_lock<std::mutex> lk(Threads.serverMutex);
+            running = session.job && !session.job->done;
+        }
+
+        if (token == "position")
+        {
+            std::getline(is >> skipws, session.position);
+            if (session.position.empty())
+                session.position = "startpos";
+        }
+        else if (token == "ucinewgame")
+        {
+            session.position = "startpos";
+
+            if (session.tt && !running)
+                session.tt->reset();
+        }
+        else if (token == "go")
+        {
+            Position pos;
+            StateListPtr states;
+            istringstream ps(session.position);
+            string batchFile;
+            bool ponderMode = false;
+
+            position(pos, ps, states);
+            Search::LimitsType limits = read_limits(pos, is, ponderMode, batchFile);
+
+            if (running)
+                sync_cout << name << " info string the previous search is not finished" << sync_endl;
+
+            else if (ponderMode || limits.perft || !batchFile.empty())
+                sync_cout << name << " info string ponder, perft and batch are not supported" << sync_endl;
+
+            else
+            {
+                TimeManagement tm{};
+                tm.init(limits, pos.side_to_move(), pos.game_ply());
+
+                session.job = std::make_shared<ServerJob>();
+                session.job->session = name;
+                session.job->fen = pos.fen();
+                session.job->chess960 = pos.is_chess960();
+                session.job->states = states;
+                session.job->limits = limits;
+                session.job->optimum = tm.optimum();
+                session.job->maximum = tm.maximum();
+                session.job->tt = session.tt.get();
+
+                Threads.queue_job(session.job);
+            }
+        }
+        else if (token == "stop")
+        {
+            // A queued job of the session still answers with a bestmove
+            std::scoped_lock<std::mutex> lk(Threads.serverMutex);
+
+            if (running && session.job->started)
+                session.job->stop = true;
+            else if (running)
+            {
+                Search::LimitsType limits;
+                limits.startTime = now();
+                limits.depth = 1;
+                session.job->limits = limits;
+            }
+        }
+        else if (token == "isready")
+            sync_cout << name << " readyok" << sync_endl;
+
+        else
+            sync_cout << name << " Unknown command: " << token << sync_endl;
+    }
+
+    Threads.stop_server();
+  }
+
+
   // The win rate model returns the probability (per mille) of winning given an eval
   // and a game-ply. The model fits rather accurately the LTC fishtest statistics.
   int win_rate_model(Value v, int ply) {
@@ -240,7 +1491,7 @@ void UCI::loop(int argc, char* argv[]) {
       cmd += std::string(argv[i]) + " ";
 
   do {
-      if (argc == 1 && !getline(cin, cmd)) // Block here waiting for input or EOF
+      if (argc == 1 && !Cluster::getline(cin, cmd)) // Block here waiting for input or EOF
           cmd = "quit";
 
       istringstream is(cmd);
@@ -250,7 +1501,11 @@ void UCI::loop(int argc, char* argv[]) {
 
       if (    token == "quit"
           ||  token == "stop")
+      {
+          if (!Threads.main()->stopTime)
+              Threads.main()->stopTime = now();
           Threads.stop = true;
+      }
 
       // The GUI sends 'ponderhit' to tell us the user has played the expected move.
       // So 'ponderhit' will be sent if we were told to ponder on the same move the
@@ -268,12 +1523,38 @@ void UCI::loop(int argc, char* argv[]) {
       else if (token == "go")         go(pos, is, states);
       else if (token == "position")   position(pos, is, states);
       else if (token == "ucinewgame") Search::clear();
-      else if (token == "isready")    sync_cout << "readyok" << sync_endl;
+      else if (token == "isready")
+      {
+          TT.wait_for_clear(); // Reply only once the hash table is usable
+
+          string info, line;
+
+          if (debugMode)
+          {
+              istringstream report(memory_report(states, size_t(Options["Hash"]),
+                                                         size_t(Options["Threads"])));
+              while (getline(report, line))
+                  info += "info string " + line + "\n";
+          }
+
+          sync_cout << info << "readyok" << sync_endl;
+      }
+      else if (token == "debug")      is >> token, debugMode = token == "on";
 
       // Additional custom non-UCI commands, mainly for debugging.
       // Do not use these commands during a search!
       else if (token == "flip")     pos.flip();
       else if (token == "bench")    bench(pos, is, states);
+      else if (token == "benchstats") bench_stats(pos, is, states);
+      else if (token == "speedtest")  speed_test(pos, is);
+      else if (token == "server")
+      {
+          server(is);
+          token = "quit";
+      }
+      else if (token == "score")      score(is);
+      else if (token == "gensfen")    gensfen(is);
+      else if (token == "memory")     memory(states, is);
       else if (token == "d")        sync_cout << pos << sync_endl;
       else if (token == "eval")     trace_eval(pos);
       else if (token == "compiler") sync_cout << compiler_info() << sync_endl;
@@ -285,6 +1566,96 @@ void UCI::loop(int argc, char* argv[]) {
               filename = f;
           Eval::NNUE::save_eval(filename);
       }
+      else if (token == "export_compact_net")
+      {
+          std::string f;
+          if (!(is >> skipws >> f))
+              sync_cout << "Missing file name for " << token << sync_endl;
+          else
+              Eval::NNUE::save_eval(f, true);
+      }
+      else if (token == "export_image")
+      {
+          std::string f;
+          if (!(is >> skipws >> f))
+              sync_cout << "Missing file name for " << token << sync_endl;
+          else
+              Eval::NNUE::save_image(f);
+      }
+      else if (token == "save_hash" || token == "load_hash")
+      {
+          std::string f;
+          if (!(is >> skipws >> f))
+              sync_cout << "Missing file name for " << token << sync_endl;
+          else if (token == "save_hash")
+          {
+              bool saved = TT.save(f);
+              sync_cout << (saved ? "Hash saved successfully to " + f
+                                  : "Failed to save hash to " + f) << sync_endl;
+          }
+          else
+          {
+              bool loaded = TT.load(f);
+              sync_cout << (loaded ? "Hash loaded successfully from " + f
+                                   : "Failed to load hash from " + f
+                                     + " (missing file or different Hash size)") << sync_endl;
+          }
+      }
+      else if (token == "nnuebench")  nnue_bench(pos, is);
+      else if (token == "movegenbench") movegen_bench(pos, is);
+      else if (token == "microbench")   micro_bench(pos, is);
+      else if (token == "evalbatch")
+      {
+          string file;
+          is >> file;
+          eval_batch(file);
+      }
+      else if (token == "stats")
+      {
+          Search::SearchStats s = Threads.search_stats();
+          auto permill = [](uint64_t a, uint64_t b) { return b ? 1000 * a / b : 0; };
+
+          sync_cout << "info string search nodes " << s.nodes
+                    << " qnodes " << s.qnodes
+                    << " qshare " << permill(s.qnodes, s.nodes + s.qnodes)
+                    << " cutoffs " << s.cutoffs
+                    << " firstmove " << permill(s.firstMoveCutoffs, s.cutoffs)
+                    << " tt " << s.stageCutoffs[PICK_TT]
+                    << " goodcaptures " << s.stageCutoffs[PICK_GOOD_CAPTURE]
+                    << " refutations " << s.stageCutoffs[PICK_REFUTATION]
+                    << " quiets " << s.stageCutoffs[PICK_QUIET]
+                    << " badcaptures " << s.stageCutoffs[PICK_BAD_CAPTURE]
+                    << " evasions " << s.stageCutoffs[PICK_EVASION]
+                    << " lmr " << s.lmrSearches
+                    << " researches " << permill(s.lmrResearches, s.lmrSearches)
+                    << " nullmove " << s.nullMoveSearches
+                    << " nullcutoffs " << permill(s.nullMoveCutoffs, s.nullMoveSearches)
+                    << " singular " << s.singularSearches
+                    << " extended " << permill(s.singularExtensions, s.singularSearches)
+                    << " evalcache " << s.evalCacheHits + s.evalCacheMisses
+                    << " evalhits " << permill(s.evalCacheHits, s.evalCacheHits + s.evalCacheMisses)
+                    << sync_endl;
+
+          // Process wide, mostly the first touch of tablebase and net pages
+          uint64_t major, minor;
+          if (page_faults(&major, &minor))
+              sync_cout << "info string page faults major " << major << " minor " << minor << sync_endl;
+      }
+      else if (token == "ttstats")
+      {
+          TT.wait_for_clear();
+          TTStats s = Threads.tt_stats();
+          uint64_t probes = s.hits + s.misses;
+
+          sync_cout << "info string tt probes " << probes
+                    << " hits " << s.hits
+                    << " misses " << s.misses
+                    << " hitrate " << (probes ? 1000 * s.hits / probes : 0)
+                    << " collisions " << s.collisions
+                    << " deeperoverwrites " << s.deeperOverwrites
+                    << " samegenreplacements " << s.sameGenReplacements
+                    << " hashfull " << TT.hashfull() << sync_endl;
+      }
       else if (!token.empty() && token[0] != '#')
           sync_cout << "Unknown command: " << cmd << sync_endl;
 
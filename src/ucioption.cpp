@@ -38,13 +38,33 @@ UCI::OptionsMap Options; // Global object
 namespace UCI {
 
 /// 'On change' actions, triggered by an option's value change
-void on_clear_hash(const Option&) { Search::clear(); }
+void on_clear_hash(const Option&) { Search::clear(); TT.clear(true); }
 void on_hash_size(const Option& o) { TT.resize(size_t(o)); }
+void on_shared_hash(const Option&) { TT.resize(size_t(Options["Hash"])); }
 void on_logger(const Option& o) { start_logger(o); }
 void on_threads(const Option& o) { Threads.set(size_t(o)); }
+void on_thread_binding(const Option&) { Threads.set(0); Threads.set(size_t(Options["Threads"])); }
 void on_tb_path(const Option& o) { Tablebases::init(o); }
+void on_eval_hash(const Option&) {
+  Threads.main()->wait_for_search_finished();
+  Pawns::resize_shared(size_t(Options["Shared Pawn Hash"]));
+  Threads.clear();
+}
+void on_tb_setup(const Option&) { Tablebases::init(Options["SyzygyPath"]); }
+void on_tb_access(const Option&) { Tablebases::set_access(); }
+void on_tb_cache(const Option&) {
+  Threads.main()->wait_for_search_finished();
+  Tablebases::resize_cache();
+}
 void on_use_NNUE(const Option& ) { Eval::NNUE::init(); }
 void on_eval_file(const Option& ) { Eval::NNUE::init(); }
+void on_huge_pages(const Option& o) {
+  set_huge_page_size(o == "1GB" ? size_t(1) << 30 : o == "2MB" ? size_t(2) << 20 : 0);
+  TT.resize(size_t(Options["Hash"]));
+  Eval::eval_file_loaded = "None"; // Reload the net into the new pages
+  Eval::NNUE::init();
+}
+void on_replicate_NNUE(const Option& ) { Eval::NNUE::replicate(); }
 
 /// Our case insensitive less() function as required by UCI protocol
 bool CaseInsensitiveLess::operator() (const string& s1, const string& s2) const {
@@ -62,12 +82,22 @@ void init(OptionsMap& o) {
 
   o["Debug Log File"]        << Option("", on_logger);
   o["Threads"]               << Option(1, 1, 512, on_threads);
+  o["Thread Binding"]        << Option("compact var compact var spread var off", "compact", on_thread_binding);
+  o["Hybrid Binding"]        << Option(true, on_thread_binding);
+  o["Efficiency Core Weight"] << Option(100, 0, 100);
   o["Hash"]                  << Option(16, 1, MaxHashMB, on_hash_size);
+  o["Huge Pages"]            << Option("Transparent var Transparent var 2MB var 1GB", "Transparent", on_huge_pages);
   o["Clear Hash"]            << Option(on_clear_hash);
+  o["Shared Hash"]           << Option("", on_shared_hash);
+  o["Pawn Hash"]             << Option(int(Pawns::Table::DefaultSize * sizeof(Pawns::Entry) / 1024), 1, 1048576, on_eval_hash);
+  o["Material Hash"]         << Option(int(Material::Table::DefaultSize * sizeof(Material::Entry) / 1024), 1, 1048576, on_eval_hash);
+  o["Shared Pawn Hash"]      << Option(0, 0, MaxHashMB, on_eval_hash);
   o["Ponder"]                << Option(false);
   o["MultiPV"]               << Option(1, 1, 500);
+  o["Split MultiPV"]         << Option(false);
   o["Skill Level"]           << Option(20, 0, 20);
   o["Move Overhead"]         << Option(10, 0, 5000);
+  o["Adaptive Move Overhead"] << Option(false);
   o["Slow Mover"]            << Option(100, 10, 1000);
   o["nodestime"]             << Option(0, 0, 10000);
   o["UCI_Chess960"]          << Option(false);
@@ -79,8 +109,15 @@ void init(OptionsMap& o) {
   o["SyzygyProbeDepth"]      << Option(1, 1, 100);
   o["Syzygy50MoveRule"]      << Option(true);
   o["SyzygyProbeLimit"]      << Option(7, 0, 7);
+  o["SyzygyWDLAccess"]       << Option("Random var Random var WillNeed var Normal", "Random", on_tb_access);
+  o["SyzygyDTZAccess"]       << Option("Random var Random var WillNeed var Normal", "Random", on_tb_access);
+  o["SyzygyPreload"]         << Option(0, 0, MaxHashMB, on_tb_setup);
+  o["SyzygyLock"]            << Option(false, on_tb_setup);
+  o["SyzygyCache"]           << Option(16, 0, 4096, on_tb_cache);
+  o["SyzygyRootProbeTime"]   << Option(0, 0, 10000);
   o["Use NNUE"]              << Option(true, on_use_NNUE);
   o["EvalFile"]              << Option(EvalFileDefaultName, on_eval_file);
+  o["NUMA Replicate NNUE"]   << Option(true, on_replicate_NNUE);
 }
 
 